@@ -6,8 +6,15 @@
 
 typedef void AudioCallbackFunction(void);
 
+// Called when a queued codec write is done, ok is false if the codec did not
+// take it. Runs in the I2C1 interrupt.
+typedef void AudioControlCallbackFunction(void *context, bool ok);
+
 #define Audio8000HzSettings 256,5,12,1
+#define Audio11025HzSettings 429,4,19,0
+#define Audio12000HzSettings 258,3,14,0
 #define Audio16000HzSettings 213,2,13,0
+#define Audio24000HzSettings 258,3,7,0
 #define Audio32000HzSettings 213,2,6,1
 #define Audio48000HzSettings 258,3,3,1
 #define Audio96000HzSettings 344,2,3,1
@@ -19,12 +26,32 @@ typedef void AudioCallbackFunction(void);
 // Can probably only be called once.
 void InitializeAudio(int plln,int pllr,int i2sdiv,int i2sodd);
 
+// Same as above, but looks up the settings for a sample rate in Hz.
+// Returns false if there are no settings for that rate.
+bool InitializeAudioForSampleRate(int samplerate);
+
 // Power up and down the audio hardware.
+// AudioOff() waits for the codec to power down.
 void AudioOn();
 void AudioOff();
 
+// The codec registers are written by the I2C1 interrupts from a queue, so the
+// functions below return before the codec has the values.
+
 // Set audio volume in steps of 0.5 dB. 0xff is +12 dB.
-void SetAudioVolume(int volume);
+// A volume not yet sent is replaced, so a ramp never backs up the queue.
+// Returns false if the queue is full.
+bool SetAudioVolume(int volume);
+
+// Queue a write of a codec register, in order with the other writes.
+// Callback is optional. Can be called from interrupts.
+// Returns false if the queue is full.
+bool WriteAudioRegister(uint8_t address, uint8_t value,
+		AudioControlCallbackFunction *callback, void *context);
+
+// Wait until the queued codec writes are done. Not to be called from an
+// interrupt of a higher priority than the I2C1 ones.
+void WaitForAudioControl();
 
 // Output one audio sample directly to the hardware without using DMA.
 void OutputAudioSample(int16_t sample);
@@ -37,4 +64,8 @@ void StopAudio();
 
 void ProvideAudioBuffer(void *samples, int numsamples);
 
+// Samples of the buffer given to ProvideAudioBuffer() still to be sent,
+// 0 when it is done.
+int GetAudioBufferSamplesLeft();
+
 #endif
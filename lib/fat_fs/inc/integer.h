@@ -8,7 +8,10 @@
 #include <windows.h>
 #else
 
+#if defined(__arm__) || defined(__thumb__)
 #include "usb_conf.h"
+#endif
+#include <stdint.h>
 
 /* These types must be 16-bit, 32-bit or larger integer */
 typedef int				INT;
@@ -26,9 +29,9 @@ typedef unsigned short	WORD;
 typedef unsigned short	WCHAR;
 
 /* These types must be 32-bit integer */
-typedef long			LONG;
-typedef unsigned long	ULONG;
-typedef unsigned long	DWORD;
+typedef int32_t			LONG;
+typedef uint32_t		ULONG;
+typedef uint32_t		DWORD;
 
 /* Boolean type */
 // typedef enum { FALSE = 0, TRUE } BOOL;
@@ -197,13 +197,48 @@ void MP3GetLastFrameInfo(HMP3Decoder hMP3Decoder, MP3FrameInfo *mp3FrameInfo)
 		mp3FrameInfo->bitrate = mp3DecInfo->bitrate;
 		mp3FrameInfo->nChans = mp3DecInfo->nChans;
 		mp3FrameInfo->samprate = mp3DecInfo->samprate;
-		mp3FrameInfo->bitsPerSample = 16;
-		mp3FrameInfo->outputSamps = mp3DecInfo->nChans * (int)samplesPerFrameTab[mp3DecInfo->version][mp3DecInfo->layer - 1];
+		mp3FrameInfo->bitsPerSample = 8 * OUTPUT_NBYTES(mp3DecInfo);
+		mp3FrameInfo->outputSamps = OUTPUT_NCHANS(mp3DecInfo) * (int)samplesPerFrameTab[mp3DecInfo->version][mp3DecInfo->layer - 1];
 		mp3FrameInfo->layer = mp3DecInfo->layer;
 		mp3FrameInfo->version = mp3DecInfo->version;
 	}
 }
 
+/**************************************************************************************
+ * Function:    MP3SetOutputFormat
+ *
+ * Description: select the PCM layout MP3Decode() writes
+ *
+ * Inputs:      valid MP3 decoder instance pointer (HMP3Decoder)
+ *              MP3_OUTPUT_NATIVE, MP3_OUTPUT_STEREO or MP3_OUTPUT_MONO,
+ *                optionally or'ed with MP3_OUTPUT_32BIT
+ *
+ * Outputs:     none
+ *
+ * Return:      error code, defined in mp3dec.h (0 means no error, < 0 means error)
+ *
+ * Notes:       the layout is produced by the polyphase filter itself, so mono to
+ *                stereo duplication or stereo downmix costs no extra pass over outbuf
+ *              takes effect with the next call to MP3Decode(), reset by MP3InitDecoder()
+ *              32-bit samples are Q31, i.e. the 16-bit sample in the upper half plus
+ *                the extra fraction bits of the synthesis filter in the lower half
+ **************************************************************************************/
+int MP3SetOutputFormat(HMP3Decoder hMP3Decoder, int outFormat)
+{
+	MP3DecInfo *mp3DecInfo = (MP3DecInfo *)hMP3Decoder;
+
+	if (!mp3DecInfo)
+		return ERR_MP3_NULL_POINTER;
+
+	if ((outFormat & ~(MP3_OUTPUT_LAYOUT_MASK | MP3_OUTPUT_32BIT)) ||
+		(outFormat & MP3_OUTPUT_LAYOUT_MASK) == MP3_OUTPUT_LAYOUT_MASK)
+		return ERR_UNKNOWN;
+
+	mp3DecInfo->outFormat = outFormat;
+
+	return ERR_MP3_NONE;
+}
+
 /**************************************************************************************
  * Function:    MP3GetNextFrameInfo
  *
@@ -247,13 +282,15 @@ int MP3GetNextFrameInfo(HMP3Decoder hMP3Decoder, MP3FrameInfo *mp3FrameInfo, uns
  **************************************************************************************/
 static void MP3ClearBadFrame(MP3DecInfo *mp3DecInfo, short *outbuf)
 {
-	int i;
+	int i, nBytes;
+	unsigned char *buf = (unsigned char *)outbuf;
 
 	if (!mp3DecInfo)
 		return;
 
-	for (i = 0; i < mp3DecInfo->nGrans * mp3DecInfo->nGranSamps * mp3DecInfo->nChans; i++)
-		outbuf[i] = 0;
+	nBytes = mp3DecInfo->nGrans * mp3DecInfo->nGranSamps * OUTPUT_NCHANS(mp3DecInfo) * OUTPUT_NBYTES(mp3DecInfo);
+	for (i = 0; i < nBytes; i++)
+		buf[i] = 0;
 }
 
 /**************************************************************************************
@@ -265,11 +302,13 @@ static void MP3ClearBadFrame(MP3DecInfo *mp3DecInfo, short *outbuf)
  *              double pointer to buffer of MP3 data (containing headers + mainData)
  *              number of valid bytes remaining in inbuf
  *              pointer to outbuf, big enough to hold one frame of decoded PCM samples
+ *                (cast to short * when 32-bit output is selected)
  *              flag indicating whether MP3 data is normal MPEG format (useSize = 0)
  *                or reformatted as "self-contained" frames (useSize = 1)
  *
- * Outputs:     PCM data in outbuf, interleaved LRLRLR... if stereo
- *                number of output samples = nGrans * nGranSamps * nChans
+ * Outputs:     PCM data in outbuf, in the layout selected by MP3SetOutputFormat()
+ *                (default: interleaved LRLRLR... if stereo, 16-bit)
+ *                number of output samples = nGrans * nGranSamps * output channels
  *              updated inbuf pointer, updated bytesLeft
  *
  * Return:      error code, defined in mp3dec.h (0 means no error, < 0 means error)
@@ -409,8 +448,9 @@ int MP3Decode(HMP3Decoder hMP3Decoder, unsigned char **inbuf, int *bytesLeft, sh
 				return ERR_MP3_INVALID_IMDCT;			
 			}
 
-		/* subband transform - if stereo, interleaves pcm LRLRLR */
-		if (Subband(mp3DecInfo, outbuf + gr*mp3DecInfo->nGranSamps*mp3DecInfo->nChans) < 0) {
+		/* subband transform - writes pcm in the selected output layout */
+		if (Subband(mp3DecInfo, (short *)((unsigned char *)outbuf +
+				gr*mp3DecInfo->nGranSamps*OUTPUT_NCHANS(mp3DecInfo)*OUTPUT_NBYTES(mp3DecInfo))) < 0) {
 			MP3ClearBadFrame(mp3DecInfo, outbuf);
 			return ERR_MP3_INVALID_SUBBAND;			
 		}
@@ -10,7 +10,12 @@
 
 #include <stdint.h>
 
+#if defined(__arm__) || defined(__thumb__)
 #define ARM_TEST
+#else
+/* host builds, e.g. tools/bpmscan, use the plain C helpers of assembly.h */
+#define HELIX_GENERIC_C
+#endif
 
 typedef long long Word64;
 typedef uint32_t ULONG32;
@@ -92,8 +92,16 @@ typedef struct _MP3DecInfo {
 
 	int part23Length[MAX_NGRAN][MAX_NCHAN];
 
+	/* PCM layout written by Subband(), MP3_OUTPUT_xxx */
+	int outFormat;
+
 } MP3DecInfo;
 
+/* interleaved channels and bytes per sample of the PCM written by Subband() */
+#define OUTPUT_NCHANS(di)	(((di)->outFormat & MP3_OUTPUT_LAYOUT_MASK) == MP3_OUTPUT_STEREO ? 2 : \
+							 ((di)->outFormat & MP3_OUTPUT_LAYOUT_MASK) == MP3_OUTPUT_MONO ? 1 : (di)->nChans)
+#define OUTPUT_NBYTES(di)	(((di)->outFormat & MP3_OUTPUT_32BIT) ? 4 : 2)
+
 typedef struct _SFBandTable {
 	short l[23];
 	short s[14];
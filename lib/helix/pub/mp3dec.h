@@ -66,6 +66,8 @@
 #
 #elif defined(ARM_TEST)
 #
+#elif defined(HELIX_GENERIC_C)
+#
 #else
 #error No platform defined. See valid options in mp3dec.h
 #endif
@@ -112,6 +114,16 @@ enum {
 	ERR_UNKNOWN =                  -9999
 };
 
+/* PCM output format, see MP3SetOutputFormat() */
+enum {
+	MP3_OUTPUT_NATIVE =        0,	/* channels as coded: mono, or interleaved LRLRLR... */
+	MP3_OUTPUT_STEREO =        1,	/* always interleaved LRLRLR..., mono is written to both channels */
+	MP3_OUTPUT_MONO =          2,	/* always one channel, stereo is downmixed to (L+R)/2 */
+	MP3_OUTPUT_LAYOUT_MASK =   3,
+
+	MP3_OUTPUT_32BIT =         4	/* or'ed with a layout: 32-bit left-justified samples instead of 16-bit */
+};
+
 typedef struct _MP3FrameInfo {
 	int bitrate;
 	int nChans;
@@ -130,6 +142,7 @@ int MP3Decode(HMP3Decoder hMP3Decoder, unsigned char **inbuf, int *bytesLeft, sh
 void MP3GetLastFrameInfo(HMP3Decoder hMP3Decoder, MP3FrameInfo *mp3FrameInfo);
 int MP3GetNextFrameInfo(HMP3Decoder hMP3Decoder, MP3FrameInfo *mp3FrameInfo, unsigned char *buf);
 int MP3FindSyncWord(unsigned char *buf, int nBytes);
+int MP3SetOutputFormat(HMP3Decoder hMP3Decoder, int outFormat);
 
 #ifdef __cplusplus
 }
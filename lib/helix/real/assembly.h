@@ -396,6 +396,51 @@ static __inline Word64 SAR64(Word64 x, int n)
 
 }
 
+#elif defined(HELIX_GENERIC_C)
+
+/* portable C, for host builds of the decoder */
+static __inline int MULSHIFT32(int x, int y)
+{
+	return (int)(((Word64)x * y) >> 32);
+}
+
+static __inline int FASTABS(int x)
+{
+	int sign;
+
+	sign = x >> (sizeof(int) * 8 - 1);
+	x ^= sign;
+	x -= sign;
+
+	return x;
+}
+
+static __inline int CLZ(int x)
+{
+	int numZeros;
+
+	if (!x)
+		return (sizeof(int) * 8);
+
+	numZeros = 0;
+	while (!(x & 0x80000000)) {
+		numZeros++;
+		x <<= 1;
+	}
+
+	return numZeros;
+}
+
+static __inline Word64 MADD64(Word64 sum64, int x, int y)
+{
+	return sum64 + (Word64)x * y;
+}
+
+static __inline Word64 SAR64(Word64 x, int n)
+{
+	return x >> n;
+}
+
 #else
 
 #error Unsupported platform in assembly.h
@@ -73,6 +73,29 @@ static void ClearBuffer(void *buf, int nBytes)
 	return;
 }
 
+/*
+ * Use static buffers to make the RAM usage known at compile time.
+ * There is a small pool of them, so that the next stream can be opened
+ * while the current one is still decoding (gapless playback).
+ */
+#ifndef MP3DEC_MAX_INSTANCES
+#define MP3DEC_MAX_INSTANCES	2
+#endif
+
+typedef struct _MP3DecBuffers {
+	MP3DecInfo decInfo;
+	FrameHeader fh;
+	SideInfo si;
+	ScaleFactorInfo sfi;
+	HuffmanInfo hi;
+	DequantInfo di;
+	IMDCTInfo mi;
+	SubbandInfo sbi;
+	int inUse;
+} MP3DecBuffers;
+
+static MP3DecBuffers s_mp3DecBuffers[MP3DEC_MAX_INSTANCES];
+
 /**************************************************************************************
  * Function:    AllocateBuffers
  *
@@ -88,6 +111,7 @@ static void ClearBuffer(void *buf, int nBytes)
  *
  * Notes:       if one or more mallocs fail, function frees any buffers already
  *                allocated before returning
+ *              returns 0 when all MP3DEC_MAX_INSTANCES instances are in use
  **************************************************************************************/
 MP3DecInfo *AllocateBuffers(void)
 {
@@ -99,28 +123,29 @@ MP3DecInfo *AllocateBuffers(void)
 	DequantInfo *di;
 	IMDCTInfo *mi;
 	SubbandInfo *sbi;
+	MP3DecBuffers *b;
+	int i;
+
+	/* take a free instance from the pool */
+	b = 0;
+	for (i = 0; i < MP3DEC_MAX_INSTANCES; i++) {
+		if (!s_mp3DecBuffers[i].inUse) {
+			b = &s_mp3DecBuffers[i];
+			break;
+		}
+	}
+	if (!b)
+		return 0;
+	b->inUse = 1;
 
-	/*
-	 * Use static buffers to make the RAM usage
-	 * known at compile time.
-	 */
-	static MP3DecInfo s_mp3DecInfo;
-	static FrameHeader s_fh;
-	static SideInfo s_si;
-	static ScaleFactorInfo s_sfi;
-	static HuffmanInfo s_hi;
-	static DequantInfo s_di;
-	static IMDCTInfo s_mi;
-	static SubbandInfo s_sbi;
-	
-	mp3DecInfo = &s_mp3DecInfo;
-	fh = &s_fh;
-	si = &s_si;
-	sfi = &s_sfi;
-	hi = &s_hi;
-	di = &s_di;
-	mi = &s_mi;
-	sbi = &s_sbi;
+	mp3DecInfo = &b->decInfo;
+	fh = &b->fh;
+	si = &b->si;
+	sfi = &b->sfi;
+	hi = &b->hi;
+	di = &b->di;
+	mi = &b->mi;
+	sbi = &b->sbi;
 
 //	mp3DecInfo = (MP3DecInfo *)malloc(sizeof(MP3DecInfo));
 //	if (!mp3DecInfo) {
@@ -136,6 +161,9 @@ MP3DecInfo *AllocateBuffers(void)
 //	mi =  (IMDCTInfo *)       malloc(sizeof(IMDCTInfo));
 //	sbi = (SubbandInfo *)     malloc(sizeof(SubbandInfo));
 
+	/* instances are reused, so don't inherit the state of the previous user */
+	ClearBuffer(mp3DecInfo, sizeof(MP3DecInfo));
+
 	mp3DecInfo->FrameHeaderPS =     (void *)fh;
 	mp3DecInfo->SideInfoPS =        (void *)si;
 	mp3DecInfo->ScaleFactorInfoPS = (void *)sfi;
@@ -144,6 +172,8 @@ MP3DecInfo *AllocateBuffers(void)
 	mp3DecInfo->IMDCTInfoPS =       (void *)mi;
 	mp3DecInfo->SubbandInfoPS =     (void *)sbi;
 
+	mp3DecInfo->outFormat =         MP3_OUTPUT_NATIVE;
+
 	if (!fh || !si || !sfi || !hi || !di || !mi || !sbi) {
 		FreeBuffers(mp3DecInfo);	/* safe to call - only frees memory that was successfully allocated */
 		return 0;
@@ -178,9 +208,16 @@ MP3DecInfo *AllocateBuffers(void)
  **************************************************************************************/
 void FreeBuffers(MP3DecInfo *mp3DecInfo)
 {
+	int i;
+
 	if (!mp3DecInfo)
 		return;
-	// Malloc not used, nothing to do
+
+	// Malloc not used, just give the instance back to the pool
+	for (i = 0; i < MP3DEC_MAX_INSTANCES; i++) {
+		if (mp3DecInfo == &s_mp3DecBuffers[i].decInfo)
+			s_mp3DecBuffers[i].inUse = 0;
+	}
 //	SAFE_FREE(mp3DecInfo->FrameHeaderPS);
 //	SAFE_FREE(mp3DecInfo->SideInfoPS);
 //	SAFE_FREE(mp3DecInfo->ScaleFactorInfoPS);
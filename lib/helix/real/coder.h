@@ -288,8 +288,8 @@ extern const int quadTabMaxBits[2];
 #ifdef __cplusplus
 extern "C" {
 #endif
-void PolyphaseMono(short *pcm, int *vbuf, const int *coefBase);
-void PolyphaseStereo(short *pcm, int *vbuf, const int *coefBase);
+void PolyphaseMono(void *pcm, int *vbuf, const int *coefBase, int outFormat);
+void PolyphaseStereo(void *pcm, int *vbuf, const int *coefBase, int outFormat);
 #ifdef __cplusplus
 }
 #endif
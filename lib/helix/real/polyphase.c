@@ -71,6 +71,60 @@ static __inline short ClipToShort(int x, int fracBits)
 	return (short)x;
 }
 
+static __inline int ClipToInt32(int x, int fracBits)
+{
+	int sign, shift = 16 - fracBits;
+
+	/* left-justify to Q31, keeping the extra fraction bits of the filter output */
+	sign = x >> 31;
+	if (sign != (x >> (31 - shift)))
+		return sign ^ 0x7fffffff;
+
+	return x << shift;
+}
+
+/* store sample n of a mono block in the requested output layout, x = rounded Q(DEF_NFRACBITS) */
+static __inline void StoreMono(void *pcm, int n, int x, int outFormat)
+{
+	if (outFormat & MP3_OUTPUT_32BIT) {
+		int *out = (int *)pcm;
+		x = ClipToInt32(x, DEF_NFRACBITS);
+		if ((outFormat & MP3_OUTPUT_LAYOUT_MASK) == MP3_OUTPUT_STEREO) {
+			out[2*n + 0] = x;
+			out[2*n + 1] = x;
+		} else {
+			out[n] = x;
+		}
+	} else {
+		short *out = (short *)pcm;
+		short v = ClipToShort(x, DEF_NFRACBITS);
+		if ((outFormat & MP3_OUTPUT_LAYOUT_MASK) == MP3_OUTPUT_STEREO) {
+			out[2*n + 0] = v;
+			out[2*n + 1] = v;
+		} else {
+			out[n] = v;
+		}
+	}
+}
+
+/* store sample n of a stereo block in the requested output layout, downmixing before the clip */
+static __inline void StoreStereo(void *pcm, int n, int xL, int xR, int outFormat)
+{
+	if ((outFormat & MP3_OUTPUT_LAYOUT_MASK) == MP3_OUTPUT_MONO) {
+		xL = (xL + xR) >> 1;
+		if (outFormat & MP3_OUTPUT_32BIT)
+			((int *)pcm)[n] = ClipToInt32(xL, DEF_NFRACBITS);
+		else
+			((short *)pcm)[n] = ClipToShort(xL, DEF_NFRACBITS);
+	} else if (outFormat & MP3_OUTPUT_32BIT) {
+		((int *)pcm)[2*n + 0] = ClipToInt32(xL, DEF_NFRACBITS);
+		((int *)pcm)[2*n + 1] = ClipToInt32(xR, DEF_NFRACBITS);
+	} else {
+		((short *)pcm)[2*n + 0] = ClipToShort(xL, DEF_NFRACBITS);
+		((short *)pcm)[2*n + 1] = ClipToShort(xR, DEF_NFRACBITS);
+	}
+}
+
 #define MC0M(x)	{ \
 	c1 = *coef;		coef++;		c2 = *coef;		coef++; \
 	vLo = *(vb1+(x));			vHi = *(vb1+(23-(x))); \
@@ -101,15 +155,17 @@ static __inline short ClipToShort(int x, int fracBits)
  *              start of filter coefficient table (in proper, shuffled order)
  *              no minimum number of guard bits is required for input vbuf 
  *                (see additional scaling comments below)
+ *              output format (MP3_OUTPUT_xxx)
  *
- * Outputs:     32 samples of one channel of decoded PCM data, (i.e. Q16.0)
+ * Outputs:     32 samples of one channel of decoded PCM data, (i.e. Q16.0),
+ *                duplicated to LRLRLR... if MP3_OUTPUT_STEREO, Q31 if MP3_OUTPUT_32BIT
  *
  * Return:      none
  *
  * TODO:        add 32-bit version for platforms where 64-bit mul-acc is not supported
  *                (note max filter gain - see polyCoef[] comments)
  **************************************************************************************/
-void PolyphaseMono(short *pcm, int *vbuf, const int *coefBase)
+void PolyphaseMono(void *pcm, int *vbuf, const int *coefBase, int outFormat)
 {	
 	int i;
 	const int *coef;
@@ -133,7 +189,7 @@ void PolyphaseMono(short *pcm, int *vbuf, const int *coefBase)
 	MC0M(6)
 	MC0M(7)
 
-	*(pcm + 0) = ClipToShort((int)SAR64(sum1L, (32-CSHIFT)), DEF_NFRACBITS);
+	StoreMono(pcm, 0, (int)SAR64(sum1L, (32-CSHIFT)), outFormat);
 
 	/* special case, output sample 16 */
 	coef = coefBase + 256;
@@ -149,12 +205,11 @@ void PolyphaseMono(short *pcm, int *vbuf, const int *coefBase)
 	MC1M(6)
 	MC1M(7)
 
-	*(pcm + 16) = ClipToShort((int)SAR64(sum1L, (32-CSHIFT)), DEF_NFRACBITS);
+	StoreMono(pcm, 16, (int)SAR64(sum1L, (32-CSHIFT)), outFormat);
 
 	/* main convolution loop: sum1L = samples 1, 2, 3, ... 15   sum2L = samples 31, 30, ... 17 */
 	coef = coefBase + 16;
 	vb1 = vbuf + 64;
-	pcm++;
 
 	/* right now, the compiler creates bad asm from this... */
 	for (i = 15; i > 0; i--) {
@@ -170,9 +225,8 @@ void PolyphaseMono(short *pcm, int *vbuf, const int *coefBase)
 		MC2M(7)
 
 		vb1 += 64;
-		*(pcm)       = ClipToShort((int)SAR64(sum1L, (32-CSHIFT)), DEF_NFRACBITS);
-		*(pcm + 2*i) = ClipToShort((int)SAR64(sum2L, (32-CSHIFT)), DEF_NFRACBITS);
-		pcm++;
+		StoreMono(pcm, 16 - i, (int)SAR64(sum1L, (32-CSHIFT)), outFormat);
+		StoreMono(pcm, 16 + i, (int)SAR64(sum2L, (32-CSHIFT)), outFormat);
 	}
 }
 
@@ -213,8 +267,10 @@ void PolyphaseMono(short *pcm, int *vbuf, const int *coefBase)
  *              start of filter coefficient table (in proper, shuffled order)
  *              no minimum number of guard bits is required for input vbuf 
  *                (see additional scaling comments below)
+ *              output format (MP3_OUTPUT_xxx)
  *
- * Outputs:     32 samples of two channels of decoded PCM data, (i.e. Q16.0)
+ * Outputs:     32 samples of two channels of decoded PCM data, (i.e. Q16.0),
+ *                or 32 samples of (L+R)/2 if MP3_OUTPUT_MONO, Q31 if MP3_OUTPUT_32BIT
  *
  * Return:      none
  *
@@ -222,7 +278,7 @@ void PolyphaseMono(short *pcm, int *vbuf, const int *coefBase)
  *
  * TODO:        add 32-bit version for platforms where 64-bit mul-acc is not supported
  **************************************************************************************/
-void PolyphaseStereo(short *pcm, int *vbuf, const int *coefBase)
+void PolyphaseStereo(void *pcm, int *vbuf, const int *coefBase, int outFormat)
 {
 	int i;
 	const int *coef;
@@ -246,8 +302,7 @@ void PolyphaseStereo(short *pcm, int *vbuf, const int *coefBase)
 	MC0S(6)
 	MC0S(7)
 
-	*(pcm + 0) = ClipToShort((int)SAR64(sum1L, (32-CSHIFT)), DEF_NFRACBITS);
-	*(pcm + 1) = ClipToShort((int)SAR64(sum1R, (32-CSHIFT)), DEF_NFRACBITS);
+	StoreStereo(pcm, 0, (int)SAR64(sum1L, (32-CSHIFT)), (int)SAR64(sum1R, (32-CSHIFT)), outFormat);
 
 	/* special case, output sample 16 */
 	coef = coefBase + 256;
@@ -263,13 +318,11 @@ void PolyphaseStereo(short *pcm, int *vbuf, const int *coefBase)
 	MC1S(6)
 	MC1S(7)
 
-	*(pcm + 2*16 + 0) = ClipToShort((int)SAR64(sum1L, (32-CSHIFT)), DEF_NFRACBITS);
-	*(pcm + 2*16 + 1) = ClipToShort((int)SAR64(sum1R, (32-CSHIFT)), DEF_NFRACBITS);
+	StoreStereo(pcm, 16, (int)SAR64(sum1L, (32-CSHIFT)), (int)SAR64(sum1R, (32-CSHIFT)), outFormat);
 
 	/* main convolution loop: sum1L = samples 1, 2, 3, ... 15   sum2L = samples 31, 30, ... 17 */
 	coef = coefBase + 16;
 	vb1 = vbuf + 64;
-	pcm += 2;
 
 	/* right now, the compiler creates bad asm from this... */
 	for (i = 15; i > 0; i--) {
@@ -286,10 +339,7 @@ void PolyphaseStereo(short *pcm, int *vbuf, const int *coefBase)
 		MC2S(7)
 
 		vb1 += 64;
-		*(pcm + 0)         = ClipToShort((int)SAR64(sum1L, (32-CSHIFT)), DEF_NFRACBITS);
-		*(pcm + 1)         = ClipToShort((int)SAR64(sum1R, (32-CSHIFT)), DEF_NFRACBITS);
-		*(pcm + 2*2*i + 0) = ClipToShort((int)SAR64(sum2L, (32-CSHIFT)), DEF_NFRACBITS);
-		*(pcm + 2*2*i + 1) = ClipToShort((int)SAR64(sum2R, (32-CSHIFT)), DEF_NFRACBITS);
-		pcm += 2;
+		StoreStereo(pcm, 16 - i, (int)SAR64(sum1L, (32-CSHIFT)), (int)SAR64(sum1R, (32-CSHIFT)), outFormat);
+		StoreStereo(pcm, 16 + i, (int)SAR64(sum2L, (32-CSHIFT)), (int)SAR64(sum2R, (32-CSHIFT)), outFormat);
 	}
 }
@@ -59,7 +59,8 @@
  **************************************************************************************/
 int Subband(MP3DecInfo *mp3DecInfo, short *pcmBuf)
 {
-	int b;
+	int b, pcmStep;
+	unsigned char *pcm;
 	HuffmanInfo *hi;
 	IMDCTInfo *mi;
 	SubbandInfo *sbi;
@@ -72,25 +73,28 @@ int Subband(MP3DecInfo *mp3DecInfo, short *pcmBuf)
 	mi = (IMDCTInfo *)(mp3DecInfo->IMDCTInfoPS);
 	sbi = (SubbandInfo*)(mp3DecInfo->SubbandInfoPS);
 
+	/* the polyphase filter writes the requested layout directly, so step in bytes */
+	pcm = (unsigned char *)pcmBuf;
+	pcmStep = OUTPUT_NCHANS(mp3DecInfo) * OUTPUT_NBYTES(mp3DecInfo) * NBANDS;
+
 	if (mp3DecInfo->nChans == 2) {
 		/* stereo */
 		for (b = 0; b < BLOCK_SIZE; b++) {
 			FDCT32(mi->outBuf[0][b], sbi->vbuf + 0*32, sbi->vindex, (b & 0x01), mi->gb[0]);
 			FDCT32(mi->outBuf[1][b], sbi->vbuf + 1*32, sbi->vindex, (b & 0x01), mi->gb[1]);
-			PolyphaseStereo(pcmBuf, sbi->vbuf + sbi->vindex + VBUF_LENGTH * (b & 0x01), polyCoef);
+			PolyphaseStereo(pcm, sbi->vbuf + sbi->vindex + VBUF_LENGTH * (b & 0x01), polyCoef, mp3DecInfo->outFormat);
 			sbi->vindex = (sbi->vindex - (b & 0x01)) & 7;
-			pcmBuf += (2 * NBANDS);
+			pcm += pcmStep;
 		}
 	} else {
 		/* mono */
 		for (b = 0; b < BLOCK_SIZE; b++) {
 			FDCT32(mi->outBuf[0][b], sbi->vbuf + 0*32, sbi->vindex, (b & 0x01), mi->gb[0]);
-			PolyphaseMono(pcmBuf, sbi->vbuf + sbi->vindex + VBUF_LENGTH * (b & 0x01), polyCoef);
+			PolyphaseMono(pcm, sbi->vbuf + sbi->vindex + VBUF_LENGTH * (b & 0x01), polyCoef, mp3DecInfo->outFormat);
 			sbi->vindex = (sbi->vindex - (b & 0x01)) & 7;
-			pcmBuf += NBANDS;
+			pcm += pcmStep;
 		}
 	}
 
 	return 0;
 }
-
@@ -4,16 +4,77 @@
 
 #include <stdlib.h>
 
+// I2C clock of the codec control in Hz. The CS43L22 data sheet stops at
+// 100 kHz; define this as 400000 (or pass -DAUDIO_I2C_SPEED=400000) for the
+// fast mode, if the codec on the board takes it.
+#ifndef AUDIO_I2C_SPEED
+#define AUDIO_I2C_SPEED 100000
+#endif
+
+// Codec writes waiting for the I2C bus, a power of 2.
+#define AUDIO_CONTROL_QUEUE_SIZE 16
+
+// I2C address of the codec, for writing.
+#define CODEC_I2C_ADDRESS 0x94
+
+static bool QueueWrite(uint8_t address, uint8_t value, bool merge,
+		AudioControlCallbackFunction *callback, void *context);
+static void StartWrite();
+static void FinishWrite(bool ok);
 static void WriteRegister(uint8_t address, uint8_t value);
 static void StopAudioDMA();
 
 static AudioCallbackFunction *CallbackFunction;
 
+// Codec register writes, sent by the I2C1 interrupts from ControlTail on.
+typedef struct {
+	uint8_t address, value;
+	bool merge; // May be replaced by a later write to the register.
+	AudioControlCallbackFunction *callback;
+	void *context;
+} AudioControlWrite;
+
+static AudioControlWrite ControlQueue[AUDIO_CONTROL_QUEUE_SIZE];
+static volatile uint32_t ControlHead, ControlTail;
+
+// Where the write at ControlTail is, each state waits for one I2C event.
+static volatile enum {
+	ControlIdle, // Nothing on the bus.
+	ControlStop, // Stop condition of the last write requested, event interrupt off.
+	ControlStart, // Start condition requested, waiting for SB.
+	ControlAddress, // Codec address sent, waiting for ADDR.
+	ControlRegister, // Register address sent, waiting for BTF.
+	ControlValue, // Value sent, waiting for BTF.
+} ControlState;
+
+static const struct {
+	int samplerate;
+	int plln, pllr, i2sdiv, i2sodd;
+} SampleRateSettings[] = {
+	{ 8000, Audio8000HzSettings },
+	{ 11025, Audio11025HzSettings },
+	{ 12000, Audio12000HzSettings },
+	{ 16000, Audio16000HzSettings },
+	{ 22050, Audio22050HzSettings },
+	{ 24000, Audio24000HzSettings },
+	{ 32000, Audio32000HzSettings },
+	{ 44100, Audio44100HzSettings },
+	{ 48000, Audio48000HzSettings },
+	{ 96000, Audio96000HzSettings },
+};
+
 void InitializeAudio(int plln, int pllr, int i2sdiv, int i2sodd) {
 	GPIO_InitTypeDef  GPIO_InitStructure;
 
+	// Let the codec take what was queued for it before resetting it.
+	if (I2C1 ->CR1 & I2C_CR1_PE) {
+		WaitForAudioControl();
+	}
+
 	// Intitialize state.
 	CallbackFunction = NULL;
+	ControlHead = ControlTail = 0;
+	ControlState = ControlIdle;
 
 	// Turn on peripherals.
 	RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
@@ -80,20 +141,38 @@ void InitializeAudio(int plln, int pllr, int i2sdiv, int i2sodd) {
 	// Configure I2C.
 	uint32_t pclk1 = 42000000;
 
-	I2C1 ->CR2 = pclk1 / 1000000; // Configure frequency and disable interrupts and DMA.
+	I2C1 ->CR2 = pclk1 / 1000000 | I2C_CR2_ITEVTEN | I2C_CR2_ITERREN; // Configure frequency, enable event and error interrupts, disable DMA.
 	I2C1 ->OAR1 = I2C_OAR1_ADDMODE | 0x33;
 
-	// Configure I2C speed in standard mode.
-	const uint32_t i2c_speed = 100000;
-	int ccrspeed = pclk1 / (i2c_speed * 2);
-	if (ccrspeed < 4) {
-		ccrspeed = 4;
+	// Configure I2C speed in standard or fast mode.
+	const uint32_t i2c_speed = AUDIO_I2C_SPEED;
+	int ccrspeed;
+	if (i2c_speed <= 100000) {
+		ccrspeed = pclk1 / (i2c_speed * 2);
+		if (ccrspeed < 4) {
+			ccrspeed = 4;
+		}
+		I2C1 ->CCR = ccrspeed;
+		I2C1 ->TRISE = pclk1 / 1000000 + 1; // 1000 ns rise time.
+	} else {
+		ccrspeed = pclk1 / (i2c_speed * 3); // Low time twice the high time.
+		if (ccrspeed < 1) {
+			ccrspeed = 1;
+		}
+		I2C1 ->CCR = I2C_CCR_FS | ccrspeed;
+		I2C1 ->TRISE = pclk1 / 1000000 * 300 / 1000 + 1; // 300 ns rise time.
 	}
-	I2C1 ->CCR = ccrspeed;
-	I2C1 ->TRISE = pclk1 / 1000000 + 1;
 
 	I2C1 ->CR1 = I2C_CR1_ACK | I2C_CR1_PE; // Enable and configure the I2C peripheral.
 
+	// Below the audio DMA (4), a late codec write is harmless. The top bit
+	// differs, so the DMA preempts these with the one preemption bit of
+	// NVIC_PriorityGroup_1 (usb_bsp.c) as well as with more.
+	NVIC_SetPriority(I2C1_EV_IRQn, 12);
+	NVIC_SetPriority(I2C1_ER_IRQn, 12);
+	NVIC_EnableIRQ(I2C1_EV_IRQn);
+	NVIC_EnableIRQ(I2C1_ER_IRQn);
+
 	// Configure codec.
 	WriteRegister(0x02, 0x01); // Keep codec powered off.
 	WriteRegister(0x04, 0xaf); // SPK always off and HP always on.
@@ -106,9 +185,10 @@ void InitializeAudio(int plln, int pllr, int i2sdiv, int i2sodd) {
 	// Power on the codec.
 	WriteRegister(0x02, 0x9e);
 
-	// Configure codec for fast shutdown.
+	// Configure codec for fast shutdown. The samples are faded by the
+	// player, the digital soft ramp only smooths a volume write.
 	WriteRegister(0x0a, 0x00); // Disable the analog soft ramp.
-	WriteRegister(0x0e, 0x04); // Disable the digital soft ramp.
+	WriteRegister(0x0e, 0x06); // Enable the digital soft ramp.
 
 	WriteRegister(0x27, 0x00); // Disable the limiter attack level.
 	WriteRegister(0x1f, 0x0f); // Adjust bass and treble levels.
@@ -116,6 +196,9 @@ void InitializeAudio(int plln, int pllr, int i2sdiv, int i2sodd) {
 	WriteRegister(0x1a, 0x0a); // Adjust PCM volume level.
 	WriteRegister(0x1b, 0x0a);
 
+	// The codec is configured before it gets clocks.
+	WaitForAudioControl();
+
 	// Disable I2S.
 	SPI3 ->I2SCFGR = 0;
 
@@ -135,6 +218,18 @@ void InitializeAudio(int plln, int pllr, int i2sdiv, int i2sodd) {
 
 }
 
+bool InitializeAudioForSampleRate(int samplerate) {
+	for (unsigned int i = 0; i < sizeof(SampleRateSettings) / sizeof(SampleRateSettings[0]); i++) {
+		if (SampleRateSettings[i].samplerate == samplerate) {
+			InitializeAudio(SampleRateSettings[i].plln, SampleRateSettings[i].pllr,
+					SampleRateSettings[i].i2sdiv, SampleRateSettings[i].i2sodd);
+			return true;
+		}
+	}
+
+	return false;
+}
+
 void AudioOn() {
 	WriteRegister(0x02, 0x9e);
 	SPI3 ->I2SCFGR = SPI_I2SCFGR_I2SMOD | SPI_I2SCFGR_I2SCFG_1
@@ -143,12 +238,34 @@ void AudioOn() {
 
 void AudioOff() {
 	WriteRegister(0x02, 0x01);
+	WaitForAudioControl(); // The codec powers down with its clocks running.
 	SPI3 ->I2SCFGR = 0;
 }
 
-void SetAudioVolume(int volume) {
-	WriteRegister(0x20, (volume + 0x19) & 0xff);
-	WriteRegister(0x21, (volume + 0x19) & 0xff);
+bool SetAudioVolume(int volume) {
+	uint32_t primask = __get_PRIMASK();
+	bool queued = false;
+
+	// Both channels or none.
+	__disable_irq();
+	if (ControlHead - ControlTail <= AUDIO_CONTROL_QUEUE_SIZE - 2) {
+		QueueWrite(0x20, (volume + 0x19) & 0xff, true, NULL, NULL);
+		QueueWrite(0x21, (volume + 0x19) & 0xff, true, NULL, NULL);
+		queued = true;
+	}
+	__set_PRIMASK(primask);
+
+	return queued;
+}
+
+bool WriteAudioRegister(uint8_t address, uint8_t value,
+		AudioControlCallbackFunction *callback, void *context) {
+	return QueueWrite(address, value, false, callback, context);
+}
+
+void WaitForAudioControl() {
+	while (ControlState != ControlIdle || ControlHead != ControlTail)
+		StartWrite(); // Nothing else may notice the end of a stop.
 }
 
 void OutputAudioSample(int16_t sample) {
@@ -195,28 +312,93 @@ void ProvideAudioBuffer(void *samples, int numsamples) {
 	DMA1_Stream7 ->CR |= DMA_SxCR_EN;
 }
 
-static void WriteRegister(uint8_t address, uint8_t value) {
-	while (I2C1 ->SR2 & I2C_SR2_BUSY )
-		;
+int GetAudioBufferSamplesLeft() {
+	return DMA1_Stream7 ->NDTR;
+}
+
+static bool QueueWrite(uint8_t address, uint8_t value, bool merge,
+		AudioControlCallbackFunction *callback, void *context) {
+	uint32_t primask = __get_PRIMASK();
+	bool queued = false;
+
+	// There may be writers in interrupts.
+	__disable_irq();
+
+	// Replace a mergeable write to the register that has not started yet.
+	if (merge) {
+		uint32_t i = ControlTail;
+		if (ControlState != ControlIdle && ControlState != ControlStop) {
+			i++;
+		}
+		for (; i != ControlHead; i++) {
+			AudioControlWrite *write = &ControlQueue[i & (AUDIO_CONTROL_QUEUE_SIZE - 1)];
+			if (write->merge && write->address == address) {
+				write->value = value;
+				queued = true;
+				break;
+			}
+		}
+	}
 
-	I2C1 ->CR1 |= I2C_CR1_START; // Start the transfer sequence.
-	while (!(I2C1 ->SR1 & I2C_SR1_SB ))
-		; // Wait for start bit.
+	if (!queued && ControlHead - ControlTail < AUDIO_CONTROL_QUEUE_SIZE) {
+		AudioControlWrite *write = &ControlQueue[ControlHead & (AUDIO_CONTROL_QUEUE_SIZE - 1)];
+		write->address = address;
+		write->value = value;
+		write->merge = merge;
+		write->callback = callback;
+		write->context = context;
+		ControlHead++;
+		queued = true;
+	}
+
+	StartWrite();
 
-	I2C1 ->DR = 0x94;
-	while (!(I2C1 ->SR1 & I2C_SR1_ADDR ))
-		; // Wait for master transmitter mode.
-	I2C1 ->SR2;
+	__set_PRIMASK(primask);
 
-	I2C1 ->DR = address; // Transmit the address to write to.
-	while (!(I2C1 ->SR1 & I2C_SR1_TXE ))
-		; // Wait for byte to move to shift register.
+	return queued;
+}
 
-	I2C1 ->DR = value; // Transmit the value.
+// Put the write at ControlTail on the bus if it is free. Called by the
+// writers, WaitForAudioControl() and the audio DMA interrupt, as no I2C
+// interrupt reports the end of a stop.
+static void StartWrite() {
+	uint32_t primask = __get_PRIMASK();
 
-	while (!(I2C1 ->SR1 & I2C_SR1_BTF ))
-		; // Wait for all bytes to finish.
-	I2C1 ->CR1 |= I2C_CR1_STOP; // End the transfer sequence.
+	__disable_irq();
+	if (ControlState == ControlStop && !(I2C1 ->CR1 & I2C_CR1_STOP)) {
+		ControlState = ControlIdle;
+		I2C1 ->CR2 |= I2C_CR2_ITEVTEN;
+	}
+	if (ControlState == ControlIdle && ControlHead != ControlTail) {
+		ControlState = ControlStart;
+		I2C1 ->CR1 |= I2C_CR1_START; // Start the transfer sequence.
+	}
+	__set_PRIMASK(primask);
+}
+
+// End the write at ControlTail, and start the next one.
+static void FinishWrite(bool ok) {
+	AudioControlWrite *write = &ControlQueue[ControlTail & (AUDIO_CONTROL_QUEUE_SIZE - 1)];
+	AudioControlCallbackFunction *callback = write->callback;
+	void *context = write->context;
+
+	// The stop condition takes about a bit time, until then BTF would keep
+	// raising the event interrupt and CR1 must not be written. Nothing is
+	// waited for here, the next StartWrite() after the stop goes on.
+	I2C1 ->CR2 &= ~I2C_CR2_ITEVTEN;
+
+	ControlTail++;
+	ControlState = ControlStop;
+	StartWrite();
+
+	if (callback)
+		callback(context, ok);
+}
+
+// For the configuration, waits only if the queue is full.
+static void WriteRegister(uint8_t address, uint8_t value) {
+	while (!QueueWrite(address, value, false, NULL, NULL))
+		;
 }
 
 static void StopAudioDMA() {
@@ -228,8 +410,61 @@ static void StopAudioDMA() {
 void DMA1_Stream7_IRQHandler() {
 	DMA1 ->HIFCR |= DMA_HIFCR_CTCIF7; // Clear interrupt flag.
 
+	StartWrite(); // Go on with the codec writes while playing.
+
 	if (CallbackFunction)
 		CallbackFunction();
 }
 
+void I2C1_EV_IRQHandler() {
+	AudioControlWrite *write = &ControlQueue[ControlTail & (AUDIO_CONTROL_QUEUE_SIZE - 1)];
+	uint16_t sr1 = I2C1 ->SR1;
+
+	switch (ControlState) {
+	case ControlStart:
+		if (sr1 & I2C_SR1_SB) {
+			I2C1 ->DR = CODEC_I2C_ADDRESS; // Clears SB.
+			ControlState = ControlAddress;
+		}
+		break;
+
+	case ControlAddress:
+		if (sr1 & I2C_SR1_ADDR) {
+			I2C1 ->SR2; // Clears ADDR, we are master transmitter.
+			I2C1 ->DR = write->address; // Transmit the address to write to.
+			ControlState = ControlRegister;
+		}
+		break;
+
+	case ControlRegister:
+		if (sr1 & I2C_SR1_BTF) {
+			I2C1 ->DR = write->value; // Transmit the value, clears BTF.
+			ControlState = ControlValue;
+		}
+		break;
+
+	case ControlValue:
+		if (sr1 & I2C_SR1_BTF) {
+			I2C1 ->CR1 |= I2C_CR1_STOP; // End the transfer sequence.
+			FinishWrite(true);
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+void I2C1_ER_IRQHandler() {
+	uint16_t sr1 = I2C1 ->SR1;
+
+	I2C1 ->SR1 = ~(I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_ARLO | I2C_SR1_OVR); // Clear the error flags.
 
+	if (ControlState != ControlIdle && ControlState != ControlStop) {
+		// The bus is released already when arbitration was lost.
+		if (!(sr1 & I2C_SR1_ARLO)) {
+			I2C1 ->CR1 |= I2C_CR1_STOP;
+		}
+		FinishWrite(false);
+	}
+}
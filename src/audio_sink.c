@@ -0,0 +1,366 @@
+/*
+ *  Name:    audio_sink.c
+ *
+ *  Purpose: the audio output, the I2S DMA of the board or a host backend
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_sink.h"
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+
+/* go to the attenuation att (Q15) in frames */
+static void audio_sink_ramp_start(struct audio_sink_ramp *r, int32_t att, uint32_t frames) {
+    r->target = att << 16;
+    if (frames == 0) {
+        r->att  = r->target;
+        r->step = 0;
+    } else {
+        r->step = (r->target - r->att) / (int32_t)frames;
+        if (r->step == 0) {
+            r->att = r->target;
+        }
+    }
+}
+
+/* frames until the ramp is at its target */
+static uint32_t audio_sink_ramp_left(const struct audio_sink_ramp *r) {
+    if (r->step == 0) {
+        return UINT32_MAX;
+    }
+
+    return (uint32_t)(((int64_t)r->target - r->att + r->step - (r->step > 0 ? 1 : -1)) / r->step);
+}
+
+static void audio_sink_ramp_run(struct audio_sink_ramp *r, uint32_t frames) {
+    if (frames >= audio_sink_ramp_left(r)) {
+        r->att  = r->target;
+        r->step = 0;
+    } else {
+        r->att  += r->step * (int32_t)frames;
+    }
+}
+
+/* the gain of the volume and the fade together, Q15 */
+static int32_t audio_sink_gain(struct audio_sink *sink) {
+    int32_t volume  = AUDIO_SINK_UNITY - (sink->volume.att >> 16);
+    int32_t fade    = AUDIO_SINK_UNITY - (sink->fade.att >> 16);
+
+    if (volume == AUDIO_SINK_UNITY) {
+        return fade;
+    } else if (fade == AUDIO_SINK_UNITY) {
+        return volume;
+    }
+
+    return (volume * fade + (1 << 14)) >> 15;
+}
+
+static uint32_t audio_sink_frames(struct audio_sink *sink, uint32_t ms) {
+    return (uint32_t)((uint64_t)sink->rate * ms / 1000);
+}
+
+/*
+ * scale the samples by the volume and the fade, the gain going
+ * linearly between the points where a ramp ends
+ */
+static void audio_sink_apply_gain(struct audio_sink *sink,
+                                  int16_t *samples, uint32_t frames) {
+    int32_t     g0, g1, g, step, gi;
+    uint32_t    n, i;
+    int         c;
+
+    if (sink->volume_att << 16 != sink->volume.target) {
+        audio_sink_ramp_start(&sink->volume, sink->volume_att,
+                              audio_sink_frames(sink, AUDIO_SINK_RAMP_MS));
+    }
+
+    while (frames > 0) {
+        n = frames;
+        if (n > audio_sink_ramp_left(&sink->volume)) {
+            n = audio_sink_ramp_left(&sink->volume);
+        }
+        if (n > audio_sink_ramp_left(&sink->fade)) {
+            n = audio_sink_ramp_left(&sink->fade);
+        }
+
+        g0 = audio_sink_gain(sink);
+        audio_sink_ramp_run(&sink->volume, n);
+        audio_sink_ramp_run(&sink->fade, n);
+        g1 = audio_sink_gain(sink);
+
+        if (g0 == 0 && g1 == 0) {
+            memset(samples, 0, n * sink->channels * sizeof(int16_t));
+            samples += n * sink->channels;
+        } else if (g0 == AUDIO_SINK_UNITY && g1 == AUDIO_SINK_UNITY) {
+            samples += n * sink->channels;
+        } else {
+            g       = g0 << 16;
+            step    = (g1 - g0) * 65536 / (int32_t)n;
+            for (i = 0; i < n; i++) {
+                gi = g >> 16;
+                for (c = 0; c < sink->channels; c++) {
+                    *samples = (*samples * gi) >> 15;
+                    samples++;
+                }
+                g += step;
+            }
+        }
+
+        frames -= n;
+    }
+}
+
+/*
+ * a buffer of frames took work ticks to make, and slack frames were
+ * left to play when it came
+ */
+static void audio_sink_deadline(struct audio_sink *sink, uint32_t work,
+                                uint32_t frames, uint32_t slack) {
+    struct audio_sink_stats *stats = &sink->stats;
+    uint64_t    budget;
+    uint32_t    load, bin;
+
+    budget = (uint64_t)frames * sink->tick_rate / sink->rate;
+    if (budget == 0) {
+        return;
+    }
+    load = (uint32_t)((uint64_t)work * 1000 / budget);
+
+    stats->timed++;
+    stats->work_ticks   += work;
+    stats->budget_ticks += budget;
+    if (load > stats->max_load) {
+        stats->max_load = load;
+    }
+    if (load > 1000) {
+        stats->late++;
+    }
+
+    bin = (uint32_t)((uint64_t)slack * 8 / frames);
+    if (bin >= AUDIO_SINK_SLACK_BINS) {
+        bin = AUDIO_SINK_SLACK_BINS - 1;
+    }
+    stats->slack[bin]++;
+}
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+
+/*
+ * (re)start the output at rate Hz, what was submitted is played first
+ *
+ * The output fades in over AUDIO_SINK_FADE_MS.
+ *
+ * ret: 0, OK
+ *      -1, the backend can not play this rate, the output is unchanged
+ */
+int audio_sink_open(struct audio_sink *sink, uint32_t rate, int channels) {
+    if (sink->ops->open(sink, rate, channels) != 0) {
+        return -1;
+    }
+
+    sink->rate      = rate;
+    sink->channels  = channels;
+    sink->submitted = 0;
+
+    audio_sink_ramp_start(&sink->fade, AUDIO_SINK_UNITY, 0);
+    audio_sink_fade_in(sink, AUDIO_SINK_FADE_MS);
+
+    return 0;
+}
+
+/*
+ * a buffer of frames to fill and submit, the one submitted before
+ * the last is reused, so buffers must be submitted in turn
+ *
+ * ret: the buffer, NULL if out of memory
+ */
+int16_t *audio_sink_acquire(struct audio_sink *sink, uint32_t frames) {
+    uint32_t    samples = frames * sink->channels;
+    int16_t     *buf;
+    int         i;
+
+    if (samples > sink->buf_samples) {
+        for (i = 0; i < AUDIO_SINK_BUFFERS; i++) {
+            free(sink->bufs[i]);
+            sink->bufs[i] = (int16_t *)malloc(samples * sizeof(int16_t));
+            if (sink->bufs[i] == NULL) {
+                sink->buf_samples = 0;
+                return NULL;
+            }
+        }
+        sink->buf_samples = samples;
+    }
+
+    buf = sink->bufs[sink->buf_next];
+    sink->buf_next = (sink->buf_next + 1) % AUDIO_SINK_BUFFERS;
+
+    return buf;
+}
+
+/*
+ * queue frames of interleaved samples, waiting while the output is full
+ *
+ * The samples are scaled in place by the volume, and may be read
+ * until the next submit returns.
+ *
+ * ret: 0, OK
+ *      -1, the sink is not open or the backend failed
+ */
+int audio_sink_submit(struct audio_sink *sink,
+                      int16_t *samples, uint32_t frames) {
+    struct audio_sink_stats *stats = &sink->stats;
+    uint64_t    before, after;
+    uint32_t    latency, now = 0, slack = 0;
+
+    if (sink->rate == 0) {
+        return -1;
+    }
+
+    if (sink->ticks) {
+        now = sink->ticks();
+    }
+
+    audio_sink_apply_gain(sink, samples, frames);
+
+    before = sink->ops->clock(sink);
+    if (sink->submitted > 0 && before >= sink->submitted) {
+        stats->underruns++;
+    } else {
+        slack = (uint32_t)(sink->submitted - before);
+    }
+
+    if (sink->ops->submit(sink, samples, frames) != 0) {
+        return -1;
+    }
+
+    if (sink->ticks) {
+        if (sink->submitted > 0) {
+            audio_sink_deadline(sink, now - sink->work_start, frames, slack);
+        }
+        sink->work_start = sink->ticks();
+    }
+    sink->submitted += frames;
+
+    after = sink->ops->clock(sink);
+    latency = (uint32_t)(sink->submitted - after);
+
+    stats->buffers++;
+    stats->frames           += frames;
+    stats->frames_waited    += after - before;
+    if (latency > stats->max_latency) {
+        stats->max_latency  = latency;
+    }
+
+    return 0;
+}
+
+/* frames played since open */
+uint64_t audio_sink_clock(struct audio_sink *sink) {
+    if (sink->rate == 0) {
+        return 0;
+    }
+
+    return sink->ops->clock(sink);
+}
+
+/*
+ * the volume, 0 to 1, reached in AUDIO_SINK_RAMP_MS
+ *
+ * It may be called from an interrupt.
+ */
+void audio_sink_set_volume(struct audio_sink *sink, float volume) {
+    if (volume < 0) {
+        volume = 0;
+    } else if (volume > 1) {
+        volume = 1;
+    }
+
+    sink->volume_att = AUDIO_SINK_UNITY - (int32_t)(volume * AUDIO_SINK_UNITY);
+}
+
+/*
+ * fade the output in, or out, over ms from the next buffer, as when
+ * starting, stopping or seeking. Once faded out the output is silent
+ * until faded in again.
+ */
+void audio_sink_fade_in(struct audio_sink *sink, uint32_t ms) {
+    audio_sink_ramp_start(&sink->fade, 0, audio_sink_frames(sink, ms));
+}
+
+void audio_sink_fade_out(struct audio_sink *sink, uint32_t ms) {
+    audio_sink_ramp_start(&sink->fade, AUDIO_SINK_UNITY, audio_sink_frames(sink, ms));
+}
+
+/* a fade out is over, the output can be stopped without a click */
+int audio_sink_faded(struct audio_sink *sink) {
+    return sink->fade.att == AUDIO_SINK_UNITY << 16;
+}
+
+/* frames submitted and not played yet */
+uint32_t audio_sink_latency(struct audio_sink *sink) {
+    return (uint32_t)(sink->submitted - audio_sink_clock(sink));
+}
+
+/*
+ * print the statistics, to USART2 on the board (see _write())
+ */
+void audio_sink_report(struct audio_sink *sink) {
+    struct audio_sink_stats *stats = &sink->stats;
+    uint32_t    avg_load, i;
+
+    printf("audio: buffers %lu, underruns %lu, late %lu\n",
+           (unsigned long)stats->buffers, (unsigned long)stats->underruns,
+           (unsigned long)stats->late);
+
+    if (stats->timed == 0) {
+        return;
+    }
+
+    avg_load = (uint32_t)(stats->work_ticks * 1000 / stats->budget_ticks);
+    printf("audio: load avg %lu.%lu%%, max %lu.%lu%%\n",
+           (unsigned long)avg_load / 10, (unsigned long)avg_load % 10,
+           (unsigned long)stats->max_load / 10, (unsigned long)stats->max_load % 10);
+
+    printf("audio: slack, in eighths of a buffer\n");
+    for (i = 0; i < AUDIO_SINK_SLACK_BINS; i++) {
+        if (stats->slack[i] > 0) {
+            printf("audio: %s%2lu/8 %lu\n",
+                   (i == AUDIO_SINK_SLACK_BINS - 1) ? ">=" : "  ",
+                   (unsigned long)i, (unsigned long)stats->slack[i]);
+        }
+    }
+}
+
+/*
+ * play out what was submitted and stop the output
+ */
+void audio_sink_close(struct audio_sink *sink) {
+    sink->ops->close(sink);
+
+    sink->rate      = 0;
+    sink->channels  = 0;
+    sink->submitted = 0;
+}
+
+void audio_sink_delete(struct audio_sink *sink) {
+    int i;
+
+    audio_sink_close(sink);
+
+    for (i = 0; i < AUDIO_SINK_BUFFERS; i++) {
+        free(sink->bufs[i]);
+        sink->bufs[i] = NULL;
+    }
+    sink->buf_samples = 0;
+
+    if (sink->ops->destroy) {
+        sink->ops->destroy(sink);
+    }
+}
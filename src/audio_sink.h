@@ -0,0 +1,158 @@
+/*
+ *  Name:    audio_sink.h
+ *
+ *  Purpose: the audio output, the I2S DMA of the board or a host backend
+ *
+ */
+
+#ifndef _AUDIO_SINK_H_
+#define _AUDIO_SINK_H_
+
+#include <stdint.h>
+
+/* buffers of audio_sink_acquire(), one is filled while the other plays */
+#define AUDIO_SINK_BUFFERS      2
+
+/* a new volume is reached in this time, so it does not click */
+#define AUDIO_SINK_RAMP_MS      20
+
+/* the output fades in this time when opened, by default */
+#define AUDIO_SINK_FADE_MS      10
+
+/* full volume, Q15 */
+#define AUDIO_SINK_UNITY        32767
+
+/* bins of the slack histogram, an eighth of a buffer each */
+#define AUDIO_SINK_SLACK_BINS   16
+
+struct audio_sink;
+
+/*
+ * A backend. The samples given to submit() are interleaved 16-bit,
+ * and may be read until the next submit() returns, so a writer
+ * alternates between two buffers; submit() waits while the output
+ * is full. clock() counts the frames played since open(), the time
+ * of the output.
+ */
+struct audio_sink_ops {
+    /* 0 if OK, -1 if the backend can not play this rate */
+    int         (*open)(struct audio_sink *sink, uint32_t rate, int channels);
+    int         (*submit)(struct audio_sink *sink,
+                          const int16_t *samples, uint32_t frames);
+    uint64_t    (*clock)(struct audio_sink *sink);
+
+    /* play out what was submitted and stop */
+    void        (*close)(struct audio_sink *sink);
+
+    /* free the backend, NULL if it is not allocated */
+    void        (*destroy)(struct audio_sink *sink);
+};
+
+/* counted over all the opens */
+struct audio_sink_stats {
+    uint32_t    buffers;
+    uint64_t    frames;
+
+    /* the output had played everything when a buffer came */
+    uint32_t    underruns;
+
+    /*
+     * frames played while submit() waited, the time the writer had
+     * to spare: frames_waited / frames is the CPU headroom
+     */
+    uint64_t    frames_waited;
+
+    /* the most frames submitted and not played, after a submit() */
+    uint32_t    max_latency;
+
+    /*
+     * The deadline, measured when the sink has ticks: the time the
+     * writer took to make a buffer, from the return of one submit to
+     * the next, against the time the buffer plays for. Counted from
+     * the second buffer after an open.
+     */
+    uint32_t    timed;
+    uint64_t    work_ticks;
+    uint64_t    budget_ticks;
+
+    /* the slowest buffer, in permille of its playing time */
+    uint32_t    max_load;
+
+    /* buffers made slower than they play */
+    uint32_t    late;
+
+    /*
+     * what was left to play when a buffer came, in eighths of that
+     * buffer: bin 0 holds the underruns and the near misses, the last
+     * bin everything above
+     */
+    uint32_t    slack[AUDIO_SINK_SLACK_BINS];
+};
+
+/*
+ * A gain going linearly to target, by step per frame. It is kept as
+ * the attenuation, Q15 << 16, so a zeroed sink plays at full volume.
+ */
+struct audio_sink_ramp {
+    int32_t     att;
+    int32_t     target;
+    int32_t     step;
+};
+
+struct audio_sink {
+    const struct audio_sink_ops *ops;
+    void                *priv;
+
+    /* of the output, 0 while closed */
+    uint32_t            rate;
+    int                 channels;
+
+    /* frames submitted since open */
+    uint64_t            submitted;
+
+    struct audio_sink_stats stats;
+
+    /*
+     * A free running counter of tick_rate Hz for the deadline
+     * statistics, optional: the cycle counter on the board
+     * (DWT_CYCCNT), ns on the host.
+     */
+    uint32_t            (*ticks)(void);
+    uint32_t            tick_rate;
+    uint32_t            work_start;
+
+    /*
+     * The digital volume, applied to the samples in audio_sink_submit()
+     * so changing it needs no I2C traffic. volume_att is the attenuation
+     * asked for, Q15, it may be written from an interrupt and the ramp
+     * to it starts with the next buffer. The fade is for starting and
+     * stopping the output, on top of the volume.
+     */
+    volatile int32_t    volume_att;
+    struct audio_sink_ramp volume;
+    struct audio_sink_ramp fade;
+
+    /* audio_sink_acquire() buffers, allocated when first acquired */
+    int16_t             *bufs[AUDIO_SINK_BUFFERS];
+    uint32_t            buf_samples;
+    uint32_t            buf_next;
+};
+
+int audio_sink_open(struct audio_sink *sink, uint32_t rate, int channels);
+int16_t *audio_sink_acquire(struct audio_sink *sink, uint32_t frames);
+int audio_sink_submit(struct audio_sink *sink,
+                      int16_t *samples, uint32_t frames);
+uint64_t audio_sink_clock(struct audio_sink *sink);
+void audio_sink_set_volume(struct audio_sink *sink, float volume);
+void audio_sink_fade_in(struct audio_sink *sink, uint32_t ms);
+void audio_sink_fade_out(struct audio_sink *sink, uint32_t ms);
+int audio_sink_faded(struct audio_sink *sink);
+uint32_t audio_sink_latency(struct audio_sink *sink);
+void audio_sink_report(struct audio_sink *sink);
+void audio_sink_close(struct audio_sink *sink);
+void audio_sink_delete(struct audio_sink *sink);
+
+/* the I2S DMA to the CS43L22 of the board, there is one */
+struct audio_sink *audio_sink_i2s(void);
+
+#endif
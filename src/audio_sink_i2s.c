@@ -0,0 +1,129 @@
+/*
+ *  Name:    audio_sink_i2s.c
+ *
+ *  Purpose: the audio output of the board, I2S DMA to the CS43L22
+ *
+ */
+#include <stdlib.h>
+
+#include "stm32f4xx.h"
+#include "Audio.h"
+#include "audio_sink.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+
+/*
+ * the level of the codec while playing, 0.5 dB steps, see SetAudioVolume().
+ * It is not changed, the volume is digital, see audio_sink_set_volume().
+ */
+#define I2S_VOLUME          0xAF
+
+/*
+ * One buffer is sent by the DMA at a time, the next is started
+ * when it is done.
+ */
+static volatile uint8_t     i2s_busy = 0;
+
+/* frames of the buffer being sent, and of the ones done since open */
+static uint32_t             i2s_frames = 0;
+static volatile uint64_t    i2s_played = 0;
+
+static struct audio_sink    i2s_sink;
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+
+/* Called by the audio driver when its DMA complete */
+static void i2s_callback(void) {
+    i2s_played  += i2s_frames;
+    i2s_busy    = 0;
+}
+
+static void i2s_wait(void) {
+    while (i2s_busy == 1);
+}
+
+static int i2s_open(struct audio_sink *sink, uint32_t rate, int channels) {
+    (void)sink;
+    (void)channels;
+
+    /* the samples of the old rate go out first */
+    i2s_wait();
+
+    if (!InitializeAudioForSampleRate(rate)) {
+        return -1;
+    }
+    SetAudioVolume(I2S_VOLUME);
+    PlayAudioWithCallback(i2s_callback);
+
+    i2s_played  = 0;
+
+    return 0;
+}
+
+static int i2s_submit(struct audio_sink *sink,
+                      const int16_t *samples, uint32_t frames) {
+    i2s_wait();
+
+    i2s_frames  = frames;
+    i2s_busy    = 1;
+    ProvideAudioBuffer((void *)samples, frames * sink->channels);
+
+    return 0;
+}
+
+static uint64_t i2s_clock(struct audio_sink *sink) {
+    uint32_t    primask;
+    uint64_t    played;
+
+    /* i2s_played and i2s_busy change together in the DMA interrupt */
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    played = i2s_played;
+    if (i2s_busy) {
+        played += i2s_frames - GetAudioBufferSamplesLeft() / sink->channels;
+    }
+
+    __set_PRIMASK(primask);
+
+    return played;
+}
+
+static void i2s_close(struct audio_sink *sink) {
+    (void)sink;
+
+    /* wait for the last buffer */
+    i2s_wait();
+
+    /* Re-initialize and set volume to avoid noise */
+    InitializeAudio(Audio44100HzSettings);
+    SetAudioVolume(0);
+}
+
+static const struct audio_sink_ops i2s_ops = {
+    i2s_open,
+    i2s_submit,
+    i2s_clock,
+    i2s_close,
+    NULL,
+};
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+
+/*
+ * The buffers are sent straight from the memory of the writer, so
+ * they must be reachable by DMA1 (not the core coupled memory).
+ * Between two buffers the output stops for the time the writer takes
+ * to submit the next one after the DMA interrupt.
+ */
+struct audio_sink *audio_sink_i2s(void) {
+    i2s_sink.ops = &i2s_ops;
+
+    return &i2s_sink;
+}
@@ -44,24 +44,18 @@ static int                          debug = DEBUG_LEVEL_INFO;
  *          The constant definition for this module
  *======================================================*/
 
-/* number of fft points for analyse */
-#define BPM_DETECT_FFT_POINTS       64      /* 64 */
-
-
-/* buffer size in milliseconds */
-#define BPM_BUFFER_SIZE             1000    /* 4000 */
-
-/* window size in millisecods */
-#define BPM_WINDOW_SIZE             500     /* 2000 */
-
-/* overlap size in milliseconds */
-#define BPM_OVERLAP_SUCCESS_SIZE    500     /* 2000 */
-#define BPM_OVERLAP_FAIL_SIZE       875     /* 3500 */
+/*
+ * The analysis parameters are per detector, see bpm_detector_preset().
+ * These are their limits.
+ */
+#define BPM_MIN_FFT_POINTS          16
+#define BPM_MAX_FFT_POINTS          1024
 
-/* number of subbands */
-#define BPM_NUMBER_OF_SUBBANDS      8       /* 16 */
+#define BPM_MIN_WINDOW              100     /* ms */
+#define BPM_MAX_WINDOW              8000
 
-#define SUBBAND_SIZE                (BPM_DETECT_FFT_POINTS / (2 * BPM_NUMBER_OF_SUBBANDS))
+#define BPM_LOWEST_BPM              30
+#define BPM_HIGHEST_BPM             300
 
 
 #define BPM_HISTORY_TOLERANCE       1
@@ -72,22 +66,47 @@ static int                          debug = DEBUG_LEVEL_INFO;
 /* right safe margin used by autocorrelation */
 #define BPM_DETECT_MAX_MARGIN       1
 
-#define BPM_DETECT_MIN_BPM          55
-#define BPM_DETECT_MAX_BPM          200
-
-/* 
- * (BPM_BUFFER_SIZE - BPM_WINDOW_SIZE) / 1000
- *  * (BPM_DETECT_MIN_BPM - BPM_DETECT_MIN_MARGIN - 1)
+/*
+ * beat tracking
+ *
+ * The spectral flux of the subband energies is summed over the hops
+ * of one onset frame of about BPM_BEAT_FRAME_SIZE samples (5.8 ms at
+ * 44.1 kHz). The beat period comes from the autocorrelation of the last
+ * BPM_BEAT_FRAMES onset frames, and the beats from a cumulative score
+ * that favours onsets one period after the previous strong ones.
  */
-#define OFFSET_FACTOR               26      
+#define BPM_BEAT_FRAME_SIZE         256
+#define BPM_BEAT_FRAMES             512     /* power of 2 */
+
+/* onset frames between two tempo estimates */
+#define BPM_BEAT_TEMPO_INTERVAL     128
+
+/* beats found but not yet read, power of 2 */
+#define BPM_BEAT_QUEUE              16
+
+/* weight of the past in the cumulative score */
+#define BPM_BEAT_ALPHA              0.9f
+
+/* how strictly the score expects one period between beats */
+#define BPM_BEAT_TIGHTNESS          5.0f
+
+/* the tempo prior, log-normal around this BPM, width in octaves */
+#define BPM_BEAT_PRIOR_BPM          120.0f
+#define BPM_BEAT_PRIOR_WIDTH        0.7f
 /*========================================================
  *          The internal structure
  *======================================================*/
 struct subband_t{
     u16     BPM;
-    u16     *BPM_history_hit; 
+    u16     *BPM_history_hit;   /* max_bpm + 2 */
     u32     buffer_load;
-    REAL    *buffer;
+
+    /*
+     * circular, the oldest value is at buffer_start, so the overlap
+     * after a correlation pass only moves the start
+     */
+    u32     buffer_start;
+    ENERGY  *buffer;
 };
 
 struct BPM_mod_t {
@@ -96,448 +115,1003 @@ struct BPM_mod_t {
     u32     sum;
 };
 
+struct beat_tracker_t {
+#ifdef BPM_FIXED_POINT
+    u16     prev_energy[BPM_MAX_SUBBANDS];  /* log2(1 + energy), Q8 */
+#else
+    REAL    prev_energy[BPM_MAX_SUBBANDS];
+#endif
+    REAL    onset;              /* flux of the onset frame being summed */
+    u32     hops;               /* hops put since reset */
+    u32     frames;             /* onset frames since reset */
 
+    REAL    oss[BPM_BEAT_FRAMES];       /* onset strength, ring */
+    REAL    score[BPM_BEAT_FRAMES];     /* cumulative score, ring */
 
+    /* weight of a predecessor d frames back, for the current period */
+    REAL    weight[BPM_BEAT_FRAMES];
 
-/*========================================================
- *          The static definition for this module
- *======================================================*/
+    REAL    frame_rate;         /* onset frames per second */
+    REAL    period;             /* in onset frames, 0 until estimated */
+    REAL    candidate;          /* a new period seen once */
+
+    u32     beats;              /* beats found since reset */
+    u32     last_beat;          /* onset frame of the last one */
+
+    u32     queue[BPM_BEAT_QUEUE];
+    u32     queue_head, queue_tail;
+};
 
-static u8               c_ready = 0;
+struct bpm_detector {
+    /* memory comes from bpm_detector_create() */
+    u8                  own;
 
-static u16              c_low_limit_index = 0;
-static u16              c_high_limit_index = BPM_NUMBER_OF_SUBBANDS;
-static u16              c_band_size_index = BPM_NUMBER_OF_SUBBANDS;
+    u16                 low_limit_index;
+    u16                 high_limit_index;
+    u16                 band_size_index;
 
-static u32              c_buffer_size;
-static u32              c_window_size;
-static u32              c_overlap_success_size;
-static u32              c_overlap_fail_size;
-static u32              c_overlap_success_start;
-static u32              c_overlap_fail_start;
+    u32                 sample_rate;
+    u32                 channel;
 
-/* number of subbands with detected BPM */
-static u32              c_subband_BPM_detected;
+    struct bpm_detector_params params;
 
-static REAL             c_sqrt_FFT_points;
+    /* FFT bins per subband, hops per onset frame */
+    u32                 subband_size;
+    u32                 beat_decimate;
 
-static u32              c_channel = 0;
-static u32              c_sample_rate = 0;
+    u32                 buffer_size;
+    u32                 window_size;
+    u32                 overlap_success_size;
+    u32                 overlap_fail_size;
+    u32                 overlap_success_start;
+    u32                 overlap_fail_start;
 
-/* subbands array */
-static struct subband_t *c_pSubBand;
+    /* number of subbands with detected BPM */
+    u32                 subband_BPM_detected;
 
-/* array of amplitudes returned from FFT analyse */
-static REAL             *c_amplitudes;
+    struct subband_t    subband[BPM_MAX_SUBBANDS];
 
-/* array of samples sent to FFT analyse */
+    /* array of amplitudes returned from FFT analyse, fft_points / 2 */
+    ENERGY              *amplitudes;
 
-complex_t               *c_samples;
+#ifdef BPM_FIXED_POINT
+    /* array of samples sent to FFT analyse, fft_points */
+    int16_t             *frame;
 
-static REAL             *c_pfl_window;      /* FFT window */
+    /* the spectrum of frame, bins 0 .. fft_points / 2 */
+    complex_q15_t       *samples;
 
-static u16              *c_pn_offset;
+    int16_t             *window;            /* FFT window, Q15 */
+#else
+    REAL                *frame;
+    complex_t           *samples;
+    REAL                *window;
+#endif
+
+    /* lag in hops of each BPM, max_bpm + BPM_DETECT_MAX_MARGIN + 2 */
+    u16                 *pn_offset;
+
+    /* energy of each subband in the current hop */
+    ENERGY              energy[BPM_MAX_SUBBANDS];
+
+    struct beat_tracker_t beat;
+
+    struct fft_plan     *fft_plan;
+
+#ifdef BPM_FIXED_POINT
+    /*
+     * the subband buffer scaled to 16 bits for the autocorrelation,
+     * which is a dot product per lag
+     */
+    int16_t             *acf_env;           /* buffer_size */
+    u32                 acf_size;
+#else
+    /*
+     * autocorrelation of the subband buffers by FFT:
+     * corr[lag] = ifft(conj(fft(window)) * fft(buffer))[lag]
+     */
+    u32                 acf_size;
+    struct fft_plan     *acf_plan;
+    REAL                *acf_buf;           /* acf_size */
+    complex_t           *acf_spec;          /* acf_size / 2 + 1 */
+    complex_t           *acf_win_spec;      /* acf_size / 2 + 1 */
+#endif
+};
 
+/* the arrays behind the structure are 8-byte aligned */
+#define BPM_ALIGN(x)                (((x) + 7) & ~7)
 
 
 /*========================================================
  *              The internal interfaces 
  *======================================================*/
-int free_internal_mem() {
-	if (c_amplitudes) {
-		free(c_amplitudes);
-		c_amplitudes = 0;
-	}
-
-	if (c_samples) {
-		free(c_samples);
-		c_samples = 0;
-	}
-
-	if (c_pfl_window) {
-		free(c_pfl_window);
-		c_pfl_window = 0;
-	}
-
-	if(c_pn_offset) {
-		free(c_pn_offset);
-		c_pn_offset = 0;
-	}
-
-
-	if (c_pSubBand) {
-		unsigned int i;
-		for (i = 0; i < BPM_NUMBER_OF_SUBBANDS; i++) {
-			if (c_pSubBand[i].buffer) {
-				free(c_pSubBand[i].buffer);
-				c_pSubBand[i].buffer = 0;
-            }
 
-			if (c_pSubBand[i].BPM_history_hit) {
-				free(c_pSubBand[i].BPM_history_hit);
-				c_pSubBand[i].BPM_history_hit = 0;
-            }
+/*
+ * fft, subbands, window, min/max BPM, overlap success/fail, octave
+ * The analysis of libzplay (64, 16, 2000 ms) finds the half tempo of
+ * more tracks than either, see tools/bpmbench.
+ */
+static const struct bpm_detector_params bpm_presets[BPM_PRESETS] = {
+    { 128,  4,  500, 55, 200,  500,  875,  0 },     /* BPM_PRESET_DEVICE */
+    { 128,  4,  500, 55, 200,  500,  875, 70 },     /* BPM_PRESET_ACCURATE */
+};
+
+/* the preset of a detector made without parameters */
+#define BPM_DEFAULT_PRESET          BPM_PRESET_DEVICE
+
+static int bpm_check_params(const struct bpm_detector_params *params) {
+    u32     fft = params->fft_points;
+
+    if (fft < BPM_MIN_FFT_POINTS || fft > BPM_MAX_FFT_POINTS || (fft & (fft - 1))
+        || params->subbands == 0 || params->subbands > BPM_MAX_SUBBANDS
+        || (fft / 2) % params->subbands != 0
+        || params->window < BPM_MIN_WINDOW || params->window > BPM_MAX_WINDOW
+        || params->min_bpm < BPM_LOWEST_BPM || params->max_bpm > BPM_HIGHEST_BPM
+        || params->min_bpm >= params->max_bpm
+        || params->octave > 100) {
+        return -1;
+    }
+
+    return 0;
+}
 
-		}
+/* ms of samples in hops */
+static u32 bpm_hops(const struct bpm_detector_params *params,
+                    u32 sample_rate, u32 ms) {
+    u32 hops = (u32)(((uint64_t)sample_rate * ms) / (1000 * params->fft_points));
 
-		free(c_pSubBand);
-		c_pSubBand = 0;
-	}
+    return hops ? hops : 1;
+}
 
-	c_ready = 0;
+/* the beat period of a tempo in hops, the lag of its correlation */
+static u32 bpm_lag(const struct bpm_detector_params *params,
+                   u32 sample_rate, u32 bpm) {
+    return (u32)(60.0f * (float)sample_rate
+                 / ((float)bpm * (float)params->fft_points) + 0.5f);
+}
 
-	return 0;
+/*
+ * the window is correlated with the buffer at every lag up to the one
+ * of the lowest BPM and its margin, which must stay in the buffer
+ */
+static u32 bpm_buffer_size(const struct bpm_detector_params *params,
+                           u32 sample_rate) {
+    return bpm_hops(params, sample_rate, params->window)
+           + bpm_lag(params, sample_rate, params->min_bpm - BPM_DETECT_MIN_MARGIN - 1);
 }
 
-static int allocate_internal_mem(void) {
-    u32 i;
+/*
+ * window + lag never reaches past the buffer, so a transform of
+ * at least buffer_size points has no circular wrap-around
+ */
+static u32 bpm_acf_size(u32 buffer_size) {
+    u32 size;
+
+    for (size = 4; size < buffer_size; size *= 2) {
+        ;
+    }
+
+    return size;
+}
+
+/*
+ * lay out the arrays of a detector after the structure, the pointers
+ * are only set if det is not NULL
+ *
+ * ret: the total size in bytes
+ */
+static u32 bpm_layout(struct bpm_detector *det,
+                      const struct bpm_detector_params *params, u32 sample_rate) {
+    u32     i;
+    u32     fft = params->fft_points;
+    u32     buffer_size = bpm_buffer_size(params, sample_rate);
+    u32     acf_size = bpm_acf_size(buffer_size);
+    u8      *base = (u8 *)det;
+    u32     pos = BPM_ALIGN(sizeof(struct bpm_detector));
+
+    for (i = 0; i < params->subbands; i++) {
+        if (det) det->subband[i].buffer = (ENERGY *)(base + pos);
+        pos += BPM_ALIGN(buffer_size * sizeof(ENERGY));
+
+        if (det) det->subband[i].BPM_history_hit = (u16 *)(base + pos);
+        pos += BPM_ALIGN((params->max_bpm + 2) * sizeof(u16));
+    }
+
+    if (det) det->pn_offset = (u16 *)(base + pos);
+    pos += BPM_ALIGN((params->max_bpm + BPM_DETECT_MAX_MARGIN + 2) * sizeof(u16));
+
+    if (det) det->amplitudes = (ENERGY *)(base + pos);
+    pos += BPM_ALIGN(fft / 2 * sizeof(ENERGY));
+
+#ifdef BPM_FIXED_POINT
+    (void)acf_size;
+
+    if (det) det->frame = (int16_t *)(base + pos);
+    pos += BPM_ALIGN(fft * sizeof(int16_t));
+
+    if (det) det->samples = (complex_q15_t *)(base + pos);
+    pos += BPM_ALIGN((fft / 2 + 1) * sizeof(complex_q15_t));
 
-	c_amplitudes = (REAL *)malloc(BPM_DETECT_FFT_POINTS / 2 * sizeof(REAL));
-	c_samples = (complex_t *)malloc(BPM_DETECT_FFT_POINTS * sizeof(complex_t));
-	c_pfl_window = (REAL *)malloc(BPM_DETECT_FFT_POINTS * sizeof(REAL));
-	c_pn_offset = (u16 *)malloc((BPM_DETECT_MAX_BPM + BPM_DETECT_MAX_MARGIN + 2) * sizeof(u16));
+    if (det) det->window = (int16_t *)(base + pos);
+    pos += BPM_ALIGN(fft * sizeof(int16_t));
 
-	if (c_amplitudes == 0 || c_samples == 0 || c_pfl_window == 0 || c_pn_offset == 0) {
-		free_internal_mem();
-		return -1;
-	}
+    if (det) det->acf_env = (int16_t *)(base + pos);
+    pos += BPM_ALIGN(buffer_size * sizeof(int16_t));
 
-	memset(c_amplitudes, 0, BPM_DETECT_FFT_POINTS / 2 * sizeof(REAL));
-	memset(c_samples, 0, BPM_DETECT_FFT_POINTS * sizeof(complex_t));
-	memset(c_pfl_window, 0, BPM_DETECT_FFT_POINTS * sizeof(REAL));
-	memset(c_pn_offset, 0, (BPM_DETECT_MAX_BPM + BPM_DETECT_MAX_MARGIN + 2) * sizeof(u16));
+    if (det) det->fft_plan = fft_plan_init_real(base + pos, fft, FFT_PLAN_Q15);
+    pos += BPM_ALIGN(fft_plan_size(fft, 1, FFT_PLAN_Q15));
+#else
+    if (det) det->frame = (REAL *)(base + pos);
+    pos += BPM_ALIGN(fft * sizeof(REAL));
 
-    c_pSubBand = (struct subband_t *)malloc(BPM_NUMBER_OF_SUBBANDS * sizeof(struct subband_t));
-	if (c_pSubBand == 0) {
-		free_internal_mem();
-		return -1;
-	}
-	memset(c_pSubBand, 0, BPM_NUMBER_OF_SUBBANDS * sizeof(struct subband_t));
+    if (det) det->samples = (complex_t *)(base + pos);
+    pos += BPM_ALIGN((fft / 2 + 1) * sizeof(complex_t));
 
-    for (i = 0; i < BPM_NUMBER_OF_SUBBANDS; i++) {
-        c_pSubBand[i].buffer = (REAL *)malloc(c_buffer_size * sizeof(REAL));
-        if (c_pSubBand[i].buffer == 0) {
-		    free_internal_mem();
-            return -1;
+    if (det) det->window = (REAL *)(base + pos);
+    pos += BPM_ALIGN(fft * sizeof(REAL));
+
+    if (det) det->acf_buf = (REAL *)(base + pos);
+    pos += BPM_ALIGN(acf_size * sizeof(REAL));
+
+    if (det) det->acf_spec = (complex_t *)(base + pos);
+    pos += BPM_ALIGN((acf_size / 2 + 1) * sizeof(complex_t));
+
+    if (det) det->acf_win_spec = (complex_t *)(base + pos);
+    pos += BPM_ALIGN((acf_size / 2 + 1) * sizeof(complex_t));
+
+    if (det) det->fft_plan = fft_plan_init_real(base + pos, fft, FFT_PLAN_FLOAT);
+    pos += BPM_ALIGN(fft_plan_size(fft, 1, FFT_PLAN_FLOAT));
+
+    if (det) det->acf_plan = fft_plan_init_real(base + pos, acf_size, FFT_PLAN_FLOAT);
+    pos += BPM_ALIGN(fft_plan_size(acf_size, 1, FFT_PLAN_FLOAT));
+#endif
+
+    return pos;
+}
+
+#ifdef BPM_FIXED_POINT
+/*
+ * window the samples in Q15 and get the energy of each bin
+ *
+ * The Q15 transform gives DFT / fft_points, its squared magnitude is
+ * the float energy |DFT|^2 / fft_points scaled down by fft_points,
+ * which does not move the peaks.
+ */
+static void bpm_spectrum(struct bpm_detector *det,
+                         const short *samples, u32 sample_num) {
+    u32     i;
+    int32_t re, im;
+
+    if (det->channel == 2) {
+        /* convert to mono */
+        for (i = 0; i < sample_num; i++) {
+            re = ((int32_t)samples[2 * i] + samples[2 * i + 1]) >> 1;
+            det->frame[i] = (int16_t)((re * det->window[i] + (1 << 14)) >> 15);
+        }
+    } else {
+        for (i = 0; i < sample_num; i++) {
+            det->frame[i] = (int16_t)(((int32_t)samples[i] * det->window[i] + (1 << 14)) >> 15);
         }
-        memset(c_pSubBand[i].buffer, 0, c_buffer_size * sizeof(REAL));
+    }
+
+    fft_real_forward_q15(det->fft_plan, det->frame, det->samples);
+
+    /*
+     * |X|^2 <= 2^31, no sqrt needed as only the energy is used.
+     * The bins of a subband are summed in 64 bits.
+     */
+    re = det->samples[det->params.fft_points / 2].r;
+    det->amplitudes[det->params.fft_points / 2 - 1] = (u32)(re * re);
 
-	    c_pSubBand[i].BPM_history_hit = (u16 *)malloc((BPM_DETECT_MAX_BPM + 2) * sizeof(u16));
-		if (c_pSubBand[i].BPM_history_hit == 0) {
-		    free_internal_mem();
-            return -1;
-		}
+    for (i = 1; i < det->params.fft_points / 2; i++) {
+        re = det->samples[i].r;
+        im = det->samples[i].i;
 
+        det->amplitudes[i - 1] = (u32)(re * re) + (u32)(im * im);
     }
+}
+
+/*
+ * scale the buffer to 15 bits (one shift for the whole buffer, so
+ * the correlations keep their ratios) for the dot products, and
+ * unroll it from the ring, oldest value first
+ */
+static void autocorrelation(struct bpm_detector *det, const struct subband_t *subband) {
+    u32             k;
+    u32             shift;
+    u32             first = det->buffer_size - subband->buffer_start;
+    ENERGY          max = 0;
+    const ENERGY    *buffer = subband->buffer;
+
+    for (k = 0; k < det->buffer_size; k++) {
+        if (buffer[k] > max) {
+            max = buffer[k];
+        }
+    }
+
+    for (shift = 0; (max >> shift) > 0x7FFF; shift++) {
+        ;
+    }
+
+    for (k = 0; k < first; k++) {
+        det->acf_env[k] = (int16_t)(buffer[subband->buffer_start + k] >> shift);
+    }
+    for (k = 0; k < subband->buffer_start; k++) {
+        det->acf_env[first + k] = (int16_t)(buffer[k] >> shift);
+    }
+}
+
+/*
+ * correlate the first window_size values of the buffer with the
+ * buffer at lag, Q30 products summed in 64 bits (SMLAL)
+ */
+static CORRELATION correlation_at(const struct bpm_detector *det, u32 lag) {
+    u32             k;
+    CORRELATION     sum = 0;
+    const int16_t   *a = det->acf_env;
+    const int16_t   *b = det->acf_env + lag;
+
+    for (k = 0; k < det->window_size; k++) {
+        sum += (int32_t)a[k] * b[k];
+    }
+
+    return sum;
+}
+#else
+/*
+ * window the samples and get the energy of each bin,
+ * |DFT|^2 / fft_points
+ */
+static void bpm_spectrum(struct bpm_detector *det,
+                         const short *samples, u32 sample_num) {
+    u32     i;
+    REAL    re, im;
 
     /* 
-     * create COSINE window
+     * create samples array
+     * NOTE: I just treat samples as Q1.15, just like samples[i] / 32767.0
      */
-    for (i = 0; i < BPM_DETECT_FFT_POINTS; i++) {
-        c_pfl_window[i] = (REAL)(sin((PI * i) / (BPM_DETECT_FFT_POINTS - 1.0))); 
+    if (det->channel == 2) {
+        /* convert to mono */
+        for (i = 0; i < sample_num; i++) {
+            det->frame[i] = ((REAL)samples[2 * i] + (REAL)samples[2 * i + 1])
+                            * det->window[i] / 2.0f;
+            DEBUG("%f, %d, %d, %f\n", det->window[i], samples[2 * i],
+                                      samples[2 * i + 1], det->frame[i]);
+        }
+    } else {
+        for (i = 0; i < sample_num; i++) {
+            det->frame[i] = (REAL)samples[i] * det->window[i];
+            DEBUG("%f, %d, %f\n", det->window[i], samples[i], det->frame[i]);
+        }
     }
-    DEBUG("c_pfl_window:\n");
-    for (i = 1; i < BPM_DETECT_FFT_POINTS; i++) {
+
+    /* make fft, the input is real so only half of the spectrum is computed */
+    fft_real_forward(det->fft_plan, det->frame, det->samples);
+
+    DEBUG("after fft transfer\n");
+    DEBUG("Real/Image:\n");
+    for (i = 1; i < det->params.fft_points / 2; i++) {
         if (i % 5 == 0) DEBUG("\n");
-        DEBUG("%f, ", c_pfl_window[i]);
+        DEBUG("%f/%f, ", det->samples[i].r,
+                         det->samples[i].i);
     }
     DEBUG("\n");
 
+    /* only the energy is used, no need for sqrt */
+    re = det->samples[det->params.fft_points / 2].r;
+    det->amplitudes[det->params.fft_points / 2 - 1] = re * re / det->params.fft_points;
 
-    c_ready = 1;
+    for (i = 1; i < det->params.fft_points / 2; i++) {
+        re = det->samples[i].r;
+        im = det->samples[i].i;
 
-    return 0;
+        det->amplitudes[i - 1] = (re * re + im * im) / det->params.fft_points;
+    }
 }
 
+/*
+ * correlate the first window_size values of the buffer with the
+ * buffer at every lag, det->acf_buf[lag] is the result
+ */
+static void autocorrelation(struct bpm_detector *det, const struct subband_t *subband) {
+    u32         k;
+    u32         first = det->buffer_size - subband->buffer_start;
+    complex_t   b, w;
+
+    /* spectrum of the whole buffer, unrolled from the ring */
+    memcpy(det->acf_buf, subband->buffer + subband->buffer_start, first * sizeof(REAL));
+    memcpy(det->acf_buf + first, subband->buffer, subband->buffer_start * sizeof(REAL));
+    memset(det->acf_buf + det->buffer_size, 0,
+           (det->acf_size - det->buffer_size) * sizeof(REAL));
+    fft_real_forward(det->acf_plan, det->acf_buf, det->acf_spec);
+
+    /* spectrum of the window */
+    memset(det->acf_buf + det->window_size, 0,
+           (det->acf_size - det->window_size) * sizeof(REAL));
+    fft_real_forward(det->acf_plan, det->acf_buf, det->acf_win_spec);
+
+    /* cross spectrum, conj(W) * B */
+    for (k = 0; k <= det->acf_size / 2; k++) {
+        b = det->acf_spec[k];
+        w = det->acf_win_spec[k];
+
+        det->acf_spec[k].r = w.r * b.r + w.i * b.i;
+        det->acf_spec[k].i = w.r * b.i - w.i * b.r;
+    }
 
+    fft_real_inverse(det->acf_plan, det->acf_spec, det->acf_buf);
+}
 
-/*========================================================
- *          The interfaces provided to others
- *======================================================*/
+static inline CORRELATION correlation_at(const struct bpm_detector *det, u32 lag) {
+    return det->acf_buf[lag];
+}
+#endif
 
 /*
- * initialize of BPM detetion algorithm
- *
- * PARAMETERS:
- *     sample_rate
- *         Sample rate. Optimized for sample rate 44100 Hz.
- *
- *     channel
- *         Number of channels. Stereo is converted to mono.
- *
- * RETURN VALUES:
- *     0    - all OK, class initialized
- *     -1   - memory allocation error
- *
- * REMARKS:
- *     Call this function before you put samples.
- *     Also call this function before processing new song
- *     to clear internal buffers and initialize all to starting positions.
- *
+ * the BPM of a pass one octave up, if it correlates at least
+ * params.octave % as well as bpm did (best)
  */
-int BPM_init(u32 sample_rate, u32 channel) {
-    u32 i;
-    struct subband_t *subband;
+static u16 bpm_octave_up(const struct bpm_detector *det, u16 bpm, CORRELATION best) {
+    u32             j;
+    CORRELATION     correlation;
 
-    if (sample_rate == 0 || channel == 0) {
-        return -1;
+    if (det->params.octave == 0 || 2 * bpm > det->params.max_bpm) {
+        return bpm;
     }
 
-    /*
-     * Init the global constant variables
-     * according to sample rate and channel
-     */
-
-    c_buffer_size = (sample_rate * BPM_BUFFER_SIZE)
-                    / (1000 * BPM_DETECT_FFT_POINTS);
-    if (c_buffer_size == 0) {
-        c_buffer_size = 1;
+    /* the lag of 2 * bpm is rounded, its neighbours may hit the peak */
+    for (j = 2 * bpm - 1; j <= 2 * bpm + 1u; j++) {
+        correlation = correlation_at(det, det->pn_offset[j]);
+        if (correlation * 100 >= best * det->params.octave) {
+            return 2 * bpm;
+        }
     }
 
-    c_window_size = (sample_rate * BPM_WINDOW_SIZE)
-                    / (1000 * BPM_DETECT_FFT_POINTS);
-    if (c_window_size == 0) {
-        c_window_size = 1;
+    return bpm;
+}
+
+/* onset frame of beat number n in samples, the middle of the frame */
+static u32 beat_position(const struct bpm_detector *det, u32 frame) {
+    u32 frame_size = det->beat_decimate * det->params.fft_points;
+
+    return frame * frame_size + frame_size / 2;
+}
+
+/* the weight of a predecessor k frames back, log-gaussian around the period */
+static void beat_weights(struct beat_tracker_t *bt) {
+    u32     k;
+    REAL    x;
+
+    for (k = 0; k < BPM_BEAT_FRAMES; k++) {
+        if (k < bt->period / 2 || k > bt->period * 2) {
+            bt->weight[k] = 0;
+        } else {
+            x = BPM_BEAT_TIGHTNESS * LOG((REAL)k / bt->period);
+            bt->weight[k] = EXP(-0.5f * x * x);
+        }
     }
+}
+
+/*
+ * estimate the beat period from the autocorrelation of the onset
+ * strength, each lag supported by its double and weighted by the prior
+ */
+static void beat_tempo(struct bpm_detector *det) {
+    struct beat_tracker_t *bt = &det->beat;
+
+    u32     n, k, lag, best_lag;
+    u32     min_lag, max_lag;
+    u32     first;
 
-    c_overlap_success_size = (sample_rate * BPM_OVERLAP_SUCCESS_SIZE)
-                              / (1000 * BPM_DETECT_FFT_POINTS);
-    if (c_overlap_success_size >= c_buffer_size) {
-        c_overlap_success_size = c_buffer_size - 1;    
+    REAL    mean, r, r2, value, best;
+    REAL    prev, next, period, x;
+
+    n       = bt->frames < BPM_BEAT_FRAMES ? bt->frames : BPM_BEAT_FRAMES;
+    first   = bt->frames - n;
+
+    min_lag = (u32)(bt->frame_rate * 60.0f / det->params.max_bpm);
+    max_lag = (u32)(bt->frame_rate * 60.0f / det->params.min_bpm + 1);
+    if (min_lag < 2) {
+        min_lag = 2;
+    }
+    /* lag and its double, with room for the interpolation */
+    if (2 * max_lag + 3 > n) {
+        max_lag = (n - 3) / 2;
+    }
+    if (max_lag <= min_lag) {
+        return;
     }
 
-    c_overlap_fail_size = (sample_rate * BPM_OVERLAP_FAIL_SIZE)
-                           / (1000 * BPM_DETECT_FFT_POINTS);
-    if (c_overlap_fail_size >= c_buffer_size) {
-        c_overlap_fail_size = c_buffer_size - 1;    
+    mean = 0;
+    for (k = 0; k < n; k++) {
+        mean += bt->oss[(first + k) & (BPM_BEAT_FRAMES - 1)];
     }
+    mean /= n;
 
-    c_overlap_success_start = c_buffer_size - c_overlap_success_size;
-    c_overlap_fail_start    = c_buffer_size - c_overlap_fail_size;
-    c_subband_BPM_detected  = 0;
+#define OSS(k)  (bt->oss[(first + (k)) & (BPM_BEAT_FRAMES - 1)] - mean)
 
-    c_sqrt_FFT_points       = sqrt(BPM_DETECT_FFT_POINTS);
-    DEBUG("c_sqrt_FFT_points: %f\n", c_sqrt_FFT_points);
+    best        = 0;
+    best_lag    = 0;
+    prev        = 0;
+    next        = 0;
+    value       = 0;
 
-    if (c_ready == 0
-        || c_sample_rate != sample_rate
-        || c_channel != channel) {
+    for (lag = min_lag - 1; lag <= max_lag + 1; lag++) {
+        r = 0;
+        for (k = lag; k < n; k++) {
+            r += OSS(k) * OSS(k - lag);
+        }
+        r /= (REAL)(n - lag);
 
-        if (allocate_internal_mem() < 0) {
-            return -1;
+        r2 = 0;
+        for (k = 2 * lag; k < n; k++) {
+            r2 += OSS(k) * OSS(k - 2 * lag);
         }
+        r2 /= (REAL)(n - 2 * lag);
 
-        c_sample_rate   = sample_rate;
-        c_channel       = channel;
+        x = LOG2((REAL)lag / (bt->frame_rate * 60.0f / BPM_BEAT_PRIOR_BPM)) / BPM_BEAT_PRIOR_WIDTH;
+        r = (r + 0.5f * r2) * EXP(-0.5f * x * x);
 
-        for (i = BPM_DETECT_MIN_BPM - BPM_DETECT_MIN_MARGIN - 1;
-             i <= BPM_DETECT_MAX_BPM + BPM_DETECT_MAX_MARGIN + 1;
-             i++) {
-            c_pn_offset[i] = (u16)(((double)(OFFSET_FACTOR * c_sample_rate)
-                             / (double)(i * BPM_DETECT_FFT_POINTS)) + 0.5);
+        if (lag == best_lag + 1) {
+            next = r;
+        }
+        if (lag >= min_lag && lag <= max_lag && r > best) {
+            best        = r;
+            best_lag    = lag;
+            prev        = value;
         }
+        value = r;
+    }
+
+#undef OSS
 
+    if (best_lag == 0) {
+        return;
     }
 
-    for (i = 0; i < BPM_NUMBER_OF_SUBBANDS; i++) {
-        subband                     = &c_pSubBand[i];
-        subband->buffer_load        = 0;
-        subband->BPM                = 0;
-        memset(subband->BPM_history_hit, 0,
-               (BPM_DETECT_MAX_BPM + 2) * sizeof(u16));
+    /* parabolic interpolation around the peak */
+    period = best_lag;
+    r = prev - 2 * best + next;
+    if (r < 0) {
+        period += 0.5f * (prev - next) / r;
     }
 
+    /*
+     * follow small drifts smoothly, and jump when a different tempo
+     * is found twice in a row
+     */
+    if (bt->period > 0 && FABS(period - bt->period) < 0.15f * bt->period) {
+        bt->period      = 0.75f * bt->period + 0.25f * period;
+        bt->candidate   = 0;
+        beat_weights(bt);
+        return;
+    }
 
-    return 0;
+    if (bt->period > 0 && FABS(period - bt->candidate) >= 0.15f * period) {
+        bt->candidate = period;
+        return;
+    }
+
+    bt->period      = period;
+    bt->candidate   = 0;
+
+    beat_weights(bt);
+}
+
+/* the frame with the best score in [from, to] */
+static u32 beat_pick(const struct beat_tracker_t *bt, u32 from, u32 to) {
+    u32     k, best = to;
+
+    for (k = from; k <= to; k++) {
+        if (bt->score[k & (BPM_BEAT_FRAMES - 1)]
+            > bt->score[best & (BPM_BEAT_FRAMES - 1)]) {
+            best = k;
+        }
+    }
+
+    return best;
+}
+
+static void beat_emit(struct bpm_detector *det, u32 frame) {
+    struct beat_tracker_t *bt = &det->beat;
+
+    bt->last_beat = frame;
+    bt->beats++;
+
+    /* a full queue loses its oldest beat */
+    if (bt->queue_head - bt->queue_tail == BPM_BEAT_QUEUE) {
+        bt->queue_tail++;
+    }
+    bt->queue[bt->queue_head++ & (BPM_BEAT_QUEUE - 1)] = beat_position(det, frame);
 }
 
 /*
- * set the range of frequency band
- *
- * parameters:
- *     low_limit
- *        the low limit of freqency band
- *     high_limit
- *        the high limit of freqency band
- *
- * return values:
- *     return 0 if success, or return -1
- *
- * remarks:
- *     none
- *
+ * one onset frame is complete: update the score, the tempo and
+ * decide on the beats that can no longer change
  */
-int BPM_set_freq_band(u32 low_limit, u32 high_limit) {
-    /* calculate low index */
-    double subband      = (double)c_sample_rate / (double)(BPM_NUMBER_OF_SUBBANDS * 2);
+static void beat_frame(struct bpm_detector *det) {
+    struct beat_tracker_t *bt = &det->beat;
+
+    u32     n = bt->frames;
+    u32     d, lo, hi, win, expected;
+    REAL    v, best;
+
+    bt->oss[n & (BPM_BEAT_FRAMES - 1)] = bt->onset;
+    bt->onset = 0;
+    bt->frames++;
+
+    /* cumulative score */
+    best = 0;
+    if (bt->period > 0) {
+        lo = (u32)(bt->period / 2);
+        hi = (u32)(bt->period * 2);
+        if (hi >= BPM_BEAT_FRAMES) {
+            hi = BPM_BEAT_FRAMES - 1;
+        }
+        if (hi > n) {
+            hi = n;
+        }
 
-    c_low_limit_index   = (u16)((double)low_limit / (double)subband);
-    c_high_limit_index  = (u16)((double)high_limit / (double)subband);
-    if (c_high_limit_index > BPM_NUMBER_OF_SUBBANDS) {
-        c_high_limit_index = BPM_NUMBER_OF_SUBBANDS;    
+        for (d = lo < 1 ? 1 : lo; d <= hi; d++) {
+            v = bt->weight[d] * bt->score[(n - d) & (BPM_BEAT_FRAMES - 1)];
+            if (v > best) {
+                best = v;
+            }
+        }
     }
+    bt->score[n & (BPM_BEAT_FRAMES - 1)] = (1 - BPM_BEAT_ALPHA) * bt->oss[n & (BPM_BEAT_FRAMES - 1)]
+                                           + BPM_BEAT_ALPHA * best;
 
-    c_band_size_index = c_high_limit_index - c_low_limit_index;
-    DEBUG("c_band_size_index: %d\n", c_band_size_index);
+    if (bt->frames == BPM_BEAT_FRAMES / 2
+        || (bt->frames > BPM_BEAT_FRAMES / 2
+            && bt->frames % BPM_BEAT_TEMPO_INTERVAL == 0)) {
+        beat_tempo(det);
+    }
 
-    return 0;
+    if (bt->period <= 0) {
+        return;
+    }
+
+    /* a beat is final a quarter period after its expected position */
+    win = (u32)(bt->period / 4 + 0.5f);
+    if (win < 1) {
+        win = 1;
+    }
+
+    if (bt->beats == 0) {
+        if (n >= (u32)bt->period) {
+            beat_emit(det, beat_pick(bt, n - (u32)bt->period + 1, n));
+        }
+    } else {
+        expected = bt->last_beat + (u32)(bt->period + 0.5f);
+        if (n >= expected + win) {
+            beat_emit(det, beat_pick(bt, expected - win, expected + win));
+        }
+    }
 }
 
+#ifdef BPM_FIXED_POINT
+/* log2(1 + i / 64) in Q8 */
+static const u8 bpm_log2_table[64] = {
+      0,   6,  11,  17,  22,  28,  33,  38,
+     44,  49,  54,  59,  63,  68,  73,  78,
+     82,  87,  92,  96, 100, 105, 109, 113,
+    118, 122, 126, 130, 134, 138, 142, 146,
+    150, 154, 157, 161, 165, 169, 172, 176,
+    179, 183, 186, 190, 193, 197, 200, 203,
+    207, 210, 213, 216, 220, 223, 226, 229,
+    232, 235, 238, 241, 244, 247, 250, 253,
+};
+
 /*
- * get number of samples needed for put_samples function.
- *
- * PARAMETERS:
- *     None
- *
- * RETURN VALUES:
- *     number of samples needed for BPM_put_samples function.
- *
- * REMARKS:
- *     Use this function to get number of samples you need
- *     to feed with BPM_put_samples function
- *
+ * log2(1 + x) in Q8, from the top bit and the six bits below it,
+ * at most 0.023 under log2()
  */
-u32 BPM_num_of_samples(void) {
-    return BPM_DETECT_FFT_POINTS;
+static u32 bpm_log2(u32 x) {
+    u32 top, frac;
+
+    if (x < 0xFFFFFFFF) {
+        x++;
+    }
+
+    top     = 31 - __builtin_clz(x);
+    frac    = (top >= 6) ? x >> (top - 6) : x << (6 - top);
+
+    return (top << 8) + bpm_log2_table[frac & 63];
 }
+#endif
 
 /*
- * put samples into processing
- *
- * PARAMETERS:
- *     samples
- *         Pointer to buffer with samples. Supports only 16 bit samples
+ * the spectral flux of this hop, called after the energies are set
  *
- *     sample_num
- *         Number of samples in buffer.
- *
- * RETURN VALUES:
- *     1    - detecting is done, we have BPM, we don't need more data.
- *     0    - we need more data to detect BPM
- *
- * REMARKS:
- *     Call this function with new samples until function returns 1
- *     or you are out of data.
- *     If function returns 1, detection is done and we have BPM value,
- *     so we don't need more data.
+ * The fixed-point build takes log2 rather than log of the energies,
+ * which only scales the onset strength.
  */
-int BPM_put_samples(short *samples, u32 sample_num) {
-    u16     bpm;
-    u16     i, j, k;
+static void beat_track(struct bpm_detector *det) {
+    struct beat_tracker_t *bt = &det->beat;
+
+    u32     i;
+#ifdef BPM_FIXED_POINT
+    u32     e, flux = 0;
+#else
+    REAL    e, flux = 0;
+#endif
 
-    u32     history_hit;
-    u32     avg;
+    for (i = det->low_limit_index; i < det->high_limit_index; i++) {
+#ifdef BPM_FIXED_POINT
+        e = bpm_log2(det->energy[i]);
+#else
+        e = LOG(1.0f + (REAL)det->energy[i]);
+#endif
 
-    REAL    amp;
-    REAL    re, im;
-    REAL    instant_amplitude;
+        if (bt->hops > 0 && e > bt->prev_energy[i]) {
+            flux += e - bt->prev_energy[i];
+        }
+        bt->prev_energy[i] = e;
+    }
 
-    REAL    max_correlation;
-    REAL    correlation;
+    bt->onset += flux;
+    bt->hops++;
 
-    struct subband_t *subband;
+    if (bt->hops % det->beat_decimate == 0) {
+        beat_frame(det);
+    }
+}
 
-    DEBUG("%s\n", __func__);
+/*========================================================
+ *          The interfaces provided to others
+ *======================================================*/
+
+const struct bpm_detector_params *bpm_detector_preset(int preset) {
+    if (preset < 0 || preset >= BPM_PRESETS) {
+        return NULL;
+    }
+
+    return &bpm_presets[preset];
+}
+
+uint32_t bpm_detector_mem_size(const struct bpm_detector_params *params,
+                               uint32_t sample_rate) {
+    if (params == NULL) {
+        params = &bpm_presets[BPM_DEFAULT_PRESET];
+    }
+
+    if (sample_rate == 0 || bpm_check_params(params) < 0) {
+        return 0;
+    }
+
+    return bpm_layout(NULL, params, sample_rate);
+}
+
+bpm_detector_t *bpm_detector_init(void *mem, uint32_t size,
+                                  const struct bpm_detector_params *params,
+                                  uint32_t sample_rate, uint32_t channel) {
+    u32                 i;
+    u32                 fft;
+    u32                 need;
+    struct bpm_detector *det = (struct bpm_detector *)mem;
+
+    if (params == NULL) {
+        params = &bpm_presets[BPM_DEFAULT_PRESET];
+    }
+
+    need = bpm_detector_mem_size(params, sample_rate);
+    if (mem == NULL || channel == 0 || need == 0 || size < need) {
+        return NULL;
+    }
+
+    memset(det, 0, sizeof(struct bpm_detector));
+
+    /*
+     * Init the constant variables
+     * according to parameters, sample rate and channel
+     */
+    det->params         = *params;
+    det->sample_rate    = sample_rate;
+    det->channel        = channel;
+
+    fft                 = params->fft_points;
+    det->subband_size   = fft / (2 * params->subbands);
+    det->beat_decimate  = fft < BPM_BEAT_FRAME_SIZE ? BPM_BEAT_FRAME_SIZE / fft : 1;
+
+    det->buffer_size    = bpm_buffer_size(params, sample_rate);
+    det->acf_size       = bpm_acf_size(det->buffer_size);
+    det->window_size    = bpm_hops(params, sample_rate, params->window);
+
+    det->overlap_success_size = bpm_hops(params, sample_rate, params->overlap_success);
+    if (det->overlap_success_size >= det->buffer_size) {
+        det->overlap_success_size = det->buffer_size - 1;    
+    }
+
+    det->overlap_fail_size = bpm_hops(params, sample_rate, params->overlap_fail);
+    if (det->overlap_fail_size >= det->buffer_size) {
+        det->overlap_fail_size = det->buffer_size - 1;    
+    }
+
+    det->overlap_success_start  = det->buffer_size - det->overlap_success_size;
+    det->overlap_fail_start     = det->buffer_size - det->overlap_fail_size;
+
+    det->low_limit_index        = 0;
+    det->high_limit_index       = params->subbands;
+    det->band_size_index        = params->subbands;
+
+    bpm_layout(det, params, sample_rate);
 
-#if 1
     /* 
-     * create samples array
-     * NOTE: I just treat samples as Q1.15, just like samples[i] / 32767.0
+     * create COSINE window
      */
+    for (i = 0; i < fft; i++) {
+#ifdef BPM_FIXED_POINT
+        det->window[i] = (int16_t)(sin((PI * i) / (fft - 1.0)) * 32767.0 + 0.5);
+#else
+        det->window[i] = (REAL)(sin((PI * i) / (fft - 1.0))); 
+#endif
+    }
 
-    if (c_channel == 2) {
-        /* convert to mono */
-        for (i = 0; i < sample_num; i++) {
-            c_samples[i].r = ((REAL)samples[2 * i] + (REAL)samples[2 * i + 1])
-                             * c_pfl_window[i] / 2.0;
-            c_samples[i].i = 0;
-            DEBUG("%f, %d, %d, %f\n", c_pfl_window[i], samples[2 * i],
-                                      samples[2 * i + 1], creal(samples[i]));
-        }
-    } else {
-        for (i = 0; i < sample_num; i++) {
-            c_samples[i].r = (REAL)samples[i] * c_pfl_window[i];
-            c_samples[i].i = 0;
-            DEBUG("%f, %d, %f\n", c_pfl_window[i], samples[i], c_samples[i].r);
-        }
+    /* a beat every 60 / bpm seconds, sample_rate / fft hops per second */
+    for (i = params->min_bpm - BPM_DETECT_MIN_MARGIN - 1;
+         i <= (u32)params->max_bpm + BPM_DETECT_MAX_MARGIN + 1;
+         i++) {
+        det->pn_offset[i] = (u16)bpm_lag(params, sample_rate, i);
     }
 
+    bpm_detector_reset(det);
 
-    /* make fft */
-    DEBUG("before fft transfer\n");
-    for (i = 1; i < sample_num; i++) {
-        if (i % 5 == 0) DEBUG("\n");
-        DEBUG("%f, ", c_samples[i].r);
-    }                     
-    DEBUG("\n");
+    return det;
+}
 
-    fft(c_samples, BPM_DETECT_FFT_POINTS);
+bpm_detector_t *bpm_detector_create(const struct bpm_detector_params *params,
+                                    uint32_t sample_rate, uint32_t channel) {
+    u32                 size = bpm_detector_mem_size(params, sample_rate);
+    void                *mem;
+    struct bpm_detector *det;
 
-    DEBUG("after fft transfer\n");
-    DEBUG("Real/Image:\n");
-    for (i = 1; i < BPM_DETECT_FFT_POINTS / 2; i++) {
-        if (i % 5 == 0) DEBUG("\n");
-        DEBUG("%f/%f, ", c_samples[i].r,
-                         c_samples[i].i);
+    if (size == 0 || channel == 0) {
+        return NULL;
     }
-    DEBUG("\n");
 
-    re = c_samples[BPM_DETECT_FFT_POINTS / 2].r;
-    im = 0;
-    DEBUG("re = %f\n", re);
+    mem = malloc(size);
+    if (mem == NULL) {
+        return NULL;
+    }
 
-    amp = sqrt(re * re + im * im) / c_sqrt_FFT_points;
-    c_amplitudes[BPM_DETECT_FFT_POINTS / 2 - 1] = amp * amp;
+    det = bpm_detector_init(mem, size, params, sample_rate, channel);
+    if (det == NULL) {
+        free(mem);
+        return NULL;
+    }
+    det->own = 1;
 
-    for (i = 1; i < BPM_DETECT_FFT_POINTS / 2; i++) {
-        re = c_samples[i].r;
-        im = c_samples[i].i;
+    return det;
+}
 
-        amp = sqrt(re * re + im * im) / c_sqrt_FFT_points;
-        c_amplitudes[i - 1] = amp * amp;
+void bpm_detector_destroy(bpm_detector_t *det) {
+    if (det && det->own) {
+        free(det);
     }
+}
 
-    for (i = c_low_limit_index; i < c_high_limit_index; i++) {
-        subband = &c_pSubBand[i];
+void bpm_detector_reset(bpm_detector_t *det) {
+    u32                 i;
+    struct subband_t    *subband;
+
+    det->subband_BPM_detected = 0;
+
+    memset(&det->beat, 0, sizeof(struct beat_tracker_t));
+    det->beat.frame_rate = (REAL)det->sample_rate
+                           / (det->beat_decimate * det->params.fft_points);
+
+    for (i = 0; i < det->params.subbands; i++) {
+        subband                     = &det->subband[i];
+        subband->buffer_load        = 0;
+        subband->buffer_start       = 0;
+        subband->BPM                = 0;
+        memset(subband->BPM_history_hit, 0,
+               (det->params.max_bpm + 2) * sizeof(u16));
+    }
+}
+
+int bpm_detector_set_freq_band(bpm_detector_t *det,
+                               uint32_t low_limit, uint32_t high_limit) {
+    u32 subbands = det->params.subbands;
+
+    /* calculate low index */
+    double subband      = (double)det->sample_rate / (double)(subbands * 2);
+
+    /* the subbands that overlap the band, a partial one included */
+    det->low_limit_index    = (u16)((double)low_limit / (double)subband);
+    det->high_limit_index   = (u16)ceil((double)high_limit / (double)subband);
+    if (det->high_limit_index > subbands) {
+        det->high_limit_index = subbands;    
+    }
+
+    if (det->low_limit_index > det->high_limit_index) {
+        det->low_limit_index = det->high_limit_index;
+    }
+
+    det->band_size_index = det->high_limit_index - det->low_limit_index;
+    DEBUG("band_size_index: %d\n", det->band_size_index);
+
+    return 0;
+}
+
+uint32_t bpm_detector_num_of_samples(const bpm_detector_t *det) {
+    return det->params.fft_points;
+}
+
+int bpm_detector_put_samples(bpm_detector_t *det,
+                             const short *samples, uint32_t sample_num) {
+    u16     bpm;
+    u16     i, j;
+
+    u32     pos;
+    u32     history_hit;
+    u32     avg;
+
+    ENERGY          instant_amplitude;
+    ENERGY_SUM      amplitude_sum;
+
+    CORRELATION     max_correlation;
+    CORRELATION     correlation;
+
+    struct subband_t *subband;
+
+    DEBUG("%s\n", __func__);
+
+    if (sample_num > det->params.fft_points) {
+        sample_num = det->params.fft_points;
+    }
+
+    bpm_spectrum(det, samples, sample_num);
+
+    for (i = det->low_limit_index; i < det->high_limit_index; i++) {
+        subband = &det->subband[i];
 
-        if (subband->BPM) {     /* we have BPM, don't compute anymore */
-            continue;
-        }
-    
         /* 
          * CREATE SUBBANDS
          */
-        instant_amplitude = 0;
+        amplitude_sum = 0;
 
-        for (j = i * SUBBAND_SIZE; j < (i + 1) * SUBBAND_SIZE; j++) {
-            instant_amplitude += c_amplitudes[j];
+        for (j = i * det->subband_size; j < (i + 1) * det->subband_size; j++) {
+            amplitude_sum += det->amplitudes[j];
         }
 
-        instant_amplitude /= (REAL)SUBBAND_SIZE;
+        instant_amplitude = (ENERGY)(amplitude_sum / det->subband_size);
+        det->energy[i] = instant_amplitude;
+
+        if (subband->BPM) {     /* we have BPM, don't compute anymore */
+            continue;
+        }
 
         /* 
          * FILL BUFFER
          */
-        subband->buffer[subband->buffer_load] = instant_amplitude;
+        pos = subband->buffer_start + subband->buffer_load;
+        if (pos >= det->buffer_size) {
+            pos -= det->buffer_size;
+        }
+        subband->buffer[pos] = instant_amplitude;
 
         subband->buffer_load++;
-        if (subband->buffer_load < c_buffer_size) {
+        if (subband->buffer_load < det->buffer_size) {
             continue;
         }
 
 
-        /* calculate auto correlation of each BPM in range */
+        /* 
+         * calculate auto correlation of each BPM in range,
+         * all lags come from one transform
+         */
+        autocorrelation(det, subband);
+
         bpm = 0;
         max_correlation = 0;
 
-        for (j = BPM_DETECT_MIN_BPM - BPM_DETECT_MIN_MARGIN - 1;
-             j <= BPM_DETECT_MAX_BPM + BPM_DETECT_MAX_MARGIN;
+        for (j = det->params.min_bpm - BPM_DETECT_MIN_MARGIN - 1;
+             j <= det->params.max_bpm + BPM_DETECT_MAX_MARGIN;
              j++) {
-            correlation = 0;
-
-            for (k = 0; k < c_window_size; k++) {
-                correlation += (subband->buffer[k] * subband->buffer[k + c_pn_offset[j]]);
-            }
+            correlation = correlation_at(det, det->pn_offset[j]);
 
             if (correlation >= max_correlation) {
                 max_correlation = correlation;    
@@ -545,8 +1119,10 @@ int BPM_put_samples(short *samples, u32 sample_num) {
             }
         }
 
+        bpm = bpm_octave_up(det, bpm, max_correlation);
+
         /* mark bpm in history */
-        if (bpm >= BPM_DETECT_MIN_BPM && bpm <= BPM_DETECT_MAX_BPM) {    
+        if (bpm >= det->params.min_bpm && bpm <= det->params.max_bpm) {    
             history_hit = subband->BPM_history_hit[bpm]
                           + subband->BPM_history_hit[bpm - 1]
                           + subband->BPM_history_hit[bpm + 1];
@@ -557,81 +1133,67 @@ int BPM_put_samples(short *samples, u32 sample_num) {
                           + (bpm + 1) * subband->BPM_history_hit[bpm + 1])
                             / history_hit;
                     subband->BPM = avg;
-                    c_subband_BPM_detected++;
+                    det->subband_BPM_detected++;
                 }
             }
 
             subband->BPM_history_hit[bpm]++;
 
-            for (j = 0 ; j < c_overlap_success_size; j++) {
-                subband->buffer[j] = subband->buffer[j + c_overlap_success_start];
-            }
-
-            subband->buffer_load = c_overlap_success_size;
+            /* keep the newest overlap_success_size values */
+            subband->buffer_start += det->overlap_success_start;
+            subband->buffer_load = det->overlap_success_size;
             
         } else {
-            for (j = 0 ; j < c_overlap_fail_size; j++) {
-                subband->buffer[j] = subband->buffer[j + c_overlap_fail_start];
-            }
+            subband->buffer_start += det->overlap_fail_start;
+            subband->buffer_load = det->overlap_fail_size;
+        }
 
-            subband->buffer_load = c_overlap_fail_size;
+        if (subband->buffer_start >= det->buffer_size) {
+            subband->buffer_start -= det->buffer_size;
         }
     }
 
-    if (c_subband_BPM_detected == c_band_size_index) {
+    beat_track(det);
+
+    if (det->subband_BPM_detected == det->band_size_index) {
         return 1;
     }
-#endif
 
     return 0;
 }
 
-
-/*
- * get BPM value
- *
- * PARAMETERS:
- *     None
- *
- * RETURN VALUES:
- *     BPM value.
- *     This value can be 0 if detection fails or song has no beat.
- *
- * REMARKS:
- *     There can be case that class can't detect beat value.
- *     Maybe is song too short, or has no beat, or is too much noise
- */
-u32 BPM_get_bpm(void) {
+uint32_t bpm_detector_get_bpm(const bpm_detector_t *det) {
     u16 BPM;
     u16 i, j;
 
     u32 size;
     u32 have;
     u32 max_hit;
-    struct BPM_mod_t mod_value[BPM_NUMBER_OF_SUBBANDS];
+    struct BPM_mod_t mod_value[BPM_MAX_SUBBANDS];
+    const struct subband_t *subband = det->subband;
     
-    for (i = c_low_limit_index; i < c_high_limit_index; i++) {
-        DEBUG("Subband: %02u   %u\n", i, c_pSubBand[i].BPM);
+    for (i = det->low_limit_index; i < det->high_limit_index; i++) {
+        DEBUG("Subband: %02u   %u\n", i, subband[i].BPM);
     }
     
     /* get BPM by calculating mod value */
-    memset(mod_value, 0, BPM_NUMBER_OF_SUBBANDS * sizeof(struct BPM_mod_t));
+    memset(mod_value, 0, BPM_MAX_SUBBANDS * sizeof(struct BPM_mod_t));
 
     /* search unique values */
     size = 0;
-    for (i = c_low_limit_index; i < c_high_limit_index; i++) {
+    for (i = det->low_limit_index; i < det->high_limit_index; i++) {
         have = 0;
         /* check if this value is already in */
         for (j = 0; j < size; j++) {
-            if(c_pSubBand[i].BPM != 0 && mod_value[j].BPM == c_pSubBand[i].BPM) {
+            if(subband[i].BPM != 0 && mod_value[j].BPM == subband[i].BPM) {
                 have = 1;
                 break;
             }
         }
 
         /* we don't have value in, add new value if value is not 0 */
-        if (have == 0 && c_pSubBand[i].BPM != 0) {
-            mod_value[size].BPM = c_pSubBand[i].BPM;
+        if (have == 0 && subband[i].BPM != 0) {
+            mod_value[size].BPM = subband[i].BPM;
             size++;
         }
     }
@@ -640,20 +1202,20 @@ u32 BPM_get_bpm(void) {
     max_hit = 0;
     BPM = 0;
     for (i = 0; i < size; i++) {
-        for (j = c_low_limit_index; j < c_high_limit_index; j++) {
-            if (mod_value[i].BPM == c_pSubBand[j].BPM) {
+        for (j = det->low_limit_index; j < det->high_limit_index; j++) {
+            if (mod_value[i].BPM == subband[j].BPM) {
                 mod_value[i].hit++;
-                mod_value[i].sum += c_pSubBand[j].BPM;
+                mod_value[i].sum += subband[j].BPM;
             }
 
-            if (mod_value[i].BPM + 1 == c_pSubBand[j].BPM) {
+            if (mod_value[i].BPM + 1 == subband[j].BPM) {
                 mod_value[i].hit++;
-                mod_value[i].sum += c_pSubBand[j].BPM;
+                mod_value[i].sum += subband[j].BPM;
             }
 
-            if (mod_value[i].BPM - 1 == c_pSubBand[j].BPM) {
+            if (mod_value[i].BPM - 1 == subband[j].BPM) {
                 mod_value[i].hit++;
-                mod_value[i].sum += c_pSubBand[j].BPM;
+                mod_value[i].sum += subband[j].BPM;
             }
 
             if (mod_value[i].hit > max_hit) {
@@ -666,22 +1228,28 @@ u32 BPM_get_bpm(void) {
     return BPM;
 }
 
+uint32_t bpm_detector_get_beats(bpm_detector_t *det,
+                                uint32_t *beats, uint32_t max) {
+    struct beat_tracker_t *bt = &det->beat;
+    uint32_t n = 0;
 
-/*
- * de-initialize of BPM detetion algorithm
- *
- * PARAMETERS:
- *     None
- *
- * RETURN VALUES:
- *     None
- *
- * REMARKS:
- *     Call this function if you do not need the BPM detection algorythm
- *
- */
-void BPM_release(void) {
-    free_internal_mem();
+    while (n < max && bt->queue_tail != bt->queue_head) {
+        beats[n++] = bt->queue[bt->queue_tail++ & (BPM_BEAT_QUEUE - 1)];
+    }
+
+    return n;
 }
 
+int bpm_detector_get_grid(const bpm_detector_t *det, struct bpm_beat_grid *grid) {
+    const struct beat_tracker_t *bt = &det->beat;
 
+    if (bt->beats == 0) {
+        return -1;
+    }
+
+    grid->beat      = beat_position(det, bt->last_beat);
+    grid->period    = (uint32_t)(bt->period * det->beat_decimate
+                                 * det->params.fft_points * 256.0f + 0.5f);
+
+    return 0;
+}
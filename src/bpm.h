@@ -10,6 +10,9 @@
  *
  * ChangeList:
  * Created in 2013-08-29 by Lipeng;
+ * Re-entrant detector object in 2026-10-19;
+ * Beat tracking in 2026-10-19;
+ * Analysis parameters per detector in 2026-10-19;
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -30,29 +33,131 @@
 #ifndef _BPM_H_
 #define _BPM_H_
 
-#include "main.h"
+#include <stdint.h>
 
 /*
- * initialize of BPM detetion algorithm
+ * One detector holds all the state of one analysis, so several of
+ * them can run at the same time, e.g. on the playing track and on the
+ * prefetched one. The memory is sized at init and never reallocated.
+ */
+typedef struct bpm_detector bpm_detector_t;
+
+/* most subbands a detector can analyse */
+#define BPM_MAX_SUBBANDS        16
+
+/*
+ * the analysis of a detector
+ *
+ * The energy of fft_points samples (one hop) is split into subbands;
+ * each subband correlates window ms of its energies with the ones one
+ * beat later, for every BPM of min_bpm .. max_bpm. After a pass that
+ * found a BPM in range, overlap_success ms of energies are kept for the
+ * next one, overlap_fail ms after a pass that did not.
+ *
+ * The kick of many tracks is on every other beat, so the half tempo
+ * often correlates best. With octave set, a pass takes twice its BPM
+ * when the correlation there is at least octave % of the best one.
+ *
+ * More subbands and a longer window do not make the BPM more accurate,
+ * the half tempo wins more often with them. The memory grows with the
+ * sample rate, the window and the longest beat period (min_bpm).
+ */
+struct bpm_detector_params {
+    uint16_t    fft_points;         /* power of 2, 16 .. 1024 */
+    uint16_t    subbands;           /* 1 .. BPM_MAX_SUBBANDS, divides fft_points / 2 */
+    uint16_t    window;             /* ms, 100 .. 8000 */
+    uint16_t    min_bpm;            /* 30 .. max_bpm */
+    uint16_t    max_bpm;            /* .. 300 */
+    uint16_t    overlap_success;    /* ms */
+    uint16_t    overlap_fail;       /* ms */
+    uint16_t    octave;             /* %, 0 .. 100, 0 never doubles */
+};
+
+enum {
+    /* small enough for the playback tap, 42 KB at 48 kHz (22 KB fixed point) */
+    BPM_PRESET_DEVICE = 0,
+
+    /*
+     * the device analysis that also looks one octave up, for the host
+     * tools until its cycles in the playback tap are measured
+     */
+    BPM_PRESET_ACCURATE,
+
+    BPM_PRESETS
+};
+
+/*
+ * get the parameters of a preset
+ *
+ * RETURN VALUES:
+ *     the parameters, NULL if preset is unknown
+ */
+const struct bpm_detector_params *bpm_detector_preset(int preset);
+
+/*
+ * get the memory needed by a detector
  *
  * PARAMETERS:
+ *     params
+ *         The analysis, NULL for BPM_PRESET_DEVICE.
+ *
  *     sample_rate
- *         Sample rate. Optimized for sample rate 44100 Hz.
+ *         Sample rate.
+ *
+ * RETURN VALUES:
+ *     size in bytes for bpm_detector_init(), 0 if params or
+ *     sample_rate are invalid
+ */
+uint32_t bpm_detector_mem_size(const struct bpm_detector_params *params,
+                               uint32_t sample_rate);
+
+/*
+ * initialize a detector in memory provided by the caller
+ *
+ * PARAMETERS:
+ *     mem, size
+ *         Memory of at least bpm_detector_mem_size() bytes, 8-byte
+ *         aligned. It must stay valid while the detector is used.
+ *
+ *     params
+ *         The analysis, NULL for BPM_PRESET_DEVICE. It is copied.
+ *
+ *     sample_rate
+ *         Sample rate.
  *
  *     channel
  *         Number of channels. Stereo is converted to mono.
  *
  * RETURN VALUES:
- *     0    - all OK, class initialized
- *     -1   - memory allocation error
+ *     the detector, NULL if the parameters or size are invalid
  *
  * REMARKS:
- *     Call this function before you put samples.
- *     Also call this function before processing new song
- *     to clear internal buffers and initialize all to starting positions.
+ *     The whole frequency range is analysed, see bpm_detector_set_freq_band().
+ *     Such a detector needs no bpm_detector_destroy().
+ */
+bpm_detector_t *bpm_detector_init(void *mem, uint32_t size,
+                                  const struct bpm_detector_params *params,
+                                  uint32_t sample_rate, uint32_t channel);
+
+/*
+ * allocate and initialize a detector
  *
+ * RETURN VALUES:
+ *     the detector, NULL if the parameters are invalid or out of memory
+ */
+bpm_detector_t *bpm_detector_create(const struct bpm_detector_params *params,
+                                    uint32_t sample_rate, uint32_t channel);
+
+/*
+ * release a detector returned by bpm_detector_create()
  */
-int BPM_init(u32 sample_rate, u32 channel);
+void bpm_detector_destroy(bpm_detector_t *det);
+
+/*
+ * clear the detector before processing a new song
+ * of the same sample rate and channels
+ */
+void bpm_detector_reset(bpm_detector_t *det);
 
 /*
  * set the range of frequency band
@@ -70,25 +175,16 @@ int BPM_init(u32 sample_rate, u32 channel);
  *     none
  *
  */
-int BPM_set_freq_band(u32 low_limit, u32 high_limit);
-
-
+int bpm_detector_set_freq_band(bpm_detector_t *det,
+                               uint32_t low_limit, uint32_t high_limit);
 
 /*
  * get number of samples needed for put_samples function.
  *
- * PARAMETERS:
- *     None
- *
  * RETURN VALUES:
- *     number of samples needed for BPM_put_samples function.
- *
- * REMARKS:
- *     Use this function to get number of samples you need
- *     to feed with BOM_put_samples function
- *
+ *     number of samples (per channel) needed for bpm_detector_put_samples().
  */
-u32 BPM_num_of_samples(void);
+uint32_t bpm_detector_num_of_samples(const bpm_detector_t *det);
 
 /*
  * put samples into processing
@@ -98,26 +194,22 @@ u32 BPM_num_of_samples(void);
  *         Pointer to buffer with samples. Supports only 16 bit samples
  *
  *     sample_num
- *         Number of samples in buffer.
+ *         Number of samples in buffer, bpm_detector_num_of_samples().
  *
  * RETURN VALUES:
- *     0    - detecting is done, we have BPM, we don't need more data.
- *     -1   - we need more data to detect BPM
+ *     1    - detecting is done, we have BPM, we don't need more data.
+ *     0    - we need more data to detect BPM
  *
  * REMARKS:
- *     Call this function with new samples until function returns 0
+ *     Call this function with new samples until function returns 1
  *     or you are out of data.
- *     If function returns 1, detection is done and we have BPM value,
- *     so we don't need more data.
  */
-int BPM_put_samples(short *samples, u32 sample_num);
+int bpm_detector_put_samples(bpm_detector_t *det,
+                             const short *samples, uint32_t sample_num);
 
 /*
  * get BPM value
  *
- * PARAMETERS:
- *     None
- *
  * RETURN VALUES:
  *     BPM value.
  *     This value can be 0 if detection fails or song has no beat.
@@ -126,21 +218,46 @@ int BPM_put_samples(short *samples, u32 sample_num);
  *     There can be case that class can't detect beat value.
  *     Maybe is song too short, or has no beat, or is too much noise
  */
-u32 BPM_get_bpm(void); 
+uint32_t bpm_detector_get_bpm(const bpm_detector_t *det);
+
+/*
+ * Beat positions. The detector also tracks the beat phase from the
+ * onsets of the analysed subbands, for as long as samples are put,
+ * including after bpm_detector_put_samples() has returned 1.
+ * A beat is final about a quarter of a beat period after it passed,
+ * plus one onset frame of about 256 samples.
+ */
 
 /*
- * de-initialize of BPM detetion algorithm
+ * get the beats found since the last call
  *
  * PARAMETERS:
- *     None
+ *     beats, max
+ *         Array for the positions, in samples (per channel) from the
+ *         first sample put after init or reset.
  *
  * RETURN VALUES:
- *     None
- *
- * REMARKS:
- *     Call this function if you do not need the BPM detection algorythm
+ *     number of beats written. At most 16 are kept between two calls,
+ *     older ones are lost.
+ */
+uint32_t bpm_detector_get_beats(bpm_detector_t *det,
+                                uint32_t *beats, uint32_t max);
+
+/*
+ * the beat grid, compact enough to store with the track
+ */
+struct bpm_beat_grid {
+    uint32_t    beat;           /* position of the last beat, in samples */
+    uint32_t    period;         /* beat period in samples, Q24.8 */
+};
+
+/*
+ * get the current beat grid
  *
+ * RETURN VALUES:
+ *     0    - grid is valid
+ *     -1   - no beat found yet
  */
-void BPM_release(void);
+int bpm_detector_get_grid(const bpm_detector_t *det, struct bpm_beat_grid *grid);
 
 #endif
@@ -0,0 +1,60 @@
+/*
+ *  Name:    bpm_index.h
+ *
+ *  Purpose: the format of the BPM index written by tools/bpmscan
+ *
+ */
+
+#ifndef _BPM_INDEX_H_
+#define _BPM_INDEX_H_
+
+#include <stdint.h>
+
+#include "bpm.h"
+
+/*
+ * The index is analysed on a PC and copied to the root of the stick,
+ * so the player knows the BPM, duration and beat grid of a track
+ * without decoding it.
+ *
+ * Layout, all fields little endian:
+ *     struct bpm_index_header
+ *     struct bpm_index_record     count times, sorted by path
+ *     string table                strings_size bytes of '\0' ended paths
+ *
+ * The paths are the ones the player opens, from the root of the stick
+ * and starting with '/', e.g. "/album/track.mp3". The records are
+ * sorted by strcmp() of their paths, so a track is found by bisection.
+ */
+#define BPM_INDEX_NAME          "/bpm.idx"
+
+#define BPM_INDEX_MAGIC         0x494d5042      /* "BPMI" */
+#define BPM_INDEX_VERSION       1
+
+/* bpm_index_record.flags */
+#define BPM_INDEX_HAS_BPM       0x01            /* bpm is valid */
+#define BPM_INDEX_HAS_GRID      0x02            /* grid is valid */
+#define BPM_INDEX_GAPLESS       0x04            /* duration from the LAME tag */
+#define BPM_INDEX_ERROR         0x80            /* the file could not be decoded */
+
+struct bpm_index_header {
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    record_size;            /* sizeof(struct bpm_index_record) */
+    uint32_t    count;                  /* number of records */
+    uint32_t    strings_size;           /* bytes of the string table */
+};
+
+struct bpm_index_record {
+    uint32_t    path;                   /* offset of the path in the string table */
+    uint32_t    duration;               /* playable samples per channel */
+    uint32_t    sample_rate;            /* Hz, 0 if unknown */
+    uint16_t    bpm;                    /* 0 if no beat was found */
+    uint8_t     channels;
+    uint8_t     flags;                  /* BPM_INDEX_xxx */
+
+    /* beat grid, in samples from the first playable sample */
+    struct bpm_beat_grid    grid;
+};
+
+#endif
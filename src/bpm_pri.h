@@ -6,6 +6,8 @@
  *
  * ChangeList:
  * Created in 2013-08-29 by Lipeng;
+ * Own integer types in 2026-10-19;
+ * Fixed point option in 2026-10-19;
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -26,13 +28,31 @@
 #ifndef _BPM_PRI_H_
 #define _BPM_PRI_H_
 
+#include <stdint.h>
+
+/* bpm.c does not pull in the STM32 headers */
+typedef uint8_t                 u8;
+typedef uint16_t                u16;
+typedef uint32_t                u32;
+
 #define REAL_IS_FLOAT
 
+/*
+ * Define this (or pass -DBPM_FIXED_POINT) to run the analysis in
+ * integers: Q15 window and FFT, squared magnitudes as energies and
+ * 64-bit accumulators for the autocorrelation.
+ */
+/* #define BPM_FIXED_POINT */
+
 #ifdef REAL_IS_FLOAT
 	typedef float               REAL;
 
 	#define SIN(x)              sinf(x)
 	#define COS(x)              cosf(x)
+	#define LOG(x)              logf(x)
+	#define LOG2(x)             log2f(x)
+	#define EXP(x)              expf(x)
+	#define FABS(x)             fabsf(x)
 
 	#define CDFT_RECURSIVE_N    1024
 #endif
@@ -42,6 +62,10 @@
 
 	#define SIN(x)              sin(x)
 	#define COS(x)              cos(x)
+	#define LOG(x)              log(x)
+	#define LOG2(x)             log2(x)
+	#define EXP(x)              exp(x)
+	#define FABS(x)             fabs(x)
 
 	#define CDFT_RECURSIVE_N    512
 #endif
@@ -51,10 +75,24 @@
 
 	#define SIN(x)              sinl(x)
 	#define COS(x)              cosl(x)
+	#define LOG(x)              logl(x)
+	#define LOG2(x)             log2l(x)
+	#define EXP(x)              expl(x)
+	#define FABS(x)             fabsl(x)
 
 	#define CDFT_RECURSIVE_N    512
 #endif
 
+#ifdef BPM_FIXED_POINT
+	typedef uint32_t            ENERGY;
+	typedef uint64_t            ENERGY_SUM;     /* the bins of a subband */
+	typedef int64_t             CORRELATION;
+#else
+	typedef REAL                ENERGY;
+	typedef REAL                ENERGY_SUM;
+	typedef REAL                CORRELATION;
+#endif
+
 #define PI                      3.1415926535897932384626433832795029L
 #define PI2                     6.283185307179586476925286766559L
 
@@ -8,25 +8,34 @@
  *
  *  ChangeList:
  *  Created in 2013-06-20 by Lipeng;
+ *  Planned transforms in 2026-10-19;
+ *  Plans in caller memory in 2026-10-19;
  *
- *  This document and the information contained in it is confidential and 
- *  proprietary to Unication Co., Ltd. The reproduction or disclosure, in 
- *  whole or in part, to anyone outside of Unication Co., Ltd. without the 
- *  written approval of the President of Unication Co., Ltd., under a 
- *  Non-Disclosure Agreement, or to any employee of Unication Co., Ltd. who 
- *  has not previously obtained written authorization for access from the 
- *  individual responsible for the document, will have a significant 
- *  detrimental effect on Unication Co., Ltd. and is expressly prohibited. 
+ *  This document and the information contained in it is confidential and
+ *  proprietary to Unication Co., Ltd. The reproduction or disclosure, in
+ *  whole or in part, to anyone outside of Unication Co., Ltd. without the
+ *  written approval of the President of Unication Co., Ltd., under a
+ *  Non-Disclosure Agreement, or to any employee of Unication Co., Ltd. who
+ *  has not previously obtained written authorization for access from the
+ *  individual responsible for the document, will have a significant
+ *  detrimental effect on Unication Co., Ltd. and is expressly prohibited.
  */
 
-#include "fft.h"
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
-#define FFT_LEN         (256)
-#define FFT_HLEN        (128)
+#include "fft.h"
+
+#ifndef M_PI
+#define M_PI            3.14159265358979323846
+#endif
 
+/*========================================================
+ *          Private functions
+ *======================================================*/
 static inline complex_t complex_mul(complex_t a,
-                                      complex_t b) {
+                                    complex_t b) {
     complex_t  c;
     c.r = a.r * b.r - a.i * b.i;
     c.i = a.r * b.i + a.i * b.r;
@@ -35,16 +44,16 @@ static inline complex_t complex_mul(complex_t a,
 }
 
 static inline complex_t complex_add(complex_t a,
-                                      complex_t b) {
+                                    complex_t b) {
     complex_t  c;
     c.r = a.r + b.r;
     c.i = a.i + b.i;
 
     return (c);
 }
- 
+
 static inline complex_t complex_sub(complex_t a,
-                                      complex_t b) {
+                                    complex_t b) {
     complex_t  c;
     c.r = a.r - b.r;
     c.i = a.i - b.i;
@@ -52,77 +61,512 @@ static inline complex_t complex_sub(complex_t a,
     return (c);
 }
 
-void fft(complex_t *ptCompx_in, int len) {
-    int        i, k, j, loop;
-    int        loopCtl;                           /* use to control the number of loop */
-    int        NumCtl;                            /* control the number of series */
-    int        le, lei, ip, hlen; 
-    complex_t  tCompxU, tCompxW, tCompxT;           /* three struct of complex */
-    
-    /* initialization */
-    j  = 0;
-    hlen = len / 2;
-        
-    /* index calculation */
-    for (i = 0; i < len - 1; i++) {
-        if (i < j) {
-            tCompxT        = ptCompx_in[j];
-            ptCompx_in[j]  = ptCompx_in[i];
-            ptCompx_in[i]  = tCompxT;
+static inline int16_t q15_sat(int32_t x) {
+    if (x > 32767) {
+        return 32767;
+    } else if (x < -32768) {
+        return -32768;
+    }
+
+    return x;
+}
+
+/* the product of a Q15 value and a Q15 twiddle, still with 32-bit range */
+static inline int32_t q15_mul(int32_t a, int32_t b) {
+    return (a * b) >> 15;
+}
+
+/* W_len^k = exp(-2 pi i k / len) */
+static void fft_make_twiddles(complex_t *tw, complex_q15_t *tw_q15,
+                              int len, int count) {
+    int     k;
+    float   a;
+
+    for (k = 0; k < count; k++) {
+        a = -2.0f * (float)M_PI * k / len;
+
+        if (tw) {
+            tw[k].r = cosf(a);
+            tw[k].i = sinf(a);
         }
-            
-        k = hlen;               /* find the next reverse order of j */
-        while (k <= j) {        /* this mean the highest bit of j is 1 */
-            j = j - k;          /* change it to 0 */
-            k = k / 2;
+        if (tw_q15) {
+            tw_q15[k].r = q15_sat((int32_t)lrintf(cosf(a) * 32768.0f));
+            tw_q15[k].i = q15_sat((int32_t)lrintf(sinf(a) * 32768.0f));
         }
-        j = j + k;              /* change it from 0 to 1 */
     }
-        
-    /* calculation the number of loop */
-    loopCtl = len;
-    for (loop = 1; (loopCtl = loopCtl / 2) != 1; loop++) {
+}
+
+/* the plan and its tables live in one block, tables 8-byte aligned */
+#define FFT_ALIGN(x)    (((x) + 7) & ~7)
+
+static int fft_check_len(int len, int real) {
+    if (len < (real ? 4 : 2) || len > FFT_MAX_LEN || (len & (len - 1))) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int fft_plan_bytes(int n, int real, int flags) {
+    int     count = (3 * n) / 4 > 0 ? (3 * n) / 4 : 1;
+    int     size = FFT_ALIGN(sizeof(struct fft_plan));
+
+    if (flags & FFT_PLAN_FLOAT) {
+        size += FFT_ALIGN(count * sizeof(complex_t));
+        if (real) {
+            size += FFT_ALIGN(n * sizeof(complex_t));
+        }
+    }
+    if (flags & FFT_PLAN_Q15) {
+        size += FFT_ALIGN(count * sizeof(complex_q15_t));
+        if (real) {
+            size += FFT_ALIGN(n * sizeof(complex_q15_t));
+        }
+    }
+
+    return size + FFT_ALIGN(n * sizeof(uint16_t));
+}
+
+static struct fft_plan *fft_plan_build(void *mem, int len, int n, int real, int flags) {
+    struct fft_plan *plan = (struct fft_plan *)mem;
+    uint8_t         *p = (uint8_t *)mem + FFT_ALIGN(sizeof(struct fft_plan));
+    int             i, j, bits;
+    int             count = (3 * n) / 4 > 0 ? (3 * n) / 4 : 1;
+
+    memset(plan, 0, sizeof(struct fft_plan));
+
+    plan->len   = len;
+    plan->n     = n;
+    plan->real  = real;
+    plan->flags = flags;
+
+    for (bits = 0; (1 << bits) < n; bits++) {
         ;
     }
-        
-    /* fft */   
-    for (NumCtl = 1; NumCtl <= loop; NumCtl++) {
-        loop         =  log2(len);
-        le           = 2 << (NumCtl - 1);
-        lei          = le / 2;
-        tCompxU.r    = 1.0;
-        tCompxU.i    = 0;
-
-        tCompxW.r    = cos(M_PI / lei);
-        tCompxW.i    = 0 - sin(M_PI / lei);
-        
-        for (j = 0; j <= lei - 1; j++) {
-            for (i = j; i <= len - 1; i = i + le) {
-                ip                  = i + lei;
-                tCompxT             = complex_mul(ptCompx_in[ip], tCompxU);
-                ptCompx_in[ip]      = complex_sub(ptCompx_in[i], tCompxT);
-                ptCompx_in[i]       = complex_add(ptCompx_in[i], tCompxT);
+    plan->log2_n = bits;
+
+    if (flags & FFT_PLAN_FLOAT) {
+        plan->twiddle = (complex_t *)p;
+        p += FFT_ALIGN(count * sizeof(complex_t));
+        if (real) {
+            plan->rtwiddle = (complex_t *)p;
+            p += FFT_ALIGN(n * sizeof(complex_t));
+        }
+    }
+    if (flags & FFT_PLAN_Q15) {
+        plan->twiddle_q15 = (complex_q15_t *)p;
+        p += FFT_ALIGN(count * sizeof(complex_q15_t));
+        if (real) {
+            plan->rtwiddle_q15 = (complex_q15_t *)p;
+            p += FFT_ALIGN(n * sizeof(complex_q15_t));
+        }
+    }
+    plan->bitrev = (uint16_t *)p;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0, bits = 0; bits < plan->log2_n; bits++) {
+            j = (j << 1) | ((i >> bits) & 1);
+        }
+        plan->bitrev[i] = j;
+    }
+
+    fft_make_twiddles(plan->twiddle, plan->twiddle_q15, n, count);
+    if (real) {
+        fft_make_twiddles(plan->rtwiddle, plan->rtwiddle_q15, len, n);
+    }
+
+    return plan;
+}
+
+/*
+ * in place complex FFT of plan->n points, not scaled
+ *
+ * After the bit reversal, every pass combines four transforms of
+ * size l into one of size 4l. In bit-reversed order these four are
+ * the subsequences with index 0, 2, 1 and 3 mod 4.
+ */
+static void fft_run(const struct fft_plan *plan, complex_t *x) {
+    int         n = plan->n;
+    int         i, j, l, base, step;
+    complex_t   a, b, c, d, t0, t1, t2, t3;
+    complex_t   w1, w2, w3;
+
+    for (i = 0; i < n; i++) {
+        j = plan->bitrev[i];
+        if (i < j) {
+            a       = x[i];
+            x[i]    = x[j];
+            x[j]    = a;
+        }
+    }
+
+    l = 1;
+    if (plan->log2_n & 1) {
+        for (i = 0; i < n; i += 2) {
+            a           = x[i];
+            b           = x[i + 1];
+            x[i]        = complex_add(a, b);
+            x[i + 1]    = complex_sub(a, b);
+        }
+        l = 2;
+    }
+
+    for (; l < n; l *= 4) {
+        step = n / (4 * l);
+
+        for (j = 0; j < l; j++) {
+            w1 = plan->twiddle[j * step];
+            w2 = plan->twiddle[2 * j * step];
+            w3 = plan->twiddle[3 * j * step];
+
+            for (base = j; base < n; base += 4 * l) {
+                a = x[base];
+                b = complex_mul(x[base + l], w2);
+                c = complex_mul(x[base + 2 * l], w1);
+                d = complex_mul(x[base + 3 * l], w3);
+
+                t0 = complex_add(a, b);
+                t1 = complex_sub(a, b);
+                t2 = complex_add(c, d);
+                t3 = complex_sub(c, d);
+
+                x[base]             = complex_add(t0, t2);
+                x[base + 2 * l]     = complex_sub(t0, t2);
+
+                /* t1 -/+ i * t3 */
+                x[base + l].r       = t1.r + t3.i;
+                x[base + l].i       = t1.i - t3.r;
+                x[base + 3 * l].r   = t1.r - t3.i;
+                x[base + 3 * l].i   = t1.i + t3.r;
             }
-            tCompxU = complex_mul(tCompxU, tCompxW);
         }
     }
 }
 
-void ifft(complex_t *ptCompx_in, int len) {
+/* the same in Q15, each pass scales by 1/2 or 1/4, so the result is DFT / n */
+static void fft_run_q15(const struct fft_plan *plan, complex_q15_t *x) {
+    int             n = plan->n;
+    int             i, j, l, base, step;
+    complex_q15_t   tmp, w1, w2, w3;
+    int32_t         ar, ai, br, bi, cr, ci, dr, di;
+    int32_t         t0r, t0i, t1r, t1i, t2r, t2i, t3r, t3i;
+
+    for (i = 0; i < n; i++) {
+        j = plan->bitrev[i];
+        if (i < j) {
+            tmp     = x[i];
+            x[i]    = x[j];
+            x[j]    = tmp;
+        }
+    }
+
+    l = 1;
+    if (plan->log2_n & 1) {
+        for (i = 0; i < n; i += 2) {
+            ar = x[i].r;
+            ai = x[i].i;
+            br = x[i + 1].r;
+            bi = x[i + 1].i;
+
+            x[i].r      = (ar + br) >> 1;
+            x[i].i      = (ai + bi) >> 1;
+            x[i + 1].r  = (ar - br) >> 1;
+            x[i + 1].i  = (ai - bi) >> 1;
+        }
+        l = 2;
+    }
+
+    for (; l < n; l *= 4) {
+        step = n / (4 * l);
+
+        for (j = 0; j < l; j++) {
+            w1 = plan->twiddle_q15[j * step];
+            w2 = plan->twiddle_q15[2 * j * step];
+            w3 = plan->twiddle_q15[3 * j * step];
+
+            for (base = j; base < n; base += 4 * l) {
+                ar = x[base].r;
+                ai = x[base].i;
+
+                br = q15_mul(x[base + l].r, w2.r) - q15_mul(x[base + l].i, w2.i);
+                bi = q15_mul(x[base + l].r, w2.i) + q15_mul(x[base + l].i, w2.r);
+                cr = q15_mul(x[base + 2 * l].r, w1.r) - q15_mul(x[base + 2 * l].i, w1.i);
+                ci = q15_mul(x[base + 2 * l].r, w1.i) + q15_mul(x[base + 2 * l].i, w1.r);
+                dr = q15_mul(x[base + 3 * l].r, w3.r) - q15_mul(x[base + 3 * l].i, w3.i);
+                di = q15_mul(x[base + 3 * l].r, w3.i) + q15_mul(x[base + 3 * l].i, w3.r);
+
+                t0r = ar + br;
+                t0i = ai + bi;
+                t1r = ar - br;
+                t1i = ai - bi;
+                t2r = cr + dr;
+                t2i = ci + di;
+                t3r = cr - dr;
+                t3i = ci - di;
+
+                x[base].r           = q15_sat((t0r + t2r) >> 2);
+                x[base].i           = q15_sat((t0i + t2i) >> 2);
+                x[base + 2 * l].r   = q15_sat((t0r - t2r) >> 2);
+                x[base + 2 * l].i   = q15_sat((t0i - t2i) >> 2);
+                x[base + l].r       = q15_sat((t1r + t3i) >> 2);
+                x[base + l].i       = q15_sat((t1i - t3r) >> 2);
+                x[base + 3 * l].r   = q15_sat((t1r - t3i) >> 2);
+                x[base + 3 * l].i   = q15_sat((t1i + t3r) >> 2);
+            }
+        }
+    }
+}
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+int fft_plan_size(int len, int real, int flags) {
+    if (fft_check_len(len, real) < 0
+        || (flags & (FFT_PLAN_FLOAT | FFT_PLAN_Q15)) == 0) {
+        return 0;
+    }
+
+    return fft_plan_bytes(real ? len / 2 : len, real, flags);
+}
+
+struct fft_plan *fft_plan_init(void *mem, int len, int flags) {
+    if (mem == NULL || fft_plan_size(len, 0, flags) == 0) {
+        return NULL;
+    }
+
+    return fft_plan_build(mem, len, len, 0, flags);
+}
+
+struct fft_plan *fft_plan_init_real(void *mem, int len, int flags) {
+    if (mem == NULL || fft_plan_size(len, 1, flags) == 0) {
+        return NULL;
+    }
+
+    return fft_plan_build(mem, len, len / 2, 1, flags);
+}
+
+struct fft_plan *fft_plan_create(int len, int flags) {
+    int size = fft_plan_size(len, 0, flags);
+
+    if (size == 0) {
+        return NULL;
+    }
+
+    return fft_plan_init(malloc(size), len, flags);
+}
+
+struct fft_plan *fft_plan_create_real(int len, int flags) {
+    int size = fft_plan_size(len, 1, flags);
+
+    if (size == 0) {
+        return NULL;
+    }
+
+    return fft_plan_init_real(malloc(size), len, flags);
+}
+
+void fft_plan_delete(struct fft_plan *plan) {
+    free(plan);
+}
+
+void fft_forward(const struct fft_plan *plan, complex_t *data) {
+    fft_run(plan, data);
+}
+
+void fft_inverse(const struct fft_plan *plan, complex_t *data) {
+    int     i;
+    float   scale = 1.0f / plan->n;
+
+    /* ifft(x) = conj(fft(conj(x))) / n */
+    for (i = 0; i < plan->n; i++) {
+        data[i].i = -data[i].i;
+    }
+
+    fft_run(plan, data);
+
+    for (i = 0; i < plan->n; i++) {
+        data[i].r = data[i].r * scale;
+        data[i].i = -data[i].i * scale;
+    }
+}
+
+/*
+ * With z[k] = x[2k] + i x[2k+1] and Z = fft(z), for k <= n/2
+ *     E = (Z[k] + conj(Z[n-k])) / 2,  O = -i (Z[k] - conj(Z[n-k])) / 2
+ *     X[k] = E + W^k O,  X[n-k] = conj(E - W^k O)
+ */
+void fft_real_forward(const struct fft_plan *plan, const float *in, complex_t *out) {
+    int         n = plan->n;
+    int         k;
+    complex_t   zk, zm, e, o, t;
+
+    for (k = 0; k < n; k++) {
+        out[k].r = in[2 * k];
+        out[k].i = in[2 * k + 1];
+    }
+
+    fft_run(plan, out);
+
+    zk          = out[0];
+    out[0].r    = zk.r + zk.i;
+    out[0].i    = 0;
+    out[n].r    = zk.r - zk.i;
+    out[n].i    = 0;
+
+    for (k = 1; k <= n / 2; k++) {
+        zk = out[k];
+        zm = out[n - k];
+
+        e.r = 0.5f * (zk.r + zm.r);
+        e.i = 0.5f * (zk.i - zm.i);
+        o.r = 0.5f * (zk.i + zm.i);
+        o.i = 0.5f * (zm.r - zk.r);
+
+        t = complex_mul(o, plan->rtwiddle[k]);
+
+        out[k].r        = e.r + t.r;
+        out[k].i        = e.i + t.i;
+        out[n - k].r    = e.r - t.r;
+        out[n - k].i    = t.i - e.i;
+    }
+}
+
+/*
+ * The other way round
+ *     E = (X[k] + conj(X[n-k])) / 2,  O = (X[k] - conj(X[n-k])) / 2 * W^-k
+ *     Z[k] = E + i O,  Z[n-k] = conj(E) + i conj(O)
+ */
+void fft_real_inverse(const struct fft_plan *plan, complex_t *in, float *out) {
+    int         n = plan->n;
+    int         k;
+    complex_t   xk, xm, e, o, d, w;
+
+    xk          = in[0];
+    xm          = in[n];
+    in[0].r     = 0.5f * (xk.r + xm.r);
+    in[0].i     = 0.5f * (xk.r - xm.r);
+
+    for (k = 1; k <= n / 2; k++) {
+        xk = in[k];
+        xm = in[n - k];
+
+        e.r = 0.5f * (xk.r + xm.r);
+        e.i = 0.5f * (xk.i - xm.i);
+        d.r = 0.5f * (xk.r - xm.r);
+        d.i = 0.5f * (xk.i + xm.i);
+
+        w.r = plan->rtwiddle[k].r;
+        w.i = -plan->rtwiddle[k].i;
+        o   = complex_mul(d, w);
+
+        in[k].r     = e.r - o.i;
+        in[k].i     = e.i + o.r;
+        in[n - k].r = e.r + o.i;
+        in[n - k].i = o.r - e.i;
+    }
+
+    fft_inverse(plan, in);
+
+    for (k = 0; k < n; k++) {
+        out[2 * k]      = in[k].r;
+        out[2 * k + 1]  = in[k].i;
+    }
+}
+
+void fft_forward_q15(const struct fft_plan *plan, complex_q15_t *data) {
+    fft_run_q15(plan, data);
+}
+
+void fft_inverse_q15(const struct fft_plan *plan, complex_q15_t *data) {
     int i;
-    float tmp;
-    
-    for (i = 0; i < len; i++) {
-        tmp = ptCompx_in[i].r;
-        ptCompx_in[i].r = ptCompx_in[i].i;
-        ptCompx_in[i].i = tmp;
+
+    for (i = 0; i < plan->n; i++) {
+        data[i].i = q15_sat(-data[i].i);
+    }
+
+    fft_run_q15(plan, data);
+
+    for (i = 0; i < plan->n; i++) {
+        data[i].i = q15_sat(-data[i].i);
+    }
+}
+
+/* as fft_real_forward(), with one more halving to scale by 1 / len */
+void fft_real_forward_q15(const struct fft_plan *plan, const int16_t *in, complex_q15_t *out) {
+    int             n = plan->n;
+    int             k;
+    complex_q15_t   zk, zm, w;
+    int32_t         er, ei, or_, oi, tr, ti;
+
+    for (k = 0; k < n; k++) {
+        out[k].r = in[2 * k];
+        out[k].i = in[2 * k + 1];
+    }
+
+    fft_run_q15(plan, out);
+
+    zk          = out[0];
+    out[0].r    = ((int32_t)zk.r + zk.i) >> 1;
+    out[0].i    = 0;
+    out[n].r    = ((int32_t)zk.r - zk.i) >> 1;
+    out[n].i    = 0;
+
+    for (k = 1; k <= n / 2; k++) {
+        zk  = out[k];
+        zm  = out[n - k];
+        w   = plan->rtwiddle_q15[k];
+
+        /* E and O at half scale */
+        er  = ((int32_t)zk.r + zm.r) >> 1;
+        ei  = ((int32_t)zk.i - zm.i) >> 1;
+        or_ = ((int32_t)zk.i + zm.i) >> 1;
+        oi  = ((int32_t)zm.r - zk.r) >> 1;
+
+        tr  = q15_mul(or_, w.r) - q15_mul(oi, w.i);
+        ti  = q15_mul(or_, w.i) + q15_mul(oi, w.r);
+
+        out[k].r        = q15_sat((er + tr) >> 1);
+        out[k].i        = q15_sat((ei + ti) >> 1);
+        out[n - k].r    = q15_sat((er - tr) >> 1);
+        out[n - k].i    = q15_sat((ti - ei) >> 1);
+    }
+}
+
+void fft_real_inverse_q15(const struct fft_plan *plan, complex_q15_t *in, int16_t *out) {
+    int             n = plan->n;
+    int             k;
+    complex_q15_t   xk, xm, w;
+    int32_t         er, ei, dr, di, or_, oi;
+
+    xk          = in[0];
+    xm          = in[n];
+    in[0].r     = ((int32_t)xk.r + xm.r) >> 1;
+    in[0].i     = ((int32_t)xk.r - xm.r) >> 1;
+
+    for (k = 1; k <= n / 2; k++) {
+        xk  = in[k];
+        xm  = in[n - k];
+        w   = plan->rtwiddle_q15[k];
+
+        er  = ((int32_t)xk.r + xm.r) >> 1;
+        ei  = ((int32_t)xk.i - xm.i) >> 1;
+        dr  = ((int32_t)xk.r - xm.r) >> 1;
+        di  = ((int32_t)xk.i + xm.i) >> 1;
+
+        /* O = D * conj(W) */
+        or_ = q15_mul(dr, w.r) + q15_mul(di, w.i);
+        oi  = q15_mul(di, w.r) - q15_mul(dr, w.i);
+
+        in[k].r     = q15_sat(er - oi);
+        in[k].i     = q15_sat(ei + or_);
+        in[n - k].r = q15_sat(er + oi);
+        in[n - k].i = q15_sat(or_ - ei);
     }
 
-    fft(ptCompx_in, len);
+    fft_inverse_q15(plan, in);
 
-    for (i = 0; i < len; i++) {
-        tmp = ptCompx_in[i].r;
-        ptCompx_in[i].r = ptCompx_in[i].i / len;
-        ptCompx_in[i].i = tmp / len;
+    for (k = 0; k < n; k++) {
+        out[2 * k]      = in[k].r;
+        out[2 * k + 1]  = in[k].i;
     }
 }
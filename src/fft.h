@@ -8,39 +8,119 @@
  *
  *  ChangeList:
  *  Created in 2013-06-20 by Lipeng;
+ *  Planned transforms in 2026-10-19;
+ *  Plans in caller memory in 2026-10-19;
  *
- *  This document and the information contained in it is confidential and 
- *  proprietary to Unication Co., Ltd. The reproduction or disclosure, in 
- *  whole or in part, to anyone outside of Unication Co., Ltd. without the 
- *  written approval of the President of Unication Co., Ltd., under a 
- *  Non-Disclosure Agreement, or to any employee of Unication Co., Ltd. who 
- *  has not previously obtained written authorization for access from the 
- *  individual responsible for the document, will have a significant 
- *  detrimental effect on Unication Co., Ltd. and is expressly prohibited. 
+ *  This document and the information contained in it is confidential and
+ *  proprietary to Unication Co., Ltd. The reproduction or disclosure, in
+ *  whole or in part, to anyone outside of Unication Co., Ltd. without the
+ *  written approval of the President of Unication Co., Ltd., under a
+ *  Non-Disclosure Agreement, or to any employee of Unication Co., Ltd. who
+ *  has not previously obtained written authorization for access from the
+ *  individual responsible for the document, will have a significant
+ *  detrimental effect on Unication Co., Ltd. and is expressly prohibited.
  */
 #ifndef _FFT_H_
 #define _FFT_H_
 
+#include <stdint.h>
+
 typedef struct {
     float   r;
     float   i;
 } complex_t;
 
+typedef struct {
+    int16_t r;
+    int16_t i;
+} complex_q15_t;
+
+/* tables to build for fft_plan_create() */
+#define FFT_PLAN_FLOAT      0x01
+#define FFT_PLAN_Q15        0x02
+
+/* the largest transform, the bit-reverse table is 16-bit */
+#define FFT_MAX_LEN         32768
+
+/*
+ * A plan holds the twiddle and bit-reverse tables of one transform
+ * size, so a transform only does the butterflies. Create it once and
+ * use it for every block. The butterflies are radix-4, with one
+ * radix-2 pass when log2 of the size is odd.
+ *
+ * A real plan of len points runs a len / 2 point complex FFT on the
+ * samples packed in pairs, and splits the result into len / 2 + 1 bins.
+ */
+struct fft_plan {
+    int             len;            /* points of the transform */
+    int             n;              /* points of the complex FFT */
+    int             log2_n;
+    int             real;
+    int             flags;
+
+    uint16_t        *bitrev;        /* n entries */
+
+    /* W_n^k, k < 3n/4 */
+    complex_t       *twiddle;
+    complex_q15_t   *twiddle_q15;
+
+    /* W_len^k, k < len/2, real plans only */
+    complex_t       *rtwiddle;
+    complex_q15_t   *rtwiddle_q15;
+};
 
 /*
  * Purpose:
- *                     To fft (reference to the book - "the principle and application of DSP chip")
+ *       create the plan of a complex (fft_plan_create) or real
+ *       (fft_plan_create_real) transform
  * Input:
- *       *ptCompx_in    a complex group input this function, and after fft it will change
- *       len            the number of fft points
- *
- * Output:
- *               None
+ *       len            the number of points, a power of 2 up to FFT_MAX_LEN,
+ *                      at least 2 for complex and 4 for real transforms
+ *       flags          FFT_PLAN_FLOAT and/or FFT_PLAN_Q15
  * Return:
- *
- * None
+ *       the plan, NULL if len is invalid or out of memory
+ */
+struct fft_plan *fft_plan_create(int len, int flags);
+struct fft_plan *fft_plan_create_real(int len, int flags);
+void fft_plan_delete(struct fft_plan *plan);
+
+/*
+ * Plans in caller memory, for users that must not allocate.
+ * fft_plan_size() returns the bytes a complex (real = 0) or real
+ * (real = 1) plan needs, 0 if len or flags are invalid.
+ * fft_plan_init()/fft_plan_init_real() build the plan in mem, which
+ * must be 8-byte aligned and stay valid while the plan is used.
+ * Such a plan is not passed to fft_plan_delete().
+ */
+int fft_plan_size(int len, int real, int flags);
+struct fft_plan *fft_plan_init(void *mem, int len, int flags);
+struct fft_plan *fft_plan_init_real(void *mem, int len, int flags);
+
+/*
+ * Complex transforms, in place on plan->len points.
+ * The forward transform is not scaled, the inverse one divides by len.
+ */
+void fft_forward(const struct fft_plan *plan, complex_t *data);
+void fft_inverse(const struct fft_plan *plan, complex_t *data);
+
+/*
+ * Real transforms.
+ * fft_real_forward() takes plan->len samples and writes the bins
+ * 0 .. len/2 to out, the imaginary parts of bin 0 and len/2 are 0.
+ * fft_real_inverse() takes these len/2 + 1 bins, which it overwrites,
+ * and writes len samples.
+ */
+void fft_real_forward(const struct fft_plan *plan, const float *in, complex_t *out);
+void fft_real_inverse(const struct fft_plan *plan, complex_t *in, float *out);
+
+/*
+ * Q15 variants. Every pass scales down to avoid overflow, so the
+ * forward transforms give DFT / len, and a forward/inverse round trip
+ * gives the input divided by len.
  */
-void fft(complex_t *ptCompx_in, int len);
-void ifft(complex_t *ptCompx_in, int len);
+void fft_forward_q15(const struct fft_plan *plan, complex_q15_t *data);
+void fft_inverse_q15(const struct fft_plan *plan, complex_q15_t *data);
+void fft_real_forward_q15(const struct fft_plan *plan, const int16_t *in, complex_q15_t *out);
+void fft_real_inverse_q15(const struct fft_plan *plan, complex_q15_t *in, int16_t *out);
 
 #endif
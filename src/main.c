@@ -19,20 +19,51 @@
  *  detrimental effect on Unication Co., Ltd. and is expressly prohibited. 
  *  
  */
+#include <stdio.h>
 #include <string.h>
 
 #include "main.h"
 #include "core_cm4.h"
 #include "stm32f4xx_conf.h"
-#include "Audio.h"
 #include "mp3dec.h"
 #include "mp3.h"
+#include "resample.h"
+#include "audio_sink.h"
 
 /*========================================================
  *                  Macros, Variables
  *======================================================*/
 #define BUTTON			    (GPIOA->IDR & GPIO_Pin_0)
 
+/*
+ * 0 switches the I2S clock to the sample rate of each file,
+ * otherwise every file is resampled to this rate
+ */
+#define OUTPUT_SAMPLE_RATE	    0
+
+/* the layout the decoder writes by default, MP3_OUTPUT_STEREO */
+#define OUTPUT_CHANNELS         2
+
+/*
+ * The tempo of the playing track is analysed while it is decoded,
+ * in the core coupled memory which nothing else uses (the DMA can
+ * not reach it, but the tap is CPU only). Only the playing decoder
+ * decodes, so the queued one can be given the same memory.
+ */
+#define BPM_TAP_MEM             ((void *)CCMDATARAM_BASE)
+#define BPM_TAP_MEM_SZ          (64 * 1024)
+
+/* detector hops per frame, a bit more than the 18 of a 44.1 kHz frame */
+#define BPM_TAP_HOPS            24
+
+/* the output statistics are printed to USART2 (PA2) at this rate */
+#define REPORT_BAUD             115200
+
+/* the cycle counter of the core, the CMSIS here has no DWT */
+#define DWT_CTRL                (*(volatile uint32_t *)0xE0001000)
+#define DWT_CYCCNT              (*(volatile uint32_t *)0xE0001004)
+#define DWT_CTRL_CYCCNTENA      (1UL << 0)
+
 USB_OTG_CORE_HANDLE         USB_OTG_Core;
 USBH_HOST                   USB_Host;
 volatile int			    enum_done = 0;
@@ -42,21 +73,19 @@ static RCC_ClocksTypeDef    RCC_Clocks;
 
 static FIL                  file;
 
-static volatile uint8_t     audio_is_playing = 0;
+/* the playing track and the one queued behind it */
+static FIL                  play_files[2];
+
+static struct audio_sink    *sink;
 
 /* just for test */
-extern float                cur_ratio;
+static float                test_speed = 1;
 static uint16_t             cur_bpm = 0;
 
 /*========================================================
  *          Private functions
  *======================================================*/
 
-/* Called by the audio driver when its DMA complete */
-static void AudioCallback(void) {
-    audio_is_playing = 0;
-}
-
 /* MP3 file read, provided to MP3 decoder */
 static uint32_t fd_fetch(void *parameter, uint8_t *buffer, uint32_t length) {
     uint32_t read_bytes = 0;
@@ -67,6 +96,42 @@ static uint32_t fd_fetch(void *parameter, uint8_t *buffer, uint32_t length) {
     return read_bytes;
 }
 
+/* the cycle counter, the ticks of the output deadline statistics */
+static uint32_t cycle_ticks(void) {
+    return DWT_CYCCNT;
+}
+
+static void report_init(void) {
+	GPIO_InitTypeDef    GPIO_InitStructure;
+	USART_InitTypeDef   USART_InitStructure;
+
+	RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOA, ENABLE);
+	RCC_APB1PeriphClockCmd(RCC_APB1Periph_USART2, ENABLE);
+
+	/* PA2 is TX, nothing is read */
+	GPIO_PinAFConfig(GPIOA, GPIO_PinSource2, GPIO_AF_USART2);
+	GPIO_InitStructure.GPIO_Pin     = GPIO_Pin_2;
+	GPIO_InitStructure.GPIO_Mode    = GPIO_Mode_AF;
+	GPIO_InitStructure.GPIO_OType   = GPIO_OType_PP;
+	GPIO_InitStructure.GPIO_Speed   = GPIO_Speed_50MHz;
+	GPIO_InitStructure.GPIO_PuPd    = GPIO_PuPd_UP;
+	GPIO_Init(GPIOA, &GPIO_InitStructure);
+
+	USART_InitStructure.USART_BaudRate              = REPORT_BAUD;
+	USART_InitStructure.USART_WordLength            = USART_WordLength_8b;
+	USART_InitStructure.USART_StopBits              = USART_StopBits_1;
+	USART_InitStructure.USART_Parity                = USART_Parity_No;
+	USART_InitStructure.USART_HardwareFlowControl   = USART_HardwareFlowControl_None;
+	USART_InitStructure.USART_Mode                  = USART_Mode_Tx;
+	USART_Init(USART2, &USART_InitStructure);
+	USART_Cmd(USART2, ENABLE);
+
+	/* start the cycle counter */
+	CoreDebug->DEMCR    |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT_CYCCNT          = 0;
+	DWT_CTRL            |= DWT_CTRL_CYCCNTENA;
+}
+
 /*
  * bpm detect
  */
@@ -91,12 +156,8 @@ static void mp3_get_bpm(char* filename) {
             mp3_decoder_delete(decoder);
         }
         
-        /* Re-initialize and set volume to avoid noise */
-        InitializeAudio(Audio44100HzSettings);
-        SetAudioVolume(0);
-        
-        /* reset the playing flag */
-        audio_is_playing = 0;
+        /* stop the output, to avoid noise */
+        audio_sink_close(sink);
 
         /* Close currently open file */
         f_close(&file);
@@ -109,49 +170,69 @@ static void mp3_get_bpm(char* filename) {
 static uint32_t mp3_callback(MP3FrameInfo *header,
                              int16_t *buffer,
                              uint32_t length) {
-    while (audio_is_playing == 1);
+    /* (re)start the output at the sample rate of this buffer */
+    if ((uint32_t)header->samprate != sink->rate
+        && audio_sink_open(sink, header->samprate, OUTPUT_CHANNELS) != 0
+        && sink->rate == 0) {
+        /* no PLL setting for this rate, play it too fast or too slow */
+        audio_sink_open(sink, 44100, OUTPUT_CHANNELS);
+    }
 
-    audio_is_playing = 1;
-    ProvideAudioBuffer(buffer, length);
+    /* waits for the buffer before, the decoder has two */
+    audio_sink_submit(sink, buffer, length / OUTPUT_CHANNELS);
 
     return 0;
 }
 
-static void play_mp3(char* filename) {
-    struct mp3_decoder *decoder;
+/* Called by the decoder when the tempo of the track is known */
+static void bpm_callback(struct mp3_decoder *decoder, uint32_t bpm) {
+    (void)decoder;
 
-	if (FR_OK == f_open(&file, filename, FA_OPEN_EXISTING | FA_READ)) {
-		/* Play mp3 */
+    cur_bpm = bpm;
+}
 
-		InitializeAudio(Audio44100HzSettings);
-		SetAudioVolume(0xAF);
-		PlayAudioWithCallback(AudioCallback);
+/*
+ * open a file and get its decoder ready to play
+ */
+static struct mp3_decoder *mp3_open(FIL *fp, const char *filename) {
+    struct mp3_decoder *decoder;
 
-        decoder = mp3_decoder_create();
-        if (decoder != NULL) {
-            decoder->fetch_data         = fd_fetch;
-            decoder->fetch_parameter    = (void *)&file;
-            decoder->output_cb          = mp3_callback;
+	if (FR_OK != f_open(fp, filename, FA_OPEN_EXISTING | FA_READ)) {
+        return NULL;
+    }
 
-            //while (mp3_decoder_run(decoder) != -1);
-            while (mp3_decoder_run_pvc(decoder) != -1);
+    decoder = mp3_decoder_create();
+    if (decoder != NULL) {
+        decoder->fetch_data         = fd_fetch;
+        decoder->fetch_parameter    = (void *)fp;
+        decoder->output_cb          = mp3_callback;
 
-            /* delete decoder object */
-            mp3_decoder_delete(decoder);
+        mp3_decoder_set_rate(decoder, OUTPUT_SAMPLE_RATE, RESAMPLER_TAPS_MEDIUM);
+        mp3_decoder_set_bpm_tap(decoder, BPM_TAP_MEM, BPM_TAP_MEM_SZ,
+                                BPM_TAP_HOPS, bpm_callback);
+
+        /* read ahead, so the track starts without waiting for the disk */
+        if (mp3_decoder_prefetch(decoder) == 0) {
+            return decoder;
         }
-        
-        /* Re-initialize and set volume to avoid noise */
-        InitializeAudio(Audio44100HzSettings);
-        SetAudioVolume(0);
-        
-        /* reset the playing flag */
-        audio_is_playing = 0;
 
-        /* Close currently open file */
-        f_close(&file);
+        mp3_decoder_delete(decoder);
     }
+
+    f_close(fp);
+
+    return NULL;
 }
 
+static void mp3_close(struct mp3_decoder *decoder) {
+    FIL *fp = (FIL *)decoder->fetch_parameter;
+
+    /* delete decoder object */
+    mp3_decoder_delete(decoder);
+
+    /* Close currently open file */
+    f_close(fp);
+}
 
 /*
  * play directory
@@ -162,10 +243,16 @@ static const char *get_filename_ext(const char *filename) {
     return dot + 1;
 }
 
-static FRESULT play_directory (const char* path, unsigned char seek) {
+/*
+ * open the next mp3 file of the directory
+ *
+ * ret: its decoder, NULL at the end of the directory
+ */
+static struct mp3_decoder *open_next_mp3(DIR *dir, const char *path,
+                                         unsigned char *seek, FIL *fp) {
 	FRESULT     res;
 	FILINFO     fno;
-	DIR         dir;
+    struct mp3_decoder *decoder;
 
     /* This function is assuming non-Unicode cfg. */
 	char        *fn; 
@@ -177,47 +264,102 @@ static FRESULT play_directory (const char* path, unsigned char seek) {
 	fno.lfsize  = sizeof(lfn);
 #endif
 
+	for (;;) {
+        /* Read a directory item */
+		res = f_readdir(dir, &fno); 
 
-	res = f_opendir(&dir, path);
-	if (res == FR_OK) {
-		for (;;) {
-            /* Read a directory item */
-			res = f_readdir(&dir, &fno); 
-
-            /* Break on error or end of dir */
-			if (res != FR_OK || fno.fname[0] == 0) break; 
-
-            /* Ignore dot entry */
-			if (fno.fname[0] == '.') continue; 
-
-        #if _USE_LFN
-			fn = *fno.lfname ? fno.lfname : fno.fname;
-        #else
-			fn = fno.fname;
-        #endif
-			if (fno.fattrib & AM_DIR) {
-                /* It is a directory */
-
-			} else {
-                /* It is a file. */
-				sprintf(buffer, "%s/%s", path, fn);
-
-				/* Check if it is an mp3 file */
-				if (strcmp("mp3", get_filename_ext(buffer)) == 0) {
-
-					/* Skip "seek" number of mp3 files... */
-					if (seek) {
-						seek--;
-						continue;
-					}
-
-					//mp3_get_bpm(buffer);
-					play_mp3(buffer);
+        /* Break on error or end of dir */
+		if (res != FR_OK || fno.fname[0] == 0) break; 
+
+        /* Ignore dot entry */
+		if (fno.fname[0] == '.') continue; 
+
+    #if _USE_LFN
+		fn = *fno.lfname ? fno.lfname : fno.fname;
+    #else
+		fn = fno.fname;
+    #endif
+		if (fno.fattrib & AM_DIR) {
+            /* It is a directory */
+
+		} else {
+            /* It is a file. */
+			sprintf(buffer, "%s/%s", path, fn);
+
+			/* Check if it is an mp3 file */
+			if (strcmp("mp3", get_filename_ext(buffer)) == 0) {
+
+				/* Skip "seek" number of mp3 files... */
+				if (*seek) {
+					(*seek)--;
+					continue;
 				}
+
+				//mp3_get_bpm(buffer);
+				decoder = mp3_open(fp, buffer);
+                if (decoder != NULL) {
+                    return decoder;
+                }
 			}
 		}
 	}
 
+    return NULL;
+}
+
+/*
+ * Play the mp3 files one after another without a gap.
+ * The output keeps running between the tracks, and the next
+ * file is opened while the current one plays.
+ */
+static FRESULT play_directory (const char* path, unsigned char seek) {
+	FRESULT     res;
+	DIR         dir;
+
+    struct mp3_decoder  *decoder, *next;
+    FIL                 *next_fp;
+    uint8_t             dir_end = 0;
+
+	res = f_opendir(&dir, path);
+	if (res != FR_OK) {
+        return res;
+    }
+
+    decoder = open_next_mp3(&dir, path, &seek, &play_files[0]);
+    while (decoder != NULL) {
+        next    = NULL;
+        next_fp = (decoder->fetch_parameter == &play_files[0]) ? &play_files[1] : &play_files[0];
+
+        //while (mp3_decoder_run(decoder) != -1) {
+        while (mp3_decoder_run_pvc(decoder) != -1) {
+            /* the track has started, queue the next one */
+            if (next == NULL && dir_end == 0) {
+                next = open_next_mp3(&dir, path, &seek, next_fp);
+                dir_end = (next == NULL);
+            }
+        }
+
+        /* a very short track */
+        if (next == NULL && dir_end == 0) {
+            next = open_next_mp3(&dir, path, &seek, next_fp);
+            dir_end = (next == NULL);
+        }
+
+        /* the last track, play out the output pipeline */
+        if (next == NULL) {
+            mp3_decoder_flush(decoder);
+        }
+
+        mp3_close(decoder);
+        decoder = next;
+    }
+
+    /* play out the last buffer and stop, to avoid noise */
+    audio_sink_close(sink);
+
+    /* how close to the deadline the directory played */
+    audio_sink_report(sink);
+
 	return res;
 }
 
@@ -247,6 +389,12 @@ int main(void) {
 	GPIO_InitStructure.GPIO_PuPd    = GPIO_PuPd_NOPULL;
 	GPIO_Init(GPIOD, &GPIO_InitStructure);
 
+	report_init();
+
+	sink = audio_sink_i2s();
+	sink->ticks     = cycle_ticks;
+	sink->tick_rate = RCC_Clocks.HCLK_Frequency;
+
 	/* Initialize USB Host Library */
 	USBH_Init(&USB_OTG_Core, USB_OTG_FS_CORE_ID, &USB_Host, &USBH_MSC_cb, &USR_Callbacks);
 
@@ -272,8 +420,9 @@ void TimingDelay_Decrement(void) {
     /* just for test */
     if (time_var2 > 10000) {
         time_var2 = 0;
-        cur_ratio += 0.5;
-        if (cur_ratio > 1.5) cur_ratio = 0.5;
+        test_speed += 0.5f;
+        if (test_speed > 1.5f) test_speed = 0.5f;
+        mp3_set_speed(test_speed);
     }
 }
 
@@ -0,0 +1,392 @@
+/*
+ *  Name:    mixer.c
+ *
+ *  Purpose: fixed-point mixer of several decks into one output
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "mixer.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+
+/* the crossfade position at its end */
+#define MIXER_XFADE_ONE     (1 << 30)
+
+/* unity gain, Q15 */
+#define MIXER_UNITY         32767
+
+/* sin(i / 64 * pi / 2), Q15, the equal-power crossfade law */
+static const int16_t mixer_sin_table[65] = {
+        0,   804,  1608,  2410,  3212,  4011,  4808,  5602,
+     6393,  7179,  7962,  8739,  9512, 10278, 11039, 11793,
+    12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+    18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+    23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+    27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+    30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971,
+    32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+    32767,
+};
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+
+/* sin(pos / MIXER_XFADE_ONE * pi / 2), Q15 */
+static int32_t mixer_sin(uint32_t pos) {
+    uint32_t    idx = pos >> 24;
+    int32_t     frac = (pos >> 14) & 1023;
+    int32_t     a;
+
+    if (idx >= 64) {
+        return MIXER_UNITY;
+    }
+    a = mixer_sin_table[idx];
+
+    return a + (((mixer_sin_table[idx + 1] - a) * frac) >> 10);
+}
+
+/* the gain of a deck, Q15, at a volume (Q15 << 16) and a crossfade position */
+static int32_t mixer_deck_gain(struct mixer *mx, int deck, int32_t gain, uint32_t pos) {
+    int32_t law = MIXER_UNITY;
+
+    if (deck == mx->xfade_from) {
+        law = mixer_sin(MIXER_XFADE_ONE - pos);
+    } else if (deck == mx->xfade_to) {
+        law = mixer_sin(pos);
+    }
+    if (law == MIXER_UNITY) {
+        return gain >> 16;
+    }
+
+    return ((gain >> 16) * law + (1 << 14)) >> 15;
+}
+
+/* the volume of a deck after n more frames of its ramp */
+static int32_t mixer_ramp(const struct mixer_deck *d, uint32_t n) {
+    int64_t gain = d->gain + (int64_t)d->gain_step * n;
+
+    if ((d->gain_step > 0 && gain > d->gain_target)
+        || (d->gain_step < 0 && gain < d->gain_target)) {
+        gain = d->gain_target;
+    }
+
+    return (int32_t)gain;
+}
+
+/*
+ * bend what is over MIXER_CLIP_KNEE towards full scale, with the
+ * slope 1 at the knee
+ */
+static inline int16_t mixer_clip(struct mixer *mx, int32_t value) {
+    const int32_t   room = 32767 - MIXER_CLIP_KNEE;
+    int32_t         over;
+
+    if (value > MIXER_CLIP_KNEE) {
+        over    = value - MIXER_CLIP_KNEE;
+        value   = MIXER_CLIP_KNEE + over * room / (over + room);
+        mx->clipped++;
+    } else if (value < -MIXER_CLIP_KNEE) {
+        over    = -MIXER_CLIP_KNEE - value;
+        value   = -MIXER_CLIP_KNEE - over * room / (over + room);
+        mx->clipped++;
+    }
+
+    return value;
+}
+
+/* add n frames of a deck to the sum, the gain going from g0 to g1 (Q15) */
+static void mixer_add(struct mixer *mx, const int16_t *s, uint32_t n,
+                      int32_t g0, int32_t g1, uint32_t block) {
+    int32_t     *acc = mx->acc;
+    int32_t     g, step, gi;
+    uint32_t    i;
+
+    /* a deck alone at unity comes out unchanged */
+    if (g0 == MIXER_UNITY && g1 == MIXER_UNITY) {
+        for (i = 0; i < n * mx->channels; i++) {
+            acc[i] += s[i];
+        }
+        return;
+    }
+
+    g       = g0 << 16;
+    step    = (g1 - g0) * (65536 / (int32_t)block);
+
+    if (mx->channels == 2) {
+        for (i = 0; i < n; i++) {
+            gi      = g >> 16;
+            acc[0]  += (s[0] * gi) >> 15;
+            acc[1]  += (s[1] * gi) >> 15;
+            acc     += 2;
+            s       += 2;
+            g       += step;
+        }
+    } else {
+        for (i = 0; i < n; i++) {
+            *acc++  += (*s++ * (g >> 16)) >> 15;
+            g       += step;
+        }
+    }
+}
+
+/* mix n <= MIXER_BLOCK frames */
+static void mixer_block(struct mixer *mx, int16_t *out, uint32_t n) {
+    struct mixer_deck   *d;
+    uint32_t            pos0, pos1, i;
+    int32_t             g0, g1;
+    int                 k, got, added = 0;
+
+    pos0 = mx->xfade_pos;
+    pos1 = pos0;
+    if (mx->xfade_step > 0) {
+        pos1 = (MIXER_XFADE_ONE - pos0 > mx->xfade_step * n)
+               ? pos0 + mx->xfade_step * n : MIXER_XFADE_ONE;
+    }
+
+    memset(mx->acc, 0, n * mx->channels * sizeof(int32_t));
+
+    for (k = 0; k < mx->num_decks; k++) {
+        d = &mx->decks[k];
+
+        /* a deck faded out still plays, to keep its time */
+        got = sonicReadShortFromStream(d->stream, mx->deck_buf, n);
+
+        g0          = mixer_deck_gain(mx, k, d->gain, pos0);
+        d->gain     = mixer_ramp(d, n);
+        g1          = mixer_deck_gain(mx, k, d->gain, pos1);
+
+        if ((uint32_t)got < n && !d->ended && (g0 != 0 || g1 != 0)) {
+            d->starved += n - got;
+        }
+        if (got > 0 && (g0 != 0 || g1 != 0)) {
+            mixer_add(mx, mx->deck_buf, got, g0, g1, n);
+            added++;
+        }
+    }
+
+    mx->xfade_pos = pos1;
+    if (pos1 == MIXER_XFADE_ONE) {
+        mx->xfade_step = 0;
+    }
+
+    /* one deck at most unity can not go past full scale */
+    if (added <= 1) {
+        for (i = 0; i < n * mx->channels; i++) {
+            out[i] = (int16_t)mx->acc[i];
+        }
+        return;
+    }
+
+    for (i = 0; i < n * mx->channels; i++) {
+        out[i] = mixer_clip(mx, mx->acc[i]);
+    }
+}
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+
+/*
+ * create a mixer of decks into an output of rate Hz
+ *
+ * channels is 1 or 2 (interleaved), of the output and of every deck.
+ * The decks start at unity gain, not crossfaded.
+ *
+ * ret: the mixer, or NULL if parameters are invalid or out of memory
+ */
+struct mixer *mixer_create(uint32_t rate, int channels, int decks) {
+    struct mixer    *mx;
+    int             k;
+
+    if (rate == 0 || channels < 1 || channels > 2
+        || decks < 1 || decks > MIXER_MAX_DECKS) {
+        return NULL;
+    }
+
+    mx = (struct mixer *)calloc(1, sizeof(struct mixer));
+    if (mx == NULL) {
+        return NULL;
+    }
+
+    mx->rate        = rate;
+    mx->channels    = channels;
+    mx->num_decks   = decks;
+    mx->xfade_from  = -1;
+    mx->xfade_to    = -1;
+
+    mx->deck_buf = (int16_t *)malloc(MIXER_BLOCK * channels * sizeof(int16_t));
+    mx->acc = (int32_t *)malloc(MIXER_BLOCK * channels * sizeof(int32_t));
+    if (mx->deck_buf == NULL || mx->acc == NULL) {
+        mixer_delete(mx);
+        return NULL;
+    }
+
+    for (k = 0; k < decks; k++) {
+        mx->decks[k].stream = sonicCreateStream(rate, channels);
+        if (mx->decks[k].stream == NULL) {
+            mixer_delete(mx);
+            return NULL;
+        }
+        mx->decks[k].in_rate        = rate;
+        mx->decks[k].rate           = 1;
+        mx->decks[k].gain           = MIXER_UNITY << 16;
+        mx->decks[k].gain_target    = MIXER_UNITY << 16;
+        mx->decks[k].ended          = 1;
+    }
+
+    return mx;
+}
+
+void mixer_delete(struct mixer *mx) {
+    int k;
+
+    for (k = 0; k < mx->num_decks; k++) {
+        if (mx->decks[k].stream) sonicDestroyStream(mx->decks[k].stream);
+    }
+    if (mx->deck_buf) free(mx->deck_buf);
+    if (mx->acc) free(mx->acc);
+
+    free(mx);
+}
+
+/*
+ * queue frames of a deck's track, at rate Hz
+ *
+ * ret: 0, OK
+ *      -1, out of memory
+ */
+int mixer_write(struct mixer *mx, int deck,
+                const int16_t *samples, uint32_t frames, uint32_t rate) {
+    struct mixer_deck *d = &mx->decks[deck];
+
+    if (d->in_rate != rate) {
+        d->in_rate = rate;
+        mixer_set_rate(mx, deck, d->rate);
+    }
+    d->ended = 0;
+
+    return sonicWriteShortToStream(d->stream, (short *)samples, frames) ? 0 : -1;
+}
+
+/*
+ * the track of a deck is over, let the samples Sonic holds out
+ */
+void mixer_flush(struct mixer *mx, int deck) {
+    sonicFlushStream(mx->decks[deck].stream);
+    mx->decks[deck].ended = 1;
+}
+
+/* output frames a deck has ready, the writer keeps them above a pass */
+uint32_t mixer_available(struct mixer *mx, int deck) {
+    return sonicSamplesAvailable(mx->decks[deck].stream);
+}
+
+/* the tempo of a deck, 1.0 is normal, see sonicSetSpeed() */
+void mixer_set_speed(struct mixer *mx, int deck, float speed) {
+    sonicSetSpeed(mx->decks[deck].stream, speed);
+}
+
+/* the pitch of a deck, 1.0 is unchanged, see sonicSetPitch() */
+void mixer_set_pitch(struct mixer *mx, int deck, float pitch) {
+    sonicSetPitch(mx->decks[deck].stream, pitch);
+}
+
+/*
+ * tempo and pitch of a deck together, as a turntable, 1.0 is normal.
+ * Sonic's rate also converts the deck to the output rate.
+ */
+void mixer_set_rate(struct mixer *mx, int deck, float rate) {
+    struct mixer_deck *d = &mx->decks[deck];
+
+    d->rate = rate;
+    sonicSetRate(d->stream, rate * d->in_rate / mx->rate);
+}
+
+/*
+ * ramp the volume of a deck to gain (0 to 1) over frames of output
+ */
+void mixer_set_gain(struct mixer *mx, int deck, float gain, uint32_t frames) {
+    struct mixer_deck *d = &mx->decks[deck];
+
+    if (gain < 0) {
+        gain = 0;
+    } else if (gain > 1) {
+        gain = 1;
+    }
+
+    d->gain_target = (int32_t)(gain * MIXER_UNITY) << 16;
+    if (frames == 0) {
+        d->gain         = d->gain_target;
+        d->gain_step    = 0;
+    } else {
+        d->gain_step    = (d->gain_target - d->gain) / (int32_t)frames;
+        if (d->gain_step == 0) {
+            d->gain = d->gain_target;
+        }
+    }
+}
+
+/*
+ * fade deck from out and deck to in over frames of output, keeping
+ * the power constant. Afterwards deck from stays silent until the
+ * next crossfade.
+ */
+void mixer_crossfade(struct mixer *mx, int from, int to, uint32_t frames) {
+    mx->xfade_from  = from;
+    mx->xfade_to    = to;
+    mx->xfade_pos   = 0;
+    mx->xfade_step  = MIXER_XFADE_ONE / (frames ? frames : 1);
+    if (mx->xfade_step == 0) {
+        mx->xfade_step = 1;
+    }
+}
+
+/*
+ * mix frames of output, decks without samples are silent
+ *
+ * ret: frames written to out
+ */
+uint32_t mixer_process(struct mixer *mx, int16_t *out, uint32_t frames) {
+    uint32_t    n, done = 0;
+    uint32_t    t;
+
+    while (done < frames) {
+        n = frames - done;
+        if (n > MIXER_BLOCK) {
+            n = MIXER_BLOCK;
+        }
+
+        t = mx->ticks ? mx->ticks() : 0;
+        mixer_block(mx, out + done * mx->channels, n);
+        if (mx->ticks) {
+            t = mx->ticks() - t;
+            mx->ticks_total += t;
+            if (t > mx->ticks_max) {
+                mx->ticks_max = t;
+            }
+        }
+        mx->blocks++;
+
+        done += n;
+    }
+
+    return done;
+}
+
+/* no deck has samples left */
+int mixer_idle(struct mixer *mx) {
+    int k;
+
+    for (k = 0; k < mx->num_decks; k++) {
+        if (sonicSamplesAvailable(mx->decks[k].stream) > 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
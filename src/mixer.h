@@ -0,0 +1,103 @@
+/*
+ *  Name:    mixer.h
+ *
+ *  Purpose: fixed-point mixer of several decks into one output
+ *
+ *           Only tools/playsim builds it so far, the player has one
+ *           decoder and no second deck to mix.
+ *
+ */
+
+#ifndef _MIXER_H_
+#define _MIXER_H_
+
+#include <stdint.h>
+
+#include "sonic.h"
+
+#define MIXER_MAX_DECKS         4
+
+/* output frames mixed per pass, the gains are ramped linearly over it */
+#define MIXER_BLOCK             256
+
+/*
+ * Above this level a sum of decks is bent smoothly towards full scale
+ * instead of wrapping or clipping hard, -0.5 dBFS. A deck mixed alone
+ * is never bent.
+ */
+#define MIXER_CLIP_KNEE         30934
+
+/*
+ * A deck is a track being played: its PCM goes through a Sonic stream
+ * of its own, so every deck has its own speed, pitch and rate, and is
+ * converted to the rate of the output by Sonic's rate mode.
+ */
+struct mixer_deck {
+    sonicStream     stream;
+
+    /* of the samples written, and the rate set by mixer_set_rate() */
+    uint32_t        in_rate;
+    float           rate;
+
+    /* volume, Q15 << 16, ramped by gain_step per frame to gain_target */
+    int32_t         gain;
+    int32_t         gain_target;
+    int32_t         gain_step;
+
+    /*
+     * the track is over, or none was written yet: running out of
+     * samples is not a starve
+     */
+    int             ended;
+
+    /* output frames of silence mixed because the deck had no samples */
+    uint32_t        starved;
+};
+
+struct mixer {
+    uint32_t        rate;
+    int             channels;
+    int             num_decks;
+    struct mixer_deck decks[MIXER_MAX_DECKS];
+
+    /*
+     * Equal-power crossfade from deck xfade_from to xfade_to, the
+     * position goes from 0 to 1 << 30 by xfade_step per frame. The
+     * other decks are not faded. -1 while there was none.
+     */
+    int             xfade_from, xfade_to;
+    uint32_t        xfade_pos;
+    uint32_t        xfade_step;
+
+    /* MIXER_BLOCK frames of one deck, and of the sum */
+    int16_t         *deck_buf;
+    int32_t         *acc;
+
+    /*
+     * Time of a pass, optional: the cycle counter on the board
+     * (DWT_CYCCNT), ns on the host.
+     */
+    uint32_t        (*ticks)(void);
+    uint32_t        blocks;
+    uint32_t        ticks_max;
+    uint64_t        ticks_total;
+
+    /* samples bent by the soft clipper */
+    uint32_t        clipped;
+};
+
+struct mixer *mixer_create(uint32_t rate, int channels, int decks);
+void mixer_delete(struct mixer *mx);
+int mixer_write(struct mixer *mx, int deck,
+                const int16_t *samples, uint32_t frames, uint32_t rate);
+void mixer_flush(struct mixer *mx, int deck);
+uint32_t mixer_available(struct mixer *mx, int deck);
+void mixer_set_speed(struct mixer *mx, int deck, float speed);
+void mixer_set_pitch(struct mixer *mx, int deck, float pitch);
+void mixer_set_rate(struct mixer *mx, int deck, float rate);
+void mixer_set_gain(struct mixer *mx, int deck, float gain, uint32_t frames);
+void mixer_crossfade(struct mixer *mx, int from, int to, uint32_t frames);
+uint32_t mixer_process(struct mixer *mx, int16_t *out, uint32_t frames);
+int mixer_idle(struct mixer *mx);
+
+#endif
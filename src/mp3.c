@@ -27,6 +27,7 @@
 #include "mp3.h"
 #include "sonic.h"
 #include "bpm.h"
+#include "resample.h"
 
 /*========================================================
  *                  Macros, Variables
@@ -36,7 +37,17 @@
 //#define MP3_DECODE_BUF_SZ   (2560)      /* output buffer size */
 #define MP3_DECODE_BUF_SZ   (4096)      /* output buffer size */
 
-static uint8_t              mp3_fd_buffer[MP3_AUDIO_BUF_SZ];
+/*
+ * one input buffer per decoder, the next track is opened while
+ * the current one plays (MP3DEC_MAX_INSTANCES in helix)
+ */
+#define MP3_MAX_DECODERS    2
+
+static uint8_t              mp3_fd_buffer[MP3_MAX_DECODERS][MP3_AUDIO_BUF_SZ];
+static struct mp3_decoder   *mp3_fd_owner[MP3_MAX_DECODERS];
+
+/* the delay of the decoder filter bank, as LAME accounts for it */
+#define MP3_DECODER_DELAY   529
 
 /* 
  * double buffer used by MP3 decoder
@@ -45,12 +56,85 @@ static int16_t              decode_buf0[MP3_DECODE_BUF_SZ];
 static int16_t              decode_buf1[MP3_DECODE_BUF_SZ];
 static volatile uint8_t     buf_switch = 0;
 
-static int16_t              tmp_buf[MP3_DECODE_BUF_SZ];
+/* 
+ * one whole frame, large enough for 32-bit stereo output
+ */
+#define MP3_FRAME_BUF_SZ    (MAX_NGRAN * MAX_NSAMP * MAX_NCHAN * 2)
+
+static int16_t              tmp_buf[MP3_FRAME_BUF_SZ];
+
+/*
+ * resampled samples on their way into Sonic
+ */
+#define MP3_RESAMPLE_BUF_SZ (1024)
+
+static int16_t              rs_buf[MP3_RESAMPLE_BUF_SZ];
+
+/*
+ * The output pipeline outlives the decoders, so consecutive tracks
+ * are spliced without a gap. What it still holds after the last
+ * track is played out by mp3_decoder_flush().
+ */
+static struct resampler     *out_resampler = NULL;
+
+static sonicStream          pvc_stream = NULL;
+static int                  pvc_pos = 0;
 
 static int                  cur_srate = 0;
 static int                  cur_channel = 0;
 
-volatile float              cur_ratio = 1;
+/*
+ * Speed/pitch control. Commands are posted from ISR or UI context
+ * through a small queue, and the decoding loop ramps the values of
+ * the Sonic stream towards the targets block by block, so a change
+ * is never applied as a step.
+ */
+#define MP3_CMD_QUEUE_SZ    8           /* power of 2 */
+
+#define MP3_CMD_SPEED       0
+#define MP3_CMD_PITCH       1
+#define MP3_CMD_RATE        2
+#define MP3_CMD_LOW_LATENCY 3
+
+struct mp3_cmd {
+    uint8_t                 type;
+    float                   value;
+};
+
+static struct mp3_cmd       cmd_queue[MP3_CMD_QUEUE_SZ];
+static volatile uint32_t    cmd_head = 0;   /* written by the producers */
+static volatile uint32_t    cmd_tail = 0;   /* written by the decoding loop */
+
+/* frames written to Sonic between two ramp steps */
+#define MP3_RAMP_BLOCK      256
+
+/* maximum change of speed, pitch or rate per second */
+#define MP3_RAMP_RATE       1.0f
+
+/*
+ * BPM tap, mono samples buffered for the detector.
+ * A power of 2 and a multiple of the detector hop, so a hop is
+ * always contiguous in the ring.
+ */
+#define MP3_BPM_RING_SZ     4096
+
+/* the detector looks at the bands up to this frequency */
+#define MP3_BPM_FREQ_HIGH   4000
+
+static float                target_speed = 1;
+static float                target_pitch = 1;
+static float                cur_speed = 1;
+static float                cur_pitch = 1;
+
+/*
+ * "vinyl" rate, changes tempo and pitch together like a turntable.
+ * Sonic resamples for it without the pitch search of speed and pitch.
+ */
+static float                target_rate = 1;
+static float                cur_rate = 1;
+
+/* Sonic searches shorter pitch periods and holds less, for scrubbing */
+static int                  low_latency = 0;
 
 /*========================================================
  *          Private functions
@@ -82,12 +166,434 @@ static int32_t mp3_decoder_fill_buffer(struct mp3_decoder *decoder) {
     }
 }
 
+/* the number of interleaved channels in the decoder output */
+static int mp3_decoder_channels(struct mp3_decoder *decoder) {
+    switch (decoder->out_format & MP3_OUTPUT_LAYOUT_MASK) {
+        case MP3_OUTPUT_STEREO:
+            return 2;
+
+        case MP3_OUTPUT_MONO:
+            return 1;
+
+        default:
+            return decoder->frame_info.nChans;
+    }
+}
+
+/* big-endian 32-bit field of the Xing tag */
+static uint32_t mp3_get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+           | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+ * look for the Xing/Info tag in the frame at read_ptr, and take the
+ * encoder delay and padding from its LAME extension
+ */
+static void mp3_decoder_parse_info(struct mp3_decoder *decoder) {
+    uint8_t         *p = decoder->read_ptr;
+    uint32_t        flags;
+    uint32_t        frames = 0;
+    uint32_t        spf, delay, padding;
+    int             offset;
+
+    decoder->skip_samples   = 0;
+    decoder->remain_samples = -1;
+
+    if (MP3GetNextFrameInfo(decoder->decoder, &decoder->frame_info, p) != ERR_MP3_NONE) {
+        return;
+    }
+
+    /* the tag follows the side information */
+    if (decoder->frame_info.version == MPEG1) {
+        offset  = (decoder->frame_info.nChans == 1) ? 17 : 32;
+        spf     = 1152;
+    } else {
+        offset  = (decoder->frame_info.nChans == 1) ? 9 : 17;
+        spf     = 576;
+    }
+    offset += 4;
+    if ((p[1] & 0x01) == 0) {
+        /* CRC */
+        offset += 2;
+    }
+
+    /* tag, flags, frames, bytes, TOC, quality, LAME extension */
+    if (decoder->bytes_left < (uint32_t)offset + 8 + 4 + 4 + 100 + 4 + 24) {
+        return;
+    }
+
+    p += offset;
+    if (memcmp(p, "Xing", 4) != 0 && memcmp(p, "Info", 4) != 0) {
+        return;
+    }
+
+    flags = mp3_get_be32(p + 4);
+    p += 8;
+    if (flags & 0x01) {
+        frames = mp3_get_be32(p);
+        p += 4;
+    }
+    if (flags & 0x02) p += 4;
+    if (flags & 0x04) p += 100;
+    if (flags & 0x08) p += 4;
+
+    /* the Info frame itself decodes to silence */
+    decoder->skip_samples = spf;
+
+    if (memcmp(p, "LAME", 4) != 0 && memcmp(p, "Lavc", 4) != 0
+        && memcmp(p, "Lavf", 4) != 0) {
+        return;
+    }
+
+    /* 12 bits each, after the version string, VBR info and ReplayGain */
+    delay   = (p[21] << 4) | (p[22] >> 4);
+    padding = ((p[22] & 0x0f) << 8) | p[23];
+
+    decoder->skip_samples += delay + MP3_DECODER_DELAY;
+    if (frames * spf > delay + padding) {
+        decoder->remain_samples = frames * spf - delay - padding;
+    }
+}
+
+/*
+ * drop the priming and the padding of a decoded frame
+ *
+ * ret: the number of samples (of all channels) left in buffer,
+ *      -1, the end of the track is reached
+ */
+static int mp3_decoder_trim(struct mp3_decoder *decoder,
+                            int16_t *buffer, int len) {
+    int         channels = mp3_decoder_channels(decoder);
+    int         size = (decoder->out_format & MP3_OUTPUT_32BIT) ? 4 : 2;
+    uint32_t    n = len / channels;
+    uint32_t    skip;
+
+    if (decoder->skip_samples > 0) {
+        skip = (n < decoder->skip_samples) ? n : decoder->skip_samples;
+
+        decoder->skip_samples -= skip;
+        n -= skip;
+        if (n > 0) {
+            memmove(buffer, (uint8_t *)buffer + skip * channels * size,
+                    n * channels * size);
+        }
+    }
+
+    if (decoder->remain_samples >= 0) {
+        if (decoder->remain_samples == 0) {
+            return -1;
+        }
+
+        if (n > (uint32_t)decoder->remain_samples) {
+            n = decoder->remain_samples;
+        }
+        decoder->remain_samples -= n;
+    }
+
+    decoder->frame_info.outputSamps = n * channels;
+
+    return n * channels;
+}
+
+/*
+ * ret: 0, OK
+ *      -1, queue full, the command is dropped
+ */
+static int mp3_post_cmd(uint8_t type, float value) {
+    uint32_t    primask;
+    int         ret = -1;
+
+    /* there may be more than one producer, e.g. an ISR and the UI */
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (cmd_head - cmd_tail < MP3_CMD_QUEUE_SZ) {
+        cmd_queue[cmd_head & (MP3_CMD_QUEUE_SZ - 1)].type   = type;
+        cmd_queue[cmd_head & (MP3_CMD_QUEUE_SZ - 1)].value  = value;
+        cmd_head++;
+        ret = 0;
+    }
+
+    __set_PRIMASK(primask);
+
+    return ret;
+}
+
+/* take the posted commands, only the decoding loop calls this */
+static void mp3_get_cmds(void) {
+    struct mp3_cmd *cmd;
+
+    while (cmd_tail != cmd_head) {
+        cmd = &cmd_queue[cmd_tail & (MP3_CMD_QUEUE_SZ - 1)];
+
+        switch (cmd->type) {
+            case MP3_CMD_SPEED:
+                target_speed = cmd->value;
+                break;
+
+            case MP3_CMD_PITCH:
+                target_pitch = cmd->value;
+                break;
+
+            case MP3_CMD_RATE:
+                target_rate = cmd->value;
+                break;
+
+            case MP3_CMD_LOW_LATENCY:
+                low_latency = (cmd->value != 0);
+                break;
+        }
+
+        cmd_tail++;
+    }
+}
+
+/* move value towards target by no more than step */
+static float mp3_ramp(float value, float target, float step) {
+    if (value < target - step) {
+        return value + step;
+    } else if (value > target + step) {
+        return value - step;
+    }
+
+    return target;
+}
+
+/* the sample rate delivered to output_cb */
+static int mp3_decoder_rate(struct mp3_decoder *decoder) {
+    return decoder->out_rate ? (int)decoder->out_rate : decoder->frame_info.samprate;
+}
+
+/* the double buffer which is not being played */
+static int16_t *mp3_decoder_get_buffer(void) {
+    return buf_switch == 0 ? decode_buf1 : decode_buf0;
+}
+
+/* the buffer from mp3_decoder_get_buffer() was handed to output_cb */
+static void mp3_decoder_put_buffer(void) {
+    buf_switch = !buf_switch;
+}
+
+/*
+ * ret: the resampler for the current frame,
+ *      NULL if the frame is already at the output rate or out of memory
+ */
+static struct resampler *mp3_decoder_resampler(struct mp3_decoder *decoder) {
+    struct resampler    *rs = out_resampler;
+    uint32_t            in_rate = decoder->frame_info.samprate;
+    int                 channels = mp3_decoder_channels(decoder);
+
+    if (decoder->out_rate == 0 || decoder->out_rate == in_rate) {
+        return NULL;
+    }
+
+    if (rs == NULL
+        || rs->in_rate != in_rate
+        || rs->out_rate != decoder->out_rate
+        || rs->channels != channels
+        || rs->taps != decoder->out_taps) {
+
+        if (rs) resampler_delete(rs);
+        out_resampler = resampler_create(in_rate, decoder->out_rate,
+                                         channels, decoder->out_taps);
+    }
+
+    return out_resampler;
+}
+
+/* hand the pvc_pos samples of the current buffer to the output */
+static void mp3_pvc_output(struct mp3_decoder *decoder) {
+    MP3FrameInfo    info;
+
+    info                = decoder->frame_info;
+    info.samprate       = cur_srate;
+    info.outputSamps    = pvc_pos;
+    decoder->output_cb(&info, mp3_decoder_get_buffer(), pvc_pos);
+    mp3_decoder_put_buffer();
+
+    pvc_pos = 0;
+}
+
+/*
+ * play out everything Sonic holds, the last buffer may be short
+ */
+static void mp3_decoder_pvc_drain(struct mp3_decoder *decoder) {
+    int16_t         *buffer;
+    int             len;
+
+    sonicFlushStream(pvc_stream);
+    do {
+        buffer = mp3_decoder_get_buffer();
+
+        len = sonicReadShortFromStream(pvc_stream, &buffer[pvc_pos],
+                                       (MP3_DECODE_BUF_SZ - pvc_pos) / cur_channel);
+        pvc_pos += len * cur_channel;
+
+        if (pvc_pos == MP3_DECODE_BUF_SZ || (len == 0 && pvc_pos > 0)) {
+            mp3_pvc_output(decoder);
+        }
+    } while (len > 0);
+
+    sonicDestroyStream(pvc_stream);
+    pvc_stream  = NULL;
+    pvc_pos     = 0;
+}
+
+/*
+ * write frames to Sonic in blocks, stepping speed, pitch and rate towards
+ * their targets before each block. Sonic writes its output straight
+ * into the DMA buffer, full buffers are handed to output_cb.
+ *
+ * ret: 0, OK
+ *      -1, out of memory
+ */
+static int mp3_pvc_write(struct mp3_decoder *decoder,
+                         int16_t *samples, uint32_t frames) {
+    int16_t     *buffer;
+    uint32_t    n;
+    int         len;
+    float       step;
+
+    mp3_get_cmds();
+
+    while (frames > 0) {
+        n = (frames < MP3_RAMP_BLOCK) ? frames : MP3_RAMP_BLOCK;
+
+        if (cur_speed != target_speed || cur_pitch != target_pitch
+            || cur_rate != target_rate) {
+            step        = MP3_RAMP_RATE * n / cur_srate;
+            cur_speed   = mp3_ramp(cur_speed, target_speed, step);
+            cur_pitch   = mp3_ramp(cur_pitch, target_pitch, step);
+            cur_rate    = mp3_ramp(cur_rate, target_rate, step);
+        }
+        sonicSetSpeed(pvc_stream, cur_speed);
+        sonicSetPitch(pvc_stream, cur_pitch);
+        sonicSetRate(pvc_stream, cur_rate);
+        sonicSetLowLatency(pvc_stream, low_latency);
+
+        buffer = mp3_decoder_get_buffer();
+        len = sonicWriteShortToBuffer(pvc_stream, samples, n, &buffer[pvc_pos],
+                                      (MP3_DECODE_BUF_SZ - pvc_pos) / cur_channel);
+        if (len < 0) {
+            return -1;
+        }
+        pvc_pos += len * cur_channel;
+
+        /* a slow down can give more than one buffer */
+        while (pvc_pos == MP3_DECODE_BUF_SZ) {
+            mp3_pvc_output(decoder);
+
+            buffer  = mp3_decoder_get_buffer();
+            len     = sonicReadShortFromStream(pvc_stream, buffer,
+                                               MP3_DECODE_BUF_SZ / cur_channel);
+            pvc_pos = len * cur_channel;
+        }
+
+        samples += n * cur_channel;
+        frames  -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * At unity speed, pitch and rate Sonic is not needed, and the frames are
+ * decoded straight into the DMA buffer as by mp3_decoder_run().
+ * What Sonic still holds is played out first.
+ *
+ * ret: 1, bypass Sonic
+ *      0, use Sonic
+ */
+static int mp3_pvc_bypass(struct mp3_decoder *decoder) {
+    mp3_get_cmds();
+
+    if (cur_speed != 1 || cur_pitch != 1 || cur_rate != 1
+        || target_speed != 1 || target_pitch != 1 || target_rate != 1) {
+        return 0;
+    }
+
+    if (pvc_stream != NULL) {
+        mp3_decoder_pvc_drain(decoder);
+    }
+
+    return 1;
+}
+
+/*
+ * feed one decoded frame to the BPM tap
+ */
+static void mp3_bpm_tap_run(struct mp3_decoder *decoder,
+                            const int16_t *pcm, int len) {
+    struct mp3_bpm_tap  *tap = &decoder->bpm_tap;
+    uint32_t            srate = decoder->frame_info.samprate;
+    uint32_t            hop, hops;
+    int                 channels, i;
+
+    if (tap->mem == NULL || tap->bpm != 0 || len <= 0
+        || (decoder->out_format & MP3_OUTPUT_32BIT)) {
+        return;
+    }
+
+    /* (re)start the analysis for this rate */
+    if (tap->srate != srate) {
+        tap->srate  = srate;
+        tap->ring   = (int16_t *)tap->mem;
+        tap->head   = 0;
+        tap->tail   = 0;
+        tap->det    = bpm_detector_init((uint8_t *)tap->mem + MP3_BPM_RING_SZ * sizeof(int16_t),
+                                        tap->size - MP3_BPM_RING_SZ * sizeof(int16_t),
+                                        NULL, srate, 1);
+        if (tap->det == NULL) {
+            /* memory too small for this rate */
+            tap->mem = NULL;
+            return;
+        }
+        bpm_detector_set_freq_band(tap->det, 0, MP3_BPM_FREQ_HIGH);
+    }
+
+    hop = bpm_detector_num_of_samples(tap->det);
+
+    /* mix to mono into the ring */
+    channels = mp3_decoder_channels(decoder);
+    if (channels == 2) {
+        for (i = 0; i < len; i += 2) {
+            tap->ring[tap->head++ & (MP3_BPM_RING_SZ - 1)] = (pcm[i] + pcm[i + 1]) >> 1;
+        }
+    } else {
+        for (i = 0; i < len; i++) {
+            tap->ring[tap->head++ & (MP3_BPM_RING_SZ - 1)] = pcm[i];
+        }
+    }
+
+    /* the detector fell behind, drop the oldest hops */
+    while (tap->head - tap->tail > MP3_BPM_RING_SZ) {
+        tap->tail       += hop;
+        tap->dropped    += hop;
+    }
+
+    for (hops = 0; hops < tap->max_hops && tap->head - tap->tail >= hop; hops++) {
+        i = tap->tail & (MP3_BPM_RING_SZ - 1);
+        tap->tail += hop;
+
+        if (bpm_detector_put_samples(tap->det, &tap->ring[i], hop) == 1) {
+            tap->bpm = bpm_detector_get_bpm(tap->det);
+            if (tap->bpm_cb != NULL) {
+                tap->bpm_cb(decoder, tap->bpm);
+            }
+            break;
+        }
+    }
+}
+
+/*
+ * ret: the number of samples (of all channels) written to buffer,
+ *      0, no output for this call,
+ *      -1, some error occuerd, should stop the decoding
+ */
 int mp3_decoder_run_internal(struct mp3_decoder *decoder,
                              int16_t *buffer) {
     int             err;
-    int             i;
-
-    int             outputSamps;
 
     if (decoder->read_ptr == NULL
         || decoder->bytes_left < 2 * MAINBUF_SIZE) {
@@ -113,6 +619,10 @@ int mp3_decoder_run_internal(struct mp3_decoder *decoder,
         }
     }
 
+    if (decoder->frames == 0) {
+        mp3_decoder_parse_info(decoder);
+    }
+
     err = MP3Decode(decoder->decoder, &decoder->read_ptr,
                     (int *)&decoder->bytes_left, (short *)buffer, 0);
 
@@ -146,19 +656,12 @@ int mp3_decoder_run_internal(struct mp3_decoder *decoder,
         /* no error */
         MP3GetLastFrameInfo(decoder->decoder, &decoder->frame_info);
 
-        /* write to sound device */
-        outputSamps = decoder->frame_info.outputSamps;
-        if (outputSamps > 0) {
-            if (decoder->frame_info.nChans == 1) {
-                for (i = outputSamps - 1; i >= 0; i--) {
-                    buffer[i * 2]       = buffer[i];
-                    buffer[i * 2 + 1]   = buffer[i];
-                }
-                outputSamps *= 2;
-            }
-        }
+        /* already in the requested layout */
+        err = mp3_decoder_trim(decoder, buffer, decoder->frame_info.outputSamps);
+
+        mp3_bpm_tap_run(decoder, buffer, err);
 
-        return outputSamps;
+        return err;
     }
 
     return 0;
@@ -168,24 +671,56 @@ int mp3_decoder_run_internal(struct mp3_decoder *decoder,
  *                  public functions
  *======================================================*/
 void mp3_decoder_init(struct mp3_decoder *decoder) {
+    int i;
+
     /* init read session */
     decoder->read_ptr           = NULL;
     decoder->bytes_left         = 0;
     decoder->frames             = 0;
+    memset(&decoder->frame_info, 0, sizeof(decoder->frame_info));
+
+    decoder->read_buffer        = NULL;
+    for (i = 0; i < MP3_MAX_DECODERS; i++) {
+        if (mp3_fd_owner[i] == NULL) {
+            mp3_fd_owner[i]         = decoder;
+            decoder->read_buffer    = &mp3_fd_buffer[i][0];
+            break;
+        }
+    }
 
+    decoder->decoder            = MP3InitDecoder();
 
-    decoder->read_buffer        = &mp3_fd_buffer[0];
+    mp3_decoder_set_format(decoder, MP3_OUTPUT_STEREO);
 
-    decoder->decoder            = MP3InitDecoder();
+    decoder->out_rate           = 0;
+    decoder->out_taps           = RESAMPLER_TAPS_MEDIUM;
+
+    decoder->skip_samples       = 0;
+    decoder->remain_samples     = -1;
 
-    buf_switch                  = 0;
+    memset(&decoder->bpm_tap, 0, sizeof(decoder->bpm_tap));
 }
 
 void mp3_decoder_detach(struct mp3_decoder *decoder) {
+    int i;
+
     /* release mp3 decoder */
     MP3FreeDecoder(decoder->decoder);
+    decoder->decoder = NULL;
+
+    /* and its input buffer */
+    for (i = 0; i < MP3_MAX_DECODERS; i++) {
+        if (mp3_fd_owner[i] == decoder) {
+            mp3_fd_owner[i] = NULL;
+        }
+    }
+    decoder->read_buffer = NULL;
 }
 
+/*
+ * ret: the decoder, or NULL if out of memory or all
+ *      MP3_MAX_DECODERS decoders are in use
+ */
 struct mp3_decoder *mp3_decoder_create(void) {
     struct mp3_decoder *decoder;
 
@@ -193,6 +728,12 @@ struct mp3_decoder *mp3_decoder_create(void) {
     decoder = (struct mp3_decoder *)malloc(sizeof(struct mp3_decoder));
     if (decoder != NULL) {
         mp3_decoder_init(decoder);
+
+        if (decoder->decoder == NULL || decoder->read_buffer == NULL) {
+            mp3_decoder_detach(decoder);
+            free(decoder);
+            decoder = NULL;
+        }
     }
 
     return decoder;
@@ -208,146 +749,435 @@ void mp3_decoder_delete(struct mp3_decoder *decoder) {
     decoder = NULL;
 }
 
+/*
+ * select the PCM layout of the decoder output
+ *
+ * format is MP3_OUTPUT_NATIVE, MP3_OUTPUT_STEREO or MP3_OUTPUT_MONO,
+ * optionally or'ed with MP3_OUTPUT_32BIT. The playback paths feed
+ * the 16-bit I2S DMA, so 32-bit output is only useful to callers of
+ * mp3_decoder_run_internal() with a frame sized buffer.
+ *
+ * ret: 0, OK
+ *      -1, invalid format
+ */
+int mp3_decoder_set_format(struct mp3_decoder *decoder, int format) {
+    if (MP3SetOutputFormat(decoder->decoder, format) != ERR_MP3_NONE) {
+        return -1;
+    }
+
+    decoder->out_format = format;
+
+    return 0;
+}
+
+/*
+ * hold the output at a fixed sample rate
+ *
+ * rate is the output rate in Hz, 0 delivers every stream at its own
+ * rate. taps is the resampler quality, see RESAMPLER_TAPS_xxx.
+ *
+ * ret: 0, OK
+ *      -1, invalid taps
+ */
+int mp3_decoder_set_rate(struct mp3_decoder *decoder, uint32_t rate, int taps) {
+    if (taps < RESAMPLER_MIN_TAPS || taps > RESAMPLER_MAX_TAPS || (taps & 1)) {
+        return -1;
+    }
+
+    decoder->out_rate   = rate;
+    decoder->out_taps   = taps;
+
+    return 0;
+}
+
+/*
+ * read the start of the stream ahead of time
+ *
+ * Fills the input buffer and parses the first frame header and the
+ * gapless info, so that a track queued behind the playing one starts
+ * without waiting for the file system.
+ *
+ * ret: 0, OK
+ *      -1, no mp3 data
+ */
+int mp3_decoder_prefetch(struct mp3_decoder *decoder) {
+    if (decoder->read_ptr == NULL
+        && mp3_decoder_fill_buffer(decoder) != 0) {
+        return -1;
+    }
+
+    decoder->read_offset = MP3FindSyncWord(decoder->read_ptr, decoder->bytes_left);
+    if (decoder->read_offset < 0) {
+        return -1;
+    }
+
+    decoder->read_ptr   += decoder->read_offset;
+    decoder->bytes_left -= decoder->read_offset;
+
+    mp3_decoder_parse_info(decoder);
+
+    return 0;
+}
+
 /*
  * ret: 0, decoder is running
  *      -1, some error occuerd, should stop the decoding
  */
 int mp3_decoder_run(struct mp3_decoder *decoder) {
-    int16_t         *buffer;
-    int             len = 0;
+    int16_t             *buffer;
+    int16_t             *src;
+    int                 len = 0;
+    int                 channels;
+    int                 out;
+    uint32_t            frames, used;
+    struct resampler    *rs;
+    MP3FrameInfo        info;
+
+    /* the I2S DMA only takes 16-bit samples */
+    if (decoder->out_format & MP3_OUTPUT_32BIT) {
+        return -1;
+    }
 
     /* get a decoder buffer */
-    if (buf_switch == 0) {
-        buffer      = decode_buf1;
-        buf_switch  = 1;
+    buffer = mp3_decoder_get_buffer();
+
+    /*
+     * decode straight into the DMA buffer unless the last frame
+     * needed resampling, which is the case until the rate is known
+     */
+    if (decoder->out_rate == 0
+        || decoder->out_rate == (uint32_t)decoder->frame_info.samprate) {
+        src = buffer;
     } else {
-        buffer      = decode_buf0;
-        buf_switch  = 0;
+        src = tmp_buf;
     }
-    
-    if ((len = mp3_decoder_run_internal(decoder, buffer)) > 0) {
+
+    if ((len = mp3_decoder_run_internal(decoder, src)) <= 0) {
+        return len;
+    }
+
+    rs = mp3_decoder_resampler(decoder);
+    if (rs == NULL) {
+        if (decoder->out_rate != 0
+            && decoder->out_rate != (uint32_t)decoder->frame_info.samprate) {
+            /* out of memory */
+            return -1;
+        }
+
+        /* already at the output rate */
+        if (src != buffer) {
+            memcpy(buffer, src, len * sizeof(int16_t));
+        }
+
         /* call the callback funtion */
         decoder->output_cb(&decoder->frame_info, buffer, len);
+        mp3_decoder_put_buffer();
         return 0;
-    } else {
-        return len;
     }
+
+    /* the rate changed under us, move the frame out of the DMA buffer */
+    if (src == buffer) {
+        memcpy(tmp_buf, src, len * sizeof(int16_t));
+        src = tmp_buf;
+    }
+
+    /* convert in pieces that fit one DMA buffer */
+    info            = decoder->frame_info;
+    info.samprate   = decoder->out_rate;
+
+    channels = mp3_decoder_channels(decoder);
+    frames = len / channels;
+    while (frames > 0) {
+        buffer = mp3_decoder_get_buffer();
+
+        used = frames;
+        out = resampler_process(rs, src, &used, buffer,
+                                MP3_DECODE_BUF_SZ / channels);
+        src     += used * channels;
+        frames  -= used;
+
+        if (out > 0) {
+            info.outputSamps = out * channels;
+            decoder->output_cb(&info, buffer, out * channels);
+            mp3_decoder_put_buffer();
+        }
+    }
+
+    return 0;
 }
 
-void mp3_set_speed(float speed) {
-    cur_ratio = speed;
+/*
+ * change the playback speed of mp3_decoder_run_pvc(), 1.0 is normal
+ *
+ * Can be called from interrupt context. The change is ramped in
+ * over about (change / MP3_RAMP_RATE) seconds.
+ *
+ * ret: 0, OK
+ *      -1, too many pending changes, try again later
+ */
+int mp3_set_speed(float speed) {
+    if (speed <= 0) {
+        return -1;
+    }
+
+    return mp3_post_cmd(MP3_CMD_SPEED, speed);
 }
 
-int mp3_decoder_run_pvc(struct mp3_decoder *decoder) {
-    static sonicStream  stream = NULL;
+/*
+ * change the pitch of mp3_decoder_run_pvc(), 1.0 is unchanged
+ *
+ * Same as mp3_set_speed().
+ */
+int mp3_set_pitch(float pitch) {
+    if (pitch <= 0) {
+        return -1;
+    }
 
-    int16_t             *buffer;
+    return mp3_post_cmd(MP3_CMD_PITCH, pitch);
+}
+
+/*
+ * change the rate of mp3_decoder_run_pvc(), 1.0 is normal
+ *
+ * The rate changes tempo and pitch together, as a turntable does,
+ * and applies on top of speed and pitch. Alone it costs a fraction
+ * of what a speed or pitch change does, there is no pitch search.
+ * Same as mp3_set_speed() otherwise.
+ */
+int mp3_set_rate(float rate) {
+    if (rate <= 0) {
+        return -1;
+    }
+
+    return mp3_post_cmd(MP3_CMD_RATE, rate);
+}
+
+/*
+ * switch the low latency mode of mp3_decoder_run_pvc(), for scrubbing
+ *
+ * Sonic holds about 7 ms instead of 27 ms of the track, as it no longer
+ * looks for pitch periods below 150 Hz. Bass voices sound rougher.
+ * Takes effect on the next frame, same as mp3_set_speed() otherwise.
+ */
+int mp3_set_low_latency(int enable) {
+    return mp3_post_cmd(MP3_CMD_LOW_LATENCY, enable ? 1.0f : 0.0f);
+}
+
+/*
+ * decode one frame and change its speed/pitch/rate with Sonic
+ *
+ * ret: 0, decoder is running
+ *      -1, the track is done or some error occuerd, should stop the decoding.
+ *          Sonic keeps the tail of the track, so the next track is
+ *          spliced to it; mp3_decoder_flush() plays it out after the last.
+ */
+int mp3_decoder_run_pvc(struct mp3_decoder *decoder) {
+    int16_t             *src;
 
     int                 len;
-    static int          buf_pos = 0;
 
-    /* get a decoder buffer */
-    if (buf_switch == 0) {
-        buffer      = decode_buf1;
-        buf_switch  = 1;
-    } else {
-        buffer      = decode_buf0;
-        buf_switch  = 0;
-    }
-
-reread:
-    if (stream != NULL) {
-        len = sonicReadShortFromStream(stream, &buffer[buf_pos],
-                                       (MP3_DECODE_BUF_SZ - buf_pos) / cur_channel);
-        if (len == (MP3_DECODE_BUF_SZ - buf_pos) / cur_channel) {
-            /* call the callback funtion */
-            decoder->output_cb(&decoder->frame_info, buffer, MP3_DECODE_BUF_SZ);
-            buf_pos = 0;
-            return 0;
-        } else if (len > 0) {
-            buf_pos += len * cur_channel;
-        }
+    uint32_t            frames, used;
+    struct resampler    *rs;
+
+    /* the I2S DMA only takes 16-bit samples */
+    if (decoder->out_format & MP3_OUTPUT_32BIT) {
+        return -1;
     }
 
-    /* cannot get enough data, write some samples to Sonic */
-    if ((len = mp3_decoder_run_internal(decoder, tmp_buf)) > 0) {
-        /* call the callback funtion */
-        if (stream == NULL
-            || cur_srate != decoder->frame_info.samprate
-            || cur_channel != 2) {
+    if (mp3_pvc_bypass(decoder)) {
+        return mp3_decoder_run(decoder);
+    }
 
-            cur_srate   = decoder->frame_info.samprate;
-            cur_channel = 2;
+    if ((len = mp3_decoder_run_internal(decoder, tmp_buf)) <= 0) {
+        /* at the end of the track Sonic keeps its samples for the next one */
+        return len;
+    }
 
-            if (stream) sonicDestroyStream(stream);
-            stream = sonicCreateStream(cur_srate, 2);
-            if (stream == NULL) {
-                return -1;
-            }
+    if (pvc_stream == NULL
+        || cur_srate != mp3_decoder_rate(decoder)
+        || cur_channel != mp3_decoder_channels(decoder)) {
+
+        /* the samples of the old format go out first */
+        if (pvc_stream) {
+            mp3_decoder_pvc_drain(decoder);
         }
-        sonicSetSpeed(stream, cur_ratio);
-	    sonicWriteShortToStream(stream, tmp_buf, len / 2);
-    } else if (len == -1) {
-        /* some thing error, destroy the sonic stream */
-        if (stream) {
-            sonicDestroyStream(stream);
-            stream = NULL;
+
+        cur_srate   = mp3_decoder_rate(decoder);
+        cur_channel = mp3_decoder_channels(decoder);
+
+        pvc_stream = sonicCreateStream(cur_srate, cur_channel);
+        if (pvc_stream == NULL) {
+            return -1;
         }
-        buf_pos = 0;
+    }
+
+    rs = mp3_decoder_resampler(decoder);
+    if (rs == NULL) {
+        if (cur_srate != decoder->frame_info.samprate) {
+            /* out of memory */
+            return -1;
+        }
+        return mp3_pvc_write(decoder, tmp_buf, len / cur_channel);
+    }
+
+    /* convert to the output rate on the way into Sonic */
+    src     = tmp_buf;
+    frames  = len / cur_channel;
+    while (frames > 0) {
+        used = frames;
+        len = resampler_process(rs, src, &used, rs_buf,
+                                MP3_RESAMPLE_BUF_SZ / cur_channel);
+        src     += used * cur_channel;
+        frames  -= used;
+
+        if (mp3_pvc_write(decoder, rs_buf, len) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * play out what the output pipeline still holds
+ *
+ * Consecutive tracks are spliced, so the end of a track stays in the
+ * resampler and in Sonic until the next track pushes it out. Call this
+ * with the decoder of the last track, before deleting it.
+ */
+void mp3_decoder_flush(struct mp3_decoder *decoder) {
+    struct resampler    *rs = out_resampler;
+    int16_t             *buffer;
+    uint32_t            frames;
+    int                 out;
+    MP3FrameInfo        info;
+
+    if (rs != NULL) {
+        /* silence pushes the last input samples through the filter */
+        frames = rs->taps / 2;
+        memset(tmp_buf, 0, frames * rs->channels * sizeof(int16_t));
+
+        buffer = (pvc_stream != NULL) ? rs_buf : mp3_decoder_get_buffer();
+        out = resampler_process(rs, tmp_buf, &frames, buffer,
+                                MP3_RESAMPLE_BUF_SZ / rs->channels);
+        if (out > 0 && pvc_stream != NULL) {
+            mp3_pvc_write(decoder, rs_buf, out);
+        } else if (out > 0) {
+            info                = decoder->frame_info;
+            info.samprate       = rs->out_rate;
+            info.outputSamps    = out * rs->channels;
+            decoder->output_cb(&info, buffer, out * rs->channels);
+            mp3_decoder_put_buffer();
+        }
+
+        resampler_delete(rs);
+        out_resampler = NULL;
+    }
+
+    if (pvc_stream != NULL) {
+        mp3_decoder_pvc_drain(decoder);
+    }
+}
+
+/*
+ * the memory mp3_decoder_set_bpm_tap() needs for streams of sample_rate
+ */
+uint32_t mp3_bpm_tap_mem_size(uint32_t sample_rate) {
+    return MP3_BPM_RING_SZ * sizeof(int16_t) + bpm_detector_mem_size(NULL, sample_rate);
+}
+
+/*
+ * analyse the tempo while the track is decoded
+ *
+ * mem is the memory for the ring and the detector, at least
+ * mp3_bpm_tap_mem_size() of the stream rate, 8-byte aligned, NULL to
+ * switch the tap off. It is not used by anything else while the
+ * decoder runs, but may be given to the next decoder afterwards.
+ * max_hops caps the detector work per frame, a stereo 44.1 kHz frame
+ * brings 18 hops. bpm_cb is called once, when the tempo is stable.
+ *
+ * ret: 0, OK
+ *      -1, invalid parameters
+ */
+int mp3_decoder_set_bpm_tap(struct mp3_decoder *decoder,
+                            void *mem, uint32_t size, uint32_t max_hops,
+                            void (*bpm_cb)(struct mp3_decoder *decoder, uint32_t bpm)) {
+    struct mp3_bpm_tap *tap = &decoder->bpm_tap;
+
+    if (mem != NULL && (size <= MP3_BPM_RING_SZ * sizeof(int16_t) || max_hops == 0)) {
         return -1;
     }
 
-    goto reread;
+    memset(tap, 0, sizeof(struct mp3_bpm_tap));
+    tap->mem        = mem;
+    tap->size       = size;
+    tap->max_hops   = max_hops;
+    tap->bpm_cb     = bpm_cb;
+
+    return 0;
 }
 
 /*
  * BPM detection
  */
 int mp3_bpm_detect_run(struct mp3_decoder *decoder) {
-    uint8_t         bpm_init_flag = 0;
+    bpm_detector_t  *det = NULL;
 
     uint16_t        bpm_num_samples = 0;
     uint16_t        bpm_step = 0;
 
     uint16_t        bpm = 0;
 
+    int             srate = 0;
+    int             channel = 0;
+
     int             len;
 
     int             pos = 0;
     int             left = 0;
+    int             done = 0;
+
+    /* the format of the caller, put back on every return */
+    int             format = decoder->out_format;
 
-    while ((len = mp3_decoder_run_internal(decoder, tmp_buf)) != -1) {
-        if (cur_srate != decoder->frame_info.samprate
-            || cur_channel != decoder->frame_info.nChans
-            || bpm_init_flag == 0) {
+    /* let the decoder downmix, BPM only looks at mono samples */
+    mp3_decoder_set_format(decoder, MP3_OUTPUT_MONO);
 
-            cur_srate   = decoder->frame_info.samprate;
-            cur_channel = 2;
+    while (!done && (len = mp3_decoder_run_internal(decoder, tmp_buf)) != -1) {
+        if (srate != decoder->frame_info.samprate
+            || channel != mp3_decoder_channels(decoder)
+            || det == NULL) {
 
-            BPM_release();
-            BPM_init(cur_srate, cur_channel);
+            srate   = decoder->frame_info.samprate;
+            channel = mp3_decoder_channels(decoder);
 
-            BPM_set_freq_band(0, 4000);
-            bpm_num_samples = BPM_num_of_samples();
-            bpm_step = bpm_num_samples * cur_channel;
+            bpm_detector_destroy(det);
+            det = bpm_detector_create(NULL, srate, channel);
+            if (det == NULL) {
+                break;
+            }
 
-            bpm_init_flag = 1;
+            bpm_detector_set_freq_band(det, 0, 4000);
+            bpm_num_samples = bpm_detector_num_of_samples(det);
+            bpm_step = bpm_num_samples * channel;
         }
 
         left += len;
         for (pos = 0; pos < left - bpm_step; pos += bpm_step) {
-            if (BPM_put_samples(&tmp_buf[pos], bpm_num_samples) == 1) {
+            if (bpm_detector_put_samples(det, &tmp_buf[pos], bpm_num_samples) == 1) {
                 /* BPM detect is done, get the value */
-                bpm             = BPM_get_bpm();
-
-                /* release the BPM module */
-                bpm_init_flag   = 0;
-                BPM_release();
-                return bpm;
+                bpm = bpm_detector_get_bpm(det);
+                done = 1;
+                break;
             }
         }
         left -= pos;
     }
-    
-    return 0;
+
+    /* release the BPM module */
+    bpm_detector_destroy(det);
+
+    mp3_decoder_set_format(decoder, format);
+
+    return bpm;
 }
@@ -23,6 +23,33 @@
 #ifndef _MP3_H_
 #define _MP3_H_
 
+struct mp3_decoder;
+
+/*
+ * BPM analysis of the decoded PCM on the fly, before resampling and
+ * time stretch. The samples are mixed to mono into a ring, and the
+ * detector works through at most max_hops hops of it per frame.
+ */
+struct mp3_bpm_tap {
+    void                    *mem;
+    uint32_t                size;
+    uint32_t                max_hops;
+
+    /* set up for this stream rate, 0 if not yet */
+    uint32_t                srate;
+    struct bpm_detector     *det;
+
+    int16_t                 *ring;
+    uint32_t                head, tail;
+
+    /* samples lost because the ring was full */
+    uint32_t                dropped;
+
+    /* the tempo, 0 until it is stable */
+    uint32_t                bpm;
+    void                    (*bpm_cb)(struct mp3_decoder *decoder, uint32_t bpm);
+};
+
 struct mp3_decoder {
     /* mp3 information */
     HMP3Decoder     decoder;
@@ -40,26 +67,69 @@ struct mp3_decoder {
     int32_t         read_offset;
     uint32_t        bytes_left;
 
+    /*
+     * PCM layout produced by the decoder, MP3_OUTPUT_xxx in mp3dec.h.
+     * The polyphase filter writes this layout directly, so no
+     * up/down mix pass is needed afterwards.
+     * Default is MP3_OUTPUT_STEREO, which is what the I2S output expects.
+     */
+    int             out_format;
+
+    /*
+     * Output sample rate. 0 delivers the stream rate, so the output
+     * has to follow frame_info.samprate. Otherwise the PCM is converted
+     * to out_rate by a polyphase resampler of out_taps taps, for when
+     * the I2S clock must not be switched between tracks.
+     */
+    uint32_t        out_rate;
+    int             out_taps;
+
+    /*
+     * gapless playback, from the Xing/Info and LAME tags of the first
+     * frame, counted in samples per channel.
+     * skip_samples is the priming still to be dropped (the Info frame,
+     * encoder delay and decoder delay), remain_samples what is left
+     * of the track before the encoder padding, -1 if unknown.
+     */
+    uint32_t        skip_samples;
+    int32_t         remain_samples;
+
     /* 
      * This is the output callback function.
      * It is called after each frame of MPEG audio data
      * has been completely decoded.
      * The purpose of this callback is
      * to output (or play) the decoded PCM audio.
+     * header->samprate is the rate of the PCM in buffer,
+     * i.e. out_rate when resampling.
      */
     uint32_t        (*output_cb)(MP3FrameInfo *header,
                                  int16_t *buffer,
                                  uint32_t length);
+
+    /* see mp3_decoder_set_bpm_tap() */
+    struct mp3_bpm_tap  bpm_tap;
 };
 
 void mp3_decoder_init(struct mp3_decoder *decoder);
 void mp3_decoder_detach(struct mp3_decoder *decoder);
 struct mp3_decoder *mp3_decoder_create(void);
 void mp3_decoder_delete(struct mp3_decoder *decoder);
+int mp3_decoder_set_format(struct mp3_decoder *decoder, int format);
+int mp3_decoder_set_rate(struct mp3_decoder *decoder, uint32_t rate, int taps);
+int mp3_decoder_prefetch(struct mp3_decoder *decoder);
 int mp3_decoder_run(struct mp3_decoder *decoder);
+void mp3_decoder_flush(struct mp3_decoder *decoder);
 
-void mp3_set_speed(float speed);
+int mp3_set_speed(float speed);
+int mp3_set_pitch(float pitch);
+int mp3_set_rate(float rate);
+int mp3_set_low_latency(int enable);
 int mp3_decoder_run_pvc(struct mp3_decoder *decoder);
 
+uint32_t mp3_bpm_tap_mem_size(uint32_t sample_rate);
+int mp3_decoder_set_bpm_tap(struct mp3_decoder *decoder,
+                            void *mem, uint32_t size, uint32_t max_hops,
+                            void (*bpm_cb)(struct mp3_decoder *decoder, uint32_t bpm));
 int mp3_bpm_detect_run(struct mp3_decoder *decoder);
 #endif
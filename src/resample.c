@@ -0,0 +1,242 @@
+/*
+ *  Name:    resample.c
+ *
+ *  Purpose: fixed-point polyphase sample rate converter
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "resample.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+#ifndef M_PI
+#define M_PI                3.14159265358979323846
+#endif
+
+/* keep the pass band a little below the lower Nyquist frequency */
+#define RESAMPLER_CUTOFF    0.90f
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+static inline int16_t resampler_clip(int32_t value) {
+    value = (value + (1 << 14)) >> 15;
+
+    if (value > 32767) {
+        return 32767;
+    } else if (value < -32768) {
+        return -32768;
+    }
+
+    return value;
+}
+
+/*
+ * windowed sinc, one row per phase. Row p holds the taps for an
+ * output point p / RESAMPLER_PHASES samples after the center tap,
+ * the extra last row lets the coefficients be interpolated.
+ */
+static void resampler_make_coefs(struct resampler *rs) {
+    int     p, k;
+    int     taps = rs->taps;
+    float   fc, t, x, w, sum;
+    float   row[RESAMPLER_MAX_TAPS];
+
+    /* cut-off relative to the input rate, 0.5 is the input Nyquist */
+    fc = 0.5f * RESAMPLER_CUTOFF;
+    if (rs->out_rate < rs->in_rate) {
+        fc = fc * rs->out_rate / rs->in_rate;
+    }
+
+    for (p = 0; p <= RESAMPLER_PHASES; p++) {
+        sum = 0;
+        for (k = 0; k < taps; k++) {
+            t = (float)(k - (taps / 2 - 1)) - (float)p / RESAMPLER_PHASES;
+
+            /* sinc */
+            x = 2.0f * fc * t;
+            if (x == 0.0f) {
+                row[k] = 2.0f * fc;
+            } else {
+                row[k] = 2.0f * fc * sinf((float)M_PI * x) / ((float)M_PI * x);
+            }
+
+            /* Blackman window over the filter length */
+            w = 0.42f + 0.5f * cosf(2.0f * (float)M_PI * t / taps)
+                + 0.08f * cosf(4.0f * (float)M_PI * t / taps);
+            if (t <= -taps / 2.0f || t >= taps / 2.0f) {
+                w = 0;
+            }
+
+            row[k] *= w;
+            sum += row[k];
+        }
+
+        /* unity gain at DC for every phase */
+        for (k = 0; k < taps; k++) {
+            rs->coefs[p * taps + k] = (int16_t)lrintf(row[k] / sum * 32767.0f);
+        }
+    }
+}
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+
+/*
+ * create a converter from in_rate to out_rate
+ *
+ * channels is 1 or 2 (interleaved), taps is the filter length per
+ * output sample, see RESAMPLER_TAPS_xxx.
+ *
+ * ret: the converter, or NULL if parameters are invalid or out of memory
+ */
+struct resampler *resampler_create(uint32_t in_rate, uint32_t out_rate,
+                                   int channels, int taps) {
+    struct resampler *rs;
+
+    if (in_rate == 0 || out_rate == 0
+        || channels < 1 || channels > 2
+        || taps < RESAMPLER_MIN_TAPS || taps > RESAMPLER_MAX_TAPS
+        || (taps & 1)) {
+        return NULL;
+    }
+
+    rs = (struct resampler *)calloc(1, sizeof(struct resampler));
+    if (rs == NULL) {
+        return NULL;
+    }
+
+    rs->in_rate     = in_rate;
+    rs->out_rate    = out_rate;
+    rs->channels    = channels;
+    rs->taps        = taps;
+    rs->step_int    = in_rate / out_rate;
+    rs->step_frac   = in_rate % out_rate;
+
+    rs->coefs = (int16_t *)malloc((RESAMPLER_PHASES + 1) * taps * sizeof(int16_t));
+    rs->buf = (int16_t *)malloc((taps + RESAMPLER_BLOCK) * channels * sizeof(int16_t));
+    if (rs->coefs == NULL || rs->buf == NULL) {
+        resampler_delete(rs);
+        return NULL;
+    }
+
+    resampler_make_coefs(rs);
+    resampler_reset(rs);
+
+    return rs;
+}
+
+void resampler_delete(struct resampler *rs) {
+    if (rs->coefs) free(rs->coefs);
+    if (rs->buf) free(rs->buf);
+
+    free(rs);
+}
+
+/*
+ * forget the buffered input, e.g. after a seek
+ */
+void resampler_reset(struct resampler *rs) {
+    /* prime with silence so the first output lines up with the first input */
+    rs->buf_frames  = rs->taps / 2 - 1;
+    memset(rs->buf, 0, rs->buf_frames * rs->channels * sizeof(int16_t));
+
+    rs->pos         = 0;
+    rs->frac        = 0;
+}
+
+/*
+ * convert interleaved samples
+ *
+ * *in_frames is the number of frames available at in, and is
+ * updated to the number of frames consumed. Input that is not
+ * consumed (because out is full) must be passed again.
+ *
+ * ret: the number of frames written to out
+ */
+int resampler_process(struct resampler *rs,
+                      const int16_t *in, uint32_t *in_frames,
+                      int16_t *out, uint32_t out_frames) {
+    int             k;
+    int             taps = rs->taps;
+    int             channels = rs->channels;
+
+    uint32_t        n, t, p, f;
+    uint32_t        consumed = 0;
+    uint32_t        produced = 0;
+
+    int32_t         acc_l, acc_r;
+    int32_t         c;
+
+    const int16_t   *c0, *c1, *s;
+
+    do {
+        /* top up the history with new input */
+        n = taps + RESAMPLER_BLOCK - rs->buf_frames;
+        if (n > *in_frames - consumed) {
+            n = *in_frames - consumed;
+        }
+        memcpy(rs->buf + rs->buf_frames * channels, in + consumed * channels,
+               n * channels * sizeof(int16_t));
+        rs->buf_frames  += n;
+        consumed        += n;
+
+        /* one dot product per output frame */
+        while (produced < out_frames && rs->pos + taps <= rs->buf_frames) {
+            t   = rs->frac * RESAMPLER_PHASES;
+            p   = t / rs->out_rate;
+            f   = ((t - p * rs->out_rate) << 15) / rs->out_rate;
+
+            c0  = rs->coefs + p * taps;
+            c1  = c0 + taps;
+            s   = rs->buf + rs->pos * channels;
+
+            acc_l = 0;
+            acc_r = 0;
+            if (channels == 2) {
+                for (k = 0; k < taps; k++) {
+                    c = c0[k] + (((c1[k] - c0[k]) * (int32_t)f) >> 15);
+                    acc_l += c * s[2 * k];
+                    acc_r += c * s[2 * k + 1];
+                }
+                out[2 * produced]       = resampler_clip(acc_l);
+                out[2 * produced + 1]   = resampler_clip(acc_r);
+            } else {
+                for (k = 0; k < taps; k++) {
+                    c = c0[k] + (((c1[k] - c0[k]) * (int32_t)f) >> 15);
+                    acc_l += c * s[k];
+                }
+                out[produced] = resampler_clip(acc_l);
+            }
+            produced++;
+
+            /* advance by in_rate / out_rate input frames */
+            rs->pos     += rs->step_int;
+            rs->frac    += rs->step_frac;
+            if (rs->frac >= rs->out_rate) {
+                rs->frac -= rs->out_rate;
+                rs->pos++;
+            }
+        }
+
+        /* drop the input frames no later output needs */
+        if (rs->pos >= rs->buf_frames) {
+            rs->pos         -= rs->buf_frames;
+            rs->buf_frames  = 0;
+        } else if (rs->pos > 0) {
+            rs->buf_frames  -= rs->pos;
+            memmove(rs->buf, rs->buf + rs->pos * channels,
+                    rs->buf_frames * channels * sizeof(int16_t));
+            rs->pos         = 0;
+        }
+    } while (produced < out_frames && consumed < *in_frames);
+
+    *in_frames = consumed;
+
+    return produced;
+}
@@ -0,0 +1,61 @@
+/*
+ *  Name:    resample.h
+ *
+ *  Purpose: fixed-point polyphase sample rate converter
+ *
+ */
+
+#ifndef _RESAMPLE_H_
+#define _RESAMPLE_H_
+
+#include <stdint.h>
+
+/*
+ * number of taps per output sample, i.e. the quality setting.
+ * Any even number between RESAMPLER_MIN_TAPS and RESAMPLER_MAX_TAPS
+ * is accepted, these are the usual choices.
+ */
+#define RESAMPLER_TAPS_LOW          8
+#define RESAMPLER_TAPS_MEDIUM       16
+#define RESAMPLER_TAPS_HIGH         32
+
+#define RESAMPLER_MIN_TAPS          4
+#define RESAMPLER_MAX_TAPS          64
+
+/* number of filter phases, coefficients are interpolated between them */
+#define RESAMPLER_PHASES            64
+
+/* input frames buffered per pass */
+#define RESAMPLER_BLOCK             256
+
+struct resampler {
+    uint32_t        in_rate;
+    uint32_t        out_rate;
+    int             channels;
+    int             taps;
+
+    /* (RESAMPLER_PHASES + 1) * taps coefficients, Q15 */
+    int16_t         *coefs;
+
+    /* (taps + RESAMPLER_BLOCK) * channels input history */
+    int16_t         *buf;
+    uint32_t        buf_frames;
+
+    /* read position: buf index of the first tap, plus frac / out_rate */
+    uint32_t        pos;
+    uint32_t        frac;
+
+    /* in_rate / out_rate as integer and remainder */
+    uint32_t        step_int;
+    uint32_t        step_frac;
+};
+
+struct resampler *resampler_create(uint32_t in_rate, uint32_t out_rate,
+                                   int channels, int taps);
+void resampler_delete(struct resampler *rs);
+void resampler_reset(struct resampler *rs);
+int resampler_process(struct resampler *rs,
+                      const int16_t *in, uint32_t *in_frames,
+                      int16_t *out, uint32_t out_frames);
+
+#endif
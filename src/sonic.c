@@ -21,22 +21,65 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
-#ifdef SONIC_USE_SIN
-#include <math.h>
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
+#include <stdint.h>
+#if !defined(__ARM_ARCH_7EM__) && defined(__SSE2__) && !defined(SONIC_USE_SIN)
+#include <emmintrin.h>
 #endif
 #include "sonic.h"
 
+/* The overlap-add ramps run on a Q31 phase, 0 at the start of a fade in and
+   SONIC_RAMP_ONE at its end, so a ramp costs one division per period rather
+   than one per sample.  The gains are Q15. */
+#define SONIC_RAMP_ONE 0x7fffffffu
+
+/* The rate resampler steps through its input in Q16 samples */
+#define SONIC_RATE_SHIFT 16
+#define SONIC_RATE_ONE (1 << SONIC_RATE_SHIFT)
+
+#ifdef SONIC_USE_SIN
+/* sin(x*pi/2) in Q15 for x = 0 .. 1, interpolated between the entries */
+#define SONIC_SIN_BITS 7
+static const short sonicSinTable[(1 << SONIC_SIN_BITS) + 1] = {
+        0,   402,   804,  1206,  1608,  2009,  2410,  2811,
+     3212,  3612,  4011,  4410,  4808,  5205,  5602,  5998,
+     6393,  6786,  7179,  7571,  7962,  8351,  8739,  9126,
+     9512,  9896, 10278, 10659, 11039, 11417, 11793, 12167,
+    12539, 12910, 13279, 13645, 14010, 14372, 14732, 15090,
+    15446, 15800, 16151, 16499, 16846, 17189, 17530, 17869,
+    18204, 18537, 18868, 19195, 19519, 19841, 20159, 20475,
+    20787, 21096, 21403, 21705, 22005, 22301, 22594, 22884,
+    23170, 23452, 23731, 24007, 24279, 24547, 24811, 25072,
+    25329, 25582, 25832, 26077, 26319, 26556, 26790, 27019,
+    27245, 27466, 27683, 27896, 28105, 28310, 28510, 28706,
+    28898, 29085, 29268, 29447, 29621, 29791, 29956, 30117,
+    30273, 30424, 30571, 30714, 30852, 30985, 31113, 31237,
+    31356, 31470, 31580, 31685, 31785, 31880, 31971, 32057,
+    32137, 32213, 32285, 32351, 32412, 32469, 32521, 32567,
+    32609, 32646, 32678, 32705, 32728, 32745, 32757, 32765,
+    32767
+};
+#endif
+
+/* The input, pitch and output queues are rings, so taking samples off their
+   front moves nothing.  The input and pitch queues are read maxRequired samples
+   at a time, so the first maxRequired samples of their rings are mirrored after
+   the end.  The output queue is written up to outputSlack samples at a time, past
+   the end of its ring if need be, and that part is folded back to the start. */
 struct sonicStreamStruct {
     short *inputBuffer;
     short *outputBuffer;
     short *pitchBuffer;
     short *downSampleBuffer;
+    short *rateBuffer;
+    int inputStart;
+    int pitchStart;
+    int rateStart;
+    int outputStart;
+    int outputSlack;
     float speed;
     float volume;
     float pitch;
+    float rate;
     int quality;
     int numChannels;
     int inputBufferSize;
@@ -45,14 +88,26 @@ struct sonicStreamStruct {
     int numInputSamples;
     int numOutputSamples;
     int numPitchSamples;
+    int rateBufferSize;
+    int numRateSamples;
+    /* Q16, from the first sample of the queue the rate resampler reads */
+    uint32_t ratePosition;
     int minPeriod;
     int maxPeriod;
+    /* Buffers are sized and mirrored for maxRequired, the low latency mode reads less */
     int maxRequired;
+    int lowLatency;
+    int lowLatencyMaxPeriod;
     int remainingInputToCopy;
     int sampleRate;
     int prevPeriod;
     int prevMaxDiff;
     int prevMinDiff;
+    /* Set while outputBuffer points at the caller's buffer, see sonicWriteShortToBuffer */
+    int externalOutput;
+    int numExternalSamples;
+    short *ownOutputBuffer;
+    int ownOutputBufferSize;
 };
 
 /* Just used for debugging */
@@ -122,6 +177,36 @@ void sonicSetPitch(
     stream->pitch = pitch;
 }
 
+/* Get the rate of the stream. */
+float sonicGetRate(
+    sonicStream stream)
+{
+    return stream->rate;
+}
+
+/* Set the rate of the stream, which changes the speed and pitch together. */
+void sonicSetRate(
+    sonicStream stream,
+    float rate)
+{
+    stream->rate = rate;
+}
+
+/* Get the low latency mode. */
+int sonicGetLowLatency(
+    sonicStream stream)
+{
+    return stream->lowLatency;
+}
+
+/* Set the low latency mode. */
+void sonicSetLowLatency(
+    sonicStream stream,
+    int lowLatency)
+{
+    stream->lowLatency = lowLatency;
+}
+
 /* Get the quality setting. */
 int sonicGetQuality(
     sonicStream stream)
@@ -182,6 +267,9 @@ void sonicDestroyStream(
     if(stream->downSampleBuffer != NULL) {
 	free(stream->downSampleBuffer);
     }
+    if(stream->rateBuffer != NULL) {
+	free(stream->rateBuffer);
+    }
     free(stream);
 }
 
@@ -200,19 +288,20 @@ sonicStream sonicCreateStream(
 	return NULL;
     }
     stream->inputBufferSize = maxRequired;
-    stream->inputBuffer = (short *)calloc(maxRequired, sizeof(short)*numChannels);
+    stream->inputBuffer = (short *)calloc(2*maxRequired, sizeof(short)*numChannels);
     if(stream->inputBuffer == NULL) {
 	sonicDestroyStream(stream);
 	return NULL;
     }
     stream->outputBufferSize = maxRequired;
-    stream->outputBuffer = (short *)calloc(maxRequired, sizeof(short)*numChannels);
+    stream->outputSlack = maxRequired;
+    stream->outputBuffer = (short *)calloc(2*maxRequired, sizeof(short)*numChannels);
     if(stream->outputBuffer == NULL) {
 	sonicDestroyStream(stream);
 	return NULL;
     }
     stream->pitchBufferSize = maxRequired;
-    stream->pitchBuffer = (short *)calloc(maxRequired, sizeof(short)*numChannels);
+    stream->pitchBuffer = (short *)calloc(2*maxRequired, sizeof(short)*numChannels);
     if(stream->pitchBuffer == NULL) {
 	sonicDestroyStream(stream);
 	return NULL;
@@ -220,6 +309,7 @@ sonicStream sonicCreateStream(
     stream->downSampleBuffer = (short *)calloc(maxRequired, sizeof(short));
     stream->speed = 1.0f;
     stream->pitch = 1.0f;
+    stream->rate = 1.0f;
     stream->volume = 1.0f;
     stream->quality = 0;
     stream->sampleRate = sampleRate;
@@ -227,41 +317,240 @@ sonicStream sonicCreateStream(
     stream->minPeriod = minPeriod;
     stream->maxPeriod = maxPeriod;
     stream->maxRequired = maxRequired;
+    stream->lowLatencyMaxPeriod = sampleRate/SONIC_LOW_LATENCY_MIN_PITCH;
+    if(stream->lowLatencyMaxPeriod < minPeriod) {
+	stream->lowLatencyMaxPeriod = minPeriod;
+    }
     return stream;
 }
 
-/* Enlarge the output buffer if needed. */
-static int enlargeOutputBufferIfNeeded(
+/* The ring index of the sample position samples after start. */
+static int ringIndex(
+    int size,
+    int start,
+    int position)
+{
+    int index = start + position;
+
+    return index >= size? index - size : index;
+}
+
+/* Copy the first mirror samples of a ring, where numSamples samples from index
+   were just written, after its end. */
+static void ringMirror(
+    short *buffer,
+    int size,
+    int mirror,
+    int index,
+    int numSamples,
+    int numChannels)
+{
+    int end = index + numSamples;
+
+    if(index < mirror) {
+	memcpy(buffer + (size + index)*numChannels, buffer + index*numChannels,
+	    ((end < mirror? end : mirror) - index)*sizeof(short)*numChannels);
+    }
+    if(end > size) {
+	end -= size;
+	memcpy(buffer + size*numChannels, buffer,
+	    (end < mirror? end : mirror)*sizeof(short)*numChannels);
+    }
+}
+
+/* Copy numSamples samples (silence if samples is NULL) into a ring from index,
+   and mirror the first mirror samples of the ring. */
+static void ringWrite(
+    short *buffer,
+    int size,
+    int mirror,
+    int index,
+    short *samples,
+    int numSamples,
+    int numChannels)
+{
+    int first = size - index;
+
+    if(first > numSamples) {
+	first = numSamples;
+    }
+    if(samples != NULL) {
+	memcpy(buffer + index*numChannels, samples, first*sizeof(short)*numChannels);
+	memcpy(buffer, samples + first*numChannels,
+	    (numSamples - first)*sizeof(short)*numChannels);
+    } else {
+	memset(buffer + index*numChannels, 0, first*sizeof(short)*numChannels);
+	memset(buffer, 0, (numSamples - first)*sizeof(short)*numChannels);
+    }
+    ringMirror(buffer, size, mirror, index, numSamples, numChannels);
+}
+
+/* Copy numSamples samples out of a ring from index. */
+static void ringRead(
+    short *buffer,
+    int size,
+    int index,
+    short *samples,
+    int numSamples,
+    int numChannels)
+{
+    int first = size - index;
+
+    if(first > numSamples) {
+	first = numSamples;
+    }
+    memcpy(samples, buffer + index*numChannels, first*sizeof(short)*numChannels);
+    memcpy(samples + first*numChannels, buffer, (numSamples - first)*sizeof(short)*numChannels);
+}
+
+/* Move the numSamples samples of a ring from start to a new one of newSize
+   samples and extra ones after its end, where they start at 0.  Return NULL if
+   out of memory, the old ring is kept then. */
+static short *ringResize(
+    short *buffer,
+    int size,
+    int start,
+    int numSamples,
+    int newSize,
+    int extra,
+    int numChannels)
+{
+    short *newBuffer = (short *)malloc((newSize + extra)*sizeof(short)*numChannels);
+
+    if(newBuffer == NULL) {
+	return NULL;
+    }
+    ringRead(buffer, size, start, newBuffer, numSamples, numChannels);
+    free(buffer);
+    return newBuffer;
+}
+
+/* The end of the output queue, where numSamples samples can be written once
+   enlargeOutputBufferIfNeeded made room for them, followed by commitOutput. */
+static short *outputTail(
+    sonicStream stream)
+{
+    return stream->outputBuffer + ringIndex(stream->outputBufferSize, stream->outputStart,
+	stream->numOutputSamples)*stream->numChannels;
+}
+
+/* Add numSamples samples written at outputTail to the output queue. */
+static void commitOutput(
+    sonicStream stream,
+    int numSamples)
+{
+    int end = ringIndex(stream->outputBufferSize, stream->outputStart,
+	stream->numOutputSamples) + numSamples;
+
+    if(end > stream->outputBufferSize) {
+	end -= stream->outputBufferSize;
+	memcpy(stream->outputBuffer, stream->outputBuffer +
+	    stream->outputBufferSize*stream->numChannels, end*sizeof(short)*stream->numChannels);
+    }
+    stream->numOutputSamples += numSamples;
+}
+
+/* Take numSamples samples off the front of the output queue. */
+static void removeOutputSamples(
     sonicStream stream,
     int numSamples)
 {
-    if(stream->numOutputSamples + numSamples > stream->outputBufferSize) {
-	stream->outputBufferSize += (stream->outputBufferSize >> 1) + numSamples;
-	stream->outputBuffer = (short *)realloc(stream->outputBuffer,
-	    stream->outputBufferSize*sizeof(short)*stream->numChannels);
-	if(stream->outputBuffer == NULL) {
+    stream->numOutputSamples -= numSamples;
+    if(stream->numOutputSamples == 0) {
+	stream->outputStart = 0;
+    } else {
+	stream->outputStart = ringIndex(stream->outputBufferSize, stream->outputStart,
+	    numSamples);
+    }
+}
+
+/* Enlarge the output buffer if needed, for numSamples more samples, and for
+   numContiguous of them written at once at outputTail. */
+static int enlargeOutputRing(
+    sonicStream stream,
+    int numSamples,
+    int numContiguous)
+{
+    int size = stream->outputBufferSize;
+    int slack = stream->outputSlack;
+    short *buffer;
+
+    if(stream->externalOutput &&
+	    stream->numOutputSamples + numSamples > stream->outputBufferSize) {
+	/* The caller's buffer is full, continue in our own */
+	stream->numExternalSamples = stream->numOutputSamples;
+	stream->outputBuffer = stream->ownOutputBuffer;
+	stream->outputBufferSize = stream->ownOutputBufferSize;
+	stream->outputStart = 0;
+	stream->numOutputSamples = 0;
+	stream->externalOutput = 0;
+    }
+    /* The caller's buffer starts at 0 and never wraps, so it needs no slack */
+    if(stream->externalOutput) {
+	return 1;
+    }
+    if(stream->numOutputSamples + numSamples > size) {
+	size += (size >> 1) + numSamples;
+    }
+    if(numContiguous > slack) {
+	slack = numContiguous;
+    }
+    if(size != stream->outputBufferSize || slack != stream->outputSlack) {
+	buffer = ringResize(stream->outputBuffer, stream->outputBufferSize,
+	    stream->outputStart, stream->numOutputSamples, size, slack, stream->numChannels);
+	if(buffer == NULL) {
 	    return 0;
 	}
+	stream->outputBuffer = buffer;
+	stream->outputBufferSize = size;
+	stream->outputSlack = slack;
+	stream->outputStart = 0;
     }
     return 1;
 }
 
+/* Enlarge the output buffer if needed, for numSamples samples written at once
+   at outputTail. */
+static int enlargeOutputBufferIfNeeded(
+    sonicStream stream,
+    int numSamples)
+{
+    return enlargeOutputRing(stream, numSamples, numSamples);
+}
+
 /* Enlarge the input buffer if needed. */
 static int enlargeInputBufferIfNeeded(
     sonicStream stream,
     int numSamples)
 {
-    if(stream->numInputSamples + numSamples > stream->inputBufferSize) {
-	stream->inputBufferSize += (stream->inputBufferSize >> 1) + numSamples;
-	stream->inputBuffer = (short *)realloc(stream->inputBuffer,
-	    stream->inputBufferSize*sizeof(short)*stream->numChannels);
-	if(stream->inputBuffer == NULL) {
+    int size = stream->inputBufferSize;
+    short *buffer;
+
+    if(stream->numInputSamples + numSamples > size) {
+	size += (size >> 1) + numSamples;
+	buffer = ringResize(stream->inputBuffer, stream->inputBufferSize, stream->inputStart,
+	    stream->numInputSamples, size, stream->maxRequired, stream->numChannels);
+	if(buffer == NULL) {
 	    return 0;
 	}
+	ringMirror(buffer, size, stream->maxRequired, 0, stream->numInputSamples,
+	    stream->numChannels);
+	stream->inputBuffer = buffer;
+	stream->inputBufferSize = size;
+	stream->inputStart = 0;
     }
     return 1;
 }
 
+/* The input sample at position, with maxRequired samples contiguous from it */
+static short *inputAt(
+    sonicStream stream,
+    int position)
+{
+    return stream->inputBuffer + ringIndex(stream->inputBufferSize, stream->inputStart,
+	position)*stream->numChannels;
+}
+
 /* Add the input samples to the input buffer. */
 static int addFloatSamplesToInputBuffer(
     sonicStream stream,
@@ -269,7 +558,7 @@ static int addFloatSamplesToInputBuffer(
     int numSamples)
 {
     short *buffer;
-    int count = numSamples*stream->numChannels;
+    int index, start, count;
 
     if(numSamples == 0) {
 	return 1;
@@ -277,10 +566,18 @@ static int addFloatSamplesToInputBuffer(
     if(!enlargeInputBufferIfNeeded(stream, numSamples)) {
 	return 0;
     }
-    buffer = stream->inputBuffer + stream->numInputSamples*stream->numChannels;
-    while(count--) {
+    start = index = ringIndex(stream->inputBufferSize, stream->inputStart,
+	stream->numInputSamples);
+    buffer = stream->inputBuffer + index*stream->numChannels;
+    for(count = 0; count < numSamples*stream->numChannels; count++) {
+	if(count % stream->numChannels == 0 && index++ == stream->inputBufferSize) {
+	    buffer = stream->inputBuffer;
+	    index = 1;
+	}
         *buffer++ = (*samples++)*32767.0f;
     }
+    ringMirror(stream->inputBuffer, stream->inputBufferSize, stream->maxRequired, start,
+	numSamples, stream->numChannels);
     stream->numInputSamples += numSamples;
     return 1;
 }
@@ -297,8 +594,9 @@ static int addShortSamplesToInputBuffer(
     if(!enlargeInputBufferIfNeeded(stream, numSamples)) {
 	return 0;
     }
-    memcpy(stream->inputBuffer + stream->numInputSamples*stream->numChannels, samples,
-        numSamples*sizeof(short)*stream->numChannels);
+    ringWrite(stream->inputBuffer, stream->inputBufferSize, stream->maxRequired,
+	ringIndex(stream->inputBufferSize, stream->inputStart, stream->numInputSamples),
+	samples, numSamples, stream->numChannels);
     stream->numInputSamples += numSamples;
     return 1;
 }
@@ -310,7 +608,7 @@ static int addUnsignedCharSamplesToInputBuffer(
     int numSamples)
 {
     short *buffer;
-    int count = numSamples*stream->numChannels;
+    int index, start, count;
 
     if(numSamples == 0) {
 	return 1;
@@ -318,10 +616,18 @@ static int addUnsignedCharSamplesToInputBuffer(
     if(!enlargeInputBufferIfNeeded(stream, numSamples)) {
 	return 0;
     }
-    buffer = stream->inputBuffer + stream->numInputSamples*stream->numChannels;
-    while(count--) {
+    start = index = ringIndex(stream->inputBufferSize, stream->inputStart,
+	stream->numInputSamples);
+    buffer = stream->inputBuffer + index*stream->numChannels;
+    for(count = 0; count < numSamples*stream->numChannels; count++) {
+	if(count % stream->numChannels == 0 && index++ == stream->inputBufferSize) {
+	    buffer = stream->inputBuffer;
+	    index = 1;
+	}
         *buffer++ = (*samples++ - 128) << 8;
     }
+    ringMirror(stream->inputBuffer, stream->inputBufferSize, stream->maxRequired, start,
+	numSamples, stream->numChannels);
     stream->numInputSamples += numSamples;
     return 1;
 }
@@ -331,13 +637,12 @@ static void removeInputSamples(
     sonicStream stream,
     int position)
 {
-    int remainingSamples = stream->numInputSamples - position;
-
-    if(remainingSamples > 0) {
-	memmove(stream->inputBuffer, stream->inputBuffer + position*stream->numChannels,
-	    remainingSamples*sizeof(short)*stream->numChannels);
+    stream->numInputSamples -= position;
+    if(stream->numInputSamples == 0) {
+	stream->inputStart = 0;
+    } else {
+	stream->inputStart = ringIndex(stream->inputBufferSize, stream->inputStart, position);
     }
-    stream->numInputSamples = remainingSamples;
 }
 
 /* Just copy from the array to the output buffer */
@@ -346,15 +651,45 @@ static int copyToOutput(
     short *samples,
     int numSamples)
 {
-    if(!enlargeOutputBufferIfNeeded(stream, numSamples)) {
+    int index, first;
+
+    /* Copied in two parts if it wraps, so it needs no slack */
+    if(!enlargeOutputRing(stream, numSamples, 0)) {
 	return 0;
     }
-    memcpy(stream->outputBuffer + stream->numOutputSamples*stream->numChannels,
-	samples, numSamples*sizeof(short)*stream->numChannels);
+    index = ringIndex(stream->outputBufferSize, stream->outputStart, stream->numOutputSamples);
+    first = stream->outputBufferSize - index;
+    if(first > numSamples) {
+	first = numSamples;
+    }
+    memcpy(stream->outputBuffer + index*stream->numChannels, samples,
+	first*sizeof(short)*stream->numChannels);
+    memcpy(stream->outputBuffer, samples + first*stream->numChannels,
+	(numSamples - first)*sizeof(short)*stream->numChannels);
     stream->numOutputSamples += numSamples;
     return numSamples;
 }
 
+/* The longest pitch period searched for now, so the input needed to find and
+   copy a period is twice this.  In the low latency mode it is at most
+   lowLatencyMaxPeriod, and a quarter more than the last period found, so the
+   lookahead follows the pitch.  A longer period is found by growing it a
+   quarter per period. */
+static int periodLimit(
+    sonicStream stream)
+{
+    int limit;
+
+    if(!stream->lowLatency) {
+	return stream->maxPeriod;
+    }
+    limit = stream->prevPeriod + (stream->prevPeriod >> 2);
+    if(stream->prevPeriod == 0 || limit > stream->lowLatencyMaxPeriod) {
+	limit = stream->lowLatencyMaxPeriod;
+    }
+    return limit < stream->minPeriod? stream->minPeriod : limit;
+}
+
 /* Just copy from the input buffer to the output buffer.  Return 0 if we fail to
    resize the output buffer.  Otherwise, return numSamples */
 static int copyInputToOutput(
@@ -363,11 +698,10 @@ static int copyInputToOutput(
 {
     int numSamples = stream->remainingInputToCopy;
 
-    if(numSamples > stream->maxRequired) {
-	numSamples = stream->maxRequired;
+    if(numSamples > 2*periodLimit(stream)) {
+	numSamples = 2*periodLimit(stream);
     }
-    if(!copyToOutput(stream, stream->inputBuffer + position*stream->numChannels,
-	    numSamples)) {
+    if(!copyToOutput(stream, inputAt(stream, position), numSamples)) {
 	return 0;
     }
     stream->remainingInputToCopy -= numSamples;
@@ -382,27 +716,25 @@ int sonicReadFloatFromStream(
     int maxSamples)
 {
     int numSamples = stream->numOutputSamples;
-    int remainingSamples = 0;
     short *buffer;
-    int count;
+    int index, count;
 
     if(numSamples == 0) {
 	return 0;
     }
     if(numSamples > maxSamples) {
-	remainingSamples = numSamples - maxSamples;
 	numSamples = maxSamples;
     }
-    buffer = stream->outputBuffer;
-    count = numSamples*stream->numChannels;
-    while(count--) {
+    index = stream->outputStart;
+    buffer = stream->outputBuffer + index*stream->numChannels;
+    for(count = 0; count < numSamples*stream->numChannels; count++) {
+	if(count % stream->numChannels == 0 && index++ == stream->outputBufferSize) {
+	    buffer = stream->outputBuffer;
+	    index = 1;
+	}
 	*samples++ = (*buffer++)/32767.0f;
     }
-    if(remainingSamples > 0) {
-	memmove(stream->outputBuffer, stream->outputBuffer + numSamples*stream->numChannels,
-	    remainingSamples*sizeof(short)*stream->numChannels);
-    }
-    stream->numOutputSamples = remainingSamples;
+    removeOutputSamples(stream, numSamples);
     return numSamples;
 }
 
@@ -414,21 +746,16 @@ int sonicReadShortFromStream(
     int maxSamples)
 {
     int numSamples = stream->numOutputSamples;
-    int remainingSamples = 0;
 
     if(numSamples == 0) {
 	return 0;
     }
     if(numSamples > maxSamples) {
-	remainingSamples = numSamples - maxSamples;
 	numSamples = maxSamples;
     }
-    memcpy(samples, stream->outputBuffer, numSamples*sizeof(short)*stream->numChannels);
-    if(remainingSamples > 0) {
-	memmove(stream->outputBuffer, stream->outputBuffer + numSamples*stream->numChannels,
-	    remainingSamples*sizeof(short)*stream->numChannels);
-    }
-    stream->numOutputSamples = remainingSamples;
+    ringRead(stream->outputBuffer, stream->outputBufferSize, stream->outputStart, samples,
+	numSamples, stream->numChannels);
+    removeOutputSamples(stream, numSamples);
     return numSamples;
 }
 
@@ -440,49 +767,58 @@ int sonicReadUnsignedCharFromStream(
     int maxSamples)
 {
     int numSamples = stream->numOutputSamples;
-    int remainingSamples = 0;
     short *buffer;
-    int count;
+    int index, count;
 
     if(numSamples == 0) {
 	return 0;
     }
     if(numSamples > maxSamples) {
-	remainingSamples = numSamples - maxSamples;
 	numSamples = maxSamples;
     }
-    buffer = stream->outputBuffer;
-    count = numSamples*stream->numChannels;
-    while(count--) {
+    index = stream->outputStart;
+    buffer = stream->outputBuffer + index*stream->numChannels;
+    for(count = 0; count < numSamples*stream->numChannels; count++) {
+	if(count % stream->numChannels == 0 && index++ == stream->outputBufferSize) {
+	    buffer = stream->outputBuffer;
+	    index = 1;
+	}
 	*samples++ = (char)((*buffer++) >> 8) + 128;
     }
-    if(remainingSamples > 0) {
-	memmove(stream->outputBuffer, stream->outputBuffer + numSamples*stream->numChannels,
-	    remainingSamples*sizeof(short)*stream->numChannels);
-    }
-    stream->numOutputSamples = remainingSamples;
+    removeOutputSamples(stream, numSamples);
     return numSamples;
 }
 
+/* The samples written that are in the input, pitch and rate queues, in samples
+   of output. */
+static int heldSamples(
+    sonicStream stream)
+{
+    float speed = stream->speed/stream->pitch;
+
+    return (int)((stream->numInputSamples/speed + stream->numPitchSamples/stream->pitch +
+	stream->numRateSamples)/stream->rate + 0.5f);
+}
+
 /* Force the sonic stream to generate output using whatever data it currently
    has.  No extra delay will be added to the output, but flushing in the middle of
    words could introduce distortion. */
 int sonicFlushStream(
     sonicStream stream)
 {
-    int maxRequired = stream->maxRequired;
     int remainingSamples = stream->numInputSamples;
-    float speed = stream->speed/stream->pitch;
-    int expectedOutputSamples = stream->numOutputSamples +
-	(int)(remainingSamples/speed + stream->numPitchSamples/stream->pitch + 0.5f);
+    int expectedOutputSamples = stream->numOutputSamples + heldSamples(stream);
+    /* Twice the lookahead, which is less in the low latency mode */
+    int numSilent = 4*periodLimit(stream);
 
     /* Add enough silence to flush both input and pitch buffers. */
-    if(!enlargeInputBufferIfNeeded(stream, remainingSamples + 2*maxRequired)) {
+    if(!enlargeInputBufferIfNeeded(stream, remainingSamples + numSilent)) {
         return 0;
     }
-    memset(stream->inputBuffer + remainingSamples*stream->numChannels, 0,
-	2*maxRequired*sizeof(short)*stream->numChannels);
-    stream->numInputSamples += 2*maxRequired;
+    ringWrite(stream->inputBuffer, stream->inputBufferSize, stream->maxRequired,
+	ringIndex(stream->inputBufferSize, stream->inputStart, remainingSamples),
+	NULL, numSilent, stream->numChannels);
+    stream->numInputSamples += numSilent;
     if(!sonicWriteShortToStream(stream, NULL, 0)) {
 	return 0;
     }
@@ -492,8 +828,13 @@ int sonicFlushStream(
     }
     /* Empty input and pitch buffers */
     stream->numInputSamples = 0;
+    stream->inputStart = 0;
     stream->remainingInputToCopy = 0;
     stream->numPitchSamples = 0;
+    stream->pitchStart = 0;
+    stream->numRateSamples = 0;
+    stream->rateStart = 0;
+    stream->ratePosition = 0;
     return 1;
 }
 
@@ -504,6 +845,14 @@ int sonicSamplesAvailable(
     return stream->numOutputSamples;
 }
 
+/* Return the number of samples written that are not output yet, in samples of
+   output.  Sonic holds these back to find pitch periods in them. */
+int sonicGetLatency(
+    sonicStream stream)
+{
+    return heldSamples(stream);
+}
+
 /* If skip is greater than one, average skip samples togther and write them to
    the down-sample buffer.  If numChannels is greater than one, mix the channels
    together as we down sample. */
@@ -512,7 +861,7 @@ static void downSampleInput(
     short *samples,
     int skip)
 {
-    int numSamples = stream->maxRequired/skip;
+    int numSamples = 2*periodLimit(stream)/skip;
     int samplesPerValue = stream->numChannels*skip;
     int i, j;
     int value;
@@ -573,7 +922,6 @@ static int findPitchPeriodInRange(
    aproximated by the previous pitch period estimate.  Try to detect this case.  */
 static int prevPeriodBetter(
     sonicStream stream,
-    int period,
     int minDiff,
     int maxDiff,
     int preferNewPeriod)
@@ -607,8 +955,9 @@ static int findPitchPeriod(
     short *samples,
     int preferNewPeriod)
 {
+    int limit = periodLimit(stream);
     int minPeriod = stream->minPeriod;
-    int maxPeriod = stream->maxPeriod;
+    int maxPeriod = limit;
     int sampleRate = stream->sampleRate;
     int minDiff, maxDiff, retPeriod;
     int skip = 1;
@@ -630,8 +979,8 @@ static int findPitchPeriod(
 	    if(minPeriod < stream->minPeriod) {
 		minPeriod = stream->minPeriod;
 	    }
-	    if(maxPeriod > stream->maxPeriod) {
-		maxPeriod = stream->maxPeriod;
+	    if(maxPeriod > limit) {
+		maxPeriod = limit;
 	    }
 	    if(stream->numChannels == 1) {
 		period = findPitchPeriodInRange(samples, minPeriod, maxPeriod,
@@ -643,7 +992,10 @@ static int findPitchPeriod(
 	    }
 	}
     }
-    if(prevPeriodBetter(stream, period, minDiff, maxDiff, preferNewPeriod)) {
+    /* The previous period may be longer than the lookahead of the low latency
+       mode if it was just switched on. */
+    if(stream->prevPeriod <= limit &&
+	    prevPeriodBetter(stream, minDiff, maxDiff, preferNewPeriod)) {
         retPeriod = stream->prevPeriod;
     } else {
 	retPeriod = period;
@@ -654,38 +1006,228 @@ static int findPitchPeriod(
     return retPeriod;
 }
 
-/* Overlap two sound segments, ramp the volume of one down, while ramping the
-   other one from zero up, and add them, storing the result at the output. */
-static void overlapAdd(
+/* The gain in Q15 of a fade in at phase.  A fade out at phase is the fade in at
+   SONIC_RAMP_ONE - phase. */
+static inline int rampGain(
+    uint32_t phase)
+{
+#ifdef SONIC_USE_SIN
+    int index = phase >> (31 - SONIC_SIN_BITS);
+    int frac = (phase >> (16 - SONIC_SIN_BITS)) & 0x7fff;
+    int a = sonicSinTable[index];
+
+    if(index == 1 << SONIC_SIN_BITS) {
+	return a;
+    }
+    return a + (((sonicSinTable[index + 1] - a)*frac) >> 15);
+#else
+    return phase >> 16;
+#endif
+}
+
+/* Round a Q15 product sum back to a sample.  Only the equal-power gains can sum
+   to more than one. */
+static inline short rampSample(
+    int32_t value)
+{
+    value = (value + (1 << 14)) >> 15;
+#ifdef SONIC_USE_SIN
+    if(value > 32767) {
+	value = 32767;
+    } else if(value < -32768) {
+	value = -32768;
+    }
+#endif
+    return value;
+}
+
+#ifdef __ARM_ARCH_7EM__
+/* Cortex-M4: both halfword products of x and y plus acc, in one cycle */
+static inline int32_t sonicSmlad(
+    uint32_t x,
+    uint32_t y,
+    int32_t acc)
+{
+    int32_t result;
+
+    __asm__("smlad %0, %1, %2, %3" : "=r" (result) : "r" (x), "r" (y), "r" (acc));
+    return result;
+}
+
+/* The gains of one output sample as an SMLAD operand, the one of rampDown in
+   the bottom half, the one of rampUp in the top half. */
+static inline uint32_t rampGains(
+    uint32_t downPhase,
+    uint32_t upPhase)
+{
+    return (uint32_t)rampGain(SONIC_RAMP_ONE - downPhase) | ((uint32_t)rampGain(upPhase) << 16);
+}
+
+/* Two samples of rampDown and two of rampUp, each pair packed the same way as
+   the gains, the halfword moves become PKHBT and PKHTB. */
+static inline uint32_t packFirst(
+    uint32_t down,
+    uint32_t up)
+{
+    return (down & 0xffff) | (up << 16);
+}
+
+static inline uint32_t packSecond(
+    uint32_t down,
+    uint32_t up)
+{
+    return (up & 0xffff0000) | (down >> 16);
+}
+#endif
+
+/* Cross-fade numSamples samples of rampDown into rampUp.  The phases advance by
+   step per sample, and the ones of the two ramps can differ. */
+static void crossFade(
     int numSamples,
     int numChannels,
     short *out,
     short *rampDown,
-    short *rampUp)
+    short *rampUp,
+    uint32_t downPhase,
+    uint32_t upPhase,
+    uint32_t step)
 {
-    short *o, *u, *d;
+    int gainDown, gainUp;
+    int i, t = 0;
+
+#if defined(__ARM_ARCH_7EM__)
+    uint32_t d, u, o;
+
+    /* Interleaved pairs: one stereo sample, or two mono ones */
+    if(numChannels == 2) {
+	for(; t < numSamples; t++) {
+	    uint32_t gains = rampGains(downPhase, upPhase);
+
+	    memcpy(&d, rampDown, 4);
+	    memcpy(&u, rampUp, 4);
+	    o = (uint16_t)rampSample(sonicSmlad(packFirst(d, u), gains, 0));
+	    o |= (uint32_t)rampSample(sonicSmlad(packSecond(d, u), gains, 0)) << 16;
+	    memcpy(out, &o, 4);
+	    out += 2;
+	    rampDown += 2;
+	    rampUp += 2;
+	    downPhase += step;
+	    upPhase += step;
+	}
+	return;
+    }
+    if(numChannels == 1) {
+	for(; t + 2 <= numSamples; t += 2) {
+	    memcpy(&d, rampDown, 4);
+	    memcpy(&u, rampUp, 4);
+	    o = (uint16_t)rampSample(sonicSmlad(packFirst(d, u),
+		rampGains(downPhase, upPhase), 0));
+	    o |= (uint32_t)rampSample(sonicSmlad(packSecond(d, u),
+		rampGains(downPhase + step, upPhase + step), 0)) << 16;
+	    memcpy(out, &o, 4);
+	    out += 2;
+	    rampDown += 2;
+	    rampUp += 2;
+	    downPhase += 2*step;
+	    upPhase += 2*step;
+	}
+    }
+#elif defined(__SSE2__) && !defined(SONIC_USE_SIN)
+    /* Host: four samples of each ramp per PMADDWD, eight per pass, with the
+       gains of each sample packed like the samples by PUNPCKLWD. */
+    if(numChannels == 1 || numChannels == 2) {
+	int perStep = 4/numChannels;
+	__m128i one = _mm_set1_epi32(SONIC_RAMP_ONE);
+	__m128i round = _mm_set1_epi32(1 << 14);
+	__m128i advance = _mm_set1_epi32(perStep*step);
+	__m128i down, up, gains, lo, hi;
+	__m128i downPhases, upPhases;
+
+	if(numChannels == 2) {
+	    downPhases = _mm_setr_epi32(downPhase, downPhase, downPhase + step, downPhase + step);
+	    upPhases = _mm_setr_epi32(upPhase, upPhase, upPhase + step, upPhase + step);
+	} else {
+	    downPhases = _mm_setr_epi32(downPhase, downPhase + step, downPhase + 2*step,
+		downPhase + 3*step);
+	    upPhases = _mm_setr_epi32(upPhase, upPhase + step, upPhase + 2*step, upPhase + 3*step);
+	}
+	for(; t + 2*perStep <= numSamples; t += 2*perStep) {
+	    down = _mm_loadu_si128((__m128i *)rampDown);
+	    up = _mm_loadu_si128((__m128i *)rampUp);
+	    gains = _mm_or_si128(_mm_srli_epi32(_mm_sub_epi32(one, downPhases), 16),
+		_mm_slli_epi32(_mm_srli_epi32(upPhases, 16), 16));
+	    lo = _mm_madd_epi16(_mm_unpacklo_epi16(down, up), gains);
+	    downPhases = _mm_add_epi32(downPhases, advance);
+	    upPhases = _mm_add_epi32(upPhases, advance);
+	    gains = _mm_or_si128(_mm_srli_epi32(_mm_sub_epi32(one, downPhases), 16),
+		_mm_slli_epi32(_mm_srli_epi32(upPhases, 16), 16));
+	    hi = _mm_madd_epi16(_mm_unpackhi_epi16(down, up), gains);
+	    downPhases = _mm_add_epi32(downPhases, advance);
+	    upPhases = _mm_add_epi32(upPhases, advance);
+	    lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 15);
+	    hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 15);
+	    _mm_storeu_si128((__m128i *)out, _mm_packs_epi32(lo, hi));
+	    out += 8;
+	    rampDown += 8;
+	    rampUp += 8;
+	}
+	downPhase += t*step;
+	upPhase += t*step;
+    }
+#endif
+    for(; t < numSamples; t++) {
+	gainDown = rampGain(SONIC_RAMP_ONE - downPhase);
+	gainUp = rampGain(upPhase);
+	for(i = 0; i < numChannels; i++) {
+	    *out++ = rampSample(*rampDown++*gainDown + *rampUp++*gainUp);
+	}
+	downPhase += step;
+	upPhase += step;
+    }
+}
+
+/* Ramp numSamples samples down (or up if fadeIn), the phase advancing by step
+   per sample. */
+static void rampSamples(
+    int numSamples,
+    int numChannels,
+    short *out,
+    short *samples,
+    uint32_t phase,
+    uint32_t step,
+    int fadeIn)
+{
+    int gain;
     int i, t;
 
-    for(i = 0; i < numChannels; i++) {
-	o = out + i;
-	u = rampUp + i;
-	d = rampDown + i;
-	for(t = 0; t < numSamples; t++) {
-#ifdef SONIC_USE_SIN
-	    float ratio = sin(t*M_PI/(2*numSamples));
-	    *o = *d*(1.0f - ratio) + *u*ratio;
-#else
-	    *o = (*d*(numSamples - t) + *u*t)/numSamples;
-#endif
-	    o += numChannels;
-	    d += numChannels;
-	    u += numChannels;
+    for(t = 0; t < numSamples; t++) {
+	gain = rampGain(fadeIn? phase : SONIC_RAMP_ONE - phase);
+	for(i = 0; i < numChannels; i++) {
+	    *out++ = rampSample(*samples++*gain);
 	}
+	phase += step;
     }
 }
 
 /* Overlap two sound segments, ramp the volume of one down, while ramping the
    other one from zero up, and add them, storing the result at the output. */
+static void overlapAdd(
+    int numSamples,
+    int numChannels,
+    short *out,
+    short *rampDown,
+    short *rampUp)
+{
+    if(numSamples <= 0) {
+	return;
+    }
+    crossFade(numSamples, numChannels, out, rampDown, rampUp, 0, 0,
+	SONIC_RAMP_ONE/numSamples);
+}
+
+/* Overlap two sound segments, ramp the volume of one down, while ramping the
+   other one from zero up, and add them, storing the result at the output.  The
+   ramp up starts separation samples after the ramp down. */
 static void overlapAddWithSeparation(
     int numSamples,
     int numChannels,
@@ -694,70 +1236,93 @@ static void overlapAddWithSeparation(
     short *rampDown,
     short *rampUp)
 {
-    short *o, *u, *d;
-    int i, t;
+    uint32_t step;
+    int numDown, numBoth, numSilent;
 
-    for(i = 0; i < numChannels; i++) {
-	o = out + i;
-	u = rampUp + i;
-	d = rampDown + i;
-	for(t = 0; t < numSamples + separation; t++) {
-	    if(t < separation) {
-		*o = *d*(numSamples - t)/numSamples;
-		d += numChannels;
-	    } else if(t < numSamples) {
-		*o = (*d*(numSamples - t) + *u*(t - separation))/numSamples;
-		d += numChannels;
-		u += numChannels;
-	    } else {
-		*o = *u*(t - separation)/numSamples;
-		u += numChannels;
-	    }
-	    o += numChannels;
-	}
+    if(numSamples <= 0) {
+	return;
     }
+    step = SONIC_RAMP_ONE/numSamples;
+    /* The ramp down ends after numSamples, so a separation longer than that
+       leaves silence between the two */
+    numDown = separation < numSamples? separation : numSamples;
+    numBoth = numSamples - numDown;
+    numSilent = separation - numDown;
+    rampSamples(numDown, numChannels, out, rampDown, 0, step, 0);
+    out += numDown*numChannels;
+    crossFade(numBoth, numChannels, out, rampDown + numDown*numChannels, rampUp,
+	numDown*step, 0, step);
+    out += numBoth*numChannels;
+    memset(out, 0, numSilent*sizeof(short)*numChannels);
+    out += numSilent*numChannels;
+    rampSamples(numDown, numChannels, out, rampUp + numBoth*numChannels,
+	numBoth*step, step, 1);
 }
 
-/* Just move the new samples in the output buffer to the pitch bufer */
-static int moveNewSamplesToPitchBuffer(
+/* Move the new samples in the output buffer to the end of a queue, the pitch
+   or the rate one, enlarging its ring if needed. */
+static int moveNewSamplesToRing(
     sonicStream stream,
-    int originalNumOutputSamples)
+    int originalNumOutputSamples,
+    short **ring,
+    int *ringSize,
+    int *ringStart,
+    int *numRingSamples)
 {
     int numSamples = stream->numOutputSamples - originalNumOutputSamples;
     int numChannels = stream->numChannels;
+    int size = *ringSize;
+    int index, first;
+    short *buffer;
 
-    if(stream->numPitchSamples + numSamples > stream->pitchBufferSize) {
-	stream->pitchBufferSize += (stream->pitchBufferSize >> 1) + numSamples;
-	stream->pitchBuffer = (short *)realloc(stream->pitchBuffer,
-	    stream->pitchBufferSize*sizeof(short)*numChannels);
-	if(stream->pitchBuffer == NULL) {
+    if(*numRingSamples + numSamples > size) {
+	size += (size >> 1) + numSamples;
+	buffer = ringResize(*ring, *ringSize, *ringStart, *numRingSamples, size,
+	    stream->maxRequired, numChannels);
+	if(buffer == NULL) {
 	    return 0;
 	}
+	ringMirror(buffer, size, stream->maxRequired, 0, *numRingSamples, numChannels);
+	*ring = buffer;
+	*ringSize = size;
+	*ringStart = 0;
+    }
+    /* The new output can wrap too */
+    index = ringIndex(stream->outputBufferSize, stream->outputStart, originalNumOutputSamples);
+    first = stream->outputBufferSize - index;
+    if(first > numSamples) {
+	first = numSamples;
     }
-    memcpy(stream->pitchBuffer + stream->numPitchSamples*numChannels,
-        stream->outputBuffer + originalNumOutputSamples*numChannels,
-	numSamples*sizeof(short)*numChannels);
+    ringWrite(*ring, size, stream->maxRequired, ringIndex(size, *ringStart, *numRingSamples),
+	stream->outputBuffer + index*numChannels, first, numChannels);
+    ringWrite(*ring, size, stream->maxRequired,
+	ringIndex(size, *ringStart, *numRingSamples + first),
+	stream->outputBuffer, numSamples - first, numChannels);
     stream->numOutputSamples = originalNumOutputSamples;
-    stream->numPitchSamples += numSamples;
+    *numRingSamples += numSamples;
     return 1;
 }
 
+/* Just move the new samples in the output buffer to the pitch bufer */
+static int moveNewSamplesToPitchBuffer(
+    sonicStream stream,
+    int originalNumOutputSamples)
+{
+    return moveNewSamplesToRing(stream, originalNumOutputSamples, &stream->pitchBuffer,
+	&stream->pitchBufferSize, &stream->pitchStart, &stream->numPitchSamples);
+}
+
 /* Remove processed samples from the pitch buffer. */
 static void removePitchSamples(
     sonicStream stream,
     int numSamples)
 {
-    int numChannels = stream->numChannels;
-    short *source = stream->pitchBuffer + numSamples*numChannels;
-
-    if(numSamples == 0) {
-	return;
-    }
-    if(numSamples != stream->numPitchSamples) {
-	memmove(stream->pitchBuffer, source, (stream->numPitchSamples -
-	    numSamples)*sizeof(short)*numChannels);
-    }
     stream->numPitchSamples -= numSamples;
+    if(stream->numPitchSamples == 0) {
+	stream->pitchStart = 0;
+    } else {
+	stream->pitchStart = ringIndex(stream->pitchBufferSize, stream->pitchStart, numSamples);
+    }
 }
 
 /* Change the pitch.  The latency this introduces could be reduced by looking at
@@ -770,7 +1335,7 @@ static int adjustPitch(
     int numChannels = stream->numChannels;
     int period, newPeriod, separation;
     int position = 0;
-    short *out, *rampDown, *rampUp;
+    short *samples, *out, *rampDown, *rampUp;
 
     if(stream->numOutputSamples == originalNumOutputSamples) {
 	return 1;
@@ -778,30 +1343,189 @@ static int adjustPitch(
     if(!moveNewSamplesToPitchBuffer(stream, originalNumOutputSamples)) {
 	return 0;
     }
-    while(stream->numPitchSamples - position >= stream->maxRequired) {
-	period = findPitchPeriod(stream, stream->pitchBuffer + position*numChannels, 0);
+    while(stream->numPitchSamples - position >= 2*periodLimit(stream)) {
+	/* maxRequired samples from here are contiguous, see ringMirror */
+	samples = stream->pitchBuffer + ringIndex(stream->pitchBufferSize, stream->pitchStart,
+	    position)*numChannels;
+	period = findPitchPeriod(stream, samples, 0);
 	newPeriod = period/pitch;
 	if(!enlargeOutputBufferIfNeeded(stream, newPeriod)) {
 	    return 0;
 	}
-	out = stream->outputBuffer + stream->numOutputSamples*numChannels;
+	out = outputTail(stream);
 	if(pitch >= 1.0f) {
-	    rampDown = stream->pitchBuffer + position*numChannels;
-	    rampUp = stream->pitchBuffer + (position + period - newPeriod)*numChannels;
+	    rampDown = samples;
+	    rampUp = samples + (period - newPeriod)*numChannels;
 	    overlapAdd(newPeriod, numChannels, out, rampDown, rampUp);
 	} else {
-	    rampDown = stream->pitchBuffer + position*numChannels;
-	    rampUp = stream->pitchBuffer + position*numChannels;
+	    rampDown = samples;
+	    rampUp = samples;
 	    separation = newPeriod - period;
 	    overlapAddWithSeparation(period, numChannels, separation, out, rampDown, rampUp);
 	}
-	stream->numOutputSamples += newPeriod;
+	commitOutput(stream, newPeriod);
 	position += period;
     }
     removePitchSamples(stream, position);
     return 1;
 }
 
+/* Interpolate numSamples samples, from position on by step, each one linearly
+   between the two samples around it. */
+static void interpolateLinear(
+    int numSamples,
+    int numChannels,
+    short *out,
+    short *samples,
+    uint32_t position,
+    uint32_t step)
+{
+    short *s;
+    int frac, i;
+
+    while(numSamples--) {
+	s = samples + (position >> SONIC_RATE_SHIFT)*numChannels;
+	/* Q15, so the product with a difference of two samples fits */
+	frac = (position & (SONIC_RATE_ONE - 1)) >> (SONIC_RATE_SHIFT - 15);
+	for(i = 0; i < numChannels; i++) {
+	    *out++ = s[i] + (((s[i + numChannels] - s[i])*frac) >> 15);
+	}
+	position += step;
+    }
+}
+
+/* Interpolate numSamples samples, from position on by step, each one on the
+   Catmull-Rom cubic through the four samples around it.  These start at the
+   sample position points at, so the output lags the linear one by a sample. */
+static void interpolateCubic(
+    int numSamples,
+    int numChannels,
+    short *out,
+    short *samples,
+    uint32_t position,
+    uint32_t step)
+{
+    short *s;
+    int s0, s1, s2, s3, c1, c2, c3, value;
+    int frac, i;
+
+    while(numSamples--) {
+	s = samples + (position >> SONIC_RATE_SHIFT)*numChannels;
+	/* Q12, so the Horner steps below fit in 32 bits */
+	frac = (position & (SONIC_RATE_ONE - 1)) >> (SONIC_RATE_SHIFT - 12);
+	for(i = 0; i < numChannels; i++) {
+	    s0 = s[i];
+	    s1 = s[i + numChannels];
+	    s2 = s[i + 2*numChannels];
+	    s3 = s[i + 3*numChannels];
+	    c3 = (3*(s1 - s2) + s3 - s0) >> 1;
+	    c2 = (2*s0 - 5*s1 + 4*s2 - s3) >> 1;
+	    c1 = (s2 - s0) >> 1;
+	    value = s1 + ((((((c3*frac) >> 12) + c2)*frac >> 12) + c1)*frac >> 12);
+	    if(value > 32767) {
+		value = 32767;
+	    } else if(value < -32768) {
+		value = -32768;
+	    }
+	    *out++ = value;
+	}
+	position += step;
+    }
+}
+
+/* Resample the numSamples samples of a ring from start to the output, at the
+   rate of the stream, and return how many of them are used up, or -1 if out of
+   memory.  The ring is read maxRequired contiguous samples at a time, see
+   ringMirror.  There is no pitch search, so this costs a few cycles per sample. */
+static int resampleRing(
+    sonicStream stream,
+    short *buffer,
+    int size,
+    int start,
+    int numSamples)
+{
+    int numChannels = stream->numChannels;
+    int numTaps = stream->quality? 4 : 2;
+    uint32_t step = stream->rate*SONIC_RATE_ONE + 0.5f;
+    uint32_t position = stream->ratePosition;
+    uint32_t end;
+    int base = 0, count, newSamples;
+    short *samples;
+
+    if(step == 0) {
+	step = 1;
+    }
+    while(numSamples - base >= numTaps) {
+	count = numSamples - base;
+	if(count > stream->maxRequired) {
+	    count = stream->maxRequired;
+	}
+	/* The outputs before end have all their taps in the block */
+	end = (uint32_t)(count - numTaps + 1) << SONIC_RATE_SHIFT;
+	if(position >= end) {
+	    break;
+	}
+	newSamples = (end - position - 1)/step + 1;
+	if(!enlargeOutputBufferIfNeeded(stream, newSamples)) {
+	    return -1;
+	}
+	samples = buffer + ringIndex(size, start, base)*numChannels;
+	if(numTaps == 4) {
+	    interpolateCubic(newSamples, numChannels, outputTail(stream), samples, position, step);
+	} else {
+	    interpolateLinear(newSamples, numChannels, outputTail(stream), samples, position,
+		step);
+	}
+	commitOutput(stream, newSamples);
+	position += newSamples*step;
+	base += position >> SONIC_RATE_SHIFT;
+	position &= SONIC_RATE_ONE - 1;
+    }
+    /* A rate above one can step past the samples we have */
+    if(base > numSamples) {
+	position += (uint32_t)(base - numSamples) << SONIC_RATE_SHIFT;
+	base = numSamples;
+    }
+    stream->ratePosition = position;
+    return base;
+}
+
+/* Change the rate of the new output, through the rate queue. */
+static int adjustRate(
+    sonicStream stream,
+    int originalNumOutputSamples)
+{
+    int position;
+
+    if(stream->numOutputSamples == originalNumOutputSamples) {
+	return 1;
+    }
+    if(stream->rateBuffer == NULL) {
+	stream->rateBufferSize = stream->maxRequired;
+	stream->rateBuffer = (short *)calloc(2*stream->maxRequired,
+	    sizeof(short)*stream->numChannels);
+	if(stream->rateBuffer == NULL) {
+	    return 0;
+	}
+    }
+    if(!moveNewSamplesToRing(stream, originalNumOutputSamples, &stream->rateBuffer,
+	    &stream->rateBufferSize, &stream->rateStart, &stream->numRateSamples)) {
+	return 0;
+    }
+    position = resampleRing(stream, stream->rateBuffer, stream->rateBufferSize,
+	stream->rateStart, stream->numRateSamples);
+    if(position < 0) {
+	return 0;
+    }
+    stream->numRateSamples -= position;
+    if(stream->numRateSamples == 0) {
+	stream->rateStart = 0;
+    } else {
+	stream->rateStart = ringIndex(stream->rateBufferSize, stream->rateStart, position);
+    }
+    return 1;
+}
+
 /* Skip over a pitch period, and copy period/speed samples to the output */
 static int skipPitchPeriod(
     sonicStream stream,
@@ -821,9 +1545,9 @@ static int skipPitchPeriod(
     if(!enlargeOutputBufferIfNeeded(stream, newSamples)) {
 	return 0;
     }
-    overlapAdd(newSamples, numChannels, stream->outputBuffer +
-        stream->numOutputSamples*numChannels, samples, samples + period*numChannels);
-    stream->numOutputSamples += newSamples;
+    overlapAdd(newSamples, numChannels, outputTail(stream), samples,
+	samples + period*numChannels);
+    commitOutput(stream, newSamples);
     return newSamples;
 }
 
@@ -847,11 +1571,11 @@ static int insertPitchPeriod(
     if(!enlargeOutputBufferIfNeeded(stream, period + newSamples)) {
 	return 0;
     }
-    out = stream->outputBuffer + stream->numOutputSamples*numChannels;
+    out = outputTail(stream);
     memcpy(out, samples, period*sizeof(short)*numChannels);
-    out = stream->outputBuffer + (stream->numOutputSamples + period)*numChannels;
+    out += period*numChannels;
     overlapAdd(newSamples, numChannels, out, samples + period*numChannels, samples);
-    stream->numOutputSamples += period + newSamples;
+    commitOutput(stream, period + newSamples);
     return newSamples;
 }
 
@@ -864,9 +1588,8 @@ static int changeSpeed(
     short *samples;
     int numSamples = stream->numInputSamples;
     int position = 0, period, newSamples;
-    int maxRequired = stream->maxRequired;
 
-    if(stream->numInputSamples < maxRequired) {
+    if(stream->numInputSamples < 2*periodLimit(stream)) {
 	return 1;
     }
     do {
@@ -874,7 +1597,7 @@ static int changeSpeed(
             newSamples = copyInputToOutput(stream, position);
 	    position += newSamples;
 	} else {
-	    samples = stream->inputBuffer + position*stream->numChannels;
+	    samples = inputAt(stream, position);
 	    period = findPitchPeriod(stream, samples, 1);
 	    if(speed > 1.0) {
 		newSamples = skipPitchPeriod(stream, samples, speed, period);
@@ -887,11 +1610,18 @@ static int changeSpeed(
 	if(newSamples == 0) {
 	    return 0; /* Failed to resize output buffer */
 	}
-    } while(position + maxRequired <= numSamples);
+    } while(position + 2*periodLimit(stream) <= numSamples);
     removeInputSamples(stream, position);
     return 1;
 }
 
+/* True if speed needs changeSpeed rather than a copy of the input. */
+static int speedChanges(
+    float speed)
+{
+    return speed > 1.00001f || speed < 0.99999f;
+}
+
 /* Resample as many pitch periods as we have buffered on the input.  Return 0 if
    we fail to resize an input or output buffer.  Also scale the output by the volume. */
 static int processStreamInput(
@@ -899,24 +1629,60 @@ static int processStreamInput(
 {
     int originalNumOutputSamples = stream->numOutputSamples;
     float speed = stream->speed/stream->pitch;
+    int index, first, numSamples, position;
 
-    if(speed > 1.00001 || speed < 0.99999) {
+    if(stream->rate == 1.0f && stream->numRateSamples > 0) {
+	/* What the rate queue kept would be stale by the next rate change */
+	stream->numRateSamples = 0;
+	stream->rateStart = 0;
+	stream->ratePosition = 0;
+    }
+    if(stream->rate != 1.0f && stream->pitch == 1.0f && !speedChanges(speed)) {
+	/* Only the rate changes, so resample straight from the input */
+	position = resampleRing(stream, stream->inputBuffer, stream->inputBufferSize,
+	    stream->inputStart, stream->numInputSamples);
+	if(position < 0) {
+	    return 0;
+	}
+	removeInputSamples(stream, position);
+    } else if(speedChanges(speed)) {
 	changeSpeed(stream, speed);
     } else {
-        if(!copyToOutput(stream, stream->inputBuffer, stream->numInputSamples)) {
+	/* The input can wrap */
+	first = stream->inputBufferSize - stream->inputStart;
+	if(first > stream->numInputSamples) {
+	    first = stream->numInputSamples;
+	}
+        if(first > 0 && !copyToOutput(stream, inputAt(stream, 0), first)) {
+	    return 0;
+	}
+	if(first < stream->numInputSamples &&
+		!copyToOutput(stream, stream->inputBuffer, stream->numInputSamples - first)) {
 	    return 0;
 	}
-	stream->numInputSamples = 0;
+	removeInputSamples(stream, stream->numInputSamples);
     }
     if(stream->pitch != 1.0f) {
 	if(!adjustPitch(stream, originalNumOutputSamples)) {
 	    return 0;
 	}
     }
+    if(stream->rate != 1.0f && (stream->pitch != 1.0f || speedChanges(speed))) {
+	if(!adjustRate(stream, originalNumOutputSamples)) {
+	    return 0;
+	}
+    }
     if(stream->volume != 1.0f) {
 	/* Adjust output volume. */
-        scaleSamples(stream->outputBuffer + originalNumOutputSamples*stream->numChannels,
-	    (stream->numOutputSamples - originalNumOutputSamples)*stream->numChannels,
+	numSamples = stream->numOutputSamples - originalNumOutputSamples;
+	index = ringIndex(stream->outputBufferSize, stream->outputStart, originalNumOutputSamples);
+	first = stream->outputBufferSize - index;
+	if(first > numSamples) {
+	    first = numSamples;
+	}
+        scaleSamples(stream->outputBuffer + index*stream->numChannels,
+	    first*stream->numChannels, stream->volume);
+        scaleSamples(stream->outputBuffer, (numSamples - first)*stream->numChannels,
 	    stream->volume);
     }
     return 1;
@@ -947,6 +1713,55 @@ int sonicWriteShortToStream(
     return processStreamInput(stream);
 }
 
+/* Like sonicWriteShortToStream, but the output is written straight to out, which
+   the caller owns (e.g. a DMA buffer), instead of being copied there by
+   sonicReadShortFromStream.  Output that does not fit stays in the stream and is
+   returned first by the next call.  Return the number of samples written to out,
+   or -1 if memory realloc failed. */
+int sonicWriteShortToBuffer(
+    sonicStream stream,
+    short *samples,
+    int numSamples,
+    short *out,
+    int maxSamples)
+{
+    int numWritten, ok;
+
+    if(!addShortSamplesToInputBuffer(stream, samples, numSamples)) {
+	return -1;
+    }
+    if(stream->numOutputSamples > 0 || stream->pitch != 1.0f || stream->volume != 1.0f ||
+	    (stream->rate != 1.0f && speedChanges(stream->speed))) {
+	/* Queued output goes first, and pitch, volume and the rate after a speed
+	   change work in the output buffer */
+	if(!processStreamInput(stream)) {
+	    return -1;
+	}
+	return sonicReadShortFromStream(stream, out, maxSamples);
+    }
+    /* The queue is empty, so its ring can start over from 0 afterwards */
+    stream->outputStart = 0;
+    stream->ownOutputBuffer = stream->outputBuffer;
+    stream->ownOutputBufferSize = stream->outputBufferSize;
+    stream->outputBuffer = out;
+    stream->outputBufferSize = maxSamples;
+    stream->externalOutput = 1;
+    ok = processStreamInput(stream);
+    if(stream->externalOutput) {
+	numWritten = stream->numOutputSamples;
+	stream->outputBuffer = stream->ownOutputBuffer;
+	stream->outputBufferSize = stream->ownOutputBufferSize;
+	stream->numOutputSamples = 0;
+	stream->externalOutput = 0;
+    } else {
+	/* Spilled into our own buffer, top up the caller's from there */
+	numWritten = stream->numExternalSamples;
+	numWritten += sonicReadShortFromStream(stream,
+	    out + numWritten*stream->numChannels, maxSamples - numWritten);
+    }
+    return ok? numWritten : -1;
+}
+
 /* Simple wrapper around sonicWriteFloatToStream that does the unsigned char to float
    conversion for you. */
 int sonicWriteUnsignedCharToStream(
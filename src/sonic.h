@@ -63,8 +63,9 @@ similar to high speed factors is used.
 extern "C" {
 #endif
 
-/* Uncomment this to use sin-wav based overlap add which in theory can improve
-   sound quality slightly, at the expense of lots of floating point math. */
+/* Uncomment this to use an equal-power (sine and cosine) overlap add, from a
+   table, instead of the linear one.  It can suit segments that do not
+   correlate, the linear one keeps the level of pitch periods that do. */
 /* #define SONIC_USE_SIN */
 
 /* This specifies the range of voice pitches we try to match.
@@ -72,6 +73,9 @@ extern "C" {
 #define SONIC_MIN_PITCH 65
 #define SONIC_MAX_PITCH 400
 
+/* The lowest pitch matched in the low latency mode, see sonicSetLowLatency */
+#define SONIC_LOW_LATENCY_MIN_PITCH 150
+
 /* These are used to down-sample some inputs to improve speed */
 #define SONIC_AMDF_FREQ 4000
 
@@ -92,6 +96,13 @@ int sonicWriteFloatToStream(sonicStream stream, float *samples, int numSamples);
 /* Use this to write 16-bit data to be speed up or down into the stream.
    Return 0 if memory realloc failed, otherwise 1 */
 int sonicWriteShortToStream(sonicStream stream, short *samples, int numSamples);
+/* Use this to write 16-bit data and get the result written directly to out, a
+   buffer of maxSamples owned by the caller, saving the copy done by
+   sonicReadShortFromStream.  Output that does not fit stays in the stream, and
+   comes first in the next call.  Return the number of samples written to out,
+   or -1 if memory realloc failed. */
+int sonicWriteShortToBuffer(sonicStream stream, short *samples, int numSamples,
+    short *out, int maxSamples);
 /* Use this to write 8-bit unsigned data to be speed up or down into the stream.
    Return 0 if memory realloc failed, otherwise 1 */
 int sonicWriteUnsignedCharToStream(sonicStream stream, unsigned char *samples, int numSamples);
@@ -110,6 +121,10 @@ int sonicReadUnsignedCharFromStream(sonicStream stream, unsigned char *samples,
 int sonicFlushStream(sonicStream stream);
 /* Return the number of samples in the output buffer */
 int sonicSamplesAvailable(sonicStream stream);
+/* Return the number of samples written that are not output yet, in samples of
+   output.  This is the latency Sonic adds, and what sonicFlushStream would add
+   to the output. */
+int sonicGetLatency(sonicStream stream);
 /* Get the speed of the stream. */
 float sonicGetSpeed(sonicStream stream);
 /* Set the speed of the stream. */
@@ -118,10 +133,26 @@ void sonicSetSpeed(sonicStream stream, float speed);
 float sonicGetPitch(sonicStream stream);
 /* Set the pitch of the stream. */
 void sonicSetPitch(sonicStream stream, float pitch);
+/* Get the rate of the stream. */
+float sonicGetRate(sonicStream stream);
+/* Set the rate of the stream.  Like a turntable, this changes the speed and the
+   pitch together, by resampling without any pitch search, so it costs a few
+   cycles per sample where speed and pitch cost one search per pitch period.  It
+   applies on top of the speed and pitch.  The interpolation is linear at quality
+   0, and cubic at 1. */
+void sonicSetRate(sonicStream stream, float rate);
 /* Get the scaling factor of the stream. */
 float sonicGetVolume(sonicStream stream);
 /* Set the scaling factor of the stream. */
 void sonicSetVolume(sonicStream stream, float volume);
+/* Get the low latency mode. */
+int sonicGetLowLatency(sonicStream stream);
+/* Set the low latency mode, for scrubbing and jumps that must be heard at once.
+   Pitch periods are searched up to SONIC_LOW_LATENCY_MIN_PITCH, and only a
+   quarter beyond the last one found, so the input held back follows the pitch
+   instead of being twice the longest period at SONIC_MIN_PITCH.  A flush adds
+   less silence too.  Low voices and bass are matched less well. */
+void sonicSetLowLatency(sonicStream stream, int lowLatency);
 /* Get the quality setting. */
 int sonicGetQuality(sonicStream stream);
 /* Set the "quality".  Default 0 is virtually as good as 1, but very much faster. */
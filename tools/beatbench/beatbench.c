@@ -0,0 +1,335 @@
+/*
+ *  Name:    beatbench.c
+ *
+ *  Purpose: check the beat tracker of the BPM detector on synthetic
+ *           drum loops of known beat positions, by F-measure
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bpm.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+#ifndef M_PI
+#define M_PI                3.14159265358979323846
+#endif
+
+/* seconds of every loop, -s */
+#define BENCH_SECONDS       60
+
+#define BENCH_RATE          44100
+
+/* the band the player analyses, see mp3_bpm_detect_run() */
+#define BENCH_FREQ_HIGH     4000
+
+/* a found beat this close to a true one is a hit, the usual +-70 ms */
+#define BENCH_TOLERANCE     0.07
+
+/* the beats of the first seconds are not counted, the tracker starts */
+#define BENCH_SKIP          5.0
+
+/*
+ * the lowest mean F-measure of each preset, -f. The results of this
+ * version with some margin, raise them when the tracker gets better.
+ */
+struct bench_budget {
+    const char  *name;              /* -p */
+    double      min_f;
+};
+
+static const struct bench_budget bench_budgets[BPM_PRESETS] = {
+    { "device",     0.75 },         /* BPM_PRESET_DEVICE */
+    { "accurate",   0.75 },         /* BPM_PRESET_ACCURATE */
+};
+
+/*
+ * The loops: kick on the beats, snare between them, hi-hats on the
+ * offbeats. The tempo changes from bpm to bpm_end halfway, every beat
+ * is moved by up to +-jitter / 2 of a period.
+ */
+struct bench_case {
+    double      bpm;
+    double      bpm_end;
+    double      jitter;
+    double      noise;              /* level of the white noise */
+};
+
+static const struct bench_case bench_cases[] = {
+    {  80,  80, 0,    0.02 },
+    { 100, 100, 0.01, 0.05 },
+    { 120, 120, 0,    0.05 },
+    { 128, 128, 0.02, 0.1  },
+    { 140, 140, 0,    0.05 },
+    { 160, 160, 0,    0.02 },
+    {  95, 125, 0,    0.05 },
+    { 130, 110, 0.01, 0.05 },
+    { 174, 174, 0,    0.05 },
+    {  70,  70, 0,    0.05 },
+};
+
+#define BENCH_ARRAY_SIZE(a)     (sizeof(a) / sizeof((a)[0]))
+
+/* the true beats of the loop being run, in seconds */
+static double   *bench_truth;
+static uint32_t bench_truth_num;
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+
+/* repeatable noise, the same loops on every host */
+static uint32_t bench_seed;
+
+static double bench_noise(void) {
+    bench_seed = bench_seed * 1664525u + 1013904223u;
+    return (double)(bench_seed >> 8) / (1 << 24) - 0.5;
+}
+
+static void bench_add(float *mix, uint32_t n, uint32_t at, double v) {
+    if (at < n) {
+        mix[at] += (float)v;
+    }
+}
+
+/* render the loop in stereo, and its beats into bench_truth */
+static int16_t *bench_generate(const struct bench_case *bc, uint32_t seconds) {
+    uint32_t    n = BENCH_RATE * seconds;
+    uint32_t    i, at, beat;
+    double      t, period, a;
+    float       *mix;
+    int16_t     *out;
+
+    mix         = calloc(n, sizeof(float));
+    out         = malloc(n * 2 * sizeof(int16_t));
+    bench_truth = malloc((size_t)(seconds * 300 / 60 + 2) * sizeof(double));
+    if (mix == NULL || out == NULL || bench_truth == NULL) {
+        fprintf(stderr, "beatbench: out of memory\n");
+        exit(2);
+    }
+
+    bench_seed      = (uint32_t)(bc->bpm * 100 + bc->bpm_end);
+    bench_truth_num = 0;
+
+    for (beat = 0, t = 0; t < seconds; beat++) {
+        period = 60.0 / ((t < seconds / 2.0) ? bc->bpm : bc->bpm_end);
+        bench_truth[bench_truth_num++] = t;
+        at = (uint32_t)(t * BENCH_RATE);
+
+        if (beat % 2 == 0) {
+            /* kick, a falling sine */
+            for (i = 0; i < BENCH_RATE * 15 / 100; i++) {
+                a = exp(-(double)i / (BENCH_RATE * 0.04));
+                bench_add(mix, n, at + i,
+                          0.7 * a * sin(2 * M_PI * (60 + 40 * a) * i / BENCH_RATE));
+            }
+        } else {
+            /* snare, noise */
+            for (i = 0; i < BENCH_RATE * 15 / 100; i++) {
+                a = exp(-(double)i / (BENCH_RATE * 0.03));
+                bench_add(mix, n, at + i, 0.4 * a * bench_noise());
+            }
+        }
+
+        /* hi-hat on the offbeat */
+        at = (uint32_t)((t + period / 2) * BENCH_RATE);
+        for (i = 0; i < BENCH_RATE * 2 / 100; i++) {
+            a = exp(-(double)i / (BENCH_RATE * 0.005));
+            bench_add(mix, n, at + i, 0.15 * a * bench_noise());
+        }
+
+        t += period * (1 + bc->jitter * 2 * bench_noise());
+    }
+
+    for (i = 0; i < n; i++) {
+        a = (double)mix[i] + bc->noise * bench_noise();
+        out[2 * i] = out[2 * i + 1] = (int16_t)lrint(fmax(-1, fmin(1, a)) * 32767);
+    }
+
+    free(mix);
+
+    return out;
+}
+
+static double bench_cpu_time(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * run one loop through a detector, the way the player feeds it, and
+ * match the beats it finds with the true ones, each true beat at
+ * most once
+ *
+ * ret: the F-measure, 2 hits / (2 hits + false beats + missed beats)
+ */
+static double bench_run(const struct bench_case *bc,
+                        const struct bpm_detector_params *params,
+                        uint32_t seconds, int verbose, double *cpu) {
+    bpm_detector_t          *det;
+    struct bpm_beat_grid    grid;
+    int16_t                 *samples;
+    uint8_t                 *matched;
+    uint32_t                beats[16];
+    uint32_t                hop, pos, got, k, i, n = BENCH_RATE * seconds;
+    uint32_t                hits = 0, false_beats = 0, missed = 0;
+    double                  t0, t, grid_bpm = 0;
+
+    samples = bench_generate(bc, seconds);
+    matched = calloc(bench_truth_num, 1);
+    det     = bpm_detector_create(params, BENCH_RATE, 2);
+    if (matched == NULL || det == NULL) {
+        fprintf(stderr, "beatbench: out of memory\n");
+        exit(2);
+    }
+    bpm_detector_set_freq_band(det, 0, BENCH_FREQ_HIGH);
+    hop = bpm_detector_num_of_samples(det);
+
+    for (pos = 0; pos + hop <= n; pos += hop) {
+        t0 = bench_cpu_time();
+        bpm_detector_put_samples(det, samples + pos * 2, hop);
+        got = bpm_detector_get_beats(det, beats, BENCH_ARRAY_SIZE(beats));
+        *cpu += bench_cpu_time() - t0;
+
+        for (k = 0; k < got; k++) {
+            t = (double)beats[k] / BENCH_RATE;
+            if (t < BENCH_SKIP) {
+                continue;
+            }
+
+            for (i = 0; i < bench_truth_num; i++) {
+                if (!matched[i] && fabs(bench_truth[i] - t) <= BENCH_TOLERANCE) {
+                    break;
+                }
+            }
+            if (i < bench_truth_num) {
+                matched[i] = 1;
+                hits++;
+            } else {
+                false_beats++;
+            }
+        }
+    }
+
+    /* the last second may not be final yet */
+    for (i = 0; i < bench_truth_num; i++) {
+        if (!matched[i] && bench_truth[i] >= BENCH_SKIP && bench_truth[i] < seconds - 1) {
+            missed++;
+        }
+    }
+
+    if (bpm_detector_get_grid(det, &grid) == 0 && grid.period > 0) {
+        grid_bpm = 60.0 * 256 * BENCH_RATE / grid.period;
+    }
+
+    if (verbose) {
+        printf("%3.0f -> %3.0f bpm, jitter %.2f, noise %.2f: F %.3f, "
+               "%u hits, %u false, %u missed, grid %5.1f bpm\n",
+               bc->bpm, bc->bpm_end, bc->jitter, bc->noise,
+               hits ? 2.0 * hits / (2.0 * hits + false_beats + missed) : 0.0,
+               hits, false_beats, missed, grid_bpm);
+    }
+
+    bpm_detector_destroy(det);
+    free(matched);
+    free(samples);
+    free(bench_truth);
+
+    return hits ? 2.0 * hits / (2.0 * hits + false_beats + missed) : 0;
+}
+
+static void bench_usage(void) {
+    fprintf(stderr,
+            "usage: beatbench [-p preset] [-s seconds] [-f F] [-n] [-v]\n"
+            "  -p   device or accurate, default device\n"
+            "  -s   seconds per loop, default %d\n"
+            "  -f   lowest mean F-measure, default the preset's budget\n"
+            "  -n   report only, no budget\n"
+            "  -v   print every loop\n"
+            "Exit status 1 if the budget is missed.\n",
+            BENCH_SECONDS);
+}
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+int main(int argc, char *argv[]) {
+    uint32_t            seconds = BENCH_SECONDS;
+    uint32_t            i;
+    double              min_f = -1, f = 0, cpu = 0;
+    int                 preset = BPM_PRESET_DEVICE;
+    int                 c, check = 1, verbose = 0;
+
+    while ((c = getopt(argc, argv, "p:s:f:nv")) != -1) {
+        switch (c) {
+            case 'p':
+                for (preset = 0; preset < BPM_PRESETS; preset++) {
+                    if (strcmp(optarg, bench_budgets[preset].name) == 0) {
+                        break;
+                    }
+                }
+                if (preset == BPM_PRESETS) {
+                    bench_usage();
+                    return 2;
+                }
+                break;
+            case 's':
+                seconds = (uint32_t)atoi(optarg);
+                break;
+            case 'f':
+                min_f = atof(optarg);
+                break;
+            case 'n':
+                check = 0;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                bench_usage();
+                return 2;
+        }
+    }
+    if (optind != argc || seconds < 2 * BENCH_SKIP) {
+        bench_usage();
+        return 2;
+    }
+
+    /* no override, the budget of the preset */
+    if (min_f < 0) {
+        min_f = bench_budgets[preset].min_f;
+    }
+
+    for (i = 0; i < BENCH_ARRAY_SIZE(bench_cases); i++) {
+        f += bench_run(&bench_cases[i], bpm_detector_preset(preset), seconds,
+                       verbose, &cpu);
+    }
+    f /= BENCH_ARRAY_SIZE(bench_cases);
+
+    printf("preset %s, %u loops of %u s, +-%.0f ms\n", bench_budgets[preset].name,
+           (uint32_t)BENCH_ARRAY_SIZE(bench_cases), seconds, BENCH_TOLERANCE * 1000);
+    printf("mean F %.3f\n", f);
+    printf("cpu %.1f ms per minute of audio, with the tempo detector\n",
+           cpu * 1000 * 60 / (seconds * BENCH_ARRAY_SIZE(bench_cases)));
+
+    if (!check) {
+        return 0;
+    }
+
+    if (f < min_f) {
+        printf("FAIL: mean F %.3f, the budget is %.2f\n", f, min_f);
+        return 1;
+    }
+    printf("PASS\n");
+
+    return 0;
+}
@@ -0,0 +1,516 @@
+/*
+ *  Name:    bpmbench.c
+ *
+ *  Purpose: check the accuracy and the speed of the BPM detector on
+ *           synthetic tracks of known tempo
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bpm.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+#ifndef M_PI
+#define M_PI                3.14159265358979323846
+#endif
+
+/* seconds of every generated track, -s */
+#define BENCH_SECONDS       30
+
+/* a tempo within 2 % (and at least 1 BPM) is right */
+#define BENCH_TOLERANCE     0.02
+
+/* the band the player analyses, see mp3_bpm_detect_run() */
+#define BENCH_FREQ_HIGH     4000
+
+/* the track of -h, restarted whenever the detection finishes */
+#define BENCH_HOP_SECONDS   60
+#define BENCH_HOP_BPM       128
+#define BENCH_HOP_RATE      44100
+#define BENCH_HOP_RUNS      7
+
+/* the sample rates the memory of a preset is reported for */
+#define BENCH_MEM_RATE_LOW      44100
+#define BENCH_MEM_RATE_HIGH     48000
+
+/*
+ * The budgets of each preset, checked unless -n. They are the results
+ * of this version with some margin, raise them when the detector gets
+ * better.
+ */
+struct bench_budget {
+    const char  *name;              /* -p */
+    double      min_bpm_hits;       /* % of the tracks, -a */
+    double      min_grid_hits;      /* % of the tracks, -g */
+    double      max_cpu;            /* ms per minute of audio, -c */
+};
+
+static const struct bench_budget bench_budgets[BPM_PRESETS] = {
+    { "device",     70, 55, 60 },   /* BPM_PRESET_DEVICE */
+    { "accurate",   80, 55, 60 },   /* BPM_PRESET_ACCURATE */
+};
+
+enum {
+    BENCH_CLICKS = 0,               /* a click on every beat */
+    BENCH_DRUMS,                    /* kick, snare, hi-hats */
+    BENCH_KINDS
+};
+
+static const char *bench_kind_name[BENCH_KINDS] = { "clicks", "drums" };
+
+static const double     bench_tempos[] = {
+    70, 85, 98, 110, 120, 128, 140, 155, 172
+};
+static const uint32_t   bench_rates[] = { 32000, 44100, 48000 };
+
+#define BENCH_ARRAY_SIZE(a)     (sizeof(a) / sizeof((a)[0]))
+
+/* how a found tempo relates to the true one */
+enum {
+    BENCH_HIT = 0,
+    BENCH_OCTAVE,                   /* x2 or x1/2 */
+    BENCH_METRICAL,                 /* x3/2 or x2/3 */
+    BENCH_WRONG,
+    BENCH_NONE,                     /* no tempo found */
+    BENCH_RESULTS
+};
+
+static const char *bench_result_name[BENCH_RESULTS] = {
+    "hit", "octave", "metrical", "wrong", "none"
+};
+
+struct bench_totals {
+    uint32_t    cases;
+    uint32_t    bpm[BENCH_RESULTS];
+    uint32_t    grid[BENCH_RESULTS];
+
+    double      latency;            /* seconds until detection, summed */
+    uint32_t    detected;
+    double      cpu;                /* seconds */
+    double      audio;              /* seconds */
+};
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+
+/* repeatable noise, the same tracks on every host */
+static uint32_t bench_seed;
+
+static double bench_noise(void) {
+    bench_seed = bench_seed * 1664525u + 1013904223u;
+    return (double)(bench_seed >> 8) / (1 << 24) - 0.5;
+}
+
+static void bench_add(float *mix, uint32_t n, int64_t at, float v) {
+    if (at >= 0 && (uint64_t)at < n) {
+        mix[at] += v;
+    }
+}
+
+/*
+ * render the track in mono float, then spread it over the channels
+ * with the hi-hats panned, so the stereo tracks differ per channel
+ */
+static int16_t *bench_generate(int kind, double bpm, uint32_t rate,
+                               uint32_t channels, uint32_t seconds) {
+    uint32_t    n = rate * seconds;
+    uint32_t    i, k, beat;
+    double      period = 60.0 * rate / bpm;
+    double      t, a, v;
+    float       *mix, *hats;
+    int16_t     *out;
+
+    mix     = calloc(n, sizeof(float));
+    hats    = calloc(n, sizeof(float));
+    out     = malloc(n * channels * sizeof(int16_t));
+    if (mix == NULL || hats == NULL || out == NULL) {
+        free(mix);
+        free(hats);
+        free(out);
+        return NULL;
+    }
+
+    bench_seed = (uint32_t)(bpm * 100) + rate + kind;
+
+    for (beat = 0; beat * period < n; beat++) {
+        t = beat * period;
+
+        if (kind == BENCH_CLICKS) {
+            /* 1 kHz, 30 ms */
+            for (i = 0; i < rate * 3 / 100; i++) {
+                a = exp(-(double)i / (rate * 0.008));
+                bench_add(mix, n, (int64_t)t + i,
+                          0.6f * a * sin(2 * M_PI * 1000 * i / rate));
+            }
+            continue;
+        }
+
+        if (beat % 2 == 0) {
+            /* kick on 1 and 3, a falling sine */
+            for (i = 0; i < rate * 15 / 100; i++) {
+                a = exp(-(double)i / (rate * 0.04));
+                bench_add(mix, n, (int64_t)t + i,
+                          0.7f * a * sin(2 * M_PI * (55 + 50 * a) * i / rate));
+            }
+        } else {
+            /* snare on 2 and 4, noise */
+            for (i = 0; i < rate * 12 / 100; i++) {
+                a = exp(-(double)i / (rate * 0.03));
+                bench_add(mix, n, (int64_t)t + i, 0.45f * a * bench_noise());
+            }
+        }
+
+        /* hi-hats on the eighths */
+        for (k = 0; k < 2; k++) {
+            for (i = 0; i < rate * 2 / 100; i++) {
+                a = exp(-(double)i / (rate * 0.005));
+                bench_add(hats, n, (int64_t)(t + k * period / 2) + i,
+                          0.2f * a * bench_noise());
+            }
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        /* some noise floor */
+        v = mix[i] + 0.02 * bench_noise();
+        if (channels == 1) {
+            v += hats[i];
+            out[i] = (int16_t)lrint(fmax(-1, fmin(1, v)) * 32767);
+        } else {
+            out[2 * i]      = (int16_t)lrint(fmax(-1, fmin(1, v + 0.7 * hats[i])) * 32767);
+            out[2 * i + 1]  = (int16_t)lrint(fmax(-1, fmin(1, v + 0.3 * hats[i])) * 32767);
+        }
+    }
+
+    free(mix);
+    free(hats);
+
+    return out;
+}
+
+static int bench_classify(double found, double truth) {
+    static const double ratios[] = { 1.0, 2.0, 0.5, 1.5, 2.0 / 3.0 };
+    static const int    results[] = {
+        BENCH_HIT, BENCH_OCTAVE, BENCH_OCTAVE, BENCH_METRICAL, BENCH_METRICAL
+    };
+    uint32_t    i;
+    double      want;
+
+    if (found <= 0) {
+        return BENCH_NONE;
+    }
+
+    for (i = 0; i < BENCH_ARRAY_SIZE(ratios); i++) {
+        want = truth * ratios[i];
+        if (fabs(found - want) <= fmax(1.0, want * BENCH_TOLERANCE)) {
+            return results[i];
+        }
+    }
+
+    return BENCH_WRONG;
+}
+
+static double bench_cpu_time(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * run one track through a detector, the way the player feeds it
+ */
+static void bench_run(const struct bpm_detector_params *params,
+                      int kind, double truth, uint32_t rate, uint32_t channels,
+                      uint32_t seconds, int verbose, struct bench_totals *tot) {
+    bpm_detector_t          *det;
+    struct bpm_beat_grid    grid;
+    int16_t                 *samples;
+    uint32_t                hop, pos, n = rate * seconds;
+    uint32_t                done_at = 0;
+    double                  t0, cpu, bpm, grid_bpm = 0;
+    int                     r_bpm, r_grid;
+
+    samples = bench_generate(kind, truth, rate, channels, seconds);
+    det     = bpm_detector_create(params, rate, channels);
+    if (samples == NULL || det == NULL) {
+        fprintf(stderr, "bpmbench: out of memory\n");
+        exit(2);
+    }
+    bpm_detector_set_freq_band(det, 0, BENCH_FREQ_HIGH);
+    hop = bpm_detector_num_of_samples(det);
+
+    /* keep putting after the detection, the beat tracker goes on */
+    t0 = bench_cpu_time();
+    for (pos = 0; pos + hop <= n; pos += hop) {
+        if (bpm_detector_put_samples(det, samples + pos * channels, hop) == 1
+            && done_at == 0) {
+            done_at = pos + hop;
+        }
+    }
+    cpu = bench_cpu_time() - t0;
+
+    bpm = bpm_detector_get_bpm(det);
+    if (bpm_detector_get_grid(det, &grid) == 0 && grid.period > 0) {
+        grid_bpm = 60.0 * 256 * rate / grid.period;
+    }
+
+    r_bpm   = bench_classify(bpm, truth);
+    r_grid  = bench_classify(grid_bpm, truth);
+
+    tot->cases++;
+    tot->bpm[r_bpm]++;
+    tot->grid[r_grid]++;
+    tot->cpu    += cpu;
+    tot->audio  += seconds;
+    if (done_at) {
+        tot->latency += (double)done_at / rate;
+        tot->detected++;
+    }
+
+    if (verbose) {
+        printf("%-6s %5.0f Hz %u ch %5.1f bpm: bpm %3.0f %-8s grid %5.1f %-8s "
+               "detected %5.1f s\n",
+               bench_kind_name[kind], (double)rate, channels, truth,
+               bpm, bench_result_name[r_bpm], grid_bpm,
+               bench_result_name[r_grid], (double)done_at / rate);
+    }
+
+    bpm_detector_destroy(det);
+    free(samples);
+}
+
+/*
+ * The cost of a hop, without the track generation and the grading:
+ * a drum track in stereo is put hop by hop, the detector reset every
+ * time it finishes so the correlations keep running. The best of
+ * BENCH_HOP_RUNS runs, also for the slowest hop of a run, which leaves
+ * out most of the preemptions of the host.
+ */
+static void bench_hops(const struct bpm_detector_params *params, const char *name) {
+    bpm_detector_t  *det;
+    int16_t         *samples;
+    uint32_t        hop, pos, hops, run, n = BENCH_HOP_RATE * BENCH_HOP_SECONDS;
+    double          t0, t1, cpu, peak, best = 0, best_peak = 0;
+
+    samples = bench_generate(BENCH_DRUMS, BENCH_HOP_BPM, BENCH_HOP_RATE, 2,
+                             BENCH_HOP_SECONDS);
+    det     = bpm_detector_create(params, BENCH_HOP_RATE, 2);
+    if (samples == NULL || det == NULL) {
+        fprintf(stderr, "bpmbench: out of memory\n");
+        exit(2);
+    }
+    bpm_detector_set_freq_band(det, 0, BENCH_FREQ_HIGH);
+    hop = bpm_detector_num_of_samples(det);
+
+    for (run = 0; run < BENCH_HOP_RUNS; run++) {
+        bpm_detector_reset(det);
+        cpu     = 0;
+        peak    = 0;
+        hops    = 0;
+        for (pos = 0; pos + hop <= n; pos += hop) {
+            t0 = bench_cpu_time();
+            if (bpm_detector_put_samples(det, samples + pos * 2, hop) == 1) {
+                bpm_detector_reset(det);
+            }
+            t1 = bench_cpu_time();
+
+            cpu     += t1 - t0;
+            peak    = fmax(peak, t1 - t0);
+            hops++;
+        }
+        best = fmax(best, hops / cpu);
+        best_peak = (run == 0) ? peak : fmin(best_peak, peak);
+    }
+
+    printf("%-8s | hop %4u | %6.3f M hops/s | slowest hop %6.1f us\n",
+           name, hop, best / 1e6, best_peak * 1e6);
+
+    bpm_detector_destroy(det);
+    free(samples);
+}
+
+static void bench_print_results(const char *name, const uint32_t *results,
+                                uint32_t cases) {
+    int     i;
+
+    printf("%-5s", name);
+    for (i = 0; i < BENCH_RESULTS; i++) {
+        printf(" %s %u (%.0f%%)%s", bench_result_name[i], results[i],
+               100.0 * results[i] / cases, (i < BENCH_RESULTS - 1) ? "," : "\n");
+    }
+}
+
+static void bench_usage(void) {
+    fprintf(stderr,
+            "usage: bpmbench [-p preset] [-s seconds] [-a %%] [-g %%] [-c ms] [-n] [-v] [-h]\n"
+            "  -p   device or accurate, default every preset\n"
+            "  -s   seconds per track, default %d\n"
+            "  -a   lowest share of right BPMs, default the preset's budget\n"
+            "  -g   lowest share of right beat grids, default the preset's budget\n"
+            "  -c   most CPU time per minute of audio, default the preset's budget\n"
+            "  -n   report only, no budgets\n"
+            "  -v   print every track\n"
+            "  -h   only the hops per CPU second and the slowest hop, on %d s\n"
+            "       of drums, to compare versions of the detector\n"
+            "Exit status 1 if a budget is missed.\n",
+            BENCH_SECONDS, BENCH_HOP_SECONDS);
+}
+
+/*
+ * run every track through one preset, report and check its budget
+ *
+ * ret: 1 if a budget is missed, or 0
+ */
+static int bench_preset(int preset, uint32_t seconds, int verbose, int check,
+                        double min_bpm, double min_grid, double max_cpu) {
+    const struct bpm_detector_params    *params = bpm_detector_preset(preset);
+    const struct bench_budget           *budget = &bench_budgets[preset];
+    struct bench_totals tot;
+    uint32_t            t, r, ch;
+    double              bpm_hits, grid_hits, cpu;
+    int                 kind, fail = 0;
+
+    /* no override, the budget of the preset */
+    if (min_bpm < 0) {
+        min_bpm = budget->min_bpm_hits;
+    }
+    if (min_grid < 0) {
+        min_grid = budget->min_grid_hits;
+    }
+    if (max_cpu < 0) {
+        max_cpu = budget->max_cpu;
+    }
+
+    printf("preset %s: fft %u, %u subbands, window %u ms, %u..%u BPM, octave %u%%\n",
+           budget->name, params->fft_points, params->subbands, params->window,
+           params->min_bpm, params->max_bpm, params->octave);
+    printf("memory %u bytes at %u Hz, %u bytes at %u Hz\n",
+           bpm_detector_mem_size(params, BENCH_MEM_RATE_LOW), BENCH_MEM_RATE_LOW,
+           bpm_detector_mem_size(params, BENCH_MEM_RATE_HIGH), BENCH_MEM_RATE_HIGH);
+
+    memset(&tot, 0, sizeof(tot));
+    for (kind = 0; kind < BENCH_KINDS; kind++) {
+        for (r = 0; r < BENCH_ARRAY_SIZE(bench_rates); r++) {
+            for (ch = 1; ch <= 2; ch++) {
+                for (t = 0; t < BENCH_ARRAY_SIZE(bench_tempos); t++) {
+                    bench_run(params, kind, bench_tempos[t], bench_rates[r], ch,
+                              seconds, verbose, &tot);
+                }
+            }
+        }
+    }
+
+    bpm_hits    = 100.0 * tot.bpm[BENCH_HIT] / tot.cases;
+    grid_hits   = 100.0 * tot.grid[BENCH_HIT] / tot.cases;
+    cpu         = tot.cpu * 1000 * 60 / tot.audio;
+
+    printf("%u tracks of %u s\n", tot.cases, seconds);
+    bench_print_results("bpm", tot.bpm, tot.cases);
+    bench_print_results("grid", tot.grid, tot.cases);
+    printf("detected in %u tracks, after %.1f s on average\n", tot.detected,
+           tot.detected ? tot.latency / tot.detected : 0.0);
+    printf("cpu %.1f ms per minute of audio\n", cpu);
+
+    if (!check) {
+        return 0;
+    }
+
+    if (bpm_hits < min_bpm) {
+        printf("FAIL: %.0f%% right BPMs, the budget is %.0f%%\n", bpm_hits, min_bpm);
+        fail = 1;
+    }
+    if (grid_hits < min_grid) {
+        printf("FAIL: %.0f%% right beat grids, the budget is %.0f%%\n", grid_hits, min_grid);
+        fail = 1;
+    }
+    if (cpu > max_cpu) {
+        printf("FAIL: %.1f ms per minute, the budget is %.0f ms\n", cpu, max_cpu);
+        fail = 1;
+    }
+    if (!fail) {
+        printf("PASS\n");
+    }
+
+    return fail;
+}
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+int main(int argc, char *argv[]) {
+    uint32_t            seconds = BENCH_SECONDS;
+    double              min_bpm = -1, min_grid = -1, max_cpu = -1;
+    int                 preset = -1;
+    int                 i, c;
+    int                 check = 1, verbose = 0, fail = 0, hops = 0;
+
+    while ((c = getopt(argc, argv, "p:s:a:g:c:nvh")) != -1) {
+        switch (c) {
+            case 'p':
+                for (preset = 0; preset < BPM_PRESETS; preset++) {
+                    if (strcmp(optarg, bench_budgets[preset].name) == 0) {
+                        break;
+                    }
+                }
+                if (preset == BPM_PRESETS) {
+                    bench_usage();
+                    return 2;
+                }
+                break;
+            case 's':
+                seconds = (uint32_t)atoi(optarg);
+                break;
+            case 'a':
+                min_bpm = atof(optarg);
+                break;
+            case 'g':
+                min_grid = atof(optarg);
+                break;
+            case 'c':
+                max_cpu = atof(optarg);
+                break;
+            case 'n':
+                check = 0;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'h':
+                hops = 1;
+                break;
+            default:
+                bench_usage();
+                return 2;
+        }
+    }
+    if (optind != argc || seconds < 5) {
+        bench_usage();
+        return 2;
+    }
+
+    for (i = 0; i < BPM_PRESETS; i++) {
+        if (preset >= 0 && i != preset) {
+            continue;
+        }
+        if (hops) {
+            bench_hops(bpm_detector_preset(i), bench_budgets[i].name);
+            continue;
+        }
+        if (i > 0 && preset < 0) {
+            printf("\n");
+        }
+        fail |= bench_preset(i, seconds, verbose, check, min_bpm, min_grid, max_cpu);
+    }
+
+    return fail;
+}
@@ -0,0 +1,950 @@
+/*
+ *  Name:    bpmscan.c
+ *
+ *  Purpose: analyse the BPM and duration of a music library on a PC,
+ *           and write the index the player reads
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "mp3dec.h"
+#include "bpm.h"
+#include "bpm_index.h"
+
+/* FatFs has its own DIR */
+#define DIR     FF_DIR
+#include "ff.h"
+#undef DIR
+#include <dirent.h>
+
+#include "diskio_image.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+
+/* one Helix instance per worker, see MP3DEC_MAX_INSTANCES in the Makefile */
+#define SCAN_MAX_WORKERS        32
+
+/* the detector memory of a worker is sized for the highest rate */
+#define SCAN_MAX_RATE           48000
+
+/* seconds of each track put into the detector, -t */
+#define SCAN_ANALYZE_SECONDS    60
+
+/* the band the player analyses, see mp3_bpm_detect_run() */
+#define SCAN_FREQ_HIGH          4000
+
+/* the delay of the decoder filter bank, as LAME accounts for it */
+#define SCAN_DECODER_DELAY      529
+
+/* give up a file after this many undecodable frames in a row */
+#define SCAN_MAX_ERRORS         64
+
+#define SCAN_PATH_MAX           1024
+
+struct scan_file {
+    char                    *path;          /* as the player opens it */
+    uint32_t                size;
+    struct bpm_index_record rec;
+};
+
+/* nanoseconds per stage, summed over the files of a worker */
+struct scan_stats {
+    uint64_t    read;
+    uint64_t    decode;
+    uint64_t    analyze;
+    uint64_t    scan;
+
+    uint32_t    files;
+    uint32_t    failed;
+    uint32_t    stolen;
+    uint64_t    bytes;
+};
+
+/*
+ * The files of a worker, items[top .. bottom). The owner takes from
+ * the top, thieves from the bottom, one file at a time. The lists are
+ * dealt out by decreasing size, so each worker starts with its largest
+ * files and the thieves take the small ones that balance the end.
+ */
+struct scan_deque {
+    pthread_mutex_t     lock;
+    uint32_t            *items;
+    uint32_t            top;
+    uint32_t            bottom;
+};
+
+struct scan_worker {
+    struct scan_ctx     *ctx;
+    int                 id;
+    pthread_t           thread;
+    struct scan_deque   deque;
+
+    HMP3Decoder         decoder;
+    void                *det_mem;
+    uint32_t            det_size;
+
+    uint8_t             *buf;               /* the whole file */
+    uint32_t            buf_size;
+    short               pcm[MAX_NGRAN * MAX_NSAMP];
+    short               *hop;               /* bpm_detector_num_of_samples() */
+
+    struct scan_stats   stats;
+};
+
+struct scan_ctx {
+    const char          *root;
+    int                 image;              /* root is a FAT image */
+    FATFS               fs;
+    pthread_mutex_t     fat_lock;           /* FatFs is not reentrant */
+    pthread_mutex_t     pool_lock;          /* nor the Helix instance pool */
+
+    struct scan_file    *files;
+    uint32_t            count;
+    uint32_t            cap;
+
+    struct scan_worker  *workers;
+    int                 nworkers;
+
+    uint32_t            max_seconds;
+    int                 verbose;
+
+    /* the analysis, the one of the player unless -p */
+    const struct bpm_detector_params *params;
+};
+
+/* what the first frame tells about the track */
+struct scan_track {
+    uint32_t    sample_rate;
+    uint32_t    channels;
+    uint32_t    spf;                /* samples per frame */
+    uint32_t    skip;               /* priming samples to drop */
+    int64_t     remain;             /* playable samples, -1 if unknown */
+};
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+static uint64_t scan_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int scan_is_mp3(const char *name) {
+    const char  *dot = strrchr(name, '.');
+
+    return dot != NULL && strcasecmp(dot + 1, "mp3") == 0;
+}
+
+static int scan_add_file(struct scan_ctx *ctx, const char *path, uint32_t size) {
+    struct scan_file    *files;
+
+    if (ctx->count == ctx->cap) {
+        ctx->cap    = ctx->cap ? ctx->cap * 2 : 256;
+        files       = realloc(ctx->files, ctx->cap * sizeof(*files));
+        if (files == NULL) {
+            return -1;
+        }
+        ctx->files = files;
+    }
+
+    memset(&ctx->files[ctx->count], 0, sizeof(struct scan_file));
+    ctx->files[ctx->count].path = strdup(path);
+    ctx->files[ctx->count].size = size;
+    if (ctx->files[ctx->count].path == NULL) {
+        return -1;
+    }
+    ctx->count++;
+
+    return 0;
+}
+
+/*
+ * collect the mp3 files under dir, rel is the player's path of dir
+ */
+static int scan_walk_dir(struct scan_ctx *ctx, const char *dir, const char *rel) {
+    DIR             *d;
+    struct dirent   *de;
+    struct stat     st;
+    char            path[SCAN_PATH_MAX];
+    char            sub[SCAN_PATH_MAX];
+    int             ret = 0;
+
+    d = opendir(dir);
+    if (d == NULL) {
+        fprintf(stderr, "bpmscan: cannot open %s\n", dir);
+        return -1;
+    }
+
+    while (ret == 0 && (de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        snprintf(sub, sizeof(sub), "%s/%s", rel, de->d_name);
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            ret = scan_walk_dir(ctx, path, sub);
+        } else if (S_ISREG(st.st_mode) && scan_is_mp3(de->d_name)) {
+            ret = scan_add_file(ctx, sub, (uint32_t)st.st_size);
+        }
+    }
+    closedir(d);
+
+    return ret;
+}
+
+/*
+ * the same over FatFs, path is the player's path of the directory
+ */
+static int scan_walk_fat(struct scan_ctx *ctx, const char *path) {
+    FF_DIR          dir;
+    FILINFO         fno;
+    char            lfn[_MAX_LFN + 1];
+    char            sub[SCAN_PATH_MAX];
+    char            *fn;
+    int             ret = 0;
+
+    fno.lfname  = lfn;
+    fno.lfsize  = sizeof(lfn);
+
+    if (f_opendir(&dir, path) != FR_OK) {
+        fprintf(stderr, "bpmscan: cannot open %s in the image\n", path);
+        return -1;
+    }
+
+    while (ret == 0) {
+        if (f_readdir(&dir, &fno) != FR_OK || fno.fname[0] == 0) {
+            break;
+        }
+        if (fno.fname[0] == '.') {
+            continue;
+        }
+
+        fn = *fno.lfname ? fno.lfname : fno.fname;
+        snprintf(sub, sizeof(sub), "%s/%s", path, fn);
+
+        if (fno.fattrib & AM_DIR) {
+            ret = scan_walk_fat(ctx, sub);
+        } else if (scan_is_mp3(fn)) {
+            ret = scan_add_file(ctx, sub, fno.fsize);
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * read the whole file into the buffer of the worker
+ *
+ * ret: the number of bytes, -1 on error
+ */
+static int64_t scan_read_file(struct scan_ctx *ctx, struct scan_worker *w,
+                              const struct scan_file *file) {
+    char        path[SCAN_PATH_MAX];
+    FILE        *fp;
+    FIL         fil;
+    UINT        br;
+    size_t      n;
+    FRESULT     res;
+    uint8_t     *buf;
+
+    if (file->size > w->buf_size) {
+        buf = realloc(w->buf, file->size);
+        if (buf == NULL) {
+            return -1;
+        }
+        w->buf      = buf;
+        w->buf_size = file->size;
+    }
+
+    if (ctx->image) {
+        pthread_mutex_lock(&ctx->fat_lock);
+        res = f_open(&fil, file->path, FA_OPEN_EXISTING | FA_READ);
+        if (res == FR_OK) {
+            res = f_read(&fil, w->buf, file->size, &br);
+            f_close(&fil);
+        }
+        pthread_mutex_unlock(&ctx->fat_lock);
+
+        return (res == FR_OK) ? (int64_t)br : -1;
+    }
+
+    snprintf(path, sizeof(path), "%s%s", ctx->root, file->path);
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return -1;
+    }
+    n = fread(w->buf, 1, file->size, fp);
+    fclose(fp);
+
+    return (int64_t)n;
+}
+
+/* the size of an ID3v2 tag at p, 0 if there is none */
+static uint32_t scan_id3v2_size(const uint8_t *p, uint32_t len) {
+    uint32_t    size;
+
+    if (len < 10 || memcmp(p, "ID3", 3) != 0) {
+        return 0;
+    }
+
+    /* synchsafe, 7 bits per byte */
+    size = ((uint32_t)(p[6] & 0x7f) << 21) | ((uint32_t)(p[7] & 0x7f) << 14)
+           | ((uint32_t)(p[8] & 0x7f) << 7) | (p[9] & 0x7f);
+    size += 10;
+    if (p[5] & 0x10) {
+        /* footer */
+        size += 10;
+    }
+
+    return (size < len) ? size : len;
+}
+
+static uint32_t scan_get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16)
+           | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+ * The length of the layer 3 frame with the header at p, 0 if p is not
+ * a valid header. Free format frames are not supported.
+ */
+static uint32_t scan_frame_len(const uint8_t *p, uint32_t *spf) {
+    static const uint16_t   bitrate[2][15] = {
+        { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+        { 0,  8, 16, 24, 32, 40, 48, 56,  64,  80,  96, 112, 128, 144, 160 },
+    };
+    static const uint16_t   samprate[3] = { 44100, 48000, 32000 };
+
+    uint32_t    version, layer, br, sr, lsf;
+
+    if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0) {
+        return 0;
+    }
+
+    version = (p[1] >> 3) & 3;          /* 3: MPEG1, 2: MPEG2, 0: MPEG2.5 */
+    layer   = (p[1] >> 1) & 3;          /* 1: layer 3 */
+    br      = p[2] >> 4;
+    sr      = (p[2] >> 2) & 3;
+    if (version == 1 || layer != 1 || br == 0 || br == 15 || sr == 3) {
+        return 0;
+    }
+
+    lsf = (version != 3);
+    sr  = samprate[sr] >> (version == 3 ? 0 : (version == 2 ? 1 : 2));
+
+    *spf = lsf ? 576 : 1152;
+    return (*spf / 8) * bitrate[lsf][br] * 1000 / sr + ((p[2] >> 1) & 1);
+}
+
+/*
+ * The first frame gives the format, and may be the Xing/Info frame
+ * of LAME with the encoder delay and padding. This does what
+ * mp3_decoder_parse_info() does on the player, so the positions in
+ * the index are the ones the player counts.
+ *
+ * ret: 0 if success, -1 if p is not an mp3 frame
+ */
+static int scan_parse_first(HMP3Decoder decoder, uint8_t *p, uint32_t len,
+                            struct scan_track *track) {
+    MP3FrameInfo    info;
+    uint32_t        flags, frames = 0;
+    uint32_t        delay, padding;
+    uint32_t        offset;
+
+    if (MP3GetNextFrameInfo(decoder, &info, p) != ERR_MP3_NONE) {
+        return -1;
+    }
+
+    track->sample_rate  = info.samprate;
+    track->channels     = info.nChans;
+    track->skip         = 0;
+    track->remain       = -1;
+
+    if (info.version == MPEG1) {
+        offset      = (info.nChans == 1) ? 17 : 32;
+        track->spf  = 1152;
+    } else {
+        offset      = (info.nChans == 1) ? 9 : 17;
+        track->spf  = 576;
+    }
+    offset += 4;
+    if ((p[1] & 0x01) == 0) {
+        /* CRC */
+        offset += 2;
+    }
+
+    /* tag, flags, frames, bytes, TOC, quality, LAME extension */
+    if (len < offset + 8 + 4 + 4 + 100 + 4 + 24) {
+        return 0;
+    }
+
+    p += offset;
+    if (memcmp(p, "Xing", 4) != 0 && memcmp(p, "Info", 4) != 0) {
+        return 0;
+    }
+
+    flags = scan_get_be32(p + 4);
+    p += 8;
+    if (flags & 0x01) {
+        frames = scan_get_be32(p);
+        p += 4;
+    }
+    if (flags & 0x02) p += 4;
+    if (flags & 0x04) p += 100;
+    if (flags & 0x08) p += 4;
+
+    /* the Info frame itself decodes to silence */
+    track->skip = track->spf;
+
+    if (memcmp(p, "LAME", 4) != 0 && memcmp(p, "Lavc", 4) != 0
+        && memcmp(p, "Lavf", 4) != 0) {
+        return 0;
+    }
+
+    delay   = (p[21] << 4) | (p[22] >> 4);
+    padding = ((p[22] & 0x0f) << 8) | p[23];
+
+    track->skip += delay + SCAN_DECODER_DELAY;
+    if ((uint64_t)frames * track->spf > delay + padding) {
+        track->remain = (int64_t)frames * track->spf - delay - padding;
+    }
+
+    return 0;
+}
+
+/*
+ * count the samples of a track without a LAME tag by walking the
+ * frame headers, from the first frame at p
+ */
+static uint32_t scan_count_samples(const uint8_t *p, uint32_t len) {
+    uint32_t    pos = 0;
+    uint32_t    samples = 0;
+    uint32_t    frame, spf;
+
+    while (pos + 4 <= len) {
+        frame = scan_frame_len(p + pos, &spf);
+        if (frame == 0) {
+            /* lost sync, e.g. a tag in the middle */
+            pos++;
+            continue;
+        }
+
+        /* a header in the last bytes is not a frame */
+        if (pos + frame > len) {
+            break;
+        }
+        samples += spf;
+        pos     += frame;
+    }
+
+    return samples;
+}
+
+/*
+ * decode the start of the track and put it into the detector
+ *
+ * ret: 0 if success, -1 if the track cannot be decoded
+ */
+static int scan_analyze(struct scan_ctx *ctx, struct scan_worker *w,
+                        uint8_t *p, int bytes_left,
+                        const struct scan_track *track,
+                        struct bpm_index_record *rec) {
+    bpm_detector_t  *det;
+    MP3FrameInfo    info;
+    uint32_t        hop, fill = 0;
+    uint32_t        skip = track->skip;
+    uint64_t        limit, done = 0;
+    uint64_t        t0, t1;
+    int             err, errors = 0;
+    int             n, k, offset;
+    int             finished = 0;
+    short           *pcm;
+
+    det = bpm_detector_init(w->det_mem, w->det_size, ctx->params,
+                            track->sample_rate, 1);
+    if (det == NULL) {
+        return -1;
+    }
+    bpm_detector_set_freq_band(det, 0, SCAN_FREQ_HIGH);
+    hop = bpm_detector_num_of_samples(det);
+
+    limit = (uint64_t)ctx->max_seconds * track->sample_rate;
+    if (track->remain >= 0 && (uint64_t)track->remain < limit) {
+        limit = track->remain;
+    }
+
+    MP3SetOutputFormat(w->decoder, MP3_OUTPUT_MONO);
+
+    while (!finished && done < limit) {
+        t0 = scan_now();
+        offset = MP3FindSyncWord(p, bytes_left);
+        if (offset < 0) {
+            break;
+        }
+        p           += offset;
+        bytes_left  -= offset;
+
+        err = MP3Decode(w->decoder, &p, &bytes_left, w->pcm, 0);
+        t1 = scan_now();
+        w->stats.decode += t1 - t0;
+
+        if (err == ERR_MP3_INDATA_UNDERFLOW) {
+            break;
+        } else if (err == ERR_MP3_MAINDATA_UNDERFLOW) {
+            /* the bit reservoir refers to a frame before the start */
+            continue;
+        } else if (err != ERR_MP3_NONE) {
+            if (++errors > SCAN_MAX_ERRORS) {
+                return -1;
+            }
+            /* skip the bad header and resync */
+            p++;
+            bytes_left--;
+            continue;
+        }
+        errors = 0;
+
+        MP3GetLastFrameInfo(w->decoder, &info);
+        if ((uint32_t)info.samprate != track->sample_rate) {
+            /* a rate change would need another detector, stop here */
+            break;
+        }
+
+        n   = info.outputSamps;
+        pcm = w->pcm;
+        if (skip > 0) {
+            k       = (skip < (uint32_t)n) ? (int)skip : n;
+            skip    -= k;
+            pcm     += k;
+            n       -= k;
+        }
+        if ((uint64_t)n > limit - done) {
+            n = (int)(limit - done);
+        }
+        done += n;
+
+        /* the detector takes whole hops */
+        while (n > 0 && !finished) {
+            k = hop - fill;
+            if (k > n) {
+                k = n;
+            }
+            memcpy(w->hop + fill, pcm, k * sizeof(short));
+            fill    += k;
+            pcm     += k;
+            n       -= k;
+
+            if (fill == hop) {
+                /* keep the beat tracker running after the BPM is found */
+                bpm_detector_put_samples(det, w->hop, hop);
+                fill = 0;
+            }
+        }
+
+        w->stats.analyze += scan_now() - t1;
+    }
+
+    rec->bpm = bpm_detector_get_bpm(det);
+    if (rec->bpm) {
+        rec->flags |= BPM_INDEX_HAS_BPM;
+    }
+    if (bpm_detector_get_grid(det, &rec->grid) == 0) {
+        rec->flags |= BPM_INDEX_HAS_GRID;
+    }
+
+    return (done > 0) ? 0 : -1;
+}
+
+static void scan_file(struct scan_ctx *ctx, struct scan_worker *w,
+                      struct scan_file *file) {
+    struct scan_track   track;
+    uint64_t            t0;
+    int64_t             len;
+    uint32_t            start;
+    int                 offset;
+
+    t0  = scan_now();
+    len = scan_read_file(ctx, w, file);
+    w->stats.read += scan_now() - t0;
+
+    file->rec.flags = BPM_INDEX_ERROR;
+    if (len <= 0) {
+        return;
+    }
+    w->stats.bytes += len;
+
+    start   = scan_id3v2_size(w->buf, (uint32_t)len);
+    offset  = MP3FindSyncWord(w->buf + start, (int)(len - start));
+    if (offset < 0) {
+        return;
+    }
+    start += offset;
+
+    /*
+     * Helix has no reset, and its state (overlap, bit reservoir) would
+     * carry over from the previous file, so like the player take a
+     * fresh instance per file. The pool hands back the slot just freed.
+     */
+    pthread_mutex_lock(&ctx->pool_lock);
+    MP3FreeDecoder(w->decoder);
+    w->decoder = MP3InitDecoder();
+    pthread_mutex_unlock(&ctx->pool_lock);
+    if (w->decoder == NULL) {
+        return;
+    }
+
+    if (scan_parse_first(w->decoder, w->buf + start, (uint32_t)(len - start),
+                         &track) != 0) {
+        return;
+    }
+
+    file->rec.flags         = 0;
+    file->rec.sample_rate   = track.sample_rate;
+    file->rec.channels      = track.channels;
+
+    if (scan_analyze(ctx, w, w->buf + start, (int)(len - start),
+                     &track, &file->rec) != 0) {
+        file->rec.flags |= BPM_INDEX_ERROR;
+    }
+
+    /* the duration, from the tag or else the frame headers */
+    t0 = scan_now();
+    if (track.remain >= 0) {
+        file->rec.duration  = (uint32_t)track.remain;
+        file->rec.flags     |= BPM_INDEX_GAPLESS;
+    } else {
+        file->rec.duration  = scan_count_samples(w->buf + start,
+                                                 (uint32_t)(len - start));
+        if (file->rec.duration > track.skip) {
+            file->rec.duration -= track.skip;
+        }
+    }
+    w->stats.scan += scan_now() - t0;
+}
+
+/*
+ * the next file of worker w, its own first, then one stolen
+ *
+ * ret: the index of the file, -1 when all the lists are empty
+ */
+static int64_t scan_next(struct scan_ctx *ctx, struct scan_worker *w) {
+    struct scan_deque   *q = &w->deque;
+    int64_t             item = -1;
+    int                 i;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->top < q->bottom) {
+        item = q->items[q->top++];
+    }
+    pthread_mutex_unlock(&q->lock);
+    if (item >= 0) {
+        return item;
+    }
+
+    /* the lists only shrink, so one pass over the victims is enough */
+    for (i = 1; i < ctx->nworkers && item < 0; i++) {
+        q = &ctx->workers[(w->id + i) % ctx->nworkers].deque;
+
+        pthread_mutex_lock(&q->lock);
+        if (q->top < q->bottom) {
+            item = q->items[--q->bottom];
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+    if (item >= 0) {
+        w->stats.stolen++;
+    }
+
+    return item;
+}
+
+static void *scan_worker_main(void *arg) {
+    struct scan_worker  *w = arg;
+    struct scan_ctx     *ctx = w->ctx;
+    struct scan_file    *file;
+    int64_t             item;
+
+    while ((item = scan_next(ctx, w)) >= 0) {
+        file = &ctx->files[item];
+        scan_file(ctx, w, file);
+
+        w->stats.files++;
+        if (file->rec.flags & BPM_INDEX_ERROR) {
+            w->stats.failed++;
+        }
+
+        if (ctx->verbose) {
+            printf("%3u bpm, grid %5.1f bpm, %7.1f s %s%s\n", file->rec.bpm,
+                   (file->rec.flags & BPM_INDEX_HAS_GRID)
+                       ? 60.0 * 256 * file->rec.sample_rate / file->rec.grid.period : 0.0,
+                   file->rec.sample_rate
+                       ? (double)file->rec.duration / file->rec.sample_rate : 0.0,
+                   file->path,
+                   (file->rec.flags & BPM_INDEX_ERROR) ? " (error)" : "");
+        }
+    }
+
+    return NULL;
+}
+
+/* larger files first */
+static int scan_cmp_size(const void *a, const void *b) {
+    const struct scan_file  *fa = a;
+    const struct scan_file  *fb = b;
+
+    return (fa->size < fb->size) - (fa->size > fb->size);
+}
+
+static int scan_cmp_path(const void *a, const void *b) {
+    return strcmp(((const struct scan_file *)a)->path,
+                  ((const struct scan_file *)b)->path);
+}
+
+static int scan_write_index(struct scan_ctx *ctx, const char *path) {
+    struct bpm_index_header hdr;
+    struct bpm_index_record rec;
+    FILE                    *fp;
+    uint32_t                i, offset = 0;
+    int                     ok = 1;
+
+    qsort(ctx->files, ctx->count, sizeof(struct scan_file), scan_cmp_path);
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    hdr.magic       = BPM_INDEX_MAGIC;
+    hdr.version     = BPM_INDEX_VERSION;
+    hdr.record_size = sizeof(struct bpm_index_record);
+    hdr.count       = ctx->count;
+    hdr.strings_size = 0;
+    for (i = 0; i < ctx->count; i++) {
+        hdr.strings_size += strlen(ctx->files[i].path) + 1;
+    }
+    ok &= fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+
+    for (i = 0; i < ctx->count; i++) {
+        rec         = ctx->files[i].rec;
+        rec.path    = offset;
+        offset      += strlen(ctx->files[i].path) + 1;
+        ok &= fwrite(&rec, sizeof(rec), 1, fp) == 1;
+    }
+
+    for (i = 0; i < ctx->count; i++) {
+        ok &= fputs(ctx->files[i].path, fp) >= 0;
+        ok &= fputc('\0', fp) == 0;
+    }
+
+    ok &= fclose(fp) == 0;
+
+    return ok ? 0 : -1;
+}
+
+static void scan_usage(void) {
+    fprintf(stderr,
+            "usage: bpmscan [-j workers] [-t seconds] [-p preset] [-o index] [-v] <dir | image>\n"
+            "  -j   number of worker threads, 1 .. %d, default: the CPUs\n"
+            "  -t   seconds of each track analysed, default %d\n"
+            "  -p   analysis, device (as the player, default) or accurate\n"
+            "  -o   index to write, default bpm.idx\n"
+            "  -v   print every track\n"
+            "A FAT image (file) is read through FatFs, a directory directly.\n",
+            SCAN_MAX_WORKERS, SCAN_ANALYZE_SECONDS);
+}
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+int main(int argc, char *argv[]) {
+    struct scan_ctx     ctx;
+    struct scan_worker  *w;
+    struct scan_stats   total;
+    struct stat         st;
+    const char          *out = "bpm.idx";
+    uint64_t            t0, t_walk, t_scan;
+    uint32_t            i, det_size;
+    int                 c, ret;
+    double              wall;
+
+    memset(&ctx, 0, sizeof(ctx));
+    pthread_mutex_init(&ctx.pool_lock, NULL);
+    ctx.nworkers    = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    ctx.max_seconds = SCAN_ANALYZE_SECONDS;
+    ctx.params      = bpm_detector_preset(BPM_PRESET_DEVICE);
+
+    while ((c = getopt(argc, argv, "j:t:p:o:v")) != -1) {
+        switch (c) {
+            case 'j':
+                ctx.nworkers = atoi(optarg);
+                break;
+            case 't':
+                ctx.max_seconds = (uint32_t)atoi(optarg);
+                break;
+            case 'p':
+                if (strcmp(optarg, "device") == 0) {
+                    ctx.params = bpm_detector_preset(BPM_PRESET_DEVICE);
+                } else if (strcmp(optarg, "accurate") == 0) {
+                    ctx.params = bpm_detector_preset(BPM_PRESET_ACCURATE);
+                } else {
+                    scan_usage();
+                    return 2;
+                }
+                break;
+            case 'o':
+                out = optarg;
+                break;
+            case 'v':
+                ctx.verbose = 1;
+                break;
+            default:
+                scan_usage();
+                return 2;
+        }
+    }
+    if (optind + 1 != argc || ctx.max_seconds == 0) {
+        scan_usage();
+        return 2;
+    }
+    if (ctx.nworkers < 1) {
+        ctx.nworkers = 1;
+    } else if (ctx.nworkers > SCAN_MAX_WORKERS) {
+        ctx.nworkers = SCAN_MAX_WORKERS;
+    }
+
+    ctx.root = argv[optind];
+    if (stat(ctx.root, &st) != 0) {
+        fprintf(stderr, "bpmscan: cannot find %s\n", ctx.root);
+        return 1;
+    }
+
+    /* collect the files */
+    t0 = scan_now();
+    if (S_ISDIR(st.st_mode)) {
+        ret = scan_walk_dir(&ctx, ctx.root, "");
+    } else {
+        ctx.image = 1;
+        pthread_mutex_init(&ctx.fat_lock, NULL);
+        if (disk_image_open(ctx.root) != 0 || f_mount(0, &ctx.fs) != FR_OK) {
+            fprintf(stderr, "bpmscan: cannot open the image %s\n", ctx.root);
+            return 1;
+        }
+        ret = scan_walk_fat(&ctx, "");
+    }
+    if (ret != 0) {
+        return 1;
+    }
+    t_walk = scan_now() - t0;
+
+    if (ctx.count < (uint32_t)ctx.nworkers) {
+        ctx.nworkers = ctx.count ? ctx.count : 1;
+    }
+
+    /* one decoder and one detector per worker, made before the threads */
+    ctx.workers = calloc(ctx.nworkers, sizeof(struct scan_worker));
+    if (ctx.workers == NULL) {
+        return 1;
+    }
+    det_size = bpm_detector_mem_size(ctx.params, SCAN_MAX_RATE);
+    for (c = 0; c < ctx.nworkers; c++) {
+        w           = &ctx.workers[c];
+        w->ctx      = &ctx;
+        w->id       = c;
+        w->decoder  = MP3InitDecoder();
+        w->det_mem  = malloc(det_size);
+        w->det_size = det_size;
+        w->hop      = malloc(MAX_NGRAN * MAX_NSAMP * sizeof(short));
+        w->deque.items = malloc((ctx.count / ctx.nworkers + 1) * sizeof(uint32_t));
+        if (w->decoder == NULL || w->det_mem == NULL || w->hop == NULL
+            || w->deque.items == NULL) {
+            fprintf(stderr, "bpmscan: out of memory\n");
+            return 1;
+        }
+        pthread_mutex_init(&w->deque.lock, NULL);
+    }
+
+    /* deal the files out, larger first */
+    qsort(ctx.files, ctx.count, sizeof(struct scan_file), scan_cmp_size);
+    for (i = 0; i < ctx.count; i++) {
+        w = &ctx.workers[i % ctx.nworkers];
+        w->deque.items[w->deque.bottom++] = i;
+    }
+
+    t0 = scan_now();
+    for (c = 0; c < ctx.nworkers; c++) {
+        pthread_create(&ctx.workers[c].thread, NULL, scan_worker_main,
+                       &ctx.workers[c]);
+    }
+    for (c = 0; c < ctx.nworkers; c++) {
+        pthread_join(ctx.workers[c].thread, NULL);
+    }
+    t_scan = scan_now() - t0;
+
+    if (scan_write_index(&ctx, out) != 0) {
+        fprintf(stderr, "bpmscan: cannot write %s\n", out);
+        return 1;
+    }
+
+    /* report */
+    memset(&total, 0, sizeof(total));
+    for (c = 0; c < ctx.nworkers; c++) {
+        w = &ctx.workers[c];
+        total.read      += w->stats.read;
+        total.decode    += w->stats.decode;
+        total.analyze   += w->stats.analyze;
+        total.scan      += w->stats.scan;
+        total.files     += w->stats.files;
+        total.failed    += w->stats.failed;
+        total.stolen    += w->stats.stolen;
+        total.bytes     += w->stats.bytes;
+    }
+
+    wall = t_scan / 1e9;
+    printf("%u files (%u failed), %.1f MB, %d workers, %u stolen\n",
+           total.files, total.failed, total.bytes / 1e6, ctx.nworkers,
+           total.stolen);
+    printf("walk %.3f s, scan %.3f s, %.1f files/s\n",
+           t_walk / 1e9, wall, wall > 0 ? total.files / wall : 0.0);
+    printf("stage time, summed over the workers: read %.3f s, decode %.3f s, "
+           "analyze %.3f s, duration %.3f s\n",
+           total.read / 1e9, total.decode / 1e9,
+           total.analyze / 1e9, total.scan / 1e9);
+    printf("index %s\n", out);
+
+    for (c = 0; c < ctx.nworkers; c++) {
+        w = &ctx.workers[c];
+        MP3FreeDecoder(w->decoder);
+        free(w->det_mem);
+        free(w->hop);
+        free(w->buf);
+        free(w->deque.items);
+    }
+    for (i = 0; i < ctx.count; i++) {
+        free(ctx.files[i].path);
+    }
+    free(ctx.files);
+    free(ctx.workers);
+    if (ctx.image) {
+        f_mount(0, NULL);
+        disk_image_close();
+    }
+
+    return total.failed ? 1 : 0;
+}
@@ -0,0 +1,126 @@
+/*
+ *  Name:    diskio_image.c
+ *
+ *  Purpose: FatFs disk layer over a disk image file, for the host tools
+ *
+ */
+#include <stdio.h>
+
+#include "diskio.h"
+#include "diskio_image.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+#define IMAGE_SECTOR_SIZE   512
+
+static FILE     *image_fp;
+static DSTATUS  image_stat = STA_NOINIT;
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+
+/*
+ * attach the image to drive 0, the image is only read
+ *
+ * ret: 0 if success, -1 if the image cannot be opened
+ */
+int disk_image_open(const char *path) {
+    disk_image_close();
+
+    image_fp = fopen(path, "rb");
+    if (image_fp == NULL) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void disk_image_close(void) {
+    if (image_fp) {
+        fclose(image_fp);
+        image_fp = NULL;
+    }
+    image_stat = STA_NOINIT;
+}
+
+DSTATUS disk_initialize(BYTE drv) {
+    if (drv != 0 || image_fp == NULL) {
+        return STA_NOINIT;
+    }
+
+    image_stat = STA_PROTECT;
+    return image_stat;
+}
+
+DSTATUS disk_status(BYTE drv) {
+    if (drv != 0) {
+        return STA_NOINIT;
+    }
+
+    return image_stat;
+}
+
+DRESULT disk_read(BYTE drv, BYTE *buff, DWORD sector, BYTE count) {
+    if (drv != 0 || count == 0) {
+        return RES_PARERR;
+    }
+    if (image_stat & STA_NOINIT) {
+        return RES_NOTRDY;
+    }
+
+    if (fseeko(image_fp, (off_t)sector * IMAGE_SECTOR_SIZE, SEEK_SET) != 0
+        || fread(buff, IMAGE_SECTOR_SIZE, count, image_fp) != count) {
+        return RES_ERROR;
+    }
+
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE drv, const BYTE *buff, DWORD sector, BYTE count) {
+    (void)buff;
+    (void)sector;
+    (void)count;
+
+    if (drv != 0) {
+        return RES_PARERR;
+    }
+
+    return RES_WRPRT;
+}
+
+DRESULT disk_ioctl(BYTE drv, BYTE ctrl, void *buff) {
+    off_t   size;
+
+    if (drv != 0) {
+        return RES_PARERR;
+    }
+    if (image_stat & STA_NOINIT) {
+        return RES_NOTRDY;
+    }
+
+    switch (ctrl) {
+        case CTRL_SYNC:
+            return RES_OK;
+
+        case GET_SECTOR_SIZE:
+            *(WORD *)buff = IMAGE_SECTOR_SIZE;
+            return RES_OK;
+
+        case GET_SECTOR_COUNT:
+            if (fseeko(image_fp, 0, SEEK_END) != 0) {
+                return RES_ERROR;
+            }
+            size = ftello(image_fp);
+            *(DWORD *)buff = (DWORD)(size / IMAGE_SECTOR_SIZE);
+            return RES_OK;
+
+        case GET_BLOCK_SIZE:
+            *(DWORD *)buff = 1;
+            return RES_OK;
+
+        default:
+            return RES_PARERR;
+    }
+}
@@ -0,0 +1,20 @@
+/*
+ *  Name:    diskio_image.h
+ *
+ *  Purpose: FatFs disk layer over a disk image file, for the host tools
+ *
+ */
+
+#ifndef _DISKIO_IMAGE_H_
+#define _DISKIO_IMAGE_H_
+
+/*
+ * The image is a FAT volume without a partition table (e.g. made by
+ * mkfs.vfat), or a whole stick read with dd, which FatFs finds through
+ * the first partition. It is read only, and FatFs is not reentrant
+ * (_FS_REENTRANT 0), so the users serialize their FatFs calls.
+ */
+int disk_image_open(const char *path);
+void disk_image_close(void);
+
+#endif
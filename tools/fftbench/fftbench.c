@@ -0,0 +1,314 @@
+/*
+ *  Name:    fftbench.c
+ *
+ *  Purpose: measure the planned transforms of src/fft.c against the
+ *           fft() they replaced, speed and error, for 64 to 4096 points
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fft.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+#ifndef M_PI
+#define M_PI                3.14159265358979323846
+#endif
+
+#define BENCH_MIN_LEN       64
+#define BENCH_MAX_LEN       4096
+
+/* points transformed per timing, -w scales it */
+#define BENCH_WORK          (1 << 21)
+
+/* the best of this many timings is kept */
+#define BENCH_REPEATS       3
+
+/* the transforms measured */
+enum {
+    BENCH_OLD,              /* fft() before the plans */
+    BENCH_COMPLEX,
+    BENCH_REAL,
+    BENCH_COMPLEX_Q15,
+    BENCH_REAL_Q15,
+    BENCH_CASES
+};
+
+static const char *bench_case_name[BENCH_CASES] = {
+    "old", "complex", "real", "cplx q15", "real q15"
+};
+
+/* the input, and the spectrum of a DFT in double */
+static double       *bench_xr, *bench_xi;
+static double       *bench_Xr, *bench_Xi;
+
+/* working buffers */
+static complex_t        *bench_c;
+static complex_q15_t    *bench_q;
+static float            *bench_f;
+static int16_t          *bench_s;
+
+static double       bench_work_scale = 1;
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+void fft_old(complex_t *ptCompx_in, int len);
+
+static double bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the reference, a DFT in double of n points, real input if real */
+static void bench_dft(int n, int real) {
+    double  *c, *s;
+    double  sr, si;
+    int     k, j, m;
+
+    c = (double *)malloc(n * sizeof(double));
+    s = (double *)malloc(n * sizeof(double));
+    for (k = 0; k < n; k++) {
+        c[k] = cos(-2 * M_PI * k / n);
+        s[k] = sin(-2 * M_PI * k / n);
+    }
+
+    for (k = 0; k < n; k++) {
+        sr = 0;
+        si = 0;
+        for (j = 0, m = 0; j < n; j++, m = (m + k) & (n - 1)) {
+            if (real) {
+                sr += bench_xr[j] * c[m];
+                si += bench_xr[j] * s[m];
+            } else {
+                sr += bench_xr[j] * c[m] - bench_xi[j] * s[m];
+                si += bench_xr[j] * s[m] + bench_xi[j] * c[m];
+            }
+        }
+        bench_Xr[k] = sr;
+        bench_Xi[k] = si;
+    }
+
+    free(c);
+    free(s);
+}
+
+/* load the input in the layout of a case */
+static void bench_load(int which, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        switch (which) {
+            case BENCH_OLD:
+            case BENCH_COMPLEX:
+                bench_c[i].r = (float)bench_xr[i];
+                bench_c[i].i = (float)bench_xi[i];
+                break;
+            case BENCH_REAL:
+                bench_f[i] = (float)bench_xr[i];
+                break;
+            case BENCH_COMPLEX_Q15:
+                bench_q[i].r = (int16_t)lrint(bench_xr[i] * 32767);
+                bench_q[i].i = (int16_t)lrint(bench_xi[i] * 32767);
+                break;
+            case BENCH_REAL_Q15:
+                bench_s[i] = (int16_t)lrint(bench_xr[i] * 32767);
+                break;
+        }
+    }
+}
+
+static void bench_transform(int which, const struct fft_plan *plan, int n) {
+    switch (which) {
+        case BENCH_OLD:
+            fft_old(bench_c, n);
+            break;
+        case BENCH_COMPLEX:
+            fft_forward(plan, bench_c);
+            break;
+        case BENCH_REAL:
+            fft_real_forward(plan, bench_f, bench_c);
+            break;
+        case BENCH_COMPLEX_Q15:
+            fft_forward_q15(plan, bench_q);
+            break;
+        case BENCH_REAL_Q15:
+            fft_real_forward_q15(plan, bench_s, bench_q);
+            break;
+    }
+}
+
+/* the largest error of the output, relative to the largest bin */
+static double bench_error(int which, int n) {
+    double  err = 0, peak = 0, r, i, scale = 1;
+    int     k, bins = n;
+
+    if (which == BENCH_REAL || which == BENCH_REAL_Q15) {
+        bins = n / 2 + 1;
+    }
+    /* the Q15 transforms give DFT / n */
+    if (which == BENCH_COMPLEX_Q15 || which == BENCH_REAL_Q15) {
+        scale = n / 32767.0;
+    }
+
+    for (k = 0; k < bins; k++) {
+        if (which == BENCH_COMPLEX_Q15 || which == BENCH_REAL_Q15) {
+            r = bench_q[k].r * scale;
+            i = bench_q[k].i * scale;
+        } else {
+            r = bench_c[k].r;
+            i = bench_c[k].i;
+        }
+        err     = fmax(err, fmax(fabs(r - bench_Xr[k]), fabs(i - bench_Xi[k])));
+        peak    = fmax(peak, hypot(bench_Xr[k], bench_Xi[k]));
+    }
+
+    return err / peak;
+}
+
+/* us per transform, the best of BENCH_REPEATS */
+static double bench_time(int which, const struct fft_plan *plan, int n) {
+    int     loops, i, r;
+    double  t, best = 0;
+
+    loops = (int)(BENCH_WORK * bench_work_scale / n);
+    if (loops < 1) {
+        loops = 1;
+    }
+
+    for (r = 0; r < BENCH_REPEATS; r++) {
+        t = bench_now();
+        for (i = 0; i < loops; i++) {
+            /* in place transforms start again from the input */
+            if (which == BENCH_OLD || which == BENCH_COMPLEX) {
+                memcpy(bench_c, bench_c + n, n * sizeof(complex_t));
+            } else if (which == BENCH_COMPLEX_Q15) {
+                memcpy(bench_q, bench_q + n, n * sizeof(complex_q15_t));
+            }
+            bench_transform(which, plan, n);
+        }
+        t = (bench_now() - t) / loops;
+        if (r == 0 || t < best) {
+            best = t;
+        }
+    }
+
+    return best * 1e6;
+}
+
+/* one size, every case: the time, and the error against the DFT */
+static void bench_size(int n) {
+    struct fft_plan *plan, *rplan;
+    double          us[BENCH_CASES], err[BENCH_CASES];
+    int             which, real;
+    int             i;
+
+    plan    = fft_plan_create(n, FFT_PLAN_FLOAT | FFT_PLAN_Q15);
+    rplan   = fft_plan_create_real(n, FFT_PLAN_FLOAT | FFT_PLAN_Q15);
+    if (plan == NULL || rplan == NULL) {
+        fprintf(stderr, "fftbench: out of memory\n");
+        exit(2);
+    }
+
+    for (i = 0; i < n; i++) {
+        bench_xr[i] = rand() / (double)RAND_MAX - 0.5;
+        bench_xi[i] = rand() / (double)RAND_MAX - 0.5;
+    }
+
+    for (real = 0; real < 2; real++) {
+        bench_dft(n, real);
+
+        for (which = 0; which < BENCH_CASES; which++) {
+            if ((which == BENCH_REAL || which == BENCH_REAL_Q15) != real) {
+                continue;
+            }
+
+            bench_load(which, n);
+            bench_transform(which, real ? rplan : plan, n);
+            err[which] = bench_error(which, n);
+
+            /* the second half keeps the input of the in place ones */
+            bench_load(which, n);
+            if (which == BENCH_OLD || which == BENCH_COMPLEX) {
+                memcpy(bench_c + n, bench_c, n * sizeof(complex_t));
+            } else if (which == BENCH_COMPLEX_Q15) {
+                memcpy(bench_q + n, bench_q, n * sizeof(complex_q15_t));
+            }
+            us[which] = bench_time(which, real ? rplan : plan, n);
+        }
+    }
+
+    printf("%5d", n);
+    for (which = 0; which < BENCH_CASES; which++) {
+        printf(" %9.2f", us[which]);
+    }
+    printf("  %5.2fx %5.2fx ", us[BENCH_OLD] / us[BENCH_COMPLEX],
+           us[BENCH_OLD] / us[BENCH_REAL]);
+    for (which = 0; which < BENCH_CASES; which++) {
+        printf(" %8.1e", err[which]);
+    }
+    printf("\n");
+
+    fft_plan_delete(plan);
+    fft_plan_delete(rplan);
+}
+
+static void bench_usage(void) {
+    fprintf(stderr,
+            "usage: fftbench [-w scale]\n"
+            "  -w   scale the work of every timing, default 1\n");
+}
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+int main(int argc, char *argv[]) {
+    int n, c, which;
+
+    while ((c = getopt(argc, argv, "w:")) != -1) {
+        switch (c) {
+            case 'w':
+                bench_work_scale = atof(optarg);
+                break;
+            default:
+                bench_usage();
+                return 2;
+        }
+    }
+
+    bench_xr    = (double *)malloc(BENCH_MAX_LEN * sizeof(double));
+    bench_xi    = (double *)malloc(BENCH_MAX_LEN * sizeof(double));
+    bench_Xr    = (double *)malloc(BENCH_MAX_LEN * sizeof(double));
+    bench_Xi    = (double *)malloc(BENCH_MAX_LEN * sizeof(double));
+    bench_c     = (complex_t *)malloc(2 * BENCH_MAX_LEN * sizeof(complex_t));
+    bench_q     = (complex_q15_t *)malloc(2 * BENCH_MAX_LEN * sizeof(complex_q15_t));
+    bench_f     = (float *)malloc(BENCH_MAX_LEN * sizeof(float));
+    bench_s     = (int16_t *)malloc(BENCH_MAX_LEN * sizeof(int16_t));
+
+    printf("us per forward transform, speedup of the complex and real plans\n"
+           "over old, and the largest error relative to the largest bin\n");
+    printf("%5s", "n");
+    for (which = 0; which < BENCH_CASES; which++) {
+        printf(" %9s", bench_case_name[which]);
+    }
+    printf("  %6s %6s ", "cplx", "real");
+    for (which = 0; which < BENCH_CASES; which++) {
+        printf(" %8s", bench_case_name[which]);
+    }
+    printf("\n");
+
+    for (n = BENCH_MIN_LEN; n <= BENCH_MAX_LEN; n *= 2) {
+        bench_size(n);
+    }
+
+    return 0;
+}
@@ -0,0 +1,266 @@
+/*
+ *  Name:    i2csim.c
+ *
+ *  Purpose: run the codec write queue and the I2C1 interrupts of
+ *           src/Audio.c against a model of the bus, and check what
+ *           goes over it
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "stm32f4xx.h"
+#include "Audio.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+
+/* events of one case before it counts as a hang */
+#define SIM_MAX_EVENTS      100000
+
+/* nothing written to DR */
+#define SIM_DR_EMPTY        0xffff
+
+GPIO_TypeDef        sim_gpio;
+RCC_TypeDef         sim_rcc;
+SPI_TypeDef         sim_spi;
+DMA_Stream_TypeDef  sim_dma_stream;
+DMA_TypeDef         sim_dma;
+
+static I2C_TypeDef  sim_bus;
+
+/* what went over the bus: S start, P stop, bytes in hex, [callbacks] */
+static char         sim_log[8192];
+
+/* the codec does not acknowledge the next address */
+static bool         sim_nack_next;
+
+/* a stop never ends, the clock is held low */
+static bool         sim_stop_stuck;
+
+/* calls of the event interrupt */
+static int          sim_events;
+
+static int          sim_failed;
+
+void I2C1_EV_IRQHandler(void);
+void I2C1_ER_IRQHandler(void);
+void DMA1_Stream7_IRQHandler(void);
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+static void sim_record(const char *format, ...) {
+    size_t  len = strlen(sim_log);
+    va_list ap;
+
+    va_start(ap, format);
+    vsnprintf(sim_log + len, sizeof(sim_log) - len, format, ap);
+    va_end(ap);
+}
+
+/*
+ * one event of the bus and the interrupt it raises
+ *
+ * ret: 0 if the bus is idle, or 1
+ */
+static int sim_step(void) {
+    uint32_t    sr1;
+
+    if (sim_bus.CR1 & I2C_CR1_STOP) {
+        if (sim_bus.CR1 & I2C_CR1_START) {
+            printf("FAIL: START set while a stop is pending\n");
+            exit(1);
+        }
+        if (sim_stop_stuck) {
+            return 0;
+        }
+        /* the stop ends BTF, no event is raised for it */
+        sim_bus.CR1 &= ~I2C_CR1_STOP;
+        sim_bus.SR1 &= ~I2C_SR1_BTF;
+        sim_record("P ");
+        return 1;
+    }
+
+    if (sim_bus.CR1 & I2C_CR1_START) {
+        sim_bus.CR1 &= ~I2C_CR1_START;
+        sim_bus.SR1 |= I2C_SR1_SB;
+        sim_record("S ");
+    } else if (!(sim_bus.SR1 & (I2C_SR1_SB | I2C_SR1_ADDR | I2C_SR1_BTF))) {
+        return 0;
+    }
+
+    if (!(sim_bus.CR2 & I2C_CR2_ITEVTEN)) {
+        return 0;
+    }
+
+    sim_bus.DR  = SIM_DR_EMPTY;
+    sr1         = sim_bus.SR1;
+    sim_events++;
+    I2C1_EV_IRQHandler();
+
+    if (sim_bus.DR != SIM_DR_EMPTY) {
+        sim_record("%02x ", (unsigned int)sim_bus.DR);
+
+        if (sr1 & I2C_SR1_SB) {
+            /* the address of the codec */
+            sim_bus.SR1 &= ~I2C_SR1_SB;
+            if (sim_nack_next) {
+                sim_nack_next = false;
+                sim_bus.SR1 |= I2C_SR1_AF;
+                I2C1_ER_IRQHandler();
+            } else {
+                sim_bus.SR1 |= I2C_SR1_ADDR;
+            }
+        } else {
+            /* a byte is out */
+            sim_bus.SR1 &= ~I2C_SR1_ADDR;
+            sim_bus.SR1 |= I2C_SR1_BTF;
+        }
+    } else if (sim_bus.SR1 & (I2C_SR1_SB | I2C_SR1_ADDR)) {
+        /* the interrupt would be raised again and again */
+        printf("FAIL: the event interrupt left SR1 0x%04x as it was\n",
+               (unsigned int)sim_bus.SR1);
+        exit(1);
+    }
+
+    return 1;
+}
+
+/*
+ * run the bus until it is idle, the audio DMA interrupt goes on with
+ * the queue after each stop as it does while playing
+ */
+static void sim_run(void) {
+    int     n = 0;
+
+    do {
+        while (sim_step()) {
+            if (++n > SIM_MAX_EVENTS) {
+                printf("FAIL: the bus never gets idle\n");
+                exit(1);
+            }
+        }
+        DMA1_Stream7_IRQHandler();
+    } while (sim_step());
+}
+
+static void sim_callback(void *context, bool ok) {
+    sim_record("[%s %s] ", (const char *)context, ok ? "ok" : "fail");
+
+    /* a write queued from the interrupt */
+    if (strcmp(context, "chain") == 0) {
+        WriteAudioRegister(0x33, 0x44, NULL, NULL);
+    }
+}
+
+static void sim_check(const char *name, const char *want) {
+    if (strcmp(sim_log, want) != 0) {
+        printf("FAIL %s\n  got  %s\n  want %s\n", name, sim_log, want);
+        sim_failed = 1;
+    } else {
+        printf("ok   %s\n", name);
+    }
+    sim_log[0] = '\0';
+}
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+
+/* the bus of Audio.c, a stop ends on the next sim_step() */
+I2C_TypeDef *sim_i2c(void) {
+    return &sim_bus;
+}
+
+int main(void) {
+    int     i, queued;
+
+    sim_bus.CR1 = I2C_CR1_PE;
+    sim_bus.CR2 = I2C_CR2_ITEVTEN | I2C_CR2_ITERREN;
+
+    WriteAudioRegister(0x02, 0x01, NULL, NULL);
+    WriteAudioRegister(0x04, 0xaf, NULL, NULL);
+    WriteAudioRegister(0x02, 0x9e, sim_callback, "power");
+    sim_run();
+    sim_check("writes in order",
+              "S 94 02 01 P S 94 04 af P S 94 02 9e [power ok] P ");
+
+    /* the first write is on the bus, the rest merge into one per channel */
+    for (i = 0; i < 200; i++) {
+        if (!SetAudioVolume(i)) {
+            sim_record("full at %d ", i);
+        }
+    }
+    sim_run();
+    sim_check("volume ramp merged", "S 94 20 19 P S 94 21 e0 P S 94 20 e0 P ");
+
+    /* the bus moves on while the ramp is queued */
+    for (i = 0; i < 6; i++) {
+        SetAudioVolume(i * 2);
+        sim_step();
+        sim_step();
+    }
+    sim_run();
+    sim_check("volume ramp on a busy bus",
+              "S 94 20 19 P S 94 21 1d P S 94 20 23 P S 94 21 23 P ");
+
+    /* a volume not yet sent is replaced, even behind another write */
+    SetAudioVolume(1);
+    WriteAudioRegister(0x02, 0x01, NULL, NULL);
+    SetAudioVolume(2);
+    SetAudioVolume(3);
+    sim_run();
+    sim_check("volume merged past another write",
+              "S 94 20 1a P S 94 21 1c P S 94 02 01 P S 94 20 1c P ");
+
+    /* a NACK fails that write only, the next ones still go */
+    sim_nack_next = true;
+    WriteAudioRegister(0x10, 0x11, sim_callback, "nack");
+    WriteAudioRegister(0x12, 0x13, sim_callback, "chain");
+    sim_run();
+    sim_check("NACK",
+              "S 94 [nack fail] P S 94 12 13 [chain ok] P S 94 33 44 P ");
+
+    /*
+     * a stop that does not end holds the next write back, without an
+     * event interrupt for every turn of the wait
+     */
+    sim_stop_stuck = true;
+    WriteAudioRegister(0x50, 0x01, sim_callback, "first");
+    WriteAudioRegister(0x52, 0x02, sim_callback, "second");
+    sim_events = 0;
+    sim_run();
+    for (i = 0; i < 100; i++) {
+        sim_step();
+        DMA1_Stream7_IRQHandler();
+    }
+    if (sim_events > 4) {
+        printf("FAIL stuck stop\n  %d event interrupts, want 4\n", sim_events);
+        sim_failed = 1;
+    }
+    sim_stop_stuck = false;
+    sim_run();
+    sim_check("stuck stop", "S 94 50 01 [first ok] P S 94 52 02 [second ok] P ");
+
+    /* the queue holds 16, the first of them already on the bus */
+    for (queued = 0; WriteAudioRegister(0x40, (uint8_t)queued, NULL, NULL); queued++) {
+        ;
+    }
+    sim_run();
+    if (queued != 16) {
+        printf("FAIL full queue\n  %d writes queued, want 16\n", queued);
+        sim_failed = 1;
+    } else {
+        printf("ok   full queue\n");
+    }
+    sim_log[0] = '\0';
+
+    printf(sim_failed ? "FAIL\n" : "PASS\n");
+
+    return sim_failed;
+}
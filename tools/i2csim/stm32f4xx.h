@@ -0,0 +1,148 @@
+/*
+ *  Name:    stm32f4xx.h
+ *
+ *  Purpose: the registers and the calls src/Audio.c uses, for i2csim.
+ *           I2C1 is the bus model of i2csim.c, the rest are plain
+ *           memory or do nothing.
+ *
+ */
+#ifndef __I2CSIM_STM32F4XX_H__
+#define __I2CSIM_STM32F4XX_H__
+
+#include <stdint.h>
+
+typedef struct {
+    volatile uint32_t   CR1, CR2, OAR1, DR, SR1, SR2, CCR, TRISE;
+} I2C_TypeDef;
+
+typedef struct {
+    volatile uint32_t   BSRRH, BSRRL;
+} GPIO_TypeDef;
+
+typedef struct {
+    volatile uint32_t   CFGR, PLLI2SCFGR, CR;
+} RCC_TypeDef;
+
+typedef struct {
+    volatile uint32_t   I2SCFGR, I2SPR, SR, DR, CR2;
+} SPI_TypeDef;
+
+typedef struct {
+    volatile uint32_t   CR, NDTR, PAR, M0AR, FCR;
+} DMA_Stream_TypeDef;
+
+typedef struct {
+    volatile uint32_t   HIFCR;
+} DMA_TypeDef;
+
+typedef struct {
+    int     GPIO_Pin, GPIO_Mode, GPIO_OType, GPIO_Speed, GPIO_PuPd;
+} GPIO_InitTypeDef;
+
+/* every access of I2C1 goes through the bus model */
+I2C_TypeDef *sim_i2c(void);
+
+extern GPIO_TypeDef         sim_gpio;
+extern RCC_TypeDef          sim_rcc;
+extern SPI_TypeDef          sim_spi;
+extern DMA_Stream_TypeDef   sim_dma_stream;
+extern DMA_TypeDef          sim_dma;
+
+#define I2C1                (sim_i2c())
+#define GPIOA               (&sim_gpio)
+#define GPIOB               (&sim_gpio)
+#define GPIOC               (&sim_gpio)
+#define GPIOD               (&sim_gpio)
+#define RCC                 (&sim_rcc)
+#define SPI3                (&sim_spi)
+#define DMA1_Stream7        (&sim_dma_stream)
+#define DMA1                (&sim_dma)
+
+/* the bits of the reference manual */
+#define I2C_CR1_PE          0x0001
+#define I2C_CR1_START       0x0100
+#define I2C_CR1_STOP        0x0200
+#define I2C_CR1_ACK         0x0400
+#define I2C_CR2_ITERREN     0x0100
+#define I2C_CR2_ITEVTEN     0x0200
+#define I2C_SR1_SB          0x0001
+#define I2C_SR1_ADDR        0x0002
+#define I2C_SR1_BTF         0x0004
+#define I2C_SR1_TXE         0x0080
+#define I2C_SR1_BERR        0x0100
+#define I2C_SR1_ARLO        0x0200
+#define I2C_SR1_AF          0x0400
+#define I2C_SR1_OVR         0x0800
+#define I2C_CCR_FS          0x8000
+#define I2C_OAR1_ADDMODE    0x8000
+
+enum {
+    I2C1_EV_IRQn,
+    I2C1_ER_IRQn,
+    DMA1_Stream7_IRQn
+};
+
+/* no other interrupt runs on the host */
+static inline void NVIC_SetPriority(int irq, uint32_t priority) { (void)irq; (void)priority; }
+static inline void NVIC_EnableIRQ(int irq) { (void)irq; }
+static inline void NVIC_DisableIRQ(int irq) { (void)irq; }
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t primask) { (void)primask; }
+static inline void __disable_irq(void) { }
+
+/* the setup of the pins and the clocks is not simulated */
+#define RCC_AHB1PeriphClockCmd(p, s)
+#define RCC_APB1PeriphClockCmd(p, s)
+#define RCC_APB1PeriphResetCmd(p, s)
+static inline void GPIO_Init(GPIO_TypeDef *gpio, GPIO_InitTypeDef *init) { (void)gpio; (void)init; }
+static inline void GPIO_PinAFConfig(GPIO_TypeDef *gpio, int pin, int af) { (void)gpio; (void)pin; (void)af; }
+
+#define RCC_CFGR_I2SSRC         0
+/* the PLL is ready as soon as it is on */
+#define RCC_CR_PLLI2SON         1
+#define RCC_CR_PLLI2SRDY        1
+#define SPI_I2SPR_MCKOE         0
+#define SPI_I2SCFGR_I2SMOD      0
+#define SPI_I2SCFGR_I2SCFG_1    0
+#define SPI_I2SCFGR_I2SE        0
+#define SPI_SR_TXE              0
+#define SPI_CR2_TXDMAEN         0
+#define DMA_SxCR_CHSEL_0        0
+#define DMA_SxCR_PL_0           0
+#define DMA_SxCR_PSIZE_0        0
+#define DMA_SxCR_MSIZE_0        0
+#define DMA_SxCR_MINC           0
+#define DMA_SxCR_DIR_0          0
+#define DMA_SxCR_TCIE           0
+#define DMA_SxCR_EN             0
+#define DMA_SxFCR_DMDIS         0
+#define DMA_HIFCR_CTCIF7        0
+#define GPIO_Pin_4              0
+#define GPIO_Pin_6              0
+#define GPIO_Pin_7              0
+#define GPIO_Pin_9              0
+#define GPIO_Pin_10             0
+#define GPIO_Pin_12             0
+#define GPIO_Mode_OUT           0
+#define GPIO_Mode_AF            0
+#define GPIO_OType_PP           0
+#define GPIO_OType_OD           0
+#define GPIO_Speed_50MHz        0
+#define GPIO_PuPd_NOPULL        0
+#define RCC_AHB1Periph_GPIOA    0
+#define RCC_AHB1Periph_GPIOB    0
+#define RCC_AHB1Periph_GPIOC    0
+#define RCC_AHB1Periph_GPIOD    0
+#define RCC_AHB1Periph_DMA1     0
+#define RCC_APB1Periph_I2C1     0
+#define RCC_APB1Periph_SPI3     0
+#define GPIO_PinSource4         0
+#define GPIO_PinSource6         0
+#define GPIO_PinSource7         0
+#define GPIO_PinSource9         0
+#define GPIO_PinSource10        0
+#define GPIO_PinSource12        0
+#define GPIO_AF_I2C1            0
+#define GPIO_AF_SPI3            0
+
+#endif
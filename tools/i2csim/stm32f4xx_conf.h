@@ -0,0 +1,6 @@
+/*
+ *  Name:    stm32f4xx_conf.h
+ *
+ *  Purpose: empty, the peripheral library is not used by i2csim
+ *
+ */
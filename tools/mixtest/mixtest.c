@@ -0,0 +1,190 @@
+/*
+ *  Name:    mixtest.c
+ *
+ *  Purpose: check that src/mixer.c passes a deck alone through
+ *           unchanged, sums decks exactly below the clipper's knee and
+ *           keeps a sum past full scale in range
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "mixer.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+#ifndef M_PI
+#define M_PI                3.14159265358979323846
+#endif
+
+#define TEST_RATE           44100
+#define TEST_CHANNELS       2
+
+/* frames of every case, several passes of MIXER_BLOCK */
+#define TEST_FRAMES         (MIXER_BLOCK * 40 + 100)
+
+static int16_t  test_a[TEST_FRAMES * TEST_CHANNELS];
+static int16_t  test_b[TEST_FRAMES * TEST_CHANNELS];
+static int16_t  test_out[TEST_FRAMES * TEST_CHANNELS];
+
+static int      test_failed;
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+
+/* repeatable noise, the same signal on every host */
+static uint32_t test_seed = 1;
+
+static int32_t test_noise(void) {
+    test_seed = test_seed * 1664525u + 1013904223u;
+    return (int32_t)(test_seed >> 16) - 32768;
+}
+
+/*
+ * a tone of peak level, with full-scale samples of both signs in it
+ * when full is set, and a little noise
+ */
+static void test_signal(int16_t *s, double freq, double peak, int full) {
+    uint32_t    i;
+    double      v;
+
+    for (i = 0; i < TEST_FRAMES; i++) {
+        v = peak * sin(2 * M_PI * freq * i / TEST_RATE) + test_noise() / 1024;
+        v = fmax(-32768, fmin(32767, v));
+        s[2 * i]        = (int16_t)v;
+        s[2 * i + 1]    = (int16_t)-v;
+    }
+
+    if (full) {
+        for (i = 0; i < TEST_FRAMES * TEST_CHANNELS; i += 997) {
+            s[i] = (i & 1) ? -32768 : 32767;
+        }
+    }
+}
+
+/* mix what the decks were given into test_out */
+static struct mixer *test_mix(const int16_t *a, const int16_t *b, float gain_b) {
+    struct mixer    *mx;
+
+    mx = mixer_create(TEST_RATE, TEST_CHANNELS, 2);
+    if (mx == NULL) {
+        fprintf(stderr, "mixtest: out of memory\n");
+        exit(2);
+    }
+
+    mixer_set_gain(mx, 1, gain_b, 0);
+    if (a != NULL && mixer_write(mx, 0, a, TEST_FRAMES, TEST_RATE) < 0) {
+        exit(2);
+    }
+    if (b != NULL && mixer_write(mx, 1, b, TEST_FRAMES, TEST_RATE) < 0) {
+        exit(2);
+    }
+
+    memset(test_out, 0, sizeof(test_out));
+    mixer_process(mx, test_out, TEST_FRAMES);
+
+    return mx;
+}
+
+static void test_result(const char *name, int ok, const char *why) {
+    if (ok) {
+        printf("ok   %s\n", name);
+    } else {
+        printf("FAIL %s\n  %s\n", name, why);
+        test_failed = 1;
+    }
+}
+
+/*
+ * compare test_out with want, the first sample that differs fails name
+ *
+ * ret: 1 if they are the same, or 0
+ */
+static int test_exact(const char *name, const int16_t *want) {
+    uint32_t    i;
+    char        why[128];
+
+    for (i = 0; i < TEST_FRAMES * TEST_CHANNELS; i++) {
+        if (test_out[i] != want[i]) {
+            snprintf(why, sizeof(why), "sample %u is %d, want %d",
+                     i, test_out[i], want[i]);
+            test_result(name, 0, why);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+int main(void) {
+    struct mixer    *mx;
+    uint32_t        i;
+    int32_t         sum;
+    int             ok;
+    char            why[128];
+
+    test_signal(test_a, 440, 32000, 1);
+
+    /* a deck alone at unity, the other one without a track */
+    mx = test_mix(test_a, NULL, 1);
+    if (test_exact("one deck at unity is bit-exact", test_a)) {
+        test_result("one deck at unity is bit-exact", mx->clipped == 0,
+                    "the clipper bent samples");
+    }
+    mixer_delete(mx);
+
+    /* the other deck plays, but is turned down to nothing */
+    test_signal(test_b, 620, 32000, 1);
+    mx = test_mix(test_a, test_b, 0);
+    if (test_exact("one deck at unity, one at 0, is bit-exact", test_a)) {
+        test_result("one deck at unity, one at 0, is bit-exact",
+                    mx->clipped == 0, "the clipper bent samples");
+    }
+    mixer_delete(mx);
+
+    /* two decks whose sum stays under the knee are summed exactly */
+    test_signal(test_a, 440, 14000, 0);
+    test_signal(test_b, 620, 14000, 0);
+    mx = test_mix(test_a, test_b, 1);
+    for (i = 0; i < TEST_FRAMES * TEST_CHANNELS; i++) {
+        test_out[i] -= test_b[i];
+    }
+    if (test_exact("two decks under the knee are summed exactly", test_a)) {
+        test_result("two decks under the knee are summed exactly",
+                    mx->clipped == 0, "the clipper bent samples");
+    }
+    mixer_delete(mx);
+
+    /* two loud decks in phase go past full scale, but never wrap */
+    test_signal(test_a, 440, 32000, 1);
+    mx = test_mix(test_a, test_a, 1);
+    ok = mx->clipped > 0;
+    snprintf(why, sizeof(why), "nothing was clipped");
+    for (i = 0; ok && i < TEST_FRAMES * TEST_CHANNELS; i++) {
+        sum = 2 * test_a[i];
+        if (sum >= -MIXER_CLIP_KNEE && sum <= MIXER_CLIP_KNEE) {
+            ok = test_out[i] == sum;
+        } else {
+            ok = (sum > 0) ? test_out[i] >= MIXER_CLIP_KNEE
+                           : test_out[i] <= -MIXER_CLIP_KNEE;
+        }
+        if (!ok) {
+            snprintf(why, sizeof(why), "sample %u is %d, the sum %d",
+                     i, test_out[i], (int)sum);
+        }
+    }
+    test_result("two decks past full scale stay in range", ok, why);
+    mixer_delete(mx);
+
+    printf(test_failed ? "FAIL\n" : "PASS\n");
+
+    return test_failed;
+}
@@ -0,0 +1,30 @@
+/*
+ *  Name:    audio_sink_host.h
+ *
+ *  Purpose: the audio outputs of the host tools, a WAV file and a null sink
+ *
+ */
+
+#ifndef _AUDIO_SINK_HOST_H_
+#define _AUDIO_SINK_HOST_H_
+
+#include "audio_sink.h"
+
+/*
+ * Write the output to a WAV file, as fast as it comes. A WAV file has
+ * one format, so opening it at another rate than the first fails.
+ *
+ * ret: the sink, NULL if the file can not be created or out of memory
+ */
+struct audio_sink *audio_sink_wav_create(const char *path);
+
+/*
+ * Throw the output away at the pace of the board's I2S DMA: a buffer
+ * plays while the next is filled, and the output stops when the writer
+ * is late. speedup > 1 runs the clock that many times faster.
+ *
+ * ret: the sink, NULL if out of memory
+ */
+struct audio_sink *audio_sink_null_create(double speedup);
+
+#endif
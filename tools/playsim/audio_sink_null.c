@@ -0,0 +1,128 @@
+/*
+ *  Name:    audio_sink_null.c
+ *
+ *  Purpose: the audio output of the host tools paced in real time
+ *
+ */
+#include <stdlib.h>
+#include <time.h>
+
+#include "audio_sink_host.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+struct null_sink {
+    struct audio_sink   sink;
+    double              speedup;
+
+    /* the output played from frame base on at time t0, up to end */
+    struct timespec     t0;
+    uint64_t            base;
+    uint64_t            end;
+};
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+static double null_elapsed(const struct timespec *t0) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - t0->tv_sec) + (now.tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+static uint64_t null_clock(struct audio_sink *sink) {
+    struct null_sink    *ns = (struct null_sink *)sink->priv;
+    uint64_t            played;
+
+    played = ns->base + (uint64_t)(null_elapsed(&ns->t0) * sink->rate * ns->speedup);
+
+    return (played < ns->end) ? played : ns->end;
+}
+
+/* sleep until everything submitted is played */
+static void null_wait(struct audio_sink *sink) {
+    struct null_sink    *ns = (struct null_sink *)sink->priv;
+    struct timespec     ts;
+    uint64_t            played;
+    double              left;
+
+    while ((played = null_clock(sink)) < ns->end) {
+        left        = (ns->end - played) / (sink->rate * ns->speedup);
+        ts.tv_sec   = (time_t)left;
+        ts.tv_nsec  = (long)((left - ts.tv_sec) * 1e9) + 1;
+        nanosleep(&ts, NULL);
+    }
+}
+
+static int null_open(struct audio_sink *sink, uint32_t rate, int channels) {
+    struct null_sink *ns = (struct null_sink *)sink->priv;
+
+    /* the samples of the old rate go out first */
+    if (sink->rate != 0) {
+        null_wait(sink);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ns->t0);
+    ns->base    = 0;
+    ns->end     = 0;
+
+    return 0;
+}
+
+static int null_submit(struct audio_sink *sink,
+                       const int16_t *samples, uint32_t frames) {
+    struct null_sink *ns = (struct null_sink *)sink->priv;
+
+    /* the buffer before plays to its end */
+    null_wait(sink);
+
+    /* then the output stood still until now, as the DMA does */
+    clock_gettime(CLOCK_MONOTONIC, &ns->t0);
+    ns->base    = ns->end;
+    ns->end     += frames;
+
+    return 0;
+}
+
+static void null_close(struct audio_sink *sink) {
+    if (sink->rate != 0) {
+        null_wait(sink);
+    }
+}
+
+static void null_destroy(struct audio_sink *sink) {
+    free(sink->priv);
+}
+
+static const struct audio_sink_ops null_ops = {
+    null_open,
+    null_submit,
+    null_clock,
+    null_close,
+    null_destroy,
+};
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+struct audio_sink *audio_sink_null_create(double speedup) {
+    struct null_sink *ns;
+
+    if (speedup <= 0) {
+        return NULL;
+    }
+
+    ns = (struct null_sink *)calloc(1, sizeof(struct null_sink));
+    if (ns == NULL) {
+        return NULL;
+    }
+
+    ns->speedup     = speedup;
+    ns->sink.ops    = &null_ops;
+    ns->sink.priv   = ns;
+
+    return &ns->sink;
+}
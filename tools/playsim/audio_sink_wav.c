@@ -0,0 +1,173 @@
+/*
+ *  Name:    audio_sink_wav.c
+ *
+ *  Purpose: the audio output of the host tools to a WAV file
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_sink_host.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+
+/* the RIFF header of 16-bit PCM */
+#define WAV_HEADER_SZ       44
+
+/* samples converted to little endian per fwrite() */
+#define WAV_BLOCK           1024
+
+struct wav_sink {
+    struct audio_sink   sink;
+    FILE                *fp;
+
+    /* the format of the file, 0 until first opened */
+    uint32_t            rate;
+    int                 channels;
+
+    uint64_t            frames;
+
+    /* frames of the last submit */
+    uint32_t            last;
+};
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+static void wav_put16(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static void wav_put32(uint8_t *p, uint32_t v) {
+    wav_put16(p, v & 0xffff);
+    wav_put16(p + 2, v >> 16);
+}
+
+/* (re)write the header for the frames written so far */
+static int wav_write_header(struct wav_sink *ws) {
+    uint8_t     h[WAV_HEADER_SZ];
+    uint32_t    data = (uint32_t)(ws->frames * ws->channels * 2);
+
+    memcpy(h, "RIFF", 4);
+    wav_put32(h + 4, 36 + data);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    wav_put32(h + 16, 16);
+    wav_put16(h + 20, 1);                           /* PCM */
+    wav_put16(h + 22, ws->channels);
+    wav_put32(h + 24, ws->rate);
+    wav_put32(h + 28, ws->rate * ws->channels * 2);
+    wav_put16(h + 32, ws->channels * 2);
+    wav_put16(h + 34, 16);
+    memcpy(h + 36, "data", 4);
+    wav_put32(h + 40, data);
+
+    if (fseek(ws->fp, 0, SEEK_SET) != 0
+        || fwrite(h, 1, WAV_HEADER_SZ, ws->fp) != WAV_HEADER_SZ
+        || fseek(ws->fp, 0, SEEK_END) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int wav_open(struct audio_sink *sink, uint32_t rate, int channels) {
+    struct wav_sink *ws = (struct wav_sink *)sink->priv;
+
+    ws->last = 0;
+
+    if (ws->rate == 0) {
+        ws->rate        = rate;
+        ws->channels    = channels;
+        return wav_write_header(ws);
+    }
+
+    return (rate == ws->rate && channels == ws->channels) ? 0 : -1;
+}
+
+static int wav_submit(struct audio_sink *sink,
+                      const int16_t *samples, uint32_t frames) {
+    struct wav_sink *ws = (struct wav_sink *)sink->priv;
+    uint8_t         block[WAV_BLOCK * 2];
+    uint32_t        n = frames * ws->channels;
+    uint32_t        i, len;
+
+    while (n > 0) {
+        len = (n < WAV_BLOCK) ? n : WAV_BLOCK;
+        for (i = 0; i < len; i++) {
+            wav_put16(block + 2 * i, (uint16_t)samples[i]);
+        }
+        if (fwrite(block, 2, len, ws->fp) != len) {
+            return -1;
+        }
+        samples += len;
+        n       -= len;
+    }
+    ws->frames  += frames;
+    ws->last    = frames;
+
+    return 0;
+}
+
+/*
+ * The file takes the output at once, it is never late. The last
+ * buffer counts as playing until the next one comes, as on the board.
+ */
+static uint64_t wav_clock(struct audio_sink *sink) {
+    struct wav_sink *ws = (struct wav_sink *)sink->priv;
+
+    return sink->submitted - ws->last;
+}
+
+/* the file is complete after every close */
+static void wav_close(struct audio_sink *sink) {
+    struct wav_sink *ws = (struct wav_sink *)sink->priv;
+
+    ws->last = 0;
+
+    if (ws->rate != 0) {
+        wav_write_header(ws);
+        fflush(ws->fp);
+    }
+}
+
+static void wav_destroy(struct audio_sink *sink) {
+    struct wav_sink *ws = (struct wav_sink *)sink->priv;
+
+    fclose(ws->fp);
+    free(ws);
+}
+
+static const struct audio_sink_ops wav_ops = {
+    wav_open,
+    wav_submit,
+    wav_clock,
+    wav_close,
+    wav_destroy,
+};
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+struct audio_sink *audio_sink_wav_create(const char *path) {
+    struct wav_sink *ws;
+
+    ws = (struct wav_sink *)calloc(1, sizeof(struct wav_sink));
+    if (ws == NULL) {
+        return NULL;
+    }
+
+    ws->fp = fopen(path, "wb");
+    if (ws->fp == NULL) {
+        free(ws);
+        return NULL;
+    }
+
+    ws->sink.ops    = &wav_ops;
+    ws->sink.priv   = ws;
+
+    return &ws->sink;
+}
@@ -0,0 +1,29 @@
+/*
+ *  Name:    main.h
+ *
+ *  Purpose: what mp3.c takes from the main.h of the board, for the host
+ *
+ */
+
+#ifndef MAIN_H_
+#define MAIN_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * The speed/pitch commands of mp3.c are posted with the interrupts
+ * masked. playsim posts them from its only thread.
+ */
+static inline uint32_t __get_PRIMASK(void) {
+    return 0;
+}
+
+static inline void __set_PRIMASK(uint32_t primask) {
+    (void)primask;
+}
+
+static inline void __disable_irq(void) {
+}
+
+#endif
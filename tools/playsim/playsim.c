@@ -0,0 +1,465 @@
+/*
+ *  Name:    playsim.c
+ *
+ *  Purpose: run the player loop of the board on the host, decoding MP3 files
+ *           through Sonic into an audio sink, and report the underruns,
+ *           the latency and the CPU headroom
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mp3dec.h"
+#include "mp3.h"
+#include "resample.h"
+#include "mixer.h"
+#include "audio_sink_host.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+
+/* the layout the decoder writes by default, MP3_OUTPUT_STEREO */
+#define PLAY_CHANNELS       2
+
+/* the rate tried when the sink can not play the one of a track */
+#define PLAY_FALLBACK_RATE  44100
+
+/* frames mixed per sink buffer in the two deck mode */
+#define MIX_FRAMES          1152
+
+static struct audio_sink    *sink;
+
+/* the playing track and the one queued behind it */
+static FILE                 *play_files[2];
+
+/* what the output did besides the sink statistics, in seconds */
+static double               play_seconds;
+static double               latency_sum, latency_max;
+static double               first_sound = -1;   /* from the start */
+
+/* stop the output, fading out, after this many seconds, 0 never */
+static double               stop_at;
+static int                  stopped;
+static struct timespec      start;
+
+/* the two deck mode, the deck being decoded and the seconds of each */
+static struct mixer         *mix;
+static int                  mix_deck;
+static double               mix_seconds[2];
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+static double play_now(clockid_t id) {
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* MP3 file read, provided to MP3 decoder */
+static uint32_t fd_fetch(void *parameter, uint8_t *buffer, uint32_t length) {
+    return (uint32_t)fread(buffer, 1, length, (FILE *)parameter);
+}
+
+/* as the mp3_callback() of the board */
+static uint32_t play_callback(MP3FrameInfo *header,
+                              int16_t *buffer,
+                              uint32_t length) {
+    double  latency;
+
+    /* (re)start the output at the sample rate of this buffer */
+    if ((uint32_t)header->samprate != sink->rate
+        && audio_sink_open(sink, header->samprate, PLAY_CHANNELS) != 0
+        && sink->rate == 0) {
+        audio_sink_open(sink, PLAY_FALLBACK_RATE, PLAY_CHANNELS);
+    }
+
+    if (audio_sink_submit(sink, buffer, length / PLAY_CHANNELS) != 0) {
+        fprintf(stderr, "playsim: the output failed\n");
+        exit(2);
+    }
+
+    if (first_sound < 0) {
+        first_sound = play_now(CLOCK_MONOTONIC)
+                      - (start.tv_sec + start.tv_nsec * 1e-9);
+    }
+
+    /* the tracks may have different rates */
+    latency      = (double)audio_sink_latency(sink) / sink->rate;
+    latency_sum  += latency;
+    if (latency > latency_max) {
+        latency_max = latency;
+    }
+    play_seconds += (double)(length / PLAY_CHANNELS) / sink->rate;
+
+    if (stop_at > 0 && play_seconds >= stop_at) {
+        if (audio_sink_faded(sink)) {
+            stopped = 1;
+        } else if (sink->fade.target == 0) {
+            audio_sink_fade_out(sink, AUDIO_SINK_FADE_MS);
+        }
+    }
+
+    return 0;
+}
+
+/* the output of a deck's decoder goes to the mixer */
+static uint32_t mix_callback(MP3FrameInfo *header,
+                             int16_t *buffer,
+                             uint32_t length) {
+    if (mixer_write(mix, mix_deck, buffer, length / PLAY_CHANNELS,
+                    header->samprate) != 0) {
+        fprintf(stderr, "playsim: out of memory\n");
+        exit(2);
+    }
+    mix_seconds[mix_deck] += (double)(length / PLAY_CHANNELS) / header->samprate;
+
+    return 0;
+}
+
+/* ns, the ticks of the mixer and the sink */
+static uint32_t play_ticks(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*
+ * open a file and get its decoder ready to play
+ */
+static struct mp3_decoder *play_open(FILE **fp, const char *filename, uint32_t out_rate) {
+    struct mp3_decoder *decoder;
+
+    *fp = fopen(filename, "rb");
+    if (*fp == NULL) {
+        fprintf(stderr, "playsim: can not open %s\n", filename);
+        return NULL;
+    }
+
+    decoder = mp3_decoder_create();
+    if (decoder != NULL) {
+        decoder->fetch_data         = fd_fetch;
+        decoder->fetch_parameter    = (void *)*fp;
+        decoder->output_cb          = play_callback;
+
+        mp3_decoder_set_rate(decoder, out_rate, RESAMPLER_TAPS_MEDIUM);
+
+        if (mp3_decoder_prefetch(decoder) == 0) {
+            return decoder;
+        }
+
+        mp3_decoder_delete(decoder);
+    }
+
+    fprintf(stderr, "playsim: %s is not an MP3 file\n", filename);
+    fclose(*fp);
+
+    return NULL;
+}
+
+static void play_close(struct mp3_decoder *decoder) {
+    FILE *fp = (FILE *)decoder->fetch_parameter;
+
+    mp3_decoder_delete(decoder);
+    fclose(fp);
+}
+
+/*
+ * Play the files one after another without a gap, opening the next
+ * while the current one plays, as play_directory() of the board.
+ *
+ * ret: the number of tracks played
+ */
+static int play_files_gapless(char **names, int count, uint32_t out_rate) {
+    struct mp3_decoder  *decoder, *next;
+    FILE                **next_fp;
+    int                 i = 0, played = 0;
+
+    decoder = NULL;
+    while (decoder == NULL && i < count) {
+        decoder = play_open(&play_files[0], names[i++], out_rate);
+    }
+
+    while (decoder != NULL) {
+        next    = NULL;
+        next_fp = (decoder->fetch_parameter == play_files[0]) ? &play_files[1] : &play_files[0];
+
+        while (!stopped && mp3_decoder_run_pvc(decoder) != -1) {
+            /* the track has started, queue the next one */
+            while (next == NULL && i < count) {
+                next = play_open(next_fp, names[i++], out_rate);
+            }
+        }
+
+        /* a very short track */
+        while (!stopped && next == NULL && i < count) {
+            next = play_open(next_fp, names[i++], out_rate);
+        }
+
+        /* the last track, play out the output pipeline */
+        if (next == NULL && !stopped) {
+            mp3_decoder_flush(decoder);
+        }
+
+        play_close(decoder);
+        decoder = next;
+        played++;
+
+        if (stopped && decoder != NULL) {
+            play_close(decoder);
+            decoder = NULL;
+        }
+    }
+
+    /* play out the last buffer and stop */
+    audio_sink_close(sink);
+
+    return played;
+}
+
+/*
+ * Play the files on two decks as a DJ would: the next file starts
+ * start_s seconds into the current one and is crossfaded in over
+ * fade_s seconds, each deck decoded on its own and mixed to out_rate.
+ *
+ * ret: the number of tracks played
+ */
+static int play_files_mixed(char **names, int count, uint32_t out_rate,
+                            double start_s, double fade_s) {
+    struct mp3_decoder  *decoders[2] = { NULL, NULL };
+    int16_t             *buf;
+    int                 i = 0, played = 0, cur = 0, k;
+
+    if (audio_sink_open(sink, out_rate, PLAY_CHANNELS) != 0) {
+        fprintf(stderr, "playsim: the output can not play %u Hz\n", out_rate);
+        return 0;
+    }
+
+    while (decoders[cur] == NULL && i < count) {
+        decoders[cur] = play_open(&play_files[cur], names[i++], 0);
+    }
+    if (decoders[cur] != NULL) {
+        decoders[cur]->output_cb = mix_callback;
+    }
+
+    for (;;) {
+        /* the next track, once the current one is far enough or over */
+        if (decoders[cur ^ 1] == NULL
+            && (decoders[cur] == NULL || mix_seconds[cur] >= start_s)) {
+            while (decoders[cur ^ 1] == NULL && i < count) {
+                decoders[cur ^ 1] = play_open(&play_files[cur ^ 1], names[i++], 0);
+            }
+            if (decoders[cur ^ 1] != NULL) {
+                decoders[cur ^ 1]->output_cb = mix_callback;
+                cur ^= 1;
+                mix_seconds[cur] = 0;
+                mixer_crossfade(mix, cur ^ 1, cur, (uint32_t)(fade_s * out_rate));
+            }
+        }
+        if ((decoders[0] == NULL && decoders[1] == NULL && mixer_idle(mix))
+            || stopped) {
+            break;
+        }
+
+        /* keep every deck a buffer ahead of the mix */
+        for (k = 0; k < 2; k++) {
+            mix_deck = k;
+            while (decoders[k] != NULL && mixer_available(mix, k) < MIX_FRAMES) {
+                if (mp3_decoder_run(decoders[k]) == -1) {
+                    mixer_flush(mix, k);
+                    play_close(decoders[k]);
+                    decoders[k] = NULL;
+                    played++;
+                }
+            }
+        }
+
+        buf = audio_sink_acquire(sink, MIX_FRAMES);
+        if (buf == NULL) {
+            fprintf(stderr, "playsim: out of memory\n");
+            exit(2);
+        }
+        mixer_process(mix, buf, MIX_FRAMES);
+        play_callback(&(MP3FrameInfo){ .samprate = out_rate }, buf,
+                      MIX_FRAMES * PLAY_CHANNELS);
+    }
+
+    for (k = 0; k < 2; k++) {
+        if (decoders[k] != NULL) {
+            play_close(decoders[k]);
+            played++;
+        }
+    }
+    audio_sink_close(sink);
+
+    return played;
+}
+
+static void play_usage(void) {
+    fprintf(stderr,
+            "usage: playsim [-o out.wav] [-x speedup] [-s speed] [-p pitch] [-r rate]\n"
+            "               [-R out_rate] [-l] [-m start [-f fade]] [-v volume]\n"
+            "               [-t seconds] [-d] file.mp3...\n"
+            "  -o   write the output to a WAV file, default a null sink paced\n"
+            "       like the I2S DMA of the board\n"
+            "  -x   run the clock of the null sink this many times faster\n"
+            "  -s, -p, -r\n"
+            "       mp3_set_speed(), mp3_set_pitch(), mp3_set_rate()\n"
+            "  -R   resample every track to this rate, default each at its own\n"
+            "  -l   mp3_set_low_latency()\n"
+            "  -m   mix the files on two decks, each starting this many seconds\n"
+            "       into the one before, at -R or 44100 Hz\n"
+            "  -f   the crossfade of -m in seconds, default 5\n"
+            "  -v   audio_sink_set_volume(), 0 to 1\n"
+            "  -t   stop after this many seconds of output, fading out\n"
+            "  -d   print the deadline statistics, audio_sink_report()\n"
+            "exits with 1 if the output ran dry\n");
+}
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+int main(int argc, char *argv[]) {
+    const char              *wav = NULL;
+    double                  speedup = 1;
+    float                   speed = 1, pitch = 1, rate = 1;
+    uint32_t                out_rate = 0;
+    int                     low_latency = 0;
+    double                  mix_start = -1, mix_fade = 5;
+    float                   volume = 1;
+    int                     report = 0;
+    int                     tracks, c;
+    double                  cpu;
+    struct audio_sink_stats stats;
+
+    while ((c = getopt(argc, argv, "o:x:s:p:r:R:lm:f:v:t:d")) != -1) {
+        switch (c) {
+            case 'o':
+                wav = optarg;
+                break;
+            case 'x':
+                speedup = atof(optarg);
+                break;
+            case 's':
+                speed = atof(optarg);
+                break;
+            case 'p':
+                pitch = atof(optarg);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'R':
+                out_rate = (uint32_t)atoi(optarg);
+                break;
+            case 'l':
+                low_latency = 1;
+                break;
+            case 'm':
+                mix_start = atof(optarg);
+                break;
+            case 'f':
+                mix_fade = atof(optarg);
+                break;
+            case 'v':
+                volume = atof(optarg);
+                break;
+            case 't':
+                stop_at = atof(optarg);
+                break;
+            case 'd':
+                report = 1;
+                break;
+            default:
+                play_usage();
+                return 2;
+        }
+    }
+    if (optind == argc) {
+        play_usage();
+        return 2;
+    }
+
+    sink = wav ? audio_sink_wav_create(wav) : audio_sink_null_create(speedup);
+    if (sink == NULL) {
+        fprintf(stderr, "playsim: can not create the output\n");
+        return 2;
+    }
+    audio_sink_set_volume(sink, volume);
+    sink->ticks     = play_ticks;
+    sink->tick_rate = 1000000000;
+
+    /* ramped in from 1.0 over the first frames, as on the board */
+    if (mp3_set_speed(speed) != 0 || mp3_set_pitch(pitch) != 0
+        || mp3_set_rate(rate) != 0 || mp3_set_low_latency(low_latency) != 0) {
+        play_usage();
+        return 2;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cpu = play_now(CLOCK_PROCESS_CPUTIME_ID);
+
+    if (mix_start >= 0) {
+        if (out_rate == 0) {
+            out_rate = PLAY_FALLBACK_RATE;
+        }
+        mix = mixer_create(out_rate, PLAY_CHANNELS, 2);
+        if (mix == NULL) {
+            fprintf(stderr, "playsim: can not create the mixer\n");
+            return 2;
+        }
+        mixer_set_speed(mix, 0, speed);
+        mixer_set_speed(mix, 1, speed);
+        mixer_set_pitch(mix, 0, pitch);
+        mixer_set_pitch(mix, 1, pitch);
+        mixer_set_rate(mix, 0, rate);
+        mixer_set_rate(mix, 1, rate);
+        mix->ticks = play_ticks;
+
+        tracks = play_files_mixed(argv + optind, argc - optind, out_rate,
+                                  mix_start, mix_fade);
+    } else {
+        tracks = play_files_gapless(argv + optind, argc - optind, out_rate);
+    }
+
+    cpu     = play_now(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    stats   = sink->stats;
+    if (report) {
+        audio_sink_report(sink);
+    }
+    audio_sink_delete(sink);
+
+    printf("%d tracks, %.1f s of output to %s\n", tracks, play_seconds,
+           wav ? wav : "the null sink");
+    printf("buffers %u, underruns %u\n", stats.buffers, stats.underruns);
+    if (stats.buffers > 0) {
+        printf("first sound %.1f ms, latency avg %.1f ms, max %.1f ms\n",
+               1000.0 * first_sound, 1000.0 * latency_sum / stats.buffers,
+               1000.0 * latency_max);
+    }
+    printf("cpu %.3f s, %.1fx real time", cpu, cpu > 0 ? play_seconds / cpu : 0);
+    if (wav == NULL && stats.frames > 0) {
+        printf(", headroom %.1f%%", 100.0 * stats.frames_waited / stats.frames);
+    }
+    printf("\n");
+
+    if (mix != NULL) {
+        printf("mix blocks %u, avg %.1f us, max %.1f us, clipped %u, starved %u + %u\n",
+               mix->blocks,
+               mix->blocks ? mix->ticks_total / 1000.0 / mix->blocks : 0,
+               mix->ticks_max / 1000.0, mix->clipped,
+               mix->decks[0].starved, mix->decks[1].starved);
+        mixer_delete(mix);
+    }
+
+    return stats.underruns > 0 ? 1 : 0;
+}
@@ -0,0 +1,186 @@
+/*
+ *  Name:    resamplebench.c
+ *
+ *  Purpose: measure the throughput and the quality of the resampler
+ *           (src/resample.c) per tap count, at the rates of MP3 files
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "resample.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+#ifndef M_PI
+#define M_PI                3.14159265358979323846
+#endif
+
+/* the layout the decoder writes by default */
+#define BENCH_CHANNELS      2
+
+/* seconds of input of every case, -s */
+#define BENCH_SECONDS       10
+
+/* input frames per call, a decoded MP3 frame as in mp3_decoder_run() */
+#define BENCH_BLOCK         1152
+
+/* output frames per call, MP3_DECODE_BUF_SZ of mp3.c in stereo */
+#define BENCH_OUT_FRAMES    2048
+
+/* the test tone, and the frames at both ends left out of the SNR */
+#define BENCH_TONE_HZ       1000.0
+#define BENCH_AMPLITUDE     20000.0
+#define BENCH_EDGE          1000
+
+static const uint32_t bench_conversions[][2] = {
+    { 32000, 44100 },
+    { 48000, 44100 },
+    { 22050, 44100 },
+    { 44100, 48000 },
+    { 16000, 44100 },
+    {  8000, 44100 },
+};
+
+static const int bench_taps[] = {
+    RESAMPLER_MIN_TAPS,
+    RESAMPLER_TAPS_LOW,
+    RESAMPLER_TAPS_MEDIUM,
+    RESAMPLER_TAPS_HIGH,
+    RESAMPLER_MAX_TAPS,
+};
+
+#define BENCH_NUM(a)        (sizeof(a) / sizeof((a)[0]))
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+static double bench_cpu_time(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * convert seconds of a tone from in_rate to out_rate with taps taps,
+ * print the output frames per CPU second and the SNR of the tone
+ */
+static void bench_run(uint32_t in_rate, uint32_t out_rate, int taps,
+                      uint32_t seconds) {
+    struct resampler    *rs;
+    int16_t             *in, *out;
+    uint32_t            frames = in_rate * seconds;
+    uint32_t            done = 0, total = 0, max_out, chunk, used;
+    double              t, ref, err = 0, sig = 0;
+    uint32_t            i;
+    int                 got, c;
+
+    max_out = (uint32_t)((uint64_t)frames * out_rate / in_rate) + BENCH_OUT_FRAMES;
+    in  = (int16_t *)malloc(frames * BENCH_CHANNELS * sizeof(int16_t));
+    out = (int16_t *)malloc(max_out * BENCH_CHANNELS * sizeof(int16_t));
+    rs  = resampler_create(in_rate, out_rate, BENCH_CHANNELS, taps);
+    if (in == NULL || out == NULL || rs == NULL) {
+        fprintf(stderr, "resamplebench: out of memory\n");
+        exit(2);
+    }
+
+    for (i = 0; i < frames; i++) {
+        for (c = 0; c < BENCH_CHANNELS; c++) {
+            in[i * BENCH_CHANNELS + c] = (int16_t)lrint(BENCH_AMPLITUDE
+                                         * sin(2 * M_PI * BENCH_TONE_HZ * i / in_rate));
+        }
+    }
+
+    t = bench_cpu_time();
+    while (done < frames) {
+        chunk = frames - done;
+        if (chunk > BENCH_BLOCK) {
+            chunk = BENCH_BLOCK;
+        }
+
+        /* as mp3_decoder_run(), in pieces that fit the output buffer */
+        while (chunk > 0 && total + BENCH_OUT_FRAMES <= max_out) {
+            used = chunk;
+            got = resampler_process(rs, in + done * BENCH_CHANNELS, &used,
+                                    out + total * BENCH_CHANNELS, BENCH_OUT_FRAMES);
+            total   += got;
+            done    += used;
+            chunk   -= used;
+        }
+    }
+    t = bench_cpu_time() - t;
+
+    /* the resampler takes out the delay of its filter, compare directly */
+    for (i = BENCH_EDGE; i + BENCH_EDGE < total; i++) {
+        ref = BENCH_AMPLITUDE * sin(2 * M_PI * BENCH_TONE_HZ * i / out_rate);
+        err += (out[i * BENCH_CHANNELS] - ref) * (out[i * BENCH_CHANNELS] - ref);
+        sig += ref * ref;
+    }
+
+    printf("%5u -> %5u  %2d taps  %8.2f Mframes/s  %6.0fx real time  SNR %5.1f dB\n",
+           in_rate, out_rate, taps,
+           t > 0 ? total / t / 1e6 : 0,
+           t > 0 ? total / t / out_rate : 0,
+           err > 0 ? 10 * log10(sig / err) : 999.0);
+
+    resampler_delete(rs);
+    free(in);
+    free(out);
+}
+
+static void bench_usage(void) {
+    fprintf(stderr,
+            "usage: resamplebench [-s seconds] [-t taps]\n"
+            "  -s   seconds of input of every case, default %d\n"
+            "  -t   only this tap count, default %d to %d\n",
+            BENCH_SECONDS, RESAMPLER_MIN_TAPS, RESAMPLER_MAX_TAPS);
+}
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+int main(int argc, char *argv[]) {
+    uint32_t    seconds = BENCH_SECONDS;
+    int         only_taps = 0;
+    unsigned    r, k;
+    int         c;
+
+    while ((c = getopt(argc, argv, "s:t:")) != -1) {
+        switch (c) {
+            case 's':
+                seconds = (uint32_t)atoi(optarg);
+                break;
+            case 't':
+                only_taps = atoi(optarg);
+                break;
+            default:
+                bench_usage();
+                return 2;
+        }
+    }
+    if (seconds == 0) {
+        bench_usage();
+        return 2;
+    }
+
+    printf("stereo, %u s of a %.0f Hz tone per case, output frames per CPU second\n",
+           seconds, BENCH_TONE_HZ);
+    for (r = 0; r < BENCH_NUM(bench_conversions); r++) {
+        for (k = 0; k < BENCH_NUM(bench_taps); k++) {
+            if (only_taps && bench_taps[k] != only_taps) {
+                continue;
+            }
+            bench_run(bench_conversions[r][0], bench_conversions[r][1],
+                      bench_taps[k], seconds);
+        }
+    }
+
+    return 0;
+}
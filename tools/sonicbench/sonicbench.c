@@ -0,0 +1,627 @@
+/*
+ *  Name:    sonicbench.c
+ *
+ *  Purpose: measure the speed and the quality of Sonic on synthetic
+ *           clips, at a grid of speeds, pitches and rates
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sonic.h"
+#include "fft.h"
+
+/*========================================================
+ *                  Macros, Variables
+ *======================================================*/
+#ifndef M_PI
+#define M_PI                3.14159265358979323846
+#endif
+
+/* the rate of the clips */
+#define BENCH_RATE          44100
+
+/* seconds of every clip, -s */
+#define BENCH_SECONDS       5
+
+/* frames per write, a decoded MP3 frame as in mp3_decoder_run_pvc() */
+#define BENCH_BLOCK         1152
+
+/* output frames per read, the DMA buffer of mp3.c in stereo */
+#define BENCH_OUT_FRAMES    2048
+
+/* the spectra compared, 23 ms frames overlapping by half */
+#define BENCH_FFT_LEN       1024
+#define BENCH_FFT_HOP       (BENCH_FFT_LEN / 2)
+
+/* bins this far below the loudest one of the reference frame count as that level */
+#define BENCH_FLOOR_DB      60
+
+/*
+ * The clips. Each is rendered as heard at a tempo and a pitch, so the
+ * one at the tempo and the pitch of a case is its ideal result.
+ */
+enum {
+    BENCH_VOICE = 0,                /* a gliding voiced tone with formants */
+    BENCH_CHORDS,                   /* held chords of harmonic notes */
+    BENCH_DRUMS,                    /* kick, snare, hi-hats */
+    BENCH_CLIPS
+};
+
+static const char *bench_clip_name[BENCH_CLIPS] = { "voice", "chords", "drums" };
+
+/* the grid, as set by mp3_set_speed(), mp3_set_pitch() and mp3_set_rate() */
+struct bench_case {
+    float       speed;
+    float       pitch;
+    float       rate;
+};
+
+static const struct bench_case bench_cases[] = {
+    { 1.0f,  1.0f,  1.0f  },
+    { 0.5f,  1.0f,  1.0f  },
+    { 0.8f,  1.0f,  1.0f  },
+    { 1.25f, 1.0f,  1.0f  },
+    { 2.0f,  1.0f,  1.0f  },
+    { 1.0f,  0.8f,  1.0f  },
+    { 1.0f,  1.25f, 1.0f  },
+    { 0.8f,  1.25f, 1.0f  },
+    { 1.25f, 0.8f,  1.0f  },
+    { 1.0f,  1.0f,  0.92f },
+    { 1.0f,  1.0f,  1.08f },
+    { 1.25f, 1.0f,  1.08f },
+};
+
+#define BENCH_ARRAY_SIZE(a)     (sizeof(a) / sizeof((a)[0]))
+
+/*
+ * The speed sweep of -w, the test of TimingDelay_Decrement() in main.c:
+ * the speed steps through sweep_speeds every BENCH_SWEEP_SECONDS. As
+ * mp3_pvc_write() the speed changes between blocks of BENCH_RAMP_BLOCK
+ * frames, by at most BENCH_RAMP_RATE per second, or all at once.
+ */
+#define BENCH_SWEEP_SECONDS     2
+#define BENCH_RAMP_BLOCK        256
+#define BENCH_RAMP_RATE         1.0f
+
+static const float bench_sweep_speeds[] = { 1.0f, 1.5f, 0.5f, 1.0f };
+
+struct bench_totals {
+    uint32_t    runs;
+    double      cpu;                /* seconds */
+    double      frames;             /* input frames */
+    double      peak;               /* seconds, the slowest call */
+    uint32_t    allocs;             /* while streaming, not in sonicCreateStream() */
+    double      distance;           /* dB, summed */
+    double      length;             /* relative output length error, summed */
+    double      latency;            /* sonicGetLatency() after every write, summed */
+    uint32_t    writes;
+};
+
+/* counted by the allocation wrappers, see the Makefile */
+static int      bench_counting = 0;
+static uint32_t bench_allocs = 0;
+
+static struct fft_plan *bench_plan;
+
+/*========================================================
+ *          Private functions
+ *======================================================*/
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    bench_allocs += bench_counting;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    bench_allocs += bench_counting;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    bench_allocs += bench_counting;
+    return __real_realloc(ptr, size);
+}
+
+/* repeatable noise, the same clips on every host */
+static double bench_noise(uint32_t *seed) {
+    *seed = *seed * 1664525u + 1013904223u;
+    return (double)(*seed >> 8) / (1 << 24) - 0.5;
+}
+
+/* a vowel-like spectral envelope, three formants on a falling slope */
+static double bench_formants(double f) {
+    static const double centre[] = { 500, 1500, 2500 };
+    double  a = 0.2;
+    int     i;
+
+    for (i = 0; i < 3; i++) {
+        a += exp(-(f - centre[i]) * (f - centre[i]) / (2 * 150.0 * 150.0)) / (i + 1);
+    }
+
+    return a * 300 / (300 + f);
+}
+
+/*
+ * Render one clip in mono float, as heard at tempo (seconds of the clip
+ * per second), with its pitch scaled by pitch and its spectral envelope
+ * by shift. Sonic's pitch keeps the formants where they are, while a
+ * rate moves them with the pitch.
+ */
+static void bench_render(int clip, float *out, uint32_t n,
+                         double tempo, double pitch, double shift) {
+    /* root, third and fifth of I - vi - IV - V */
+    static const double chords[4][3] = {
+        { 261.6, 329.6, 392.0 },
+        { 220.0, 261.6, 329.6 },
+        { 174.6, 220.0, 261.6 },
+        { 196.0, 246.9, 293.7 },
+    };
+    double      phase[32] = { 0 };
+    double      tau, f0, f, a, t;
+    uint32_t    i, h, k, beat, seed;
+
+    memset(out, 0, n * sizeof(float));
+
+    switch (clip) {
+        case BENCH_VOICE:
+            for (i = 0; i < n; i++) {
+                tau = (double)i * tempo / BENCH_RATE;
+                f0  = 140 * (1 + 0.15 * sin(2 * M_PI * 0.3 * tau))
+                    * (1 + 0.01 * sin(2 * M_PI * 5.5 * tau)) * pitch;
+                /* syllables */
+                a   = 0.3 + 0.7 * pow(sin(M_PI * 3 * tau), 2);
+
+                for (h = 0; h < 32 && (h + 1) * f0 < 5000; h++) {
+                    phase[h] += 2 * M_PI * (h + 1) * f0 / BENCH_RATE;
+                    out[i] += 0.35 * a * bench_formants((h + 1) * f0 / shift)
+                            * sin(phase[h]);
+                }
+            }
+            break;
+
+        case BENCH_CHORDS:
+            for (i = 0; i < n; i++) {
+                tau = (double)i * tempo / BENCH_RATE;
+                k   = (uint32_t)tau % 4;
+                /* struck at every change */
+                a   = 0.25 * (0.4 + 0.6 * exp(-(tau - floor(tau)) * 3));
+
+                for (h = 0; h < 18; h++) {
+                    f = chords[k][h / 6] * (h % 6 + 1) * pitch;
+                    phase[h] += 2 * M_PI * f / BENCH_RATE;
+                    out[i] += a / (h % 6 + 1) * sin(phase[h]);
+                }
+            }
+            break;
+
+        case BENCH_DRUMS:
+            /* eighths at 120 BPM, the hits keep their length at any tempo */
+            for (beat = 0; beat * 0.25 / tempo * BENCH_RATE < n; beat++) {
+                t       = beat * 0.25 / tempo * BENCH_RATE;
+                seed    = beat;
+
+                for (i = 0; i < BENCH_RATE / 5 && (uint32_t)t + i < n; i++) {
+                    a = (double)i / BENCH_RATE;
+                    if (beat % 4 == 0) {
+                        /* kick */
+                        out[(uint32_t)t + i] += 0.6 * exp(-a / 0.04)
+                            * sin(2 * M_PI * (55 + 40 * exp(-a / 0.04)) * pitch * a);
+                    } else if (beat % 4 == 2) {
+                        /* snare */
+                        out[(uint32_t)t + i] += 0.4 * exp(-a / 0.03) * bench_noise(&seed);
+                    }
+                    /* hi-hat */
+                    if (i < BENCH_RATE / 50) {
+                        out[(uint32_t)t + i] += 0.15 * exp(-a / 0.005) * bench_noise(&seed);
+                    }
+                }
+            }
+            break;
+    }
+}
+
+/*
+ * the clip in 16-bit, the second channel is mixed with the next clip
+ * so the channels differ
+ */
+static int16_t *bench_clip(int clip, uint32_t channels, uint32_t n,
+                           double tempo, double pitch, double shift) {
+    float       *left, *right;
+    int16_t     *out;
+    uint32_t    i, c;
+    double      v;
+
+    left    = malloc(n * sizeof(float));
+    right   = malloc(n * sizeof(float));
+    out     = malloc(n * channels * sizeof(int16_t));
+    if (left == NULL || right == NULL || out == NULL) {
+        fprintf(stderr, "sonicbench: out of memory\n");
+        exit(2);
+    }
+
+    bench_render(clip, left, n, tempo, pitch, shift);
+    if (channels > 1) {
+        bench_render((clip + 1) % BENCH_CLIPS, right, n, tempo, pitch, shift);
+    }
+
+    for (i = 0; i < n; i++) {
+        for (c = 0; c < channels; c++) {
+            v = (c == 0) ? left[i] : 0.5 * (left[i] + right[i]);
+            out[i * channels + c] = (int16_t)lrint(fmax(-1, fmin(1, v)) * 32767);
+        }
+    }
+
+    free(left);
+    free(right);
+
+    return out;
+}
+
+/*
+ * The log-spectral distance between one channel of out and ref: the
+ * RMS difference in dB of their spectra, averaged over the frames.
+ */
+static double bench_distance(const int16_t *out, const int16_t *ref,
+                             uint32_t n, uint32_t channels, uint32_t channel) {
+    static float        window[BENCH_FFT_LEN];
+    static float        frame[BENCH_FFT_LEN];
+    static complex_t    spec_out[BENCH_FFT_LEN / 2 + 1];
+    static complex_t    spec_ref[BENCH_FFT_LEN / 2 + 1];
+    uint32_t            pos, i, frames = 0;
+    double              p_out, p_ref, floor_ref, d, sum = 0, frame_sum;
+
+    for (i = 0; i < BENCH_FFT_LEN; i++) {
+        window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / BENCH_FFT_LEN);
+    }
+
+    for (pos = 0; pos + BENCH_FFT_LEN <= n; pos += BENCH_FFT_HOP) {
+        for (i = 0; i < BENCH_FFT_LEN; i++) {
+            frame[i] = window[i] * out[(pos + i) * channels + channel];
+        }
+        fft_real_forward(bench_plan, frame, spec_out);
+        for (i = 0; i < BENCH_FFT_LEN; i++) {
+            frame[i] = window[i] * ref[(pos + i) * channels + channel];
+        }
+        fft_real_forward(bench_plan, frame, spec_ref);
+
+        floor_ref = 0;
+        for (i = 0; i <= BENCH_FFT_LEN / 2; i++) {
+            p_ref = spec_ref[i].r * spec_ref[i].r + spec_ref[i].i * spec_ref[i].i;
+            floor_ref = fmax(floor_ref, p_ref);
+        }
+        /* a silent reference frame says nothing */
+        if (floor_ref < 1) {
+            continue;
+        }
+        floor_ref *= pow(10, -BENCH_FLOOR_DB / 10.0);
+
+        frame_sum = 0;
+        for (i = 0; i <= BENCH_FFT_LEN / 2; i++) {
+            p_out = spec_out[i].r * spec_out[i].r + spec_out[i].i * spec_out[i].i;
+            p_ref = spec_ref[i].r * spec_ref[i].r + spec_ref[i].i * spec_ref[i].i;
+            d = 10 * log10(fmax(p_out, floor_ref) / fmax(p_ref, floor_ref));
+            frame_sum += d * d;
+        }
+        sum += sqrt(frame_sum / (BENCH_FFT_LEN / 2 + 1));
+        frames++;
+    }
+
+    return frames ? sum / frames : 0;
+}
+
+/* append got frames of block to the n frames of out, up to max */
+static void bench_keep(int16_t *out, uint32_t *n, uint32_t max,
+                       const int16_t *block, int got, uint32_t channels) {
+    if (*n + got > max) {
+        got = max - *n;
+    }
+    memcpy(out + *n * channels, block, got * channels * sizeof(int16_t));
+    *n += got;
+}
+
+static double bench_cpu_time(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * run one clip through Sonic in BENCH_BLOCK frame writes, the way the
+ * player feeds it, and compare the result with the ideal one
+ */
+static void bench_run(const struct bench_case *bc, int clip, uint32_t channels,
+                      uint32_t seconds, int quality, int low_latency, int to_buffer,
+                      int verbose, struct bench_totals *tot) {
+    static int16_t  block[BENCH_OUT_FRAMES * 2];
+    sonicStream     stream;
+    int16_t         *in, *out, *ref;
+    uint32_t        n = BENCH_RATE * seconds, n_out = 0, n_ref, n_max;
+    uint32_t        pos, len, c;
+    double          tempo = bc->speed * bc->rate;
+    double          t0, t1, cpu = 0, peak = 0, distance = 0, latency = 0;
+    int             got;
+
+    n_ref   = (uint32_t)lrint(n / tempo);
+    /* room for what the flush gives beyond n_ref */
+    n_max   = n_ref + BENCH_RATE;
+    in      = bench_clip(clip, channels, n, 1, 1, 1);
+    ref     = bench_clip(clip, channels, n_ref, tempo, bc->pitch * bc->rate, bc->rate);
+    out     = malloc(n_max * channels * sizeof(int16_t));
+    stream  = sonicCreateStream(BENCH_RATE, channels);
+    if (out == NULL || stream == NULL) {
+        fprintf(stderr, "sonicbench: out of memory\n");
+        exit(2);
+    }
+    sonicSetSpeed(stream, bc->speed);
+    sonicSetPitch(stream, bc->pitch);
+    sonicSetRate(stream, bc->rate);
+    sonicSetQuality(stream, quality);
+    sonicSetLowLatency(stream, low_latency);
+
+    bench_allocs    = 0;
+    bench_counting  = 1;
+    for (pos = 0; pos < n; pos += len) {
+        len = (n - pos < BENCH_BLOCK) ? n - pos : BENCH_BLOCK;
+
+        /* a call is the write and the reads of one block */
+        t0 = bench_cpu_time();
+        if (to_buffer) {
+            got = sonicWriteShortToBuffer(stream, in + pos * channels, len,
+                                          block, BENCH_OUT_FRAMES);
+            if (got < 0) {
+                fprintf(stderr, "sonicbench: out of memory\n");
+                exit(2);
+            }
+            bench_keep(out, &n_out, n_max, block, got, channels);
+        } else if (!sonicWriteShortToStream(stream, in + pos * channels, len)) {
+            fprintf(stderr, "sonicbench: out of memory\n");
+            exit(2);
+        }
+        while ((got = sonicReadShortFromStream(stream, block, BENCH_OUT_FRAMES)) > 0) {
+            bench_keep(out, &n_out, n_max, block, got, channels);
+        }
+        t1 = bench_cpu_time();
+
+        cpu     += t1 - t0;
+        peak    = fmax(peak, t1 - t0);
+        latency += sonicGetLatency(stream);
+        tot->writes++;
+    }
+    sonicFlushStream(stream);
+    while ((got = sonicReadShortFromStream(stream, block, BENCH_OUT_FRAMES)) > 0) {
+        bench_keep(out, &n_out, n_max, block, got, channels);
+    }
+    bench_counting = 0;
+
+    for (c = 0; c < channels; c++) {
+        distance += bench_distance(out, ref, (n_out < n_ref) ? n_out : n_ref,
+                                   channels, c) / channels;
+    }
+
+    tot->runs++;
+    tot->cpu        += cpu;
+    tot->frames     += n;
+    tot->peak       = fmax(tot->peak, peak);
+    tot->allocs     += bench_allocs;
+    tot->distance   += distance;
+    tot->length     += fabs((double)n_out - n_ref) / n_ref;
+    tot->latency    += latency;
+
+    if (verbose) {
+        printf("  %-6s %u ch: %6.2f Mframes/s, peak %5.0f us, %u allocs, "
+               "%5.2f dB, length %+.2f%%, latency %4.1f ms\n",
+               bench_clip_name[clip], channels, n / cpu / 1e6, peak * 1e6,
+               bench_allocs, distance, 100.0 * ((double)n_out - n_ref) / n_ref,
+               1000.0 * latency / ((n + BENCH_BLOCK - 1) / BENCH_BLOCK) / BENCH_RATE);
+    }
+
+    sonicDestroyStream(stream);
+    free(in);
+    free(ref);
+    free(out);
+}
+
+/* as mp3_ramp() */
+static float bench_ramp(float value, float target, float step) {
+    if (value < target - step) {
+        return value + step;
+    } else if (value > target + step) {
+        return value - step;
+    }
+
+    return target;
+}
+
+/*
+ * Sweep the speed over the chord clip in stereo, with the speed ramped
+ * by rate per second, 0 stepped. The clicks of a step show in the
+ * second difference of the output, its energy per sample and its
+ * largest value, the cost of the changes in the CPU time of the blocks.
+ */
+static void bench_sweep(const char *name, float rate, int quality, int low_latency) {
+    static int16_t  block[BENCH_OUT_FRAMES * 2];
+    sonicStream     stream;
+    int16_t         *in;
+    uint32_t        n, pos, len, blocks = 0, i;
+    uint64_t        frames = 0;
+    int32_t         last[2] = { 0, 0 };
+    float           speed = 1, target;
+    double          t0, t1, cpu = 0, peak = 0, d2, energy = 0, d2_max = 0;
+    int             got;
+
+    n       = BENCH_RATE * BENCH_SWEEP_SECONDS * BENCH_ARRAY_SIZE(bench_sweep_speeds);
+    in      = bench_clip(BENCH_CHORDS, 2, n, 1, 1, 1);
+    stream  = sonicCreateStream(BENCH_RATE, 2);
+    if (stream == NULL) {
+        fprintf(stderr, "sonicbench: out of memory\n");
+        exit(2);
+    }
+    sonicSetQuality(stream, quality);
+    sonicSetLowLatency(stream, low_latency);
+
+    for (pos = 0; pos < n; pos += len) {
+        len     = (n - pos < BENCH_RAMP_BLOCK) ? n - pos : BENCH_RAMP_BLOCK;
+        target  = bench_sweep_speeds[pos / (BENCH_RATE * BENCH_SWEEP_SECONDS)];
+        speed   = (rate > 0) ? bench_ramp(speed, target, rate * len / BENCH_RATE) : target;
+
+        t0 = bench_cpu_time();
+        sonicSetSpeed(stream, speed);
+        got = sonicWriteShortToBuffer(stream, in + pos * 2, len, block, BENCH_OUT_FRAMES);
+        t1 = bench_cpu_time();
+        if (got < 0) {
+            fprintf(stderr, "sonicbench: out of memory\n");
+            exit(2);
+        }
+
+        cpu     += t1 - t0;
+        peak    = fmax(peak, t1 - t0);
+        blocks++;
+
+        do {
+            for (i = 0; i < (uint32_t)got; i++, frames++) {
+                d2 = block[i * 2] - 2.0 * last[1] + last[0];
+                if (frames >= 2) {
+                    energy  += d2 * d2;
+                    d2_max  = fmax(d2_max, fabs(d2));
+                }
+                last[0] = last[1];
+                last[1] = block[i * 2];
+            }
+        } while ((got = sonicReadShortFromStream(stream, block, BENCH_OUT_FRAMES)) > 0);
+    }
+
+    printf("%-17s | %12.1f %8.0f %10.1f %8.0f\n", name,
+           frames ? energy / frames : 0, d2_max, cpu / blocks * 1e6, peak * 1e6);
+
+    sonicDestroyStream(stream);
+    free(in);
+}
+
+static void bench_print(const char *name, const struct bench_totals *tot) {
+    printf("%-17s | %9.2f %8.0f %7u %12.2f %9.2f%% %10.1f\n", name,
+           tot->frames / tot->cpu / 1e6, tot->peak * 1e6, tot->allocs,
+           tot->distance / tot->runs, 100 * tot->length / tot->runs,
+           1000.0 * tot->latency / tot->writes / BENCH_RATE);
+}
+
+static void bench_usage(void) {
+    fprintf(stderr,
+            "usage: sonicbench [-s seconds] [-q quality] [-l] [-b] [-v] [-w]\n"
+            "  -s   seconds per clip, default %d\n"
+            "  -q   Sonic quality, default 0\n"
+            "  -l   the low latency mode of Sonic\n"
+            "  -b   write with sonicWriteShortToBuffer() as the player does,\n"
+            "       default sonicWriteShortToStream()\n"
+            "  -v   print every clip\n"
+            "  -w   sweep the speed as the board's test, stepped and ramped,\n"
+            "       and report the clicks and the CPU time per %d frames\n",
+            BENCH_SECONDS, BENCH_RAMP_BLOCK);
+}
+
+/*========================================================
+ *                  public functions
+ *======================================================*/
+int main(int argc, char *argv[]) {
+    const struct bench_case *bc;
+    struct bench_totals     tot, all;
+    uint32_t                seconds = BENCH_SECONDS;
+    uint32_t                i, ch;
+    int                     quality = 0, low_latency = 0, to_buffer = 0, verbose = 0;
+    int                     sweep = 0;
+    int                     clip, c;
+    char                    name[32];
+
+    while ((c = getopt(argc, argv, "s:q:lbvw")) != -1) {
+        switch (c) {
+            case 's':
+                seconds = (uint32_t)atoi(optarg);
+                break;
+            case 'q':
+                quality = atoi(optarg);
+                break;
+            case 'l':
+                low_latency = 1;
+                break;
+            case 'b':
+                to_buffer = 1;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            case 'w':
+                sweep = 1;
+                break;
+            default:
+                bench_usage();
+                return 2;
+        }
+    }
+    if (optind != argc || seconds < 1) {
+        bench_usage();
+        return 2;
+    }
+
+    if (sweep) {
+        printf("speed %.1f, %.1f, %.1f, %.1f for %d s each, chords in stereo, quality %d%s\n",
+               bench_sweep_speeds[0], bench_sweep_speeds[1], bench_sweep_speeds[2],
+               bench_sweep_speeds[3], BENCH_SWEEP_SECONDS, quality,
+               low_latency ? ", low latency" : "");
+        printf("speed change      | d2 energy    max d2  avg us/blk  peak us\n");
+        bench_sweep("stepped", 0, quality, low_latency);
+        bench_sweep("ramped 1.0/s", BENCH_RAMP_RATE, quality, low_latency);
+        return 0;
+    }
+
+    bench_plan = fft_plan_create_real(BENCH_FFT_LEN, FFT_PLAN_FLOAT);
+    if (bench_plan == NULL) {
+        fprintf(stderr, "sonicbench: out of memory\n");
+        return 2;
+    }
+
+    printf("%u clips of %u s at %u Hz in mono and stereo, quality %d%s, %s\n",
+           BENCH_CLIPS, seconds, BENCH_RATE, quality, low_latency ? ", low latency" : "",
+           to_buffer ? "sonicWriteShortToBuffer" : "sonicWriteShortToStream");
+    printf("speed pitch  rate | Mframes/s  peak us  allocs  distance dB  length err"
+           "  latency ms\n");
+
+    memset(&all, 0, sizeof(all));
+    for (i = 0; i < BENCH_ARRAY_SIZE(bench_cases); i++) {
+        bc = &bench_cases[i];
+
+        memset(&tot, 0, sizeof(tot));
+        for (clip = 0; clip < BENCH_CLIPS; clip++) {
+            for (ch = 1; ch <= 2; ch++) {
+                bench_run(bc, clip, ch, seconds, quality, low_latency, to_buffer,
+                          verbose, &tot);
+            }
+        }
+
+        snprintf(name, sizeof(name), "%5.2f %5.2f %5.2f", bc->speed, bc->pitch, bc->rate);
+        bench_print(name, &tot);
+
+        all.runs        += tot.runs;
+        all.cpu         += tot.cpu;
+        all.frames      += tot.frames;
+        all.peak        = fmax(all.peak, tot.peak);
+        all.allocs      += tot.allocs;
+        all.distance    += tot.distance;
+        all.length      += tot.length;
+        all.latency     += tot.latency;
+        all.writes      += tot.writes;
+    }
+    bench_print("all", &all);
+
+    fft_plan_delete(bench_plan);
+
+    return 0;
+}